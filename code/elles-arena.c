@@ -0,0 +1,243 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <lcms2.h>
+#include <lcms2_plugin.h>
+#include "elles-arena.h"
+#include "elles-trace.h"
+
+/* The arena is a list of blocks. Allocations are carved off the end
+ * of the current block, each after a small header holding its size.
+ * Freeing only updates the byte counts, except that freeing the most
+ * recent allocation hands its space back, which LCMS's mostly
+ * last-in first-out use of temporary buffers benefits from.
+ *
+ * Between jobs, every block but the first is given back to malloc,
+ * so one unusually large profile doesn't keep its memory. */
+
+#define ARENA_ALIGNMENT   16
+#define ARENA_BLOCK_SIZE  (64 * 1024)
+
+typedef struct arena_block {
+  struct arena_block * next;
+  size_t               size;    /* bytes of data after this header */
+  size_t               used;
+  size_t               unused;  /* keeps the data 16-byte aligned */
+} arena_block;
+
+typedef union {
+  size_t               size;    /* bytes asked for */
+  long double          alignment;
+} allocation_header;
+
+struct elle_arena {
+  arena_block *        first;
+  arena_block *        current;
+  size_t               allocations;
+  size_t               live_bytes;
+  size_t               peak_bytes;
+};
+
+static void* arena_malloc (cmsContext ContextID, cmsUInt32Number size);
+static void arena_free (cmsContext ContextID, void *Ptr);
+static void* arena_realloc (cmsContext ContextID, void* Ptr, cmsUInt32Number NewSize);
+static arena_block* new_arena_block (size_t size);
+
+static cmsPluginMemHandler arena_memory_plugin = {
+  { cmsPluginMagicNumber, 2060, cmsPluginMemHandlerSig, NULL },
+  arena_malloc, arena_free, arena_realloc,
+  NULL, NULL, NULL
+};
+
+#define BLOCK_DATA(block)  ((cmsUInt8Number*) (block) + sizeof(arena_block))
+#define ROUND_UP(n)        (((n) + ARENA_ALIGNMENT - 1) & ~((size_t) ARENA_ALIGNMENT - 1))
+
+
+elle_arena* elle_arena_create (void)
+{
+elle_arena *arena = (elle_arena*) calloc (1, sizeof(elle_arena));
+if (arena == NULL) return NULL;
+arena->first = arena->current = new_arena_block (ARENA_BLOCK_SIZE);
+if (arena->first == NULL)
+  {
+  free (arena);
+  return NULL;
+  }
+return arena;
+}
+
+
+cmsContext elle_arena_begin (elle_arena *arena)
+{
+arena->allocations = 0;
+arena->live_bytes = 0;
+arena->peak_bytes = 0;
+/* cmsCreateContext mallocs the context structure itself before it 
+ * installs the plugin, and cmsDeleteContext frees it the same way, so 
+ * that one block is outside the arena and its stats. Everything the 
+ * context allocates after that, its plugin chunks included, is in the 
+ * arena. */
+return cmsCreateContext (&arena_memory_plugin, arena);
+}
+
+
+void elle_arena_end (elle_arena        *arena,
+                     cmsContext        ContextID,
+                     elle_arena_stats  *stats
+                     )
+{
+arena_block *block, *next;
+
+if (ContextID != NULL) cmsDeleteContext (ContextID);
+
+if (stats != NULL)
+  {
+  stats->allocations = arena->allocations;
+  stats->peak_bytes = arena->peak_bytes;
+  stats->retained_bytes = arena->live_bytes;
+  stats->reserved_bytes = 0;
+  for ( block = arena->first; block != NULL; block = block->next )
+    stats->reserved_bytes += sizeof(arena_block) + block->size;
+  }
+
+/* Release everything the job allocated */
+for ( block = arena->first->next; block != NULL; block = next )
+  {
+  next = block->next;
+  free (block);
+  }
+arena->first->next = NULL;
+arena->first->used = 0;
+arena->current = arena->first;
+arena->live_bytes = 0;
+}
+
+
+void elle_arena_destroy (elle_arena *arena)
+{
+arena_block *block, *next;
+
+if (arena == NULL) return;
+for ( block = arena->first; block != NULL; block = next )
+  {
+  next = block->next;
+  free (block);
+  }
+free (arena);
+}
+
+
+static arena_block* new_arena_block (size_t size)
+{
+arena_block *block = (arena_block*) malloc (sizeof(arena_block) + size);
+if (block == NULL) return NULL;
+block->next = NULL;
+block->size = size;
+block->used = 0;
+return block;
+}
+
+
+static void* arena_malloc (cmsContext ContextID, cmsUInt32Number size)
+{
+elle_arena *arena = (elle_arena*) cmsGetContextUserData (ContextID);
+size_t needed = ROUND_UP(sizeof(allocation_header) + (size_t) size);
+arena_block *block = arena->current;
+allocation_header *header;
+
+if (block->used + needed > block->size)
+  {
+  size_t block_size = needed > ARENA_BLOCK_SIZE ? needed : ARENA_BLOCK_SIZE;
+  arena_block *fresh = new_arena_block (block_size);
+  if (fresh == NULL) return NULL;
+  fresh->next = block->next;
+  block->next = fresh;
+  arena->current = block = fresh;
+  }
+
+header = (allocation_header*) (BLOCK_DATA(block) + block->used);
+header->size = size;
+block->used += needed;
+
+arena->allocations++;
+arena->live_bytes += size;
+if (arena->live_bytes > arena->peak_bytes) arena->peak_bytes = arena->live_bytes;
+elle_trace_allocation (size);
+return header + 1;
+}
+
+
+static void arena_free (cmsContext ContextID, void *Ptr)
+{
+elle_arena *arena = (elle_arena*) cmsGetContextUserData (ContextID);
+allocation_header *header;
+arena_block *block = arena->current;
+size_t needed;
+
+if (Ptr == NULL) return;
+header = (allocation_header*) Ptr - 1;
+arena->live_bytes -= header->size;
+
+/* Give the space back if this was the latest allocation */
+needed = ROUND_UP(sizeof(allocation_header) + header->size);
+if ((cmsUInt8Number*) header + needed == BLOCK_DATA(block) + block->used)
+  block->used -= needed;
+}
+
+
+static void* arena_realloc (cmsContext ContextID, void* Ptr, cmsUInt32Number NewSize)
+{
+elle_arena *arena = (elle_arena*) cmsGetContextUserData (ContextID);
+allocation_header *header;
+arena_block *block = arena->current;
+size_t old_needed, new_needed;
+void *fresh;
+
+if (Ptr == NULL) return arena_malloc (ContextID, NewSize);
+header = (allocation_header*) Ptr - 1;
+old_needed = ROUND_UP(sizeof(allocation_header) + header->size);
+new_needed = ROUND_UP(sizeof(allocation_header) + (size_t) NewSize);
+
+/* Grow or shrink in place if this was the latest allocation */
+if ((cmsUInt8Number*) header + old_needed == BLOCK_DATA(block) + block->used &&
+    block->used - old_needed + new_needed <= block->size)
+  {
+  block->used = block->used - old_needed + new_needed;
+  if (NewSize > header->size) elle_trace_allocation (NewSize - header->size);
+  arena->live_bytes = arena->live_bytes - header->size + NewSize;
+  if (arena->live_bytes > arena->peak_bytes) arena->peak_bytes = arena->live_bytes;
+  header->size = NewSize;
+  return Ptr;
+  }
+
+fresh = arena_malloc (ContextID, NewSize);
+if (fresh == NULL) return NULL;
+memcpy (fresh, Ptr, header->size < NewSize ? header->size : NewSize);
+arena_free (ContextID, Ptr);
+return fresh;
+}
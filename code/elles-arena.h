@@ -0,0 +1,75 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+
+/* Per-job memory arenas.
+ *
+ * elle_arena_begin makes a fresh LCMS context whose memory plugin
+ * takes every allocation from the arena. What LCMS allocates in that
+ * context lives there: the profiles, the tags, the MLUs (all but the
+ * context structure, which LCMS mallocs before the plugin is 
+ * installed). elle_arena_end deletes the context and gives
+ * all of the job's memory back in one step, whether or not LCMS
+ * freed it, so nothing a job forgets to free can pile up.
+ *
+ * An arena belongs to one thread. Objects made in another context
+ * (for example the shared TRC curves of elles-trc.c) aren't counted,
+ * and neither are the TRC tags made from them: cmsWriteTag copies a 
+ * curve with cmsDupToneCurve, which allocates in the curve's own 
+ * context, so those copies are counted by elle_trc_registry_stats' 
+ * allocator instead, and freed with the profile as usual.
+ *
+ * */
+
+#ifndef ELLES_ARENA_H
+#define ELLES_ARENA_H
+
+#include <stddef.h>
+#include <lcms2.h>
+
+typedef struct elle_arena elle_arena;
+
+typedef struct {
+  size_t   allocations;     /* allocations LCMS made for the job */
+  size_t   peak_bytes;      /* most bytes in use at the same time */
+  size_t   retained_bytes;  /* bytes LCMS hadn't freed when the job ended */
+  size_t   reserved_bytes;  /* size of the arena blocks at the end of the job */
+} elle_arena_stats;
+
+elle_arena* elle_arena_create (void);
+
+/* Start a job: returns a new LCMS context allocating from the arena,
+ * or NULL. Only one job at a time can use an arena. */
+cmsContext elle_arena_begin (elle_arena *arena);
+
+/* End the job: delete ContextID, fill in stats (may be NULL), and
+ * release the job's memory. */
+void elle_arena_end (elle_arena        *arena,
+                     cmsContext        ContextID,
+                     elle_arena_stats  *stats
+                     );
+
+void elle_arena_destroy (elle_arena *arena);
+
+#endif
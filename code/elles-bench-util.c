@@ -0,0 +1,71 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <lcms2.h>
+#include "elles-bench-util.h"
+
+
+double elle_elapsed_seconds (struct timespec start)
+{
+struct timespec now;
+clock_gettime (CLOCK_MONOTONIC, &now);
+return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) * 1e-9;
+}
+
+
+cmsHPROFILE elle_open_profile (cmsContext ContextID, const char *directory, const char *name)
+{
+char *filename = (char*) malloc (strlen(directory) + strlen(name) + 2);
+cmsHPROFILE profile;
+
+if (strchr(name, '/') != NULL) strcpy(filename, name);
+else
+  {
+  strcpy(filename, directory);
+  if (filename[0] != '\0' && filename[strlen(filename) - 1] != '/') 
+    strcat(filename, "/");
+  strcat(filename, name);
+  }
+profile = cmsOpenProfileFromFileTHR (ContextID, filename, "r");
+if (profile == NULL) fprintf(stderr, "couldn't open %s\n", filename);
+free (filename);
+return profile;
+}
+
+
+void elle_fill_image (cmsFloat32Number *image, size_t pixels, double low, double high)
+{
+cmsUInt32Number state = 12345;
+size_t i;
+
+for ( i = 0; i < 3 * pixels; i++ )
+  {
+  state = state * 1664525u + 1013904223u;
+  image[i] = (cmsFloat32Number) ((state >> 8) / 16777215.0 * (high - low) + low);
+  }
+}
@@ -0,0 +1,57 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+/* Helpers shared by the benchmarks and tools: timing, opening a 
+ * profile from the profiles folder, and a reproducible float test 
+ * image.
+ *
+ * */
+
+#ifndef ELLES_BENCH_UTIL_H
+#define ELLES_BENCH_UTIL_H
+
+#include <stddef.h>
+#include <time.h>
+#include <lcms2.h>
+
+/* Seconds since start, which was read from CLOCK_MONOTONIC */
+double elle_elapsed_seconds (struct timespec start);
+
+/* Opens name in ContextID (NULL for the default context). A name 
+ * without a "/" is looked up in directory. Prints a message and 
+ * returns NULL if the profile can't be opened. */
+cmsHPROFILE elle_open_profile (cmsContext  ContextID,
+                               const char  *directory,
+                               const char  *name
+                               );
+
+/* Fills 3 * pixels floats with pseudo-random values from low to high,
+ * the same ones on every call */
+void elle_fill_image (cmsFloat32Number  *image,
+                      size_t            pixels,
+                      double            low,
+                      double            high
+                      );
+
+#endif
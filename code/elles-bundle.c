@@ -0,0 +1,435 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <lcms2.h>
+#include "elles-bundle.h"
+
+/* Header fields */
+#define HEADER_FORMAT          8
+#define HEADER_COUNT           12
+#define HEADER_INDEX_OFFSET    16
+#define HEADER_INDEX_SIZE      20
+#define HEADER_STRINGS_OFFSET  24
+#define HEADER_STRINGS_SIZE    28
+#define HEADER_FILE_SIZE       32
+
+/* Index entry fields */
+#define ENTRY_COLORSPACE       0
+#define ENTRY_TRC              4
+#define ENTRY_NAME             8
+#define ENTRY_VERSION          12
+#define ENTRY_PROFILE_ID       16
+#define ENTRY_DATA_OFFSET      32
+#define ENTRY_DATA_SIZE        36
+
+#define ALIGN_UP(n)  (((n) + ELLE_BUNDLE_ALIGNMENT - 1) & ~(cmsUInt32Number) (ELLE_BUNDLE_ALIGNMENT - 1))
+
+struct elle_bundle {
+  const cmsUInt8Number * base;        /* the mapping */
+  size_t                 size;
+  int                    count;
+  const cmsUInt8Number * index;
+  const char *           strings;
+};
+
+static void read_entry (const elle_bundle *bundle, int index, elle_bundle_profile *profile);
+static int compare_keys (const char           *colorspace,
+                         const char           *trc,
+                         int                  version,
+                         const cmsUInt8Number *profile_id,
+                         const elle_bundle_profile *profile
+                         );
+static int compare_profiles (const void *a, const void *b);
+static cmsUInt32Number get_uint32 (const cmsUInt8Number *bytes);
+static void set_uint32 (cmsUInt8Number *bytes, cmsUInt32Number value);
+static cmsBool write_zeros (FILE *file, cmsUInt32Number count);
+
+
+cmsBool elle_bundle_write (const char                *filename,
+                           const elle_bundle_profile *profiles,
+                           int                       count
+                           )
+{
+elle_bundle_profile *copies;
+const elle_bundle_profile **sorted;
+cmsUInt8Number header[ELLE_BUNDLE_HEADER_SIZE], entry[ELLE_BUNDLE_ENTRY_SIZE];
+char *temporary;
+FILE *file;
+double total;
+cmsUInt32Number strings_size = 0, strings_offset, data_offset, offset;
+cmsBool ok = TRUE;
+int i;
+
+/* The bundle is read through the index, in key order. The ID is the
+ * one the profile carries, at bytes 84 to 99 of its header. */
+copies = (elle_bundle_profile*) malloc ((count + 1) * sizeof(elle_bundle_profile));
+sorted = (const elle_bundle_profile**) malloc ((count + 1) * sizeof(elle_bundle_profile*));
+if (copies == NULL || sorted == NULL)
+  {
+  free (copies);
+  free (sorted);
+  return FALSE;
+  }
+for ( i = 0; i < count; i++ )
+  {
+  copies[i] = profiles[i];
+  memset (copies[i].profile_id, 0, 16);
+  if (profiles[i].size >= 100) memcpy (copies[i].profile_id, profiles[i].data + 84, 16);
+  sorted[i] = &copies[i];
+  strings_size += (cmsUInt32Number) (strlen(profiles[i].colorspace) + strlen(profiles[i].trc) 
+                                     + strlen(profiles[i].name) + 3);
+  }
+qsort (sorted, count, sizeof(elle_bundle_profile*), compare_profiles);
+for ( i = 1; i < count; i++ )
+  if (compare_profiles (&sorted[i - 1], &sorted[i]) == 0)
+    {
+    fprintf(stderr, "%s and %s have the same colorspace, TRC, version and ID\n", 
+            sorted[i - 1]->name, sorted[i]->name);
+    free (sorted);
+    free (copies);
+    return FALSE;
+    }
+
+/* Lay the file out, and check that its offsets fit in 32 bits */
+strings_offset = ELLE_BUNDLE_HEADER_SIZE + count * ELLE_BUNDLE_ENTRY_SIZE;
+total = (double) strings_offset + strings_size + ELLE_BUNDLE_ALIGNMENT;
+for ( i = 0; i < count; i++ )
+  total += (double) profiles[i].size + ELLE_BUNDLE_ALIGNMENT;
+if (total > 4294967295.0)
+  {
+  fprintf(stderr, "the profiles are too big for one bundle\n");
+  free (sorted);
+  free (copies);
+  return FALSE;
+  }
+data_offset = ALIGN_UP(strings_offset + strings_size);
+offset = data_offset;
+for ( i = 0; i < count; i++ )
+  offset = ALIGN_UP(offset + sorted[i]->size);
+
+memset (header, 0, sizeof(header));
+memcpy (header, ELLE_BUNDLE_MAGIC, 8);
+set_uint32 (header + HEADER_FORMAT, ELLE_BUNDLE_FORMAT);
+set_uint32 (header + HEADER_COUNT, (cmsUInt32Number) count);
+set_uint32 (header + HEADER_INDEX_OFFSET, ELLE_BUNDLE_HEADER_SIZE);
+set_uint32 (header + HEADER_INDEX_SIZE, (cmsUInt32Number) count * ELLE_BUNDLE_ENTRY_SIZE);
+set_uint32 (header + HEADER_STRINGS_OFFSET, strings_offset);
+set_uint32 (header + HEADER_STRINGS_SIZE, strings_size);
+set_uint32 (header + HEADER_FILE_SIZE, offset);
+
+/* Workers may have the old bundle mapped, so it's replaced, not 
+ * rewritten in place */
+temporary = (char*) malloc (strlen(filename) + 5);
+strcpy(temporary, filename);
+strcat(temporary, ".tmp");
+file = fopen (temporary, "wb");
+if (file == NULL)
+  {
+  fprintf(stderr, "couldn't create %s\n", temporary);
+  free (temporary);
+  free (sorted);
+  free (copies);
+  return FALSE;
+  }
+if (fwrite (header, sizeof(header), 1, file) != 1) ok = FALSE;
+
+/* The index */
+offset = 0;
+data_offset = ALIGN_UP(strings_offset + strings_size);
+for ( i = 0; i < count && ok; i++ )
+  {
+  const elle_bundle_profile *profile = sorted[i];
+  memset (entry, 0, sizeof(entry));
+  set_uint32 (entry + ENTRY_COLORSPACE, offset);
+  offset += (cmsUInt32Number) strlen(profile->colorspace) + 1;
+  set_uint32 (entry + ENTRY_TRC, offset);
+  offset += (cmsUInt32Number) strlen(profile->trc) + 1;
+  set_uint32 (entry + ENTRY_NAME, offset);
+  offset += (cmsUInt32Number) strlen(profile->name) + 1;
+  set_uint32 (entry + ENTRY_VERSION, (cmsUInt32Number) profile->version);
+  memcpy (entry + ENTRY_PROFILE_ID, profile->profile_id, 16);
+  set_uint32 (entry + ENTRY_DATA_OFFSET, data_offset);
+  set_uint32 (entry + ENTRY_DATA_SIZE, profile->size);
+  data_offset = ALIGN_UP(data_offset + profile->size);
+  if (fwrite (entry, sizeof(entry), 1, file) != 1) ok = FALSE;
+  }
+
+/* The strings, in the order the index refers to them */
+for ( i = 0; i < count && ok; i++ )
+  {
+  const elle_bundle_profile *profile = sorted[i];
+  if (fwrite (profile->colorspace, strlen(profile->colorspace) + 1, 1, file) != 1 ||
+      fwrite (profile->trc, strlen(profile->trc) + 1, 1, file) != 1 ||
+      fwrite (profile->name, strlen(profile->name) + 1, 1, file) != 1)
+    ok = FALSE;
+  }
+
+/* The profiles, each on a 16-byte boundary */
+offset = strings_offset + strings_size;
+for ( i = 0; i < count && ok; i++ )
+  {
+  if (!write_zeros (file, ALIGN_UP(offset) - offset) ||
+      fwrite (sorted[i]->data, 1, sorted[i]->size, file) != sorted[i]->size)
+    ok = FALSE;
+  offset = ALIGN_UP(offset) + sorted[i]->size;
+  }
+if (ok) ok = write_zeros (file, ALIGN_UP(offset) - offset);
+
+if (fclose (file) != 0) ok = FALSE;
+if (ok && rename (temporary, filename) != 0) ok = FALSE;
+if (!ok)
+  {
+  fprintf(stderr, "couldn't write %s\n", filename);
+  remove (temporary);
+  }
+free (temporary);
+free (sorted);
+free (copies);
+return ok;
+}
+
+
+elle_bundle* elle_bundle_open (const char *filename)
+{
+elle_bundle *bundle;
+struct stat status;
+const cmsUInt8Number *base;
+cmsUInt32Number count, strings_offset, strings_size;
+void *mapping;
+int fd, i;
+
+fd = open (filename, O_RDONLY);
+if (fd < 0)
+  {
+  fprintf(stderr, "couldn't open %s\n", filename);
+  return NULL;
+  }
+if (fstat (fd, &status) != 0 || status.st_size < ELLE_BUNDLE_HEADER_SIZE || 
+    status.st_size > 0xFFFFFFFF)
+  {
+  fprintf(stderr, "%s isn't a profile bundle\n", filename);
+  close (fd);
+  return NULL;
+  }
+mapping = mmap (NULL, (size_t) status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+close (fd);
+if (mapping == MAP_FAILED)
+  {
+  fprintf(stderr, "couldn't map %s\n", filename);
+  return NULL;
+  }
+base = (const cmsUInt8Number*) mapping;
+
+bundle = (elle_bundle*) calloc (1, sizeof(elle_bundle));
+if (bundle == NULL)
+  {
+  munmap (mapping, (size_t) status.st_size);
+  return NULL;
+  }
+bundle->base = base;
+bundle->size = (size_t) status.st_size;
+
+/* The header, then every entry, so lookups needn't check anything */
+count = get_uint32 (base + HEADER_COUNT);
+strings_offset = get_uint32 (base + HEADER_STRINGS_OFFSET);
+strings_size = get_uint32 (base + HEADER_STRINGS_SIZE);
+if (memcmp (base, ELLE_BUNDLE_MAGIC, 8) != 0 || 
+    get_uint32 (base + HEADER_FORMAT) != ELLE_BUNDLE_FORMAT ||
+    get_uint32 (base + HEADER_FILE_SIZE) != bundle->size ||
+    get_uint32 (base + HEADER_INDEX_OFFSET) != ELLE_BUNDLE_HEADER_SIZE ||
+    count > (bundle->size - ELLE_BUNDLE_HEADER_SIZE) / ELLE_BUNDLE_ENTRY_SIZE ||
+    get_uint32 (base + HEADER_INDEX_SIZE) != count * ELLE_BUNDLE_ENTRY_SIZE ||
+    strings_offset < ELLE_BUNDLE_HEADER_SIZE + count * ELLE_BUNDLE_ENTRY_SIZE ||
+    (strings_size == 0 && count > 0) ||
+    strings_offset > bundle->size || strings_size > bundle->size - strings_offset ||
+    (strings_size > 0 && base[strings_offset + strings_size - 1] != '\0'))
+  {
+  fprintf(stderr, "%s isn't a valid profile bundle\n", filename);
+  elle_bundle_close (bundle);
+  return NULL;
+  }
+bundle->count = (int) count;
+bundle->index = base + ELLE_BUNDLE_HEADER_SIZE;
+bundle->strings = (const char*) base + strings_offset;
+
+for ( i = 0; i < bundle->count; i++ )
+  {
+  const cmsUInt8Number *entry = bundle->index + i * ELLE_BUNDLE_ENTRY_SIZE;
+  cmsUInt32Number data_offset = get_uint32 (entry + ENTRY_DATA_OFFSET);
+  cmsUInt32Number data_size = get_uint32 (entry + ENTRY_DATA_SIZE);
+  elle_bundle_profile previous, current;
+  cmsBool valid = get_uint32 (entry + ENTRY_COLORSPACE) < strings_size &&
+                  get_uint32 (entry + ENTRY_TRC) < strings_size &&
+                  get_uint32 (entry + ENTRY_NAME) < strings_size &&
+                  data_offset % ELLE_BUNDLE_ALIGNMENT == 0 &&
+                  data_offset <= bundle->size && data_size <= bundle->size - data_offset;
+  if (valid && i > 0)
+    {
+    read_entry (bundle, i - 1, &previous);
+    read_entry (bundle, i, &current);
+    valid = compare_keys (previous.colorspace, previous.trc, previous.version,
+                          previous.profile_id, &current) < 0;
+    }
+  if (!valid)
+    {
+    fprintf(stderr, "%s has a bad index entry (%d)\n", filename, i);
+    elle_bundle_close (bundle);
+    return NULL;
+    }
+  }
+return bundle;
+}
+
+
+void elle_bundle_close (elle_bundle *bundle)
+{
+if (bundle == NULL) return;
+munmap ((void*) bundle->base, bundle->size);
+free (bundle);
+}
+
+
+int elle_bundle_count (const elle_bundle *bundle)
+{
+return bundle->count;
+}
+
+
+cmsBool elle_bundle_profile_at (const elle_bundle   *bundle,
+                                int                 index,
+                                elle_bundle_profile *profile
+                                )
+{
+if (index < 0 || index >= bundle->count) return FALSE;
+read_entry (bundle, index, profile);
+return TRUE;
+}
+
+
+cmsBool elle_bundle_find (const elle_bundle    *bundle,
+                          const char           *colorspace,
+                          const char           *trc,
+                          int                  version,
+                          const cmsUInt8Number *profile_id,
+                          elle_bundle_profile  *profile
+                          )
+{
+int low = 0, high = bundle->count;
+
+/* The first entry not below the key */
+while (low < high)
+  {
+  int middle = low + (high - low) / 2;
+  read_entry (bundle, middle, profile);
+  if (compare_keys (colorspace, trc, version, profile_id, profile) > 0) low = middle + 1;
+  else high = middle;
+  }
+if (low == bundle->count) return FALSE;
+read_entry (bundle, low, profile);
+return compare_keys (colorspace, trc, version, profile_id, profile) == 0;
+}
+
+
+cmsHPROFILE elle_bundle_open_profile (cmsContext        ContextID,
+                                      const elle_bundle *bundle,
+                                      const char        *colorspace,
+                                      const char        *trc,
+                                      int               version
+                                      )
+{
+elle_bundle_profile profile;
+
+if (!elle_bundle_find (bundle, colorspace, trc, version, NULL, &profile)) return NULL;
+return cmsOpenProfileFromMemTHR (ContextID, profile.data, profile.size);
+}
+
+
+static void read_entry (const elle_bundle *bundle, int index, elle_bundle_profile *profile)
+{
+const cmsUInt8Number *entry = bundle->index + index * ELLE_BUNDLE_ENTRY_SIZE;
+
+profile->colorspace = bundle->strings + get_uint32 (entry + ENTRY_COLORSPACE);
+profile->trc = bundle->strings + get_uint32 (entry + ENTRY_TRC);
+profile->name = bundle->strings + get_uint32 (entry + ENTRY_NAME);
+profile->version = (int) get_uint32 (entry + ENTRY_VERSION);
+memcpy (profile->profile_id, entry + ENTRY_PROFILE_ID, 16);
+profile->data = bundle->base + get_uint32 (entry + ENTRY_DATA_OFFSET);
+profile->size = get_uint32 (entry + ENTRY_DATA_SIZE);
+}
+
+
+/* The key against a profile, in index order. A NULL profile_id sorts
+ * before every ID. */
+static int compare_keys (const char           *colorspace,
+                         const char           *trc,
+                         int                  version,
+                         const cmsUInt8Number *profile_id,
+                         const elle_bundle_profile *profile
+                         )
+{
+int order = strcmp(colorspace, profile->colorspace);
+if (order == 0) order = strcmp(trc, profile->trc);
+if (order == 0) order = version - profile->version;
+if (order == 0 && profile_id != NULL) order = memcmp (profile_id, profile->profile_id, 16);
+return order;
+}
+
+
+static int compare_profiles (const void *a, const void *b)
+{
+const elle_bundle_profile *first = *(const elle_bundle_profile* const*) a;
+const elle_bundle_profile *second = *(const elle_bundle_profile* const*) b;
+return compare_keys (first->colorspace, first->trc, first->version, first->profile_id,
+                     second);
+}
+
+
+static cmsUInt32Number get_uint32 (const cmsUInt8Number *bytes)
+{
+return (cmsUInt32Number) bytes[0] | (cmsUInt32Number) bytes[1] << 8 |
+       (cmsUInt32Number) bytes[2] << 16 | (cmsUInt32Number) bytes[3] << 24;
+}
+
+
+static void set_uint32 (cmsUInt8Number *bytes, cmsUInt32Number value)
+{
+bytes[0] = (cmsUInt8Number) value;
+bytes[1] = (cmsUInt8Number) (value >> 8);
+bytes[2] = (cmsUInt8Number) (value >> 16);
+bytes[3] = (cmsUInt8Number) (value >> 24);
+}
+
+
+static cmsBool write_zeros (FILE *file, cmsUInt32Number count)
+{
+static const cmsUInt8Number zeros[ELLE_BUNDLE_ALIGNMENT] = { 0 };
+return count == 0 || fwrite (zeros, 1, count, file) == count;
+}
@@ -0,0 +1,116 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+/* Profile bundles: every profile in one file, for mapping into memory.
+ *
+ * A bundle is a fixed header, an index sorted by (colorspace, TRC,
+ * version, profile ID), a table of the NUL-terminated strings the 
+ * index refers to, and the profiles themselves, each starting on a
+ * 16-byte boundary. All numbers are little-endian.
+ *
+ *   header   "ELLEBNDL", format version, entry count, offset and size
+ *            of the index and of the strings, size of the file
+ *   index    ELLE_BUNDLE_ENTRY_SIZE bytes per profile: offsets of the
+ *            colorspace (e.g. "sRGB"), the TRC (e.g. "-srgbtrc", "" for
+ *            Lab and XYZ) and the file name, the version (2 or 4), the
+ *            16-byte MD5 profile ID from the profile's header (zeros if
+ *            it has none), and the offset and size of the profile
+ *
+ * elle_bundle_open maps the file read-only and checks the header and
+ * every index entry once, so a lookup is a binary search over the 
+ * mapped index, with no file open, no read and no copy; the profile 
+ * bytes handed back point into the mapping, and can go straight to 
+ * cmsOpenProfileFromMem. Processes that map the same bundle share its
+ * pages. A bundle is replaced by writing a new file and renaming it
+ * over the old one, which leaves the old mapping valid.
+ *
+ * */
+
+#ifndef ELLES_BUNDLE_H
+#define ELLES_BUNDLE_H
+
+#include <lcms2.h>
+
+#define ELLE_BUNDLE_MAGIC          "ELLEBNDL"
+#define ELLE_BUNDLE_FORMAT         1
+#define ELLE_BUNDLE_HEADER_SIZE    64
+#define ELLE_BUNDLE_ENTRY_SIZE     48
+#define ELLE_BUNDLE_ALIGNMENT      16
+
+typedef struct elle_bundle elle_bundle;
+
+/* One profile, as written or as found. The strings and bytes of a 
+ * found profile point into the bundle, and last until it's closed. */
+typedef struct {
+  const char *           colorspace;
+  const char *           trc;
+  const char *           name;
+  int                    version;
+  cmsUInt8Number         profile_id[16];
+  const cmsUInt8Number * data;
+  cmsUInt32Number        size;
+} elle_bundle_profile;
+
+/* Write profiles (in any order) to filename, through a temporary file
+ * renamed into place. The profile IDs are taken from the profiles' 
+ * headers. Returns FALSE, with a message, on failure. */
+cmsBool elle_bundle_write (const char                *filename,
+                           const elle_bundle_profile *profiles,
+                           int                       count
+                           );
+
+/* NULL, with a message, if the file can't be mapped or isn't a valid
+ * bundle */
+elle_bundle* elle_bundle_open (const char *filename);
+
+void elle_bundle_close (elle_bundle *bundle);
+
+int elle_bundle_count (const elle_bundle *bundle);
+
+/* The profile at index (in index order) */
+cmsBool elle_bundle_profile_at (const elle_bundle   *bundle,
+                                int                 index,
+                                elle_bundle_profile *profile
+                                );
+
+/* Binary search. profile_id NULL matches any ID, and finds the first 
+ * profile with that colorspace, TRC and version. */
+cmsBool elle_bundle_find (const elle_bundle    *bundle,
+                          const char           *colorspace,
+                          const char           *trc,
+                          int                  version,
+                          const cmsUInt8Number *profile_id,
+                          elle_bundle_profile  *profile
+                          );
+
+/* elle_bundle_find, then cmsOpenProfileFromMemTHR on the bytes found.
+ * NULL if there's no such profile. */
+cmsHPROFILE elle_bundle_open_profile (cmsContext        ContextID,
+                                      const elle_bundle *bundle,
+                                      const char        *colorspace,
+                                      const char        *trc,
+                                      int               version
+                                      );
+
+#endif
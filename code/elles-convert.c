@@ -0,0 +1,635 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+/* Converts an image from one profile to another, a band of rows at a
+ * time, on several threads, so images much larger than memory can be
+ * converted with one of the generated profiles.
+ *
+ * The main thread reads bands of rows from the input file into a ring
+ * of band slots. Worker threads, each with its own LCMS context and
+ * transform, convert whichever bands are waiting, and a writer thread
+ * writes the converted bands to the output file in order. A slot is
+ * reused only after its band is written, so the memory used is at most
+ * (bands in flight) x (rows per band) x (input + output row bytes),
+ * whatever the size of the image. That bound is printed on stderr
+ * along with the speed.
+ *
+ * Images can be binary PPM (P6) or PGM (P5) with 8 or 16 bits per
+ * sample, PFM (PF or Pf) with 32-bit floats, or headerless raw
+ * interleaved samples in the machine's byte order. The output format
+ * follows the output file's extension: .pfm, .ppm/.pgm/.pnm, and
+ * anything else is written raw. PFM rows are stored bottom to top;
+ * when only one of the files is a PFM, the writer puts each band at
+ * the mirrored place in the output file.
+ *
+ * The number of channels comes from the profiles' color spaces: 3 for
+ * RGB, 1 for gray. The profiles are read from the profiles folder,
+ * e.g. "sRGB-elle-V4-srgbtrc.icc", unless the name contains a "/".
+ *
+ * Sample command line to compile this code:
+ *
+ * gcc -g -O2 -Wall -o elles-convert.exe elles-convert.c elles-bench-util.c -llcms2 -lpthread
+ *
+ * Sample command line to convert a 16-bit PPM:
+ *
+ * ./elles-convert.exe -j 8 sRGB-elle-V4-srgbtrc.icc ACES-elle-V4-g10.icc in.ppm out.pfm
+ *
+ * Command line options:
+ * -j N     worker threads (default: the number of processors)
+ * -b N     rows per band (default: 64)
+ * -q N     bands in flight (default: twice the number of workers)
+ * -i N     rendering intent, 0 to 3 (default: 1, relative colorimetric)
+ * -R w,h,t the input is raw: width, height and sample type 8, 16 or f
+ * -D t     output sample type 8, 16 or f (default: the input's; always
+ *          f for PFM, and 16 for a PPM made from float input)
+ * -d dir   profiles folder (default: ../profiles/)
+ *
+ * */
+
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <lcms2.h>
+
+#define SLOT_FREE       0
+#define SLOT_READ       1
+#define SLOT_CONVERTED  2
+
+#include "elles-bench-util.h"
+#include "elles-convert.h"
+
+int main (int argc, char *argv[])
+{
+char *directory = "../profiles/";
+char *raw_layout = NULL;
+int threads = 0, band_rows = 64, slot_count = 0, intent = INTENT_RELATIVE_COLORIMETRIC;
+int output_sample = -1, opt, i, source_channels, destination_channels;
+const char *extension;
+converter conv;
+convert_worker *workers;
+pthread_t writer;
+cmsHPROFILE profile;
+cmsUInt32Number input_format, output_format;
+struct timespec start;
+double seconds, megabytes;
+
+while ((opt = getopt(argc, argv, "j:b:q:i:R:D:d:")) != -1)
+  {
+  if (opt == 'j') threads = atoi(optarg);
+  else if (opt == 'b') band_rows = atoi(optarg);
+  else if (opt == 'q') slot_count = atoi(optarg);
+  else if (opt == 'i') intent = atoi(optarg);
+  else if (opt == 'R') raw_layout = optarg;
+  else if (opt == 'D')
+    {
+    if (strcmp(optarg, "8") == 0) output_sample = SAMPLE_8;
+    else if (strcmp(optarg, "16") == 0) output_sample = SAMPLE_16;
+    else if (strcmp(optarg, "f") == 0) output_sample = SAMPLE_FLOAT;
+    else opt = '?';
+    }
+  else if (opt == 'd') directory = optarg;
+  if (opt == '?' || opt == ':') break;
+  }
+if (opt == '?' || opt == ':' || argc - optind != 4 || intent < 0 || intent > 3)
+  {
+  fprintf(stderr, "usage: %s [-j threads] [-b rows per band] [-q bands in flight] "
+                  "[-i intent] [-R width,height,8|16|f] [-D 8|16|f] [-d folder] "
+                  "source.icc destination.icc input output\n", argv[0]);
+  return 1;
+  }
+if (threads < 1) threads = (int) sysconf (_SC_NPROCESSORS_ONLN);
+if (threads < 1) threads = 1;
+if (band_rows < 1) band_rows = 1;
+if (slot_count < 1) slot_count = 2 * threads;
+
+memset (&conv, 0, sizeof(conv));
+
+/* The profiles decide the channel counts */
+profile = elle_open_profile (NULL, directory, argv[optind]);
+if (profile == NULL) return 1;
+source_channels = profile_channels (profile);
+cmsCloseProfile (profile);
+profile = elle_open_profile (NULL, directory, argv[optind + 1]);
+if (profile == NULL) return 1;
+destination_channels = profile_channels (profile);
+cmsCloseProfile (profile);
+if (source_channels == 0 || destination_channels == 0)
+  {
+  fprintf(stderr, "only RGB and gray profiles are supported\n");
+  return 1;
+  }
+
+/* The input */
+conv.input_file = fopen (argv[optind + 2], "rb");
+if (conv.input_file == NULL)
+  {
+  fprintf(stderr, "couldn't open %s\n", argv[optind + 2]);
+  return 1;
+  }
+if (raw_layout != NULL)
+  {
+  if (!parse_raw_layout (raw_layout, &conv.input)) 
+    {
+    fprintf(stderr, "-R wants width,height,type with type 8, 16 or f\n");
+    return 1;
+    }
+  conv.input.channels = source_channels;
+  }
+else if (!read_image_header (conv.input_file, &conv.input))
+  {
+  fprintf(stderr, "%s isn't a binary PPM, PGM or PFM file (use -R for raw input)\n", 
+          argv[optind + 2]);
+  return 1;
+  }
+if (conv.input.channels != source_channels)
+  {
+  fprintf(stderr, "%s has %d channels, but %s has %d\n", argv[optind + 2], 
+          conv.input.channels, argv[optind], source_channels);
+  return 1;
+  }
+
+/* The output, in the format its extension asks for */
+extension = strrchr (argv[optind + 3], '.');
+conv.output.width = conv.input.width;
+conv.output.height = conv.input.height;
+conv.output.channels = destination_channels;
+conv.output.sample = output_sample >= 0 ? (sample_type) output_sample : conv.input.sample;
+conv.output.big_endian = host_big_endian ();
+if (extension != NULL && strcmp(extension, ".pfm") == 0)
+  {
+  conv.output.container = CONTAINER_PFM;
+  conv.output.sample = SAMPLE_FLOAT;
+  conv.output.bottom_up = TRUE;
+  }
+else if (extension != NULL && (strcmp(extension, ".ppm") == 0 || 
+         strcmp(extension, ".pgm") == 0 || strcmp(extension, ".pnm") == 0))
+  {
+  conv.output.container = CONTAINER_PNM;
+  if (conv.output.sample == SAMPLE_FLOAT)
+    {
+    if (output_sample == SAMPLE_FLOAT)
+      {
+      fprintf(stderr, "PPM and PGM files can't hold floats\n");
+      return 1;
+      }
+    conv.output.sample = SAMPLE_16;
+    }
+  conv.output.big_endian = TRUE;
+  }
+else conv.output.container = CONTAINER_RAW;
+
+conv.output_file = fopen (argv[optind + 3], "wb");
+if (conv.output_file == NULL)
+  {
+  fprintf(stderr, "couldn't create %s\n", argv[optind + 3]);
+  return 1;
+  }
+if (!write_image_header (conv.output_file, &conv.output))
+  {
+  fprintf(stderr, "couldn't write to %s\n", argv[optind + 3]);
+  return 1;
+  }
+
+conv.input_row_bytes = (size_t) conv.input.width * conv.input.channels * 
+                       sample_bytes (conv.input.sample);
+conv.output_row_bytes = (size_t) conv.output.width * conv.output.channels * 
+                        sample_bytes (conv.output.sample);
+/* cmsDoTransform converts at most 2^32 - 1 pixels at a time */
+if ((double) band_rows * conv.input.width > 4294967295.0)
+  band_rows = (int) (4294967295.0 / conv.input.width);
+if (band_rows > conv.input.height) band_rows = conv.input.height;
+if (band_rows < 1) band_rows = 1;
+conv.band_rows = band_rows;
+conv.bands = (conv.input.height + band_rows - 1) / band_rows;
+if (slot_count > conv.bands) slot_count = conv.bands > 0 ? conv.bands : 1;
+if (threads > slot_count) threads = slot_count;
+conv.slot_count = slot_count;
+
+/* The band slots */
+conv.slots = (band_slot*) calloc (slot_count, sizeof(band_slot));
+conv.ready = (int*) malloc (slot_count * sizeof(int));
+if (conv.slots == NULL || conv.ready == NULL) return 1;
+for ( i = 0; i < slot_count; i++ )
+  {
+  conv.slots[i].input = (cmsUInt8Number*) malloc (band_rows * conv.input_row_bytes);
+  conv.slots[i].output = (cmsUInt8Number*) malloc (band_rows * conv.output_row_bytes);
+  conv.slots[i].state = SLOT_FREE;
+  if (conv.slots[i].input == NULL || conv.slots[i].output == NULL)
+    {
+    fprintf(stderr, "not enough memory for %d bands of %d rows\n", slot_count, band_rows);
+    return 1;
+    }
+  }
+
+/* One transform per worker, each in its own context, so the workers
+ * share nothing but the slots. */
+input_format = layout_format (&conv.input);
+output_format = layout_format (&conv.output);
+workers = (convert_worker*) calloc (threads, sizeof(convert_worker));
+if (workers == NULL) return 1;
+for ( i = 0; i < threads; i++ )
+  {
+  cmsHPROFILE source, destination;
+  workers[i].conv = &conv;
+  workers[i].ContextID = cmsCreateContext (NULL, NULL);
+  source = elle_open_profile (workers[i].ContextID, directory, argv[optind]);
+  destination = elle_open_profile (workers[i].ContextID, directory, argv[optind + 1]);
+  if (source == NULL || destination == NULL) return 1;
+  workers[i].transform = cmsCreateTransformTHR (workers[i].ContextID, 
+                                                source, input_format, 
+                                                destination, output_format, 
+                                                intent, 0);
+  cmsCloseProfile (source);
+  cmsCloseProfile (destination);
+  if (workers[i].transform == NULL)
+    {
+    fprintf(stderr, "couldn't make a transform from %s to %s\n", argv[optind], argv[optind + 1]);
+    return 1;
+    }
+  }
+
+pthread_mutex_init (&conv.lock, NULL);
+pthread_cond_init (&conv.slot_freed, NULL);
+pthread_cond_init (&conv.band_read, NULL);
+pthread_cond_init (&conv.band_converted, NULL);
+
+clock_gettime (CLOCK_MONOTONIC, &start);
+for ( i = 0; i < threads; i++ )
+  pthread_create (&workers[i].thread, NULL, convert_bands, &workers[i]);
+pthread_create (&writer, NULL, write_bands, &conv);
+
+read_bands (&conv);
+
+for ( i = 0; i < threads; i++ )
+  pthread_join (workers[i].thread, NULL);
+pthread_join (writer, NULL);
+seconds = elle_elapsed_seconds (start);
+
+if (fclose (conv.output_file) != 0) conv.failed = 1;
+fclose (conv.input_file);
+
+megabytes = slot_count * band_rows * (double) (conv.input_row_bytes + conv.output_row_bytes) 
+            / (1024.0 * 1024.0);
+fprintf(stderr, "%d x %d pixels, %d bands of %d rows, %d workers, %d bands in flight "
+                "(at most %.1f MB of pixels)\n", conv.input.width, conv.input.height, 
+        conv.bands, band_rows, threads, slot_count, megabytes);
+for ( i = 0; i < threads; i++ )
+  {
+  fprintf(stderr, "  worker %d converted %d bands\n", i, workers[i].bands);
+  cmsDeleteTransform (workers[i].transform);
+  cmsDeleteContext (workers[i].ContextID);
+  }
+fprintf(stderr, "%.3f s, %.1f Mpixels/s\n", seconds, 
+        seconds > 0 ? (double) conv.input.width * conv.input.height / seconds / 1e6 : 0.0);
+
+for ( i = 0; i < slot_count; i++ )
+  {
+  free (conv.slots[i].input);
+  free (conv.slots[i].output);
+  }
+free (conv.slots);
+free (conv.ready);
+free (workers);
+pthread_mutex_destroy (&conv.lock);
+pthread_cond_destroy (&conv.slot_freed);
+pthread_cond_destroy (&conv.band_read);
+pthread_cond_destroy (&conv.band_converted);
+
+if (conv.failed)
+  {
+  fprintf(stderr, "the conversion failed; %s is incomplete\n", argv[optind + 3]);
+  return 1;
+  }
+return 0;
+}
+
+
+/* The reader, on the main thread. Bands are read in file order. */
+static void read_bands (converter *conv)
+{
+int band;
+
+for ( band = 0; band < conv->bands; band++ )
+  {
+  band_slot *slot = &conv->slots[band % conv->slot_count];
+  int rows = conv->input.height - band * conv->band_rows;
+  if (rows > conv->band_rows) rows = conv->band_rows;
+
+  pthread_mutex_lock (&conv->lock);
+  while (slot->state != SLOT_FREE && !conv->failed)
+    pthread_cond_wait (&conv->slot_freed, &conv->lock);
+  pthread_mutex_unlock (&conv->lock);
+  if (conv->failed) break;
+
+  if (fread (slot->input, conv->input_row_bytes, rows, conv->input_file) != (size_t) rows)
+    {
+    fprintf(stderr, "the input ends early, in band %d\n", band);
+    pthread_mutex_lock (&conv->lock);
+    conv->failed = 1;
+    pthread_cond_broadcast (&conv->band_converted);
+    pthread_mutex_unlock (&conv->lock);
+    break;
+    }
+
+  pthread_mutex_lock (&conv->lock);
+  slot->band = band;
+  slot->rows = rows;
+  slot->state = SLOT_READ;
+  conv->ready[(conv->ready_first + conv->ready_count) % conv->slot_count] = 
+    band % conv->slot_count;
+  conv->ready_count++;
+  conv->bands_read++;
+  pthread_cond_signal (&conv->band_read);
+  pthread_mutex_unlock (&conv->lock);
+  }
+
+pthread_mutex_lock (&conv->lock);
+conv->reading_done = 1;
+pthread_cond_broadcast (&conv->band_read);
+pthread_mutex_unlock (&conv->lock);
+}
+
+
+static void *convert_bands (void *arg)
+{
+convert_worker *worker = (convert_worker*) arg;
+converter *conv = worker->conv;
+cmsBool swap = conv->input.sample == SAMPLE_FLOAT && 
+               conv->input.big_endian != host_big_endian ();
+
+for (;;)
+  {
+  band_slot *slot;
+
+  pthread_mutex_lock (&conv->lock);
+  while (conv->ready_count == 0 && !conv->reading_done && !conv->failed)
+    pthread_cond_wait (&conv->band_read, &conv->lock);
+  if (conv->ready_count == 0 || conv->failed)
+    {
+    pthread_mutex_unlock (&conv->lock);
+    break;
+    }
+  slot = &conv->slots[conv->ready[conv->ready_first]];
+  conv->ready_first = (conv->ready_first + 1) % conv->slot_count;
+  conv->ready_count--;
+  pthread_mutex_unlock (&conv->lock);
+
+  /* LCMS swaps 16-bit samples itself, but not floats */
+  if (swap) 
+    swap_floats (slot->input, (size_t) slot->rows * conv->input.width * conv->input.channels);
+  cmsDoTransform (worker->transform, slot->input, slot->output, 
+                  (cmsUInt32Number) (slot->rows * conv->input.width));
+  worker->bands++;
+
+  pthread_mutex_lock (&conv->lock);
+  slot->state = SLOT_CONVERTED;
+  pthread_cond_broadcast (&conv->band_converted);
+  pthread_mutex_unlock (&conv->lock);
+  }
+return NULL;
+}
+
+
+/* The writer writes the bands in order and frees their slots */
+static void *write_bands (void *arg)
+{
+converter *conv = (converter*) arg;
+int band;
+
+for ( band = 0; band < conv->bands; band++ )
+  {
+  band_slot *slot = &conv->slots[band % conv->slot_count];
+
+  pthread_mutex_lock (&conv->lock);
+  while (!(slot->state == SLOT_CONVERTED && slot->band == band) && !conv->failed)
+    pthread_cond_wait (&conv->band_converted, &conv->lock);
+  pthread_mutex_unlock (&conv->lock);
+  if (conv->failed) break;
+
+  if (!write_band (conv, slot))
+    {
+    fprintf(stderr, "couldn't write band %d\n", band);
+    pthread_mutex_lock (&conv->lock);
+    conv->failed = 1;
+    pthread_cond_broadcast (&conv->slot_freed);
+    pthread_cond_broadcast (&conv->band_read);
+    pthread_mutex_unlock (&conv->lock);
+    break;
+    }
+
+  pthread_mutex_lock (&conv->lock);
+  slot->state = SLOT_FREE;
+  pthread_cond_signal (&conv->slot_freed);
+  pthread_mutex_unlock (&conv->lock);
+  }
+return NULL;
+}
+
+
+/* Band rows are in input file order. If the output file runs the other
+ * way, the band goes, rows reversed, at the mirrored place. */
+static cmsBool write_band (converter *conv, const band_slot *slot)
+{
+int first_row = slot->band * conv->band_rows;
+cmsBool reverse = conv->input.bottom_up != conv->output.bottom_up;
+int row;
+
+if (reverse) first_row = conv->output.height - first_row - slot->rows;
+if (fseeko (conv->output_file, conv->output.data_offset + 
+            (off_t) first_row * (off_t) conv->output_row_bytes, SEEK_SET) != 0)
+  return FALSE;
+
+if (!reverse)
+  return fwrite (slot->output, conv->output_row_bytes, slot->rows, conv->output_file) == 
+         (size_t) slot->rows;
+
+for ( row = slot->rows - 1; row >= 0; row-- )
+  if (fwrite (slot->output + row * conv->output_row_bytes, 
+              conv->output_row_bytes, 1, conv->output_file) != 1)
+    return FALSE;
+return TRUE;
+}
+
+
+/* Binary PPM/PGM (P6, P5) or PFM (PF, Pf) */
+static cmsBool read_image_header (FILE *file, image_layout *layout)
+{
+int magic[2];
+long width, height, maxval;
+double scale;
+
+magic[0] = getc (file);
+magic[1] = getc (file);
+if (magic[0] != 'P') return FALSE;
+memset (layout, 0, sizeof(image_layout));
+
+if (magic[1] == '5' || magic[1] == '6')
+  {
+  layout->container = CONTAINER_PNM;
+  layout->channels = magic[1] == '6' ? 3 : 1;
+  if (!read_header_number (file, &width) || !read_header_number (file, &height) ||
+      !read_header_number (file, &maxval))
+    return FALSE;
+  if (maxval == 255) layout->sample = SAMPLE_8;
+  else if (maxval == 65535) layout->sample = SAMPLE_16;
+  else
+    {
+    fprintf(stderr, "only maxval 255 and 65535 are supported\n");
+    return FALSE;
+    }
+  layout->big_endian = TRUE;
+  }
+else if (magic[1] == 'F' || magic[1] == 'f')
+  {
+  layout->container = CONTAINER_PFM;
+  layout->channels = magic[1] == 'F' ? 3 : 1;
+  layout->sample = SAMPLE_FLOAT;
+  layout->bottom_up = TRUE;
+  if (fscanf (file, "%ld %ld %lf", &width, &height, &scale) != 3 || scale == 0) 
+    return FALSE;
+  /* A negative scale means little-endian */
+  layout->big_endian = scale > 0;
+  }
+else return FALSE;
+
+/* Exactly one whitespace character before the samples */
+if (!isspace (getc (file))) return FALSE;
+if (width < 1 || height < 1 || width > 0x7FFFFFFF || height > 0x7FFFFFFF) return FALSE;
+layout->width = (int) width;
+layout->height = (int) height;
+layout->data_offset = ftello (file);
+return layout->data_offset >= 0;
+}
+
+
+/* Skips whitespace and # comments, then reads a decimal number */
+static cmsBool read_header_number (FILE *file, long *number)
+{
+int c = getc (file);
+
+for (;;)
+  {
+  if (c == '#')
+    while (c != '\n' && c != EOF) c = getc (file);
+  else if (isspace (c)) c = getc (file);
+  else break;
+  }
+if (!isdigit (c)) return FALSE;
+*number = 0;
+while (isdigit (c))
+  {
+  if (*number > 0x7FFFFFFF / 10) return FALSE;
+  *number = *number * 10 + (c - '0');
+  c = getc (file);
+  }
+ungetc (c, file);
+return TRUE;
+}
+
+
+static cmsBool parse_raw_layout (const char *text, image_layout *layout)
+{
+char type[8];
+
+memset (layout, 0, sizeof(image_layout));
+if (sscanf (text, "%d,%d,%7s", &layout->width, &layout->height, type) != 3) return FALSE;
+if (layout->width < 1 || layout->height < 1) return FALSE;
+if (strcmp(type, "8") == 0) layout->sample = SAMPLE_8;
+else if (strcmp(type, "16") == 0) layout->sample = SAMPLE_16;
+else if (strcmp(type, "f") == 0) layout->sample = SAMPLE_FLOAT;
+else return FALSE;
+layout->container = CONTAINER_RAW;
+layout->big_endian = host_big_endian ();
+return TRUE;
+}
+
+
+static cmsBool write_image_header (FILE *file, image_layout *layout)
+{
+if (layout->container == CONTAINER_PNM)
+  fprintf (file, "P%c\n%d %d\n%d\n", layout->channels == 3 ? '6' : '5', 
+           layout->width, layout->height, layout->sample == SAMPLE_8 ? 255 : 65535);
+else if (layout->container == CONTAINER_PFM)
+  fprintf (file, "P%c\n%d %d\n%s\n", layout->channels == 3 ? 'F' : 'f', 
+           layout->width, layout->height, layout->big_endian ? "1.0" : "-1.0");
+layout->data_offset = ftello (file);
+return layout->data_offset >= 0 && !ferror (file);
+}
+
+
+static int sample_bytes (sample_type sample)
+{
+return sample == SAMPLE_8 ? 1 : sample == SAMPLE_16 ? 2 : 4;
+}
+
+
+/* The LCMS format for the layout, swapping 16-bit samples if the file's
+ * byte order isn't the machine's */
+static cmsUInt32Number layout_format (const image_layout *layout)
+{
+cmsUInt32Number format = CHANNELS_SH(layout->channels) | 
+                         COLORSPACE_SH(layout->channels == 3 ? PT_RGB : PT_GRAY);
+
+if (layout->sample == SAMPLE_FLOAT) return format | FLOAT_SH(1) | BYTES_SH(4);
+if (layout->sample == SAMPLE_8) return format | BYTES_SH(1);
+format |= BYTES_SH(2);
+if (layout->big_endian != host_big_endian ()) format |= ENDIAN16_SH(1);
+return format;
+}
+
+
+static int profile_channels (cmsHPROFILE profile)
+{
+cmsColorSpaceSignature space = cmsGetColorSpace (profile);
+if (space == cmsSigRgbData) return 3;
+if (space == cmsSigGrayData) return 1;
+return 0;
+}
+
+
+static void swap_floats (cmsUInt8Number *data, size_t count)
+{
+size_t i;
+cmsUInt8Number t;
+
+for ( i = 0; i < count; i++, data += 4 )
+  {
+  t = data[0]; data[0] = data[3]; data[3] = t;
+  t = data[1]; data[1] = data[2]; data[2] = t;
+  }
+}
+
+
+static int host_big_endian (void)
+{
+const cmsUInt16Number one = 1;
+return *(const cmsUInt8Number*) &one == 0;
+}
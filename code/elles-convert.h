@@ -0,0 +1,114 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+typedef enum {
+  SAMPLE_8,
+  SAMPLE_16,
+  SAMPLE_FLOAT
+} sample_type;
+
+typedef enum {
+  CONTAINER_RAW,
+  CONTAINER_PNM,        /* binary PPM or PGM */
+  CONTAINER_PFM
+} container_type;
+
+typedef struct {
+  container_type   container;
+  sample_type      sample;
+  int              width;
+  int              height;
+  int              channels;          /* 1 (gray) or 3 (RGB) */
+  cmsBool          bottom_up;         /* PFM rows go from the bottom of the image up */
+  cmsBool          big_endian;        /* for 16-bit and float samples */
+  off_t            data_offset;       /* where the pixels start in the file */
+} image_layout;
+
+/* One band of rows. A band goes into slot band % slot_count, and the
+ * slot is only refilled after the band is written, so at most 
+ * slot_count bands are in memory and they are written in order. */
+typedef struct {
+  cmsUInt8Number * input;
+  cmsUInt8Number * output;
+  int              band;
+  int              rows;
+  int              state;             /* SLOT_FREE, SLOT_READ or SLOT_CONVERTED */
+} band_slot;
+
+typedef struct {
+  image_layout     input;
+  image_layout     output;
+  size_t           input_row_bytes;
+  size_t           output_row_bytes;
+  int              band_rows;
+  int              bands;             /* in the image */
+  FILE *           input_file;
+  FILE *           output_file;
+  band_slot *      slots;
+  int              slot_count;
+  int *            ready;             /* ring of slots read and waiting for a worker */
+  int              ready_first;
+  int              ready_count;
+  int              bands_read;
+  int              reading_done;
+  int              failed;
+  pthread_mutex_t  lock;
+  pthread_cond_t   slot_freed;        /* for the reader */
+  pthread_cond_t   band_read;         /* for the workers */
+  pthread_cond_t   band_converted;    /* for the writer */
+} converter;
+
+typedef struct {
+  converter *      conv;
+  cmsContext       ContextID;         /* each worker has its own context and transform */
+  cmsHTRANSFORM    transform;
+  pthread_t        thread;
+  int              bands;             /* converted by this worker */
+} convert_worker;
+
+static cmsBool read_image_header (FILE *file, image_layout *layout);
+
+static cmsBool read_header_number (FILE *file, long *number);
+
+static cmsBool parse_raw_layout (const char *text, image_layout *layout);
+
+static cmsBool write_image_header (FILE *file, image_layout *layout);
+
+static int sample_bytes (sample_type sample);
+
+static cmsUInt32Number layout_format (const image_layout *layout);
+
+static int profile_channels (cmsHPROFILE profile);
+
+static void read_bands (converter *conv);
+
+static void *convert_bands (void *arg);
+
+static void *write_bands (void *arg);
+
+static cmsBool write_band (converter *conv, const band_slot *slot);
+
+static void swap_floats (cmsUInt8Number *data, size_t count);
+
+static int host_big_endian (void);
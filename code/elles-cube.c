@@ -0,0 +1,409 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <lcms2.h>
+#include "elles-bench-util.h"
+#include "elles-cube.h"
+
+/* The grid is sampled one blue slab (grid_size^2 pixels) at a time. 
+ * The threads take the next slab from a shared counter and run it 
+ * through one shared transform, which is safe because it's a float
+ * transform made with cmsFLAGS_NOCACHE. */
+typedef struct {
+  cmsHTRANSFORM       transform;
+  elle_cube_lut *     lut;
+  cmsFloat32Number *  nodes;        /* source value of each grid step */
+  cmsUInt32Number     next_slab;
+  cmsBool             failed;
+  pthread_mutex_t     lock;
+} cube_sampling;
+
+static cmsHTRANSFORM make_float_transform (cmsContext                ContextID,
+                                           const elle_profile_buffer *source,
+                                           const elle_profile_buffer *destination,
+                                           cmsUInt32Number           intent,
+                                           cmsBool                   *linear_source
+                                           );
+
+static void* sample_slabs (void *arg);
+
+static cmsFloat32Number grid_to_source (const elle_cube_lut *lut, cmsFloat32Number value);
+
+static cmsFloat32Number apply_shaper (const elle_cube_lut *lut, cmsFloat32Number value);
+
+
+cmsBool elle_make_cube_lut (cmsContext                ContextID,
+                            const elle_profile_buffer *source,
+                            const elle_profile_buffer *destination,
+                            cmsUInt32Number           intent,
+                            cmsUInt32Number           grid_size,
+                            elle_cube_shaper          shaper,
+                            int                       threads,
+                            elle_cube_lut             *lut
+                            )
+{
+cube_sampling sampling;
+pthread_t *workers;
+int started = 0, i;
+cmsBool linear_source = FALSE;
+struct timespec start;
+
+memset (lut, 0, sizeof(elle_cube_lut));
+if (grid_size < 2 || grid_size > 256)
+  {
+  fprintf(stderr, "a 3D LUT needs 2 to 256 grid points\n");
+  return FALSE;
+  }
+
+clock_gettime (CLOCK_MONOTONIC, &start);
+sampling.transform = make_float_transform (ContextID, source, destination, 
+                                           intent, &linear_source);
+if (sampling.transform == NULL) return FALSE;
+
+lut->grid_size = grid_size;
+lut->table = (cmsFloat32Number*) malloc ((size_t) grid_size * grid_size * grid_size * 
+                                         3 * sizeof(cmsFloat32Number));
+sampling.nodes = (cmsFloat32Number*) malloc (grid_size * sizeof(cmsFloat32Number));
+if (shaper == ELLE_CUBE_SHAPER || (shaper == ELLE_CUBE_SHAPER_IF_LINEAR && linear_source))
+  {
+  lut->shaper_size = ELLE_CUBE_SHAPER_SIZE;
+  lut->shaper = (cmsFloat32Number*) malloc (lut->shaper_size * sizeof(cmsFloat32Number));
+  }
+if (lut->table == NULL || sampling.nodes == NULL || 
+    (lut->shaper_size > 0 && lut->shaper == NULL))
+  {
+  cmsDeleteTransform (sampling.transform);
+  free (sampling.nodes);
+  elle_free_cube_lut (lut);
+  return FALSE;
+  }
+
+/* The shaper encodes linear values with the L* TRC; the grid steps
+ * are evenly spaced in L*, and decoded back for sampling */
+for ( i = 0; i < (int) lut->shaper_size; i++ )
+  lut->shaper[i] = cmsEvalToneCurveFloat (elle_trc_reverse_curve (ELLE_TRC_LABL),
+                                          (cmsFloat32Number) i / (lut->shaper_size - 1));
+for ( i = 0; i < (int) grid_size; i++ )
+  sampling.nodes[i] = grid_to_source (lut, (cmsFloat32Number) i / (grid_size - 1));
+
+sampling.lut = lut;
+sampling.next_slab = 0;
+sampling.failed = FALSE;
+pthread_mutex_init (&sampling.lock, NULL);
+
+/* The calling thread samples too, so threads - 1 more are started */
+workers = threads > 1 ? (pthread_t*) malloc ((threads - 1) * sizeof(pthread_t)) : NULL;
+if (workers != NULL)
+  while (started < threads - 1 && 
+         pthread_create (&workers[started], NULL, sample_slabs, &sampling) == 0)
+    started++;
+sample_slabs (&sampling);
+for ( i = 0; i < started; i++ ) pthread_join (workers[i], NULL);
+free (workers);
+
+pthread_mutex_destroy (&sampling.lock);
+cmsDeleteTransform (sampling.transform);
+free (sampling.nodes);
+if (sampling.failed)
+  {
+  elle_free_cube_lut (lut);
+  return FALSE;
+  }
+lut->seconds = elle_elapsed_seconds (start);
+return TRUE;
+}
+
+
+static void* sample_slabs (void *arg)
+{
+cube_sampling *sampling = (cube_sampling*) arg;
+cmsUInt32Number n = sampling->lut->grid_size, slab_size = n * n, blue, i;
+cmsFloat32Number *input = (cmsFloat32Number*) malloc (slab_size * 3 * sizeof(cmsFloat32Number));
+
+if (input == NULL)
+  {
+  pthread_mutex_lock (&sampling->lock);
+  sampling->failed = TRUE;
+  pthread_mutex_unlock (&sampling->lock);
+  return NULL;
+  }
+
+for (;;)
+  {
+  pthread_mutex_lock (&sampling->lock);
+  blue = sampling->next_slab++;
+  pthread_mutex_unlock (&sampling->lock);
+  if (blue >= n) break;
+
+  /* Red changes fastest, as in the .cube file */
+  for ( i = 0; i < slab_size; i++ )
+    {
+    input[3 * i] = sampling->nodes[i % n];
+    input[3 * i + 1] = sampling->nodes[i / n];
+    input[3 * i + 2] = sampling->nodes[blue];
+    }
+  cmsDoTransform (sampling->transform, input, 
+                  sampling->lut->table + (size_t) blue * slab_size * 3, slab_size);
+  }
+
+free (input);
+return NULL;
+}
+
+
+void elle_apply_cube_lut (const elle_cube_lut     *lut,
+                          const cmsFloat32Number  input[3],
+                          cmsFloat32Number        output[3]
+                          )
+{
+cmsUInt32Number n = lut->grid_size, index[3], c;
+cmsFloat32Number fraction[3];
+const cmsFloat32Number *corner;
+size_t step[3];
+
+step[0] = 3;
+step[1] = 3 * (size_t) n;
+step[2] = 3 * (size_t) n * n;
+
+for ( c = 0; c < 3; c++ )
+  {
+  cmsFloat32Number value = input[c];
+  if (lut->shaper_size > 0) value = apply_shaper (lut, value);
+  if (value < 0.0f) value = 0.0f;
+  if (value > 1.0f) value = 1.0f;
+  value *= n - 1;
+  index[c] = (cmsUInt32Number) value;
+  if (index[c] > n - 2) index[c] = n - 2;
+  fraction[c] = value - index[c];
+  }
+
+corner = lut->table + index[0] * step[0] + index[1] * step[1] + index[2] * step[2];
+for ( c = 0; c < 3; c++ )
+  {
+  const cmsFloat32Number *p = corner + c;
+  cmsFloat32Number r00 = p[0] + fraction[0] * (p[step[0]] - p[0]);
+  cmsFloat32Number r10 = p[step[1]] + fraction[0] * (p[step[1] + step[0]] - p[step[1]]);
+  cmsFloat32Number r01 = p[step[2]] + fraction[0] * (p[step[2] + step[0]] - p[step[2]]);
+  cmsFloat32Number r11 = p[step[2] + step[1]] + 
+                         fraction[0] * (p[step[2] + step[1] + step[0]] - p[step[2] + step[1]]);
+  cmsFloat32Number g0 = r00 + fraction[1] * (r10 - r00);
+  cmsFloat32Number g1 = r01 + fraction[1] * (r11 - r01);
+  output[c] = g0 + fraction[2] * (g1 - g0);
+  }
+}
+
+
+cmsBool elle_cube_lut_error (cmsContext                ContextID,
+                             const elle_profile_buffer *source,
+                             const elle_profile_buffer *destination,
+                             cmsUInt32Number           intent,
+                             const elle_cube_lut       *lut,
+                             cmsUInt32Number           samples,
+                             elle_cube_error           *error
+                             )
+{
+cmsHTRANSFORM exact, to_lab;
+cmsHPROFILE destination_profile, lab_profile;
+cmsFloat32Number *input, *exact_rgb, *lut_rgb;
+cmsCIELab *exact_lab, *lut_lab;
+cmsUInt32Number i, c, seed = 12345;
+cmsBool ok = FALSE;
+
+memset (error, 0, sizeof(elle_cube_error));
+if (samples == 0) return FALSE;
+exact = make_float_transform (ContextID, source, destination, intent, NULL);
+if (exact == NULL) return FALSE;
+
+/* Both results are compared in Lab, through the destination profile */
+destination_profile = cmsOpenProfileFromMemTHR (ContextID, destination->data, destination->size);
+lab_profile = cmsCreateLab4ProfileTHR (ContextID, NULL);
+to_lab = NULL;
+if (destination_profile != NULL && lab_profile != NULL)
+  to_lab = cmsCreateTransformTHR (ContextID, destination_profile, TYPE_RGB_FLT, 
+                                  lab_profile, TYPE_Lab_DBL, 
+                                  INTENT_RELATIVE_COLORIMETRIC, cmsFLAGS_NOCACHE);
+if (destination_profile != NULL) cmsCloseProfile (destination_profile);
+if (lab_profile != NULL) cmsCloseProfile (lab_profile);
+
+input = (cmsFloat32Number*) malloc (samples * 3 * sizeof(cmsFloat32Number));
+exact_rgb = (cmsFloat32Number*) malloc (samples * 3 * sizeof(cmsFloat32Number));
+lut_rgb = (cmsFloat32Number*) malloc (samples * 3 * sizeof(cmsFloat32Number));
+exact_lab = (cmsCIELab*) malloc (samples * sizeof(cmsCIELab));
+lut_lab = (cmsCIELab*) malloc (samples * sizeof(cmsCIELab));
+
+if (to_lab != NULL && input != NULL && exact_rgb != NULL && lut_rgb != NULL && 
+    exact_lab != NULL && lut_lab != NULL)
+  {
+  /* The same points every run, so the reports can be compared */
+  for ( i = 0; i < samples * 3; i++ )
+    {
+    seed = seed * 1664525 + 1013904223;
+    input[i] = grid_to_source (lut, (cmsFloat32Number) (seed >> 8) / 16777215.0f);
+    }
+  cmsDoTransform (exact, input, exact_rgb, samples);
+  for ( i = 0; i < samples; i++ )
+    elle_apply_cube_lut (lut, input + 3 * i, lut_rgb + 3 * i);
+  cmsDoTransform (to_lab, exact_rgb, exact_lab, samples);
+  cmsDoTransform (to_lab, lut_rgb, lut_lab, samples);
+
+  for ( i = 0; i < samples; i++ )
+    {
+    double delta = cmsCIE2000DeltaE (&exact_lab[i], &lut_lab[i], 1.0, 1.0, 1.0);
+    error->mean += delta;
+    if (delta > error->max)
+      {
+      error->max = delta;
+      for ( c = 0; c < 3; c++ ) error->worst_input[c] = input[3 * i + c];
+      }
+    }
+  error->mean /= samples;
+  ok = TRUE;
+  }
+
+free (input);
+free (exact_rgb);
+free (lut_rgb);
+free (exact_lab);
+free (lut_lab);
+if (to_lab != NULL) cmsDeleteTransform (to_lab);
+cmsDeleteTransform (exact);
+return ok;
+}
+
+
+cmsBool elle_write_cube_file (const char           *directory,
+                              const char           *name,
+                              const char           *title,
+                              const elle_cube_lut  *lut
+                              )
+{
+char *filename = (char*) malloc (strlen(directory) + strlen(name) + 1);
+size_t i, count = (size_t) lut->grid_size * lut->grid_size * lut->grid_size;
+cmsBool ok = FALSE;
+FILE *file;
+
+strcpy(filename, directory);
+strcat(filename, name);
+
+file = fopen (filename, "w");
+if (file != NULL)
+  {
+  fprintf(file, "TITLE \"%s\"\n", title);
+  if (lut->shaper_size > 0)
+    {
+    fprintf(file, "# 1D shaper: the L* TRC\n");
+    fprintf(file, "LUT_1D_SIZE %u\n", lut->shaper_size);
+    fprintf(file, "LUT_1D_INPUT_RANGE 0.0 1.0\n");
+    }
+  fprintf(file, "LUT_3D_SIZE %u\n", lut->grid_size);
+  if (lut->shaper_size > 0) fprintf(file, "LUT_3D_INPUT_RANGE 0.0 1.0\n");
+  fprintf(file, "\n");
+
+  for ( i = 0; i < lut->shaper_size; i++ )
+    fprintf(file, "%.6f %.6f %.6f\n", lut->shaper[i], lut->shaper[i], lut->shaper[i]);
+  for ( i = 0; i < count; i++ )
+    fprintf(file, "%.6f %.6f %.6f\n", lut->table[3 * i], lut->table[3 * i + 1], 
+            lut->table[3 * i + 2]);
+
+  ok = !ferror (file);
+  if (fclose (file) != 0) ok = FALSE;
+  }
+if (!ok) fprintf(stderr, "couldn't write %s\n", filename);
+
+free (filename);
+return ok;
+}
+
+
+void elle_free_cube_lut (elle_cube_lut *lut)
+{
+free (lut->shaper);
+free (lut->table);
+lut->shaper = NULL;
+lut->table = NULL;
+lut->shaper_size = 0;
+}
+
+
+/* A float transform from source to destination that several threads
+ * can run at once. linear_source (may be NULL) is set if the source's
+ * TRC is linear. NULL, with a message, unless both profiles are RGB. */
+static cmsHTRANSFORM make_float_transform (cmsContext                ContextID,
+                                           const elle_profile_buffer *source,
+                                           const elle_profile_buffer *destination,
+                                           cmsUInt32Number           intent,
+                                           cmsBool                   *linear_source
+                                           )
+{
+cmsHPROFILE input = cmsOpenProfileFromMemTHR (ContextID, source->data, source->size);
+cmsHPROFILE output = cmsOpenProfileFromMemTHR (ContextID, destination->data, destination->size);
+cmsHTRANSFORM transform = NULL;
+
+if (input != NULL && output != NULL && 
+    cmsGetColorSpace (input) == cmsSigRgbData && 
+    cmsGetColorSpace (output) == cmsSigRgbData)
+  {
+  if (linear_source != NULL)
+    {
+    cmsToneCurve *trc = (cmsToneCurve*) cmsReadTag (input, cmsSigRedTRCTag);
+    *linear_source = trc != NULL && cmsIsToneCurveLinear (trc);
+    }
+  transform = cmsCreateTransformTHR (ContextID, input, TYPE_RGB_FLT, output, 
+                                     TYPE_RGB_FLT, intent, cmsFLAGS_NOCACHE);
+  }
+else fprintf(stderr, "3D LUTs are only made between two RGB profiles\n");
+
+if (input != NULL) cmsCloseProfile (input);
+if (output != NULL) cmsCloseProfile (output);
+return transform;
+}
+
+
+/* The source value for a position (0.0 to 1.0) in the grid */
+static cmsFloat32Number grid_to_source (const elle_cube_lut *lut, cmsFloat32Number value)
+{
+if (lut->shaper_size == 0) return value;
+return cmsEvalToneCurveFloat (elle_trc_curve (ELLE_TRC_LABL), value);
+}
+
+
+static cmsFloat32Number apply_shaper (const elle_cube_lut *lut, cmsFloat32Number value)
+{
+cmsFloat32Number position, fraction;
+cmsUInt32Number index;
+
+if (value <= 0.0f) return lut->shaper[0];
+if (value >= 1.0f) return lut->shaper[lut->shaper_size - 1];
+position = value * (lut->shaper_size - 1);
+index = (cmsUInt32Number) position;
+if (index > lut->shaper_size - 2) index = lut->shaper_size - 2;
+fraction = position - index;
+return lut->shaper[index] + fraction * (lut->shaper[index + 1] - lut->shaper[index]);
+}
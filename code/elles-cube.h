@@ -0,0 +1,113 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+
+/* Baked 3D LUTs (.cube files) between two RGB profiles.
+ *
+ * elle_make_cube_lut samples the exact float transform from the source
+ * to the destination profile on a grid_size^3 grid, on several threads
+ * at once. The LUT's input is the source encoding, 0.0 to 1.0.
+ *
+ * A linear source spends most of a uniform grid on the highlights, so
+ * the LUT can start with a 1D shaper that encodes each channel with the
+ * L* TRC of elles-trc.c; the 3D grid is then spaced evenly in L*. The
+ * shaper and the 3D table are written together, in the Resolve .cube
+ * layout (LUT_1D_SIZE followed by LUT_3D_SIZE). A LUT without a shaper
+ * is a plain Adobe .cube file.
+ *
+ * elle_cube_lut_error measures the LUT against the exact transform.
+ *
+ * */
+
+#ifndef ELLES_CUBE_H
+#define ELLES_CUBE_H
+
+#include <lcms2.h>
+#include "elles-profiles.h"
+
+#define ELLE_CUBE_SHAPER_SIZE 4096
+
+typedef enum {
+  ELLE_CUBE_NO_SHAPER,
+  ELLE_CUBE_SHAPER,
+  ELLE_CUBE_SHAPER_IF_LINEAR    /* only if the source TRC is linear */
+} elle_cube_shaper;
+
+typedef struct {
+  cmsUInt32Number    grid_size;
+  cmsUInt32Number    shaper_size;   /* 0 if there's no shaper */
+  cmsFloat32Number * shaper;        /* output for inputs i / (shaper_size - 1) */
+  cmsFloat32Number * table;         /* grid_size^3 RGB triples, red changing fastest */
+  double             seconds;       /* time taken to sample the grid */
+} elle_cube_lut;
+
+/* Delta E 2000 between the LUT and the exact transform, with both 
+ * results converted to Lab through the destination profile */
+typedef struct {
+  double             mean;
+  double             max;
+  cmsFloat32Number   worst_input[3];
+} elle_cube_error;
+
+/* Sample the transform from source to destination (both RGB) into
+ * lut, with the given intent and grid size (2 to 256), on threads
+ * threads. Returns FALSE, with a message, if the LUT couldn't be made. */
+cmsBool elle_make_cube_lut (cmsContext                ContextID,
+                            const elle_profile_buffer *source,
+                            const elle_profile_buffer *destination,
+                            cmsUInt32Number           intent,
+                            cmsUInt32Number           grid_size,
+                            elle_cube_shaper          shaper,
+                            int                       threads,
+                            elle_cube_lut             *lut
+                            );
+
+/* Apply the LUT to one pixel, with linear interpolation in the shaper
+ * and trilinear interpolation in the grid */
+void elle_apply_cube_lut (const elle_cube_lut     *lut,
+                          const cmsFloat32Number  input[3],
+                          cmsFloat32Number        output[3]
+                          );
+
+/* Compare the LUT with the exact transform at samples pseudo-random 
+ * points, spread evenly over the grid (so in L* if there's a shaper) */
+cmsBool elle_cube_lut_error (cmsContext                ContextID,
+                             const elle_profile_buffer *source,
+                             const elle_profile_buffer *destination,
+                             cmsUInt32Number           intent,
+                             const elle_cube_lut       *lut,
+                             cmsUInt32Number           samples,
+                             elle_cube_error           *error
+                             );
+
+/* Write directory + name, with title as the TITLE line */
+cmsBool elle_write_cube_file (const char           *directory,
+                              const char           *name,
+                              const char           *title,
+                              const elle_cube_lut  *lut
+                              );
+
+void elle_free_cube_lut (elle_cube_lut *lut);
+
+#endif
@@ -0,0 +1,288 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+/* Checks and times the TRC evaluation of elles-fast-curve.c.
+ *
+ * For each TRC, both ways (to linear and from linear), and each kernel
+ * the CPU can run (scalar, AVX2), the fast evaluation is compared with
+ * cmsEvalToneCurveFloat on the registry's curves, first for every 
+ * 16-bit code value (0 to 65535, divided by 65535), then for the 
+ * floats from 0.0 to 1.0: every one with "-k 1", every Nth bit pattern
+ * with "-k N" (the default checks one in 64). The error is printed in
+ * float epsilons, relative to the larger of FLT_MIN and the LCMS value;
+ * more than MAX_EPSILONS is a failure, and the program then exits 
+ * with 1.
+ *
+ * Then an array of random values from 0.0 to 1.0 is evaluated with 
+ * cmsEvalToneCurveFloat and with each kernel, and the speeds printed;
+ * they are the fastest of the repeats.
+ *
+ * Sample command line to compile this code:
+ *
+ * gcc -g -O2 -Wall -o elles-fast-curve-bench.exe elles-fast-curve-bench.c elles-fast-curve.c elles-trc.c elles-linear.c elles-bench-util.c -llcms2 -lpthread -lm
+ *
+ * Command line options:
+ * -s text  only TRCs whose suffix contains text, e.g. "srgb"
+ * -k N     check every Nth float from 0.0 to 1.0 (default: 64)
+ * -n N     values in the timed array (default: 4194304)
+ * -r N     evaluate the array N times and keep the fastest (default: 3)
+ *
+ * */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <float.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <lcms2.h>
+#include "elles-trc.h"
+#include "elles-linear.h"
+#include "elles-fast-curve.h"
+#include "elles-bench-util.h"
+#include "elles-fast-curve-bench.h"
+
+#define MAX_EPSILONS 4.0
+#define CHECK_CHUNK  65536
+
+int main (int argc, char *argv[])
+{
+char *filter = NULL;
+cmsUInt32Number stride = 64;
+size_t count = 4194304, i;
+int repeats = 3, failures = 0, opt, trc, to_linear, level;
+elle_simd_level best;
+cmsFloat32Number *values, *output;
+cmsUInt32Number state = 12345;
+
+while ((opt = getopt(argc, argv, "s:k:n:r:")) != -1)
+  {
+  if (opt == 's') filter = optarg;
+  else if (opt == 'k') stride = (cmsUInt32Number) atol(optarg);
+  else if (opt == 'n') count = (size_t) atol(optarg);
+  else if (opt == 'r') repeats = atoi(optarg);
+  else
+    {
+    fprintf(stderr, "usage: %s [-s filter] [-k stride] [-n values] [-r repeats]\n", argv[0]);
+    return 1;
+    }
+  }
+if (stride < 1) stride = 1;
+if (count < 1) count = 1;
+if (repeats < 1) repeats = 1;
+if (!elle_init_trc_registry ())
+  {
+  fprintf(stderr, "couldn't build the TRC registry\n");
+  return 1;
+  }
+
+values = (cmsFloat32Number*) malloc (count * sizeof(cmsFloat32Number));
+output = (cmsFloat32Number*) malloc (count * sizeof(cmsFloat32Number));
+if (values == NULL || output == NULL) return 1;
+for ( i = 0; i < count; i++ )
+  {
+  state = state * 1664525u + 1013904223u;
+  values[i] = (cmsFloat32Number) ((state >> 8) / 16777215.0);
+  }
+
+/* The kernels of elle_fast_curve are scalar or AVX2 */
+best = elle_simd_best () == ELLE_SIMD_AVX2 ? ELLE_SIMD_AVX2 : ELLE_SIMD_SCALAR;
+printf("every %lu float(s) checked, %lu values timed\n", (unsigned long) stride, 
+       (unsigned long) count);
+printf("%-9s %-12s %-7s %11s %11s %11s %8s\n", "trc", "direction", "kernel", 
+       "16-bit eps", "float eps", "Mvalues/s", "speedup");
+
+for ( trc = 0; trc < ELLE_TRC_COUNT; trc++ )
+  {
+  const elle_trc_definition *definition = elle_trc_definition_of ((elle_trc) trc);
+  elle_fast_curve curve;
+
+  if (filter != NULL && strstr(definition->suffix, filter) == NULL) continue;
+  if (!elle_fast_curve_init (definition, &curve))
+    {
+    printf("%-9s couldn't set up the curve\n", definition->suffix);
+    failures++;
+    continue;
+    }
+
+  for ( to_linear = 1; to_linear >= 0; to_linear-- )
+    {
+    const char *direction = to_linear ? "to-linear" : "from-linear";
+    const cmsToneCurve *lcms_curve = to_linear ? elle_trc_curve ((elle_trc) trc) : 
+                                                 elle_trc_reverse_curve ((elle_trc) trc);
+    double code_errors[ELLE_SIMD_AVX2 + 1], float_errors[ELLE_SIMD_AVX2 + 1];
+    double lcms_rate;
+
+    check_direction (&curve, lcms_curve, to_linear, stride, code_errors, float_errors);
+    lcms_rate = measure_lcms (lcms_curve, values, output, count, repeats);
+    printf("%-9s %-12s %-7s %11s %11s %11.1f %8s\n", definition->suffix, direction, "lcms", 
+           "", "", lcms_rate * 1e-6, "1.00x");
+
+    for ( level = ELLE_SIMD_SCALAR; level <= (int) best; level++ )
+      {
+      double rate, worst;
+      if (level == ELLE_SIMD_SSE2) continue;
+      curve.level = (elle_simd_level) level;
+      rate = measure_kernel (&curve, to_linear, values, output, count, repeats);
+      worst = fmax (code_errors[level], float_errors[level]);
+      printf("%-9s %-12s %-7s %11.2f %11.2f %11.1f %7.2fx%s\n", definition->suffix, 
+             direction, elle_simd_name ((elle_simd_level) level), code_errors[level], 
+             float_errors[level], rate * 1e-6, rate / lcms_rate, 
+             worst > MAX_EPSILONS ? "  FAILED" : "");
+      if (worst > MAX_EPSILONS) failures++;
+      }
+    }
+  }
+
+printf("%d failures\n", failures);
+free (values);
+free (output);
+elle_free_trc_registry ();
+return failures == 0 ? 0 : 1;
+}
+
+
+/* The largest errors of each kernel (indexed by elle_simd_level) over 
+ * the 16-bit code values and over the floats from 0.0 to 1.0. The LCMS 
+ * values are computed once per chunk, for all kernels. */
+static void check_direction (const elle_fast_curve *curve,
+                             const cmsToneCurve    *lcms_curve,
+                             int                   to_linear,
+                             cmsUInt32Number       stride,
+                             double                code_errors[],
+                             double                float_errors[]
+                             )
+{
+cmsFloat32Number values[CHECK_CHUNK];
+cmsUInt32Number bits = 0, one_bits;
+const cmsFloat32Number one = 1.0f;
+size_t i, count;
+
+memcpy (&one_bits, &one, sizeof(one_bits));
+for ( i = 0; i <= ELLE_SIMD_AVX2; i++ ) code_errors[i] = float_errors[i] = 0.0;
+
+for ( i = 0; i < 65536; i++ ) values[i] = (cmsFloat32Number) (i / 65535.0);
+check_values (curve, lcms_curve, to_linear, values, 65536, code_errors);
+
+while (bits <= one_bits)
+  {
+  for ( count = 0; count < CHECK_CHUNK && bits <= one_bits; count++ )
+    {
+    memcpy (&values[count], &bits, sizeof(bits));
+    if (one_bits - bits < stride) bits = one_bits + (bits == one_bits);   /* 1.0 itself last */
+    else bits += stride;
+    }
+  check_values (curve, lcms_curve, to_linear, values, count, float_errors);
+  }
+}
+
+
+static void check_values (const elle_fast_curve  *curve,
+                          const cmsToneCurve     *lcms_curve,
+                          int                    to_linear,
+                          const cmsFloat32Number *values,
+                          size_t                 count,
+                          double                 errors[]
+                          )
+{
+static cmsFloat32Number expected[CHECK_CHUNK], output[CHECK_CHUNK];
+elle_fast_curve kernel = *curve;
+elle_simd_level best = curve->level;
+size_t i;
+int level;
+
+for ( i = 0; i < count; i++ ) expected[i] = cmsEvalToneCurveFloat (lcms_curve, values[i]);
+for ( level = ELLE_SIMD_SCALAR; level <= (int) best; level++ )
+  {
+  if (level == ELLE_SIMD_SSE2) continue;
+  kernel.level = (elle_simd_level) level;
+  evaluate (&kernel, to_linear, values, output, count);
+  for ( i = 0; i < count; i++ )
+    {
+    double error = fabs ((double) output[i] - expected[i]) / 
+                   (FLT_EPSILON * fmax (FLT_MIN, fabs (expected[i])));
+    if (error > errors[level]) errors[level] = error;
+    }
+  }
+}
+
+
+/* Returns values per second */
+static double measure_lcms (const cmsToneCurve     *lcms_curve,
+                            const cmsFloat32Number *values,
+                            cmsFloat32Number       *output,
+                            size_t                 count,
+                            int                    repeats
+                            )
+{
+double seconds, best = 0.0;
+struct timespec start;
+size_t i;
+int r;
+
+for ( r = 0; r < repeats; r++ )
+  {
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  for ( i = 0; i < count; i++ ) output[i] = cmsEvalToneCurveFloat (lcms_curve, values[i]);
+  seconds = elle_elapsed_seconds (start);
+  if (r == 0 || seconds < best) best = seconds;
+  }
+return best > 0.0 ? count / best : 0.0;
+}
+
+
+static double measure_kernel (const elle_fast_curve  *curve,
+                              int                    to_linear,
+                              const cmsFloat32Number *values,
+                              cmsFloat32Number       *output,
+                              size_t                 count,
+                              int                    repeats
+                              )
+{
+double seconds, best = 0.0;
+struct timespec start;
+int r;
+
+for ( r = 0; r < repeats; r++ )
+  {
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  evaluate (curve, to_linear, values, output, count);
+  seconds = elle_elapsed_seconds (start);
+  if (r == 0 || seconds < best) best = seconds;
+  }
+return best > 0.0 ? count / best : 0.0;
+}
+
+
+static void evaluate (const elle_fast_curve  *curve,
+                      int                    to_linear,
+                      const cmsFloat32Number *input,
+                      cmsFloat32Number       *output,
+                      size_t                 count
+                      )
+{
+if (to_linear) elle_fast_curve_to_linear (curve, input, output, count);
+else elle_fast_curve_from_linear (curve, input, output, count);
+}
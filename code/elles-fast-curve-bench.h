@@ -0,0 +1,61 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+static void check_direction (const elle_fast_curve *curve,
+                             const cmsToneCurve    *lcms_curve,
+                             int                   to_linear,
+                             cmsUInt32Number       stride,
+                             double                code_errors[],
+                             double                float_errors[]
+                             );
+
+static void check_values (const elle_fast_curve  *curve,
+                          const cmsToneCurve     *lcms_curve,
+                          int                    to_linear,
+                          const cmsFloat32Number *values,
+                          size_t                 count,
+                          double                 errors[]
+                          );
+
+static double measure_lcms (const cmsToneCurve     *lcms_curve,
+                            const cmsFloat32Number *values,
+                            cmsFloat32Number       *output,
+                            size_t                 count,
+                            int                    repeats
+                            );
+
+static double measure_kernel (const elle_fast_curve  *curve,
+                              int                    to_linear,
+                              const cmsFloat32Number *values,
+                              cmsFloat32Number       *output,
+                              size_t                 count,
+                              int                    repeats
+                              );
+
+static void evaluate (const elle_fast_curve  *curve,
+                      int                    to_linear,
+                      const cmsFloat32Number *input,
+                      cmsFloat32Number       *output,
+                      size_t                 count
+                      );
@@ -0,0 +1,364 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <float.h>
+#include <lcms2.h>
+#include "elles-fast-curve.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ELLE_X86 1
+#include <immintrin.h>
+#endif
+
+/* log2(m) = u * (LOG2_C0 + LOG2_C1 u^2 + ... + LOG2_C4 u^8), 
+ * u = (m - 1) / (m + 1): the series of 2 atanh(u) / ln 2, which for 
+ * m from 0.71 to 1.41 (|u| < 0.172) is off by less than 2 10^-9 */
+#define LOG2_C0  2.8853900817779268
+#define LOG2_C1  0.9617966939259756
+#define LOG2_C2  0.5770780163555853
+#define LOG2_C3  0.4121985831111324
+#define LOG2_C4  0.3205988979753252
+
+/* 2^f = EXP2_C0 + EXP2_C1 f + ... + EXP2_C7 f^7: the Taylor series of
+ * e^(f ln 2), off by less than 6 10^-9 for f from -0.5 to 0.5 */
+#define EXP2_C0  1.0
+#define EXP2_C1  0.6931471805599453
+#define EXP2_C2  0.2402265069591007
+#define EXP2_C3  0.055504108664821576
+#define EXP2_C4  0.009618129107628477
+#define EXP2_C5  0.0013333558146428441
+#define EXP2_C6  0.00015403530393381606
+#define EXP2_C7  1.5252733804059838e-05
+
+static void split (cmsFloat64Number value, cmsFloat32Number parts[2]);
+
+static cmsFloat32Number float_at_or_above (cmsFloat64Number threshold);
+
+static cmsFloat64Number power_scalar (cmsFloat64Number x, cmsFloat64Number exponent);
+
+static void to_linear_scalar (const elle_fast_curve *curve, const cmsFloat32Number *input,
+                              cmsFloat32Number *output, size_t count);
+
+static void from_linear_scalar (const elle_fast_curve *curve, const cmsFloat32Number *input,
+                                cmsFloat32Number *output, size_t count);
+
+#ifdef ELLE_X86
+static void to_linear_avx2 (const elle_fast_curve *curve, const cmsFloat32Number *input,
+                            cmsFloat32Number *output, size_t count);
+
+static void from_linear_avx2 (const elle_fast_curve *curve, const cmsFloat32Number *input,
+                              cmsFloat32Number *output, size_t count);
+#endif
+
+
+cmsBool elle_fast_curve_init (const elle_trc_definition *definition,
+                              elle_fast_curve           *curve
+                              )
+{
+const cmsFloat64Number *p = definition->parameters;
+
+memset (curve, 0, sizeof(elle_fast_curve));
+if (definition->type != 1 && definition->type != 4) return FALSE;
+if (p[0] <= 0.0) return FALSE;
+if (definition->type == 4 && (p[1] <= 0.0 || p[3] <= 0.0)) return FALSE;
+
+curve->type = definition->type;
+curve->identity = definition->type == 1 && p[0] == 1.0;
+memcpy (curve->parameters, p, sizeof(curve->parameters));
+split (p[0], curve->gamma);
+split (1.0 / p[0], curve->inverse_gamma);
+if (definition->type == 4)
+  {
+  /* as LCMS's type -4 curve */
+  cmsFloat64Number e = p[1] * p[4] + p[2];
+  curve->inverse_threshold = e < 0.0 ? 0.0 : pow (e, p[0]);
+  curve->a = (cmsFloat32Number) p[1];
+  curve->b = (cmsFloat32Number) p[2];
+  curve->c = (cmsFloat32Number) p[3];
+  curve->inverse_a = (cmsFloat32Number) (1.0 / p[1]);
+  curve->inverse_c = (cmsFloat32Number) (1.0 / p[3]);
+  curve->break_point = float_at_or_above (p[4]);
+  curve->inverse_break_point = float_at_or_above (curve->inverse_threshold);
+  }
+/* SSE2 has no FMA or rounding instruction, so without AVX2 the plain
+ * C kernels are used */
+curve->level = elle_simd_best () == ELLE_SIMD_AVX2 ? ELLE_SIMD_AVX2 : ELLE_SIMD_SCALAR;
+return TRUE;
+}
+
+
+void elle_fast_curve_to_linear (const elle_fast_curve  *curve,
+                                const cmsFloat32Number *input,
+                                cmsFloat32Number       *output,
+                                size_t                 count
+                                )
+{
+if (curve->identity)
+  {
+  if (output != input) memmove (output, input, count * sizeof(cmsFloat32Number));
+  return;
+  }
+#ifdef ELLE_X86
+if (curve->level == ELLE_SIMD_AVX2)
+  {
+  to_linear_avx2 (curve, input, output, count);
+  return;
+  }
+#endif
+to_linear_scalar (curve, input, output, count);
+}
+
+
+void elle_fast_curve_from_linear (const elle_fast_curve  *curve,
+                                  const cmsFloat32Number *input,
+                                  cmsFloat32Number       *output,
+                                  size_t                 count
+                                  )
+{
+if (curve->identity)
+  {
+  if (output != input) memmove (output, input, count * sizeof(cmsFloat32Number));
+  return;
+  }
+#ifdef ELLE_X86
+if (curve->level == ELLE_SIMD_AVX2)
+  {
+  from_linear_avx2 (curve, input, output, count);
+  return;
+  }
+#endif
+from_linear_scalar (curve, input, output, count);
+}
+
+
+/* value as a float plus the float it's off by */
+static void split (cmsFloat64Number value, cmsFloat32Number parts[2])
+{
+parts[0] = (cmsFloat32Number) value;
+parts[1] = (cmsFloat32Number) (value - parts[0]);
+}
+
+
+/* The smallest float at or above threshold, so that comparing a float
+ * with it gives what LCMS gets comparing in double */
+static cmsFloat32Number float_at_or_above (cmsFloat64Number threshold)
+{
+cmsFloat32Number value = (cmsFloat32Number) threshold;
+if (value < threshold) value = nextafterf (value, FLT_MAX);
+return value;
+}
+
+
+/* ***************************** KERNELS ***************************** */
+
+/* x^exponent for x > 0, and 0 for x <= 0; infinity and NaN are 
+ * returned as they are, as pow does. The same reduction as the AVX2 
+ * kernels, in double, so the plain C kernels only have the float 
+ * rounding of their result. */
+static cmsFloat64Number power_scalar (cmsFloat64Number x, cmsFloat64Number exponent)
+{
+cmsUInt64Number bits;
+cmsFloat64Number m, u, u2, y, n, f, p, scale;
+int k;
+
+if (!(x <= DBL_MAX)) return x;
+if (!(x > 0.0)) return 0.0;
+memcpy (&bits, &x, sizeof(bits));
+k = (int) (bits >> 52) - 1023;
+bits = (bits & 0x000FFFFFFFFFFFFFull) | 0x3FF0000000000000ull;
+memcpy (&m, &bits, sizeof(m));
+if (m > M_SQRT2)
+  {
+  m *= 0.5;
+  k++;
+  }
+u = (m - 1.0) / (m + 1.0);
+u2 = u * u;
+y = exponent * (k + u * (LOG2_C0 + u2 * (LOG2_C1 + u2 * (LOG2_C2 + u2 * (LOG2_C3 + 
+                         u2 * LOG2_C4)))));
+/* x is at most FLT_MAX (or a type 4 curve's a FLT_MAX + b), so 2^n 
+ * is well inside the range of a double */
+n = (cmsFloat64Number) (long) (y >= 0.0 ? y + 0.5 : y - 0.5);
+f = y - n;
+p = EXP2_C0 + f * (EXP2_C1 + f * (EXP2_C2 + f * (EXP2_C3 + f * (EXP2_C4 + 
+                   f * (EXP2_C5 + f * (EXP2_C6 + f * EXP2_C7))))));
+bits = (cmsUInt64Number) ((long) n + 1023) << 52;
+memcpy (&scale, &bits, sizeof(scale));
+return p * scale;
+}
+
+
+static void to_linear_scalar (const elle_fast_curve *curve, const cmsFloat32Number *input,
+                              cmsFloat32Number *output, size_t count)
+{
+const cmsFloat64Number *p = curve->parameters;
+size_t i;
+
+for ( i = 0; i < count; i++ )
+  {
+  cmsFloat64Number x = input[i];
+  if (curve->type == 1) output[i] = (cmsFloat32Number) power_scalar (x, p[0]);
+  else if (x >= p[4]) output[i] = (cmsFloat32Number) power_scalar (p[1] * x + p[2], p[0]);
+  else output[i] = (cmsFloat32Number) (x * p[3]);
+  }
+}
+
+
+static void from_linear_scalar (const elle_fast_curve *curve, const cmsFloat32Number *input,
+                                cmsFloat32Number *output, size_t count)
+{
+const cmsFloat64Number *p = curve->parameters;
+cmsFloat64Number inverse_gamma = 1.0 / p[0];
+size_t i;
+
+for ( i = 0; i < count; i++ )
+  {
+  cmsFloat64Number x = input[i];
+  if (curve->type == 1) output[i] = (cmsFloat32Number) power_scalar (x, inverse_gamma);
+  else if (x >= curve->inverse_threshold) 
+    output[i] = (cmsFloat32Number) ((power_scalar (x, inverse_gamma) - p[2]) / p[1]);
+  else output[i] = (cmsFloat32Number) (x / p[3]);
+  }
+}
+
+
+#ifdef ELLE_X86
+
+/* x^exponent for eight floats, 0 where x <= 0, infinity and NaN 
+ * where x is; exponent is
+ * split into a float and the float it's off by. The product of the
+ * exponent and the input's exponent k carries its rounding error, so
+ * the fraction f the 2^f polynomial sees is right to float precision
+ * even when the integer part is large. The result is scaled by 2^n in
+ * two steps, so it overflows to infinity and underflows to denormals
+ * the way a float multiplication would. */
+__attribute__((target("avx2,fma")))
+static inline __m256 power_avx2 (__m256 x, __m256 exponent, __m256 exponent_error)
+{
+__m256 positive = _mm256_cmp_ps (x, _mm256_setzero_ps (), _CMP_GT_OQ);
+__m256 tiny = _mm256_cmp_ps (x, _mm256_set1_ps (FLT_MIN), _CMP_LT_OQ);
+__m256 m, big, u, u2, log_m, kf, high, low, n, f, p;
+__m256i bits, k, ni, half;
+
+/* denormals are scaled up by 2^24 first */
+x = _mm256_blendv_ps (x, _mm256_mul_ps (x, _mm256_set1_ps (16777216.0f)), tiny);
+bits = _mm256_castps_si256 (x);
+k = _mm256_sub_epi32 (_mm256_srli_epi32 (bits, 23), _mm256_set1_epi32 (127));
+k = _mm256_add_epi32 (k, _mm256_and_si256 (_mm256_castps_si256 (tiny), _mm256_set1_epi32 (-24)));
+m = _mm256_castsi256_ps (_mm256_or_si256 (_mm256_and_si256 (bits, _mm256_set1_epi32 (0x007FFFFF)),
+                                          _mm256_set1_epi32 (0x3F800000)));
+big = _mm256_cmp_ps (m, _mm256_set1_ps ((float) M_SQRT2), _CMP_GT_OQ);
+m = _mm256_blendv_ps (m, _mm256_mul_ps (m, _mm256_set1_ps (0.5f)), big);
+k = _mm256_sub_epi32 (k, _mm256_castps_si256 (big));     /* big lanes are -1 */
+
+u = _mm256_div_ps (_mm256_sub_ps (m, _mm256_set1_ps (1.0f)), _mm256_add_ps (m, _mm256_set1_ps (1.0f)));
+u2 = _mm256_mul_ps (u, u);
+log_m = _mm256_fmadd_ps (u2, _mm256_set1_ps ((float) LOG2_C4), _mm256_set1_ps ((float) LOG2_C3));
+log_m = _mm256_fmadd_ps (u2, log_m, _mm256_set1_ps ((float) LOG2_C2));
+log_m = _mm256_fmadd_ps (u2, log_m, _mm256_set1_ps ((float) LOG2_C1));
+log_m = _mm256_fmadd_ps (u2, log_m, _mm256_set1_ps ((float) LOG2_C0));
+log_m = _mm256_mul_ps (u, log_m);
+
+/* exponent * k = high + low exactly, give or take exponent_error's rounding */
+kf = _mm256_cvtepi32_ps (k);
+high = _mm256_mul_ps (exponent, kf);
+low = _mm256_fmadd_ps (exponent_error, kf, _mm256_fmsub_ps (exponent, kf, high));
+n = _mm256_round_ps (_mm256_fmadd_ps (exponent, log_m, high), 
+                     _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+f = _mm256_add_ps (_mm256_sub_ps (high, n), _mm256_fmadd_ps (exponent, log_m, low));
+
+p = _mm256_fmadd_ps (f, _mm256_set1_ps ((float) EXP2_C7), _mm256_set1_ps ((float) EXP2_C6));
+p = _mm256_fmadd_ps (f, p, _mm256_set1_ps ((float) EXP2_C5));
+p = _mm256_fmadd_ps (f, p, _mm256_set1_ps ((float) EXP2_C4));
+p = _mm256_fmadd_ps (f, p, _mm256_set1_ps ((float) EXP2_C3));
+p = _mm256_fmadd_ps (f, p, _mm256_set1_ps ((float) EXP2_C2));
+p = _mm256_fmadd_ps (f, p, _mm256_set1_ps ((float) EXP2_C1));
+p = _mm256_fmadd_ps (f, p, _mm256_set1_ps ((float) EXP2_C0));
+
+/* 2^n as 2^half * 2^(n - half), each a normal float */
+ni = _mm256_cvtps_epi32 (n);
+ni = _mm256_min_epi32 (_mm256_max_epi32 (ni, _mm256_set1_epi32 (-252)), _mm256_set1_epi32 (254));
+half = _mm256_srai_epi32 (ni, 1);
+p = _mm256_mul_ps (p, _mm256_castsi256_ps (_mm256_slli_epi32 (
+                        _mm256_add_epi32 (half, _mm256_set1_epi32 (127)), 23)));
+p = _mm256_mul_ps (p, _mm256_castsi256_ps (_mm256_slli_epi32 (
+                        _mm256_add_epi32 (_mm256_sub_epi32 (ni, half), _mm256_set1_epi32 (127)), 23)));
+p = _mm256_and_ps (p, positive);
+return _mm256_blendv_ps (p, x, _mm256_cmp_ps (x, _mm256_set1_ps (FLT_MAX), _CMP_NLE_UQ));
+}
+
+
+__attribute__((target("avx2,fma")))
+static void to_linear_avx2 (const elle_fast_curve *curve, const cmsFloat32Number *input,
+                            cmsFloat32Number *output, size_t count)
+{
+__m256 gamma = _mm256_set1_ps (curve->gamma[0]), gamma_error = _mm256_set1_ps (curve->gamma[1]);
+__m256 a = _mm256_set1_ps (curve->a), b = _mm256_set1_ps (curve->b);
+__m256 c = _mm256_set1_ps (curve->c), break_point = _mm256_set1_ps (curve->break_point);
+size_t i;
+
+for ( i = 0; i + 8 <= count; i += 8 )
+  {
+  __m256 x = _mm256_loadu_ps (input + i);
+  if (curve->type == 1) 
+    _mm256_storeu_ps (output + i, power_avx2 (x, gamma, gamma_error));
+  else
+    _mm256_storeu_ps (output + i, _mm256_blendv_ps (_mm256_mul_ps (x, c), 
+                        power_avx2 (_mm256_fmadd_ps (a, x, b), gamma, gamma_error),
+                        _mm256_cmp_ps (x, break_point, _CMP_GE_OQ)));
+  }
+to_linear_scalar (curve, input + i, output + i, count - i);
+}
+
+
+__attribute__((target("avx2,fma")))
+static void from_linear_avx2 (const elle_fast_curve *curve, const cmsFloat32Number *input,
+                              cmsFloat32Number *output, size_t count)
+{
+__m256 gamma = _mm256_set1_ps (curve->inverse_gamma[0]);
+__m256 gamma_error = _mm256_set1_ps (curve->inverse_gamma[1]);
+__m256 b = _mm256_set1_ps (curve->b), inverse_a = _mm256_set1_ps (curve->inverse_a);
+__m256 inverse_c = _mm256_set1_ps (curve->inverse_c);
+__m256 break_point = _mm256_set1_ps (curve->inverse_break_point);
+size_t i;
+
+for ( i = 0; i + 8 <= count; i += 8 )
+  {
+  __m256 x = _mm256_loadu_ps (input + i);
+  if (curve->type == 1) 
+    _mm256_storeu_ps (output + i, power_avx2 (x, gamma, gamma_error));
+  else
+    _mm256_storeu_ps (output + i, _mm256_blendv_ps (_mm256_mul_ps (x, inverse_c), 
+                        _mm256_mul_ps (_mm256_sub_ps (power_avx2 (x, gamma, gamma_error), b), 
+                                       inverse_a),
+                        _mm256_cmp_ps (x, break_point, _CMP_GE_OQ)));
+  }
+from_linear_scalar (curve, input + i, output + i, count - i);
+}
+
+#endif
@@ -0,0 +1,96 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+/* Fast batch evaluation of the TRCs.
+ *
+ * An elle_fast_curve is set up from the same elle_trc_definition as 
+ * the LCMS curves of elles-trc.c, and evaluates the curve (encoded to
+ * linear) or its inverse (linear to encoded) on arrays of floats, 
+ * with AVX2 and FMA when the CPU has them and plain C otherwise.
+ *
+ * The powers are computed with range reduction instead of pow: the 
+ * input's exponent is split off, log2 of the mantissa (reduced to 
+ * 0.71 to 1.41) is a degree 9 odd polynomial in (m - 1) / (m + 1),
+ * the product with the gamma carries its rounding error so that its
+ * fractional part f (-0.5 to 0.5) is right to float precision, and 
+ * 2^f is a degree 7 polynomial. Both polynomials are accurate to 
+ * better than 10^-8; what's left is float rounding.
+ *
+ * Maximum error, against cmsEvalToneCurveFloat on the curves of 
+ * elles-trc.c, over every 16-bit code value and every float from 0.0
+ * to 1.0: 4 float epsilons relative to the LCMS value (or to FLT_MIN,
+ * for smaller values), for both directions of all six TRCs. The plain
+ * C kernels, which work in double, are within 1. 
+ * elles-fast-curve-bench.c checks that.
+ *
+ * The results follow LCMS outside 0.0 to 1.0 as well: the type 4 
+ * curves are linear below their break point, and the pure gammas give
+ * 0.0 for negative values (gamma 1.0 leaves every value as it is).
+ *
+ * */
+
+#ifndef ELLES_FAST_CURVE_H
+#define ELLES_FAST_CURVE_H
+
+#include <stddef.h>
+#include <lcms2.h>
+#include "elles-trc.h"
+#include "elles-linear.h"
+
+typedef struct {
+  cmsInt32Number    type;               /* 1 or 4, as in the definition */
+  cmsBool           identity;           /* gamma 1.0 */
+  cmsFloat32Number  gamma[2];           /* the gamma as a float, and what that float is off by */
+  cmsFloat32Number  inverse_gamma[2];
+  cmsFloat32Number  a, b, c;            /* type 4 parameters */
+  cmsFloat32Number  inverse_a, inverse_c;
+  cmsFloat32Number  break_point;        /* smallest float LCMS puts on the power segment */
+  cmsFloat32Number  inverse_break_point;  
+  cmsFloat64Number  parameters[5];      /* the definition's, for the plain C kernels */
+  cmsFloat64Number  inverse_threshold;  /* where LCMS's inverse switches segments */
+  elle_simd_level   level;              /* ELLE_SIMD_AVX2 or ELLE_SIMD_SCALAR, set by init */
+} elle_fast_curve;
+
+/* FALSE unless definition is a type 1 or type 4 curve */
+cmsBool elle_fast_curve_init (const elle_trc_definition *definition,
+                              elle_fast_curve           *curve
+                              );
+
+/* Encoded to linear, as cmsEvalToneCurveFloat on elle_trc_curve; 
+ * output may be input */
+void elle_fast_curve_to_linear (const elle_fast_curve  *curve,
+                                const cmsFloat32Number *input,
+                                cmsFloat32Number       *output,
+                                size_t                 count
+                                );
+
+/* Linear to encoded, as cmsEvalToneCurveFloat on 
+ * elle_trc_reverse_curve; output may be input */
+void elle_fast_curve_from_linear (const elle_fast_curve  *curve,
+                                  const cmsFloat32Number *input,
+                                  cmsFloat32Number       *output,
+                                  size_t                 count
+                                  );
+
+#endif
@@ -0,0 +1,322 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+/* Compares the transform plugin of elles-fast-transform.c with stock
+ * LCMS.
+ *
+ * For every RGB profile in the profiles folder, converts a synthetic
+ * image of random code values to the destination profile, 8 bits to
+ * 8 bits and 16 bits to 16 bits, relative colorimetric, with a stock
+ * LCMS transform and with one made in a context that has the plugin.
+ * Both are compared with LCMS's float transform of the same image,
+ * clipped to 0.0 to 1.0 and scaled to code values. A perfectly rounded
+ * conversion would be off by at most 0.5; more than MAX_CODE_ERROR for
+ * the plugin is a failure, and the program then exits with 1.
+ *
+ * Pairs the plugin doesn't recognize (the V2 profiles with sampled
+ * TRCs, for example) are listed as left to LCMS. The speeds are the
+ * fastest of the repeats; "setup" is the time cmsCreateTransform took,
+ * which for the plugin includes filling its tables.
+ *
+ * Sample command line to compile this code:
+ *
+ * gcc -g -O2 -Wall -o elles-fast-transform-bench.exe elles-fast-transform-bench.c elles-fast-transform.c elles-linear.c elles-bench-util.c -llcms2 -lm
+ *
+ * Command line options:
+ * -d dir   profiles folder (default: ../profiles/)
+ * -t name  destination profile in that folder 
+ *          (default: sRGB-elle-V4-srgbtrc.icc)
+ * -s text  only sources whose name contains text, e.g. "-V4-"
+ * -n N     pixels in the synthetic image (default: 1048576)
+ * -r N     convert the image N times and keep the fastest (default: 3)
+ * -S       use the plugin's plain C kernel even if the CPU has AVX2
+ *
+ * */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <lcms2.h>
+#include "elles-linear.h"
+#include "elles-fast-transform.h"
+#include "elles-bench-util.h"
+#include "elles-fast-transform-bench.h"
+
+#define MAX_CODE_ERROR 0.6
+
+int main (int argc, char *argv[])
+{
+char *directory = "../profiles/";
+char *destination_name = "sRGB-elle-V4-srgbtrc.icc";
+char *source_filter = NULL;
+size_t pixels = 1048576;
+int repeats = 3, failures = 0, sources = 0, scalar = 0, opt;
+cmsContext fast_context;
+cmsHPROFILE destination, fast_destination;
+cmsUInt16Number *codes, *output;
+cmsFloat32Number *reference;
+DIR *folder;
+struct dirent *entry;
+
+while ((opt = getopt(argc, argv, "d:t:s:n:r:S")) != -1)
+  {
+  if (opt == 'd') directory = optarg;
+  else if (opt == 't') destination_name = optarg;
+  else if (opt == 's') source_filter = optarg;
+  else if (opt == 'n') pixels = (size_t) atol(optarg);
+  else if (opt == 'r') repeats = atoi(optarg);
+  else if (opt == 'S') scalar = 1;
+  else
+    {
+    fprintf(stderr, "usage: %s [-d folder] [-t destination] [-s filter] "
+                    "[-n pixels] [-r repeats] [-S]\n", argv[0]);
+    return 1;
+    }
+  }
+if (pixels < 1) pixels = 1;
+if (pixels > 0xFFFFFFFFu) pixels = 0xFFFFFFFFu;   /* cmsDoTransform's limit */
+if (repeats < 1) repeats = 1;
+if (scalar) elle_fast_transform_limit (ELLE_SIMD_SCALAR);
+
+/* Stock LCMS in the global context, the plugin in its own */
+fast_context = cmsCreateContext (elle_fast_transform_plugin (), NULL);
+if (fast_context == NULL)
+  {
+  fprintf(stderr, "couldn't register the plugin (LCMS 2.8 or later is needed)\n");
+  return 1;
+  }
+destination = elle_open_profile (NULL, directory, destination_name);
+fast_destination = elle_open_profile (fast_context, directory, destination_name);
+if (destination == NULL || fast_destination == NULL) return 1;
+folder = opendir (directory);
+if (folder == NULL)
+  {
+  fprintf(stderr, "couldn't read the folder %s\n", directory);
+  return 1;
+  }
+
+/* Room for 16-bit pixels; the 8-bit images use the first half */
+codes = (cmsUInt16Number*) malloc (3 * pixels * sizeof(cmsUInt16Number));
+output = (cmsUInt16Number*) malloc (3 * pixels * sizeof(cmsUInt16Number));
+reference = (cmsFloat32Number*) malloc (3 * pixels * sizeof(cmsFloat32Number));
+if (codes == NULL || output == NULL || reference == NULL) return 1;
+
+/* The plugin has no SSE2 kernel */
+printf("to %s, %lu pixels, plugin kernel: %s\n", destination_name, (unsigned long) pixels, 
+       !scalar && elle_simd_best () == ELLE_SIMD_AVX2 ? "avx2" : "scalar");
+printf("%-36s %4s %-6s %9s %9s %10s %8s %9s\n", "source", "bits", "path", "max error", 
+       "mean", "Mpixels/s", "speedup", "setup ms");
+
+while ((entry = readdir (folder)) != NULL)
+  {
+  const char *name = entry->d_name;
+  size_t length = strlen(name);
+  cmsHPROFILE source, fast_source;
+  int bits;
+
+  if (length < 4 || strcmp(name + length - 4, ".icc") != 0) continue;
+  if (strcmp(name, destination_name) == 0) continue;
+  if (source_filter != NULL && strstr(name, source_filter) == NULL) continue;
+  source = elle_open_profile (NULL, directory, name);
+  if (source == NULL) 
+    {
+    failures++;
+    continue;
+    }
+  if (cmsGetColorSpace (source) != cmsSigRgbData)
+    {
+    cmsCloseProfile (source);
+    continue;
+    }
+  fast_source = elle_open_profile (fast_context, directory, name);
+  if (fast_source == NULL)
+    {
+    cmsCloseProfile (source);
+    failures++;
+    continue;
+    }
+  sources++;
+
+  for ( bits = 8; bits <= 16; bits += 8 )
+    {
+    cmsUInt32Number format = bits == 8 ? TYPE_RGB_8 : TYPE_RGB_16;
+    cmsHTRANSFORM stock, fast;
+    struct timespec start;
+    double stock_setup, fast_setup, stock_rate, fast_rate, max_error, mean_error;
+
+    fill_codes (codes, bits, pixels);
+    if (!float_reference (source, destination, bits, codes, reference, pixels))
+      {
+      printf("%-36s %4d couldn't make the float transform\n", name, bits);
+      failures++;
+      continue;
+      }
+
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    stock = cmsCreateTransform (source, format, destination, format, 
+                                INTENT_RELATIVE_COLORIMETRIC, 0);
+    stock_setup = elle_elapsed_seconds (start);
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    fast = cmsCreateTransformTHR (fast_context, fast_source, format, fast_destination, 
+                                  format, INTENT_RELATIVE_COLORIMETRIC, 0);
+    fast_setup = elle_elapsed_seconds (start);
+    if (stock == NULL || fast == NULL)
+      {
+      printf("%-36s %4d couldn't make the transforms\n", name, bits);
+      if (stock != NULL) cmsDeleteTransform (stock);
+      if (fast != NULL) cmsDeleteTransform (fast);
+      failures++;
+      continue;
+      }
+
+    stock_rate = measure_transform (stock, codes, output, pixels, repeats);
+    code_error (output, bits, reference, pixels, &max_error, &mean_error);
+    printf("%-36s %4d %-6s %9.3f %9.3f %10.1f %8s %9.2f\n", name, bits, "lcms", 
+           max_error, mean_error, stock_rate * 1e-6, "1.00x", stock_setup * 1e3);
+
+    if (!elle_is_fast_transform (fast))
+      printf("%-36s %4d %-6s not recognized, left to LCMS\n", name, bits, "plugin");
+    else
+      {
+      fast_rate = measure_transform (fast, codes, output, pixels, repeats);
+      code_error (output, bits, reference, pixels, &max_error, &mean_error);
+      printf("%-36s %4d %-6s %9.3f %9.3f %10.1f %7.2fx %9.2f%s\n", name, bits, "plugin", 
+             max_error, mean_error, fast_rate * 1e-6, fast_rate / stock_rate, 
+             fast_setup * 1e3, max_error > MAX_CODE_ERROR ? "  FAILED" : "");
+      if (max_error > MAX_CODE_ERROR) failures++;
+      }
+    cmsDeleteTransform (stock);
+    cmsDeleteTransform (fast);
+    }
+  cmsCloseProfile (source);
+  cmsCloseProfile (fast_source);
+  }
+closedir (folder);
+
+printf("%d sources checked, %d failures\n", sources, failures);
+free (codes);
+free (output);
+free (reference);
+cmsCloseProfile (destination);
+cmsCloseProfile (fast_destination);
+cmsDeleteContext (fast_context);
+return failures == 0 ? 0 : 1;
+}
+
+
+/* Interleaved random code values, the same for every source */
+static void fill_codes (void *codes, int bits, size_t pixels)
+{
+cmsUInt32Number state = 12345;
+size_t i;
+
+for ( i = 0; i < 3 * pixels; i++ )
+  {
+  state = state * 1664525u + 1013904223u;
+  if (bits == 8) ((cmsUInt8Number*) codes)[i] = (cmsUInt8Number) (state >> 24);
+  else ((cmsUInt16Number*) codes)[i] = (cmsUInt16Number) (state >> 16);
+  }
+}
+
+
+/* The float transform of codes, clipped and scaled to code values */
+static cmsBool float_reference (cmsHPROFILE       source,
+                                cmsHPROFILE       destination,
+                                int               bits,
+                                const void        *codes,
+                                cmsFloat32Number  *reference,
+                                size_t            pixels
+                                )
+{
+cmsFloat32Number scale = bits == 8 ? 255.0f : 65535.0f;
+cmsHTRANSFORM transform = cmsCreateTransform (source, TYPE_RGB_FLT, destination, TYPE_RGB_FLT, 
+                                              INTENT_RELATIVE_COLORIMETRIC, 0);
+size_t i;
+
+if (transform == NULL) return FALSE;
+for ( i = 0; i < 3 * pixels; i++ )
+  reference[i] = (bits == 8 ? ((const cmsUInt8Number*) codes)[i] : 
+                              ((const cmsUInt16Number*) codes)[i]) / scale;
+cmsDoTransform (transform, reference, reference, (cmsUInt32Number) pixels);
+cmsDeleteTransform (transform);
+for ( i = 0; i < 3 * pixels; i++ )
+  {
+  if (reference[i] < 0.0f) reference[i] = 0.0f;
+  if (reference[i] > 1.0f) reference[i] = 1.0f;
+  reference[i] *= scale;
+  }
+return TRUE;
+}
+
+
+/* Returns pixels per second */
+static double measure_transform (cmsHTRANSFORM transform,
+                                 const void    *codes,
+                                 void          *output,
+                                 size_t        pixels,
+                                 int           repeats
+                                 )
+{
+double seconds, best = 0.0;
+struct timespec start;
+int r;
+
+for ( r = 0; r < repeats; r++ )
+  {
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  cmsDoTransform (transform, codes, output, (cmsUInt32Number) pixels);
+  seconds = elle_elapsed_seconds (start);
+  if (r == 0 || seconds < best) best = seconds;
+  }
+return best > 0.0 ? pixels / best : 0.0;
+}
+
+
+/* In code values */
+static void code_error (const void             *output,
+                        int                    bits,
+                        const cmsFloat32Number *reference,
+                        size_t                 pixels,
+                        double                 *max_error,
+                        double                 *mean_error
+                        )
+{
+double sum = 0.0;
+size_t i;
+
+*max_error = 0.0;
+for ( i = 0; i < 3 * pixels; i++ )
+  {
+  double value = bits == 8 ? ((const cmsUInt8Number*) output)[i] : 
+                             ((const cmsUInt16Number*) output)[i];
+  double error = fabs (value - reference[i]);
+  if (error > *max_error) *max_error = error;
+  sum += error;
+  }
+*mean_error = sum / (3.0 * pixels);
+}
@@ -0,0 +1,48 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+static void fill_codes (void *codes, int bits, size_t pixels);
+
+static cmsBool float_reference (cmsHPROFILE       source,
+                                cmsHPROFILE       destination,
+                                int               bits,
+                                const void        *codes,
+                                cmsFloat32Number  *reference,
+                                size_t            pixels
+                                );
+
+static double measure_transform (cmsHTRANSFORM transform,
+                                 const void    *codes,
+                                 void          *output,
+                                 size_t        pixels,
+                                 int           repeats
+                                 );
+
+static void code_error (const void             *output,
+                        int                    bits,
+                        const cmsFloat32Number *reference,
+                        size_t                 pixels,
+                        double                 *max_error,
+                        double                 *mean_error
+                        );
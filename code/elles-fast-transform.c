@@ -0,0 +1,551 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <lcms2.h>
+#include <lcms2_plugin.h>
+#include "elles-fast-transform.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ELLE_X86 1
+#include <immintrin.h>
+#endif
+
+/* The encoding tables are indexed by the bits of the clamped linear
+ * float: its exponent and top ENCODE_MANTISSA_BITS mantissa bits pick
+ * a node, and the other ENCODE_FRACTION_BITS interpolate to the next
+ * one. So the nodes are 1/256 of an octave apart, from ENCODE_FLOOR 
+ * (2^-40, which every Elle TRC encodes to less than a quarter of a 
+ * 16-bit code value) up to 1.0, and the linear interpolation between
+ * them is off by less than 0.03 of a 16-bit code value. */
+#define ENCODE_MANTISSA_BITS   8
+#define ENCODE_FRACTION_BITS   (23 - ENCODE_MANTISSA_BITS)
+#define ENCODE_OCTAVES         40
+#define ENCODE_FLOOR_BITS      ((cmsUInt32Number) (127 - ENCODE_OCTAVES) << 23)
+/* one more node than 2^-40 to 1.0 needs, so 1.0 has a next node too */
+#define ENCODE_NODES           ((ENCODE_OCTAVES << ENCODE_MANTISSA_BITS) + 2)
+
+#define FAST_TRANSFORM_MAGIC   0x456C6C65   /* "Elle" */
+
+typedef struct {
+  cmsUInt32Number          magic;
+  elle_simd_level          level;             /* ELLE_SIMD_AVX2 or ELLE_SIMD_SCALAR */
+  int                      input_bytes;       /* 1 or 2 */
+  int                      output_bytes;
+  cmsFloat32Number         matrix[9];         /* row-major, the pipeline's matrices joined */
+  cmsFloat32Number         offset[3];
+  const cmsFloat32Number * linearize[3];      /* input code value to linear */
+  const cmsFloat32Number * encode[3];         /* ENCODE_NODES output code values */
+  cmsFloat32Number         tables[];
+} fast_transform;
+
+static elle_simd_level level_limit = ELLE_SIMD_AVX2;
+
+static cmsBool fast_transform_factory (_cmsTransform2Fn    *xform,
+                                       void                **UserData,
+                                       _cmsFreeUserDataFn  *FreePrivateDataFn,
+                                       cmsPipeline         **Lut,
+                                       cmsUInt32Number     *InputFormat,
+                                       cmsUInt32Number     *OutputFormat,
+                                       cmsUInt32Number     *dwFlags
+                                       );
+
+static void fast_transform_lines (struct _cmstransform_struct *CMMcargo,
+                                  const void                  *InputBuffer,
+                                  void                        *OutputBuffer,
+                                  cmsUInt32Number             PixelsPerLine,
+                                  cmsUInt32Number             LineCount,
+                                  const cmsStride             *Stride
+                                  );
+
+static void free_fast_transform (cmsContext ContextID, void *Data);
+
+static cmsBool plain_rgb_format (cmsUInt32Number format);
+
+static cmsBool read_pipeline (const cmsPipeline *lut,
+                              cmsToneCurve      *input_curves[3],
+                              cmsFloat64Number  matrix[9],
+                              cmsFloat64Number  offset[3],
+                              cmsToneCurve      *output_curves[3]
+                              );
+
+static cmsBool elle_curve (const cmsToneCurve *curve);
+
+static cmsBool same_curve (const cmsToneCurve *a, const cmsToneCurve *b);
+
+static void fill_encode_table (const cmsToneCurve *curve, cmsFloat32Number *table, 
+                               cmsFloat32Number scale);
+
+static void convert_scalar (const fast_transform *t, const cmsUInt8Number *input,
+                            cmsUInt8Number *output, size_t pixels);
+
+#ifdef ELLE_X86
+static void convert_avx2 (const fast_transform *t, const cmsUInt8Number *input,
+                          cmsUInt8Number *output, size_t pixels);
+#endif
+
+static cmsPluginTransform fast_transform_plugin = {
+  { cmsPluginMagicNumber, 2080, cmsPluginTransformSig, NULL },
+  { .xform = fast_transform_factory }
+};
+
+
+void* elle_fast_transform_plugin (void)
+{
+return &fast_transform_plugin;
+}
+
+
+cmsBool elle_is_fast_transform (cmsHTRANSFORM transform)
+{
+const fast_transform *t = (const fast_transform*) 
+  _cmsGetTransformUserData ((struct _cmstransform_struct*) transform);
+return t != NULL && t->magic == FAST_TRANSFORM_MAGIC;
+}
+
+
+void elle_fast_transform_limit (elle_simd_level level)
+{
+level_limit = level;
+}
+
+
+static cmsBool fast_transform_factory (_cmsTransform2Fn    *xform,
+                                       void                **UserData,
+                                       _cmsFreeUserDataFn  *FreePrivateDataFn,
+                                       cmsPipeline         **Lut,
+                                       cmsUInt32Number     *InputFormat,
+                                       cmsUInt32Number     *OutputFormat,
+                                       cmsUInt32Number     *dwFlags
+                                       )
+{
+cmsContext ContextID = cmsGetPipelineContextID (*Lut);
+cmsToneCurve *input_curves[3], *output_curves[3];
+cmsFloat64Number matrix[9], offset[3];
+int input_entries, input_tables, output_tables, c, i;
+cmsFloat32Number output_scale, *table;
+fast_transform *t;
+
+if (*dwFlags & (cmsFLAGS_NOOPTIMIZE | cmsFLAGS_NULLTRANSFORM | 
+                cmsFLAGS_GAMUTCHECK | cmsFLAGS_SOFTPROOFING)) return FALSE;
+if (!plain_rgb_format (*InputFormat) || !plain_rgb_format (*OutputFormat)) return FALSE;
+if (!read_pipeline (*Lut, input_curves, matrix, offset, output_curves)) return FALSE;
+
+/* Elle profiles have the same TRC for R, G and B, so usually one 
+ * table of each kind does for all three channels */
+input_entries = T_BYTES(*InputFormat) == 1 ? 256 : 65536;
+input_tables = same_curve (input_curves[0], input_curves[1]) && 
+               same_curve (input_curves[0], input_curves[2]) ? 1 : 3;
+output_tables = same_curve (output_curves[0], output_curves[1]) && 
+                same_curve (output_curves[0], output_curves[2]) ? 1 : 3;
+t = (fast_transform*) _cmsMalloc (ContextID, sizeof(fast_transform) + 
+      (input_tables * input_entries + output_tables * ENCODE_NODES) * sizeof(cmsFloat32Number));
+if (t == NULL) return FALSE;
+
+t->magic = FAST_TRANSFORM_MAGIC;
+/* SSE2 has no gathers, so without AVX2 the plain C kernel is used */
+t->level = elle_simd_best () == ELLE_SIMD_AVX2 && level_limit == ELLE_SIMD_AVX2 ? 
+           ELLE_SIMD_AVX2 : ELLE_SIMD_SCALAR;
+t->input_bytes = T_BYTES(*InputFormat);
+t->output_bytes = T_BYTES(*OutputFormat);
+for ( i = 0; i < 9; i++ ) t->matrix[i] = (cmsFloat32Number) matrix[i];
+for ( i = 0; i < 3; i++ ) t->offset[i] = (cmsFloat32Number) offset[i];
+
+output_scale = t->output_bytes == 1 ? 255.0f : 65535.0f;
+table = t->tables;
+for ( c = 0; c < 3; c++ )
+  {
+  if (c >= input_tables) 
+    {
+    t->linearize[c] = t->linearize[0];
+    continue;
+    }
+  for ( i = 0; i < input_entries; i++ )
+    table[i] = cmsEvalToneCurveFloat (input_curves[c], 
+                                      (cmsFloat32Number) (i / (input_entries - 1.0)));
+  t->linearize[c] = table;
+  table += input_entries;
+  }
+for ( c = 0; c < 3; c++ )
+  {
+  if (c >= output_tables) 
+    {
+    t->encode[c] = t->encode[0];
+    continue;
+    }
+  fill_encode_table (output_curves[c], table, output_scale);
+  t->encode[c] = table;
+  table += ENCODE_NODES;
+  }
+
+*xform = fast_transform_lines;
+*UserData = t;
+*FreePrivateDataFn = free_fast_transform;
+return TRUE;
+}
+
+
+static void fast_transform_lines (struct _cmstransform_struct *CMMcargo,
+                                  const void                  *InputBuffer,
+                                  void                        *OutputBuffer,
+                                  cmsUInt32Number             PixelsPerLine,
+                                  cmsUInt32Number             LineCount,
+                                  const cmsStride             *Stride
+                                  )
+{
+const fast_transform *t = (const fast_transform*) _cmsGetTransformUserData (CMMcargo);
+const cmsUInt8Number *input = (const cmsUInt8Number*) InputBuffer;
+cmsUInt8Number *output = (cmsUInt8Number*) OutputBuffer;
+cmsUInt32Number line;
+
+for ( line = 0; line < LineCount; line++ )
+  {
+#ifdef ELLE_X86
+  if (t->level == ELLE_SIMD_AVX2) convert_avx2 (t, input, output, PixelsPerLine);
+  else
+#endif
+  convert_scalar (t, input, output, PixelsPerLine);
+  input += Stride->BytesPerLineIn;
+  output += Stride->BytesPerLineOut;
+  }
+}
+
+
+static void free_fast_transform (cmsContext ContextID, void *Data)
+{
+_cmsFree (ContextID, Data);
+}
+
+
+/* RGB, 8 or 16 bits, chunky, in RGB order, native byte order, no 
+ * extra channels */
+static cmsBool plain_rgb_format (cmsUInt32Number format)
+{
+return T_COLORSPACE(format) == PT_RGB && T_CHANNELS(format) == 3 && 
+       T_EXTRA(format) == 0 && (T_BYTES(format) == 1 || T_BYTES(format) == 2) && 
+       !T_FLOAT(format) && !T_PLANAR(format) && !T_DOSWAP(format) && 
+       !T_SWAPFIRST(format) && !T_ENDIAN16(format) && !T_FLAVOR(format);
+}
+
+
+/* A matrix-shaper to matrix-shaper pipeline is the source TRCs, the 
+ * source matrix, any matrices LCMS adds (absolute colorimetric, black
+ * point compensation), the inverse of the destination matrix and the
+ * inverse destination TRCs. FALSE for anything else. The matrices are
+ * joined into one, with an offset. */
+static cmsBool read_pipeline (const cmsPipeline *lut,
+                              cmsToneCurve      *input_curves[3],
+                              cmsFloat64Number  matrix[9],
+                              cmsFloat64Number  offset[3],
+                              cmsToneCurve      *output_curves[3]
+                              )
+{
+cmsStage *stage;
+int curve_sets = 0, matrices = 0, i, j;
+
+if (cmsPipelineInputChannels (lut) != 3 || cmsPipelineOutputChannels (lut) != 3) 
+  return FALSE;
+for ( i = 0; i < 9; i++ ) matrix[i] = i % 4 == 0 ? 1.0 : 0.0;
+for ( i = 0; i < 3; i++ ) offset[i] = 0.0;
+
+for ( stage = cmsPipelineGetPtrToFirstStage (lut); stage != NULL; 
+      stage = cmsStageNext (stage) )
+  {
+  if (cmsStageInputChannels (stage) != 3 || cmsStageOutputChannels (stage) != 3) 
+    return FALSE;
+  switch (cmsStageType (stage))
+    {
+    case cmsSigIdentityElemType:
+      break;
+
+    case cmsSigCurveSetElemType:
+      {
+      _cmsStageToneCurvesData *data = (_cmsStageToneCurvesData*) cmsStageData (stage);
+      cmsToneCurve **curves = curve_sets == 0 ? input_curves : output_curves;
+      if (curve_sets == 2 || (curve_sets == 1 && matrices == 0)) return FALSE;
+      for ( i = 0; i < 3; i++ )
+        {
+        if (!elle_curve (data->TheCurves[i])) return FALSE;
+        curves[i] = data->TheCurves[i];
+        }
+      curve_sets++;
+      break;
+      }
+
+    case cmsSigMatrixElemType:
+      {
+      _cmsStageMatrixData *data = (_cmsStageMatrixData*) cmsStageData (stage);
+      const cmsFloat64Number *m = data->Double;
+      cmsFloat64Number joined[9], shifted[3];
+      if (curve_sets != 1) return FALSE;
+      for ( i = 0; i < 3; i++ )
+        {
+        for ( j = 0; j < 3; j++ )
+          joined[3 * i + j] = m[3 * i] * matrix[j] + m[3 * i + 1] * matrix[3 + j] + 
+                              m[3 * i + 2] * matrix[6 + j];
+        shifted[i] = m[3 * i] * offset[0] + m[3 * i + 1] * offset[1] + 
+                     m[3 * i + 2] * offset[2] + (data->Offset != NULL ? data->Offset[i] : 0.0);
+        }
+      memcpy (matrix, joined, sizeof(joined));
+      memcpy (offset, shifted, sizeof(shifted));
+      matrices++;
+      break;
+      }
+
+    default:
+      return FALSE;
+    }
+  }
+return curve_sets == 2;
+}
+
+
+/* The curves make_tonecurve makes, as LCMS reads them back: pure 
+ * gammas (V2 'curv' tags with one entry are read as type 1 too) and
+ * type 4 curves, and the inverses LCMS makes of them for the 
+ * destination. The sampled V2 TRCs aren't recognized. */
+static cmsBool elle_curve (const cmsToneCurve *curve)
+{
+int type = cmsGetToneCurveParametricType (curve);
+return type == 1 || type == -1 || type == 4 || type == -4;
+}
+
+
+static cmsBool same_curve (const cmsToneCurve *a, const cmsToneCurve *b)
+{
+int type = cmsGetToneCurveParametricType (a);
+if (a == b) return TRUE;
+if (type != cmsGetToneCurveParametricType (b)) return FALSE;
+return memcmp (cmsGetToneCurveParams (a), cmsGetToneCurveParams (b), 
+               (type == 1 || type == -1 ? 1 : 5) * sizeof(cmsFloat64Number)) == 0;
+}
+
+
+/* Node n is the linear value whose bits are ENCODE_FLOOR_BITS plus n
+ * shifted up by ENCODE_FRACTION_BITS; each holds the encoded value 
+ * times scale, so the kernels only have to round */
+static void fill_encode_table (const cmsToneCurve *curve, cmsFloat32Number *table, 
+                               cmsFloat32Number scale)
+{
+int node;
+
+for ( node = 0; node < ENCODE_NODES - 1; node++ )
+  {
+  cmsUInt32Number bits = ENCODE_FLOOR_BITS + ((cmsUInt32Number) node << ENCODE_FRACTION_BITS);
+  cmsFloat32Number linear, encoded;
+  memcpy (&linear, &bits, sizeof(linear));
+  encoded = cmsEvalToneCurveFloat (curve, linear);
+  if (encoded < 0.0f) encoded = 0.0f;
+  if (encoded > 1.0f) encoded = 1.0f;
+  table[node] = encoded * scale;
+  }
+table[ENCODE_NODES - 1] = table[ENCODE_NODES - 2];
+}
+
+
+/* ***************************** KERNELS ***************************** */
+
+/* Clamps value to ENCODE_FLOOR..1.0 (NaN goes to the floor) and looks
+ * it up */
+static cmsUInt32Number encode (const cmsFloat32Number *table, cmsFloat32Number value)
+{
+cmsUInt32Number bits, index;
+cmsFloat32Number fraction;
+
+memcpy (&bits, &value, sizeof(bits));
+if (!(bits >= ENCODE_FLOOR_BITS && bits < 0x3F800000u))    /* also catches negatives and NaN */
+  bits = (value >= 1.0f) ? 0x3F800000u : ENCODE_FLOOR_BITS;
+bits -= ENCODE_FLOOR_BITS;
+index = bits >> ENCODE_FRACTION_BITS;
+fraction = (bits & ((1u << ENCODE_FRACTION_BITS) - 1)) * (1.0f / (1u << ENCODE_FRACTION_BITS));
+return (cmsUInt32Number) (table[index] + fraction * (table[index + 1] - table[index]) + 0.5f);
+}
+
+
+static void convert_scalar (const fast_transform *t, const cmsUInt8Number *input,
+                            cmsUInt8Number *output, size_t pixels)
+{
+const cmsFloat32Number *m = t->matrix;
+size_t i;
+
+for ( i = 0; i < pixels; i++ )
+  {
+  cmsFloat32Number r, g, b;
+  cmsUInt32Number x, y, z;
+
+  if (t->input_bytes == 1)
+    {
+    r = t->linearize[0][input[0]];
+    g = t->linearize[1][input[1]];
+    b = t->linearize[2][input[2]];
+    input += 3;
+    }
+  else
+    {
+    const cmsUInt16Number *codes = (const cmsUInt16Number*) input;
+    r = t->linearize[0][codes[0]];
+    g = t->linearize[1][codes[1]];
+    b = t->linearize[2][codes[2]];
+    input += 6;
+    }
+  x = encode (t->encode[0], m[0] * r + m[1] * g + m[2] * b + t->offset[0]);
+  y = encode (t->encode[1], m[3] * r + m[4] * g + m[5] * b + t->offset[1]);
+  z = encode (t->encode[2], m[6] * r + m[7] * g + m[8] * b + t->offset[2]);
+  if (t->output_bytes == 1)
+    {
+    output[0] = (cmsUInt8Number) x;
+    output[1] = (cmsUInt8Number) y;
+    output[2] = (cmsUInt8Number) z;
+    output += 3;
+    }
+  else
+    {
+    cmsUInt16Number *codes = (cmsUInt16Number*) output;
+    codes[0] = (cmsUInt16Number) x;
+    codes[1] = (cmsUInt16Number) y;
+    codes[2] = (cmsUInt16Number) z;
+    output += 6;
+    }
+  }
+}
+
+
+#ifdef ELLE_X86
+
+/* The AVX2 kernel does eight pixels at a time. Each pixel's codes are
+ * gathered as one 32-bit word (two for 16 bits), which reads a byte 
+ * or two of the next pixel, so the last pixel of a line is always
+ * left to the scalar kernel. The results are packed back with byte
+ * shuffles and stored twelve bytes at a time, so nothing after the 
+ * eight pixels is written, and converting in place works. */
+
+__attribute__((target("avx2,fma")))
+static inline __m256i encode_avx2 (const cmsFloat32Number *table, __m256 value)
+{
+__m256i floor_bits = _mm256_set1_epi32 ((int) ENCODE_FLOOR_BITS);
+__m256i bits, index;
+__m256 fraction, low, high;
+
+/* max returns its second operand for NaN */
+value = _mm256_min_ps (_mm256_max_ps (value, _mm256_castsi256_ps (floor_bits)), 
+                       _mm256_set1_ps (1.0f));
+bits = _mm256_sub_epi32 (_mm256_castps_si256 (value), floor_bits);
+index = _mm256_srli_epi32 (bits, ENCODE_FRACTION_BITS);
+fraction = _mm256_mul_ps (_mm256_cvtepi32_ps (_mm256_and_si256 (bits, 
+                            _mm256_set1_epi32 ((1 << ENCODE_FRACTION_BITS) - 1))),
+                          _mm256_set1_ps (1.0f / (1 << ENCODE_FRACTION_BITS)));
+low = _mm256_i32gather_ps (table, index, 4);
+high = _mm256_i32gather_ps (table + 1, index, 4);
+return _mm256_cvttps_epi32 (_mm256_add_ps (_mm256_fmadd_ps (fraction, _mm256_sub_ps (high, low), low),
+                                           _mm256_set1_ps (0.5f)));
+}
+
+
+__attribute__((target("avx2,fma")))
+static inline void store_12 (cmsUInt8Number *output, __m128i value)
+{
+cmsUInt32Number last = (cmsUInt32Number) _mm_cvtsi128_si32 (_mm_srli_si128 (value, 8));
+_mm_storel_epi64 ((__m128i*) output, value);
+memcpy (output + 8, &last, sizeof(last));
+}
+
+
+__attribute__((target("avx2,fma")))
+static void convert_avx2 (const fast_transform *t, const cmsUInt8Number *input,
+                          cmsUInt8Number *output, size_t pixels)
+{
+const cmsFloat32Number *m = t->matrix;
+__m256 m0 = _mm256_set1_ps (m[0]), m1 = _mm256_set1_ps (m[1]), m2 = _mm256_set1_ps (m[2]);
+__m256 m3 = _mm256_set1_ps (m[3]), m4 = _mm256_set1_ps (m[4]), m5 = _mm256_set1_ps (m[5]);
+__m256 m6 = _mm256_set1_ps (m[6]), m7 = _mm256_set1_ps (m[7]), m8 = _mm256_set1_ps (m[8]);
+__m256 o0 = _mm256_set1_ps (t->offset[0]), o1 = _mm256_set1_ps (t->offset[1]);
+__m256 o2 = _mm256_set1_ps (t->offset[2]);
+__m256i offsets = _mm256_mullo_epi32 (_mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7), 
+                                      _mm256_set1_epi32 (3 * t->input_bytes));
+__m256i byte_mask = _mm256_set1_epi32 (0xFF), word_mask = _mm256_set1_epi32 (0xFFFF);
+/* per 128-bit half: 4 pixels of 0x00BBGGRR, or 2 pixels of RRRR GGGG BBBB xxxx */
+__m256i pack_8 = _mm256_setr_epi8 (0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                   0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+__m256i pack_16 = _mm256_setr_epi8 (0, 1, 2, 3, 4, 5, 8, 9, 10, 11, 12, 13, -1, -1, -1, -1,
+                                    0, 1, 2, 3, 4, 5, 8, 9, 10, 11, 12, 13, -1, -1, -1, -1);
+size_t i;
+
+for ( i = 0; i + 8 < pixels; i += 8 )
+  {
+  __m256i r, g, b, x, y, z;
+  __m256 lr, lg, lb;
+
+  if (t->input_bytes == 1)
+    {
+    __m256i words = _mm256_i32gather_epi32 ((const int*) input, offsets, 1);
+    r = _mm256_and_si256 (words, byte_mask);
+    g = _mm256_and_si256 (_mm256_srli_epi32 (words, 8), byte_mask);
+    b = _mm256_and_si256 (_mm256_srli_epi32 (words, 16), byte_mask);
+    input += 24;
+    }
+  else
+    {
+    __m256i rg = _mm256_i32gather_epi32 ((const int*) input, offsets, 1);
+    r = _mm256_and_si256 (rg, word_mask);
+    g = _mm256_srli_epi32 (rg, 16);
+    b = _mm256_and_si256 (_mm256_i32gather_epi32 ((const int*) (input + 4), offsets, 1), 
+                          word_mask);
+    input += 48;
+    }
+  lr = _mm256_i32gather_ps (t->linearize[0], r, 4);
+  lg = _mm256_i32gather_ps (t->linearize[1], g, 4);
+  lb = _mm256_i32gather_ps (t->linearize[2], b, 4);
+  x = encode_avx2 (t->encode[0], _mm256_fmadd_ps (m2, lb, _mm256_fmadd_ps (m1, lg, 
+                                   _mm256_fmadd_ps (m0, lr, o0))));
+  y = encode_avx2 (t->encode[1], _mm256_fmadd_ps (m5, lb, _mm256_fmadd_ps (m4, lg, 
+                                   _mm256_fmadd_ps (m3, lr, o1))));
+  z = encode_avx2 (t->encode[2], _mm256_fmadd_ps (m8, lb, _mm256_fmadd_ps (m7, lg, 
+                                   _mm256_fmadd_ps (m6, lr, o2))));
+
+  if (t->output_bytes == 1)
+    {
+    __m256i packed = _mm256_shuffle_epi8 (_mm256_or_si256 (x, _mm256_or_si256 (
+                       _mm256_slli_epi32 (y, 8), _mm256_slli_epi32 (z, 16))), pack_8);
+    store_12 (output, _mm256_castsi256_si128 (packed));
+    store_12 (output + 12, _mm256_extracti128_si256 (packed, 1));
+    output += 24;
+    }
+  else
+    {
+    __m256i xy = _mm256_or_si256 (x, _mm256_slli_epi32 (y, 16));
+    __m256i low = _mm256_shuffle_epi8 (_mm256_unpacklo_epi32 (xy, z), pack_16);   /* pixels 0 1, 4 5 */
+    __m256i high = _mm256_shuffle_epi8 (_mm256_unpackhi_epi32 (xy, z), pack_16);  /* pixels 2 3, 6 7 */
+    store_12 (output, _mm256_castsi256_si128 (low));
+    store_12 (output + 12, _mm256_castsi256_si128 (high));
+    store_12 (output + 24, _mm256_extracti128_si256 (low, 1));
+    store_12 (output + 36, _mm256_extracti128_si256 (high, 1));
+    output += 48;
+    }
+  }
+convert_scalar (t, input, output, pixels - i);
+}
+
+#endif
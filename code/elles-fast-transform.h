@@ -0,0 +1,64 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+/* An LCMS transform plugin for 8- and 16-bit conversions between the
+ * RGB matrix-shaper profiles made by make-elles-profiles.
+ *
+ * LCMS hands the plugin the pipeline of every new transform. When the
+ * pipeline is tone curves, matrices and tone curves, the curves are 
+ * the parametric ones of make_tonecurve (pure gammas and type 4 curves,
+ * or their inverses), and both formats are plain TYPE_RGB_8 or 
+ * TYPE_RGB_16, the plugin does the transform itself: a table to 
+ * linearize each input code value, the matrices joined into one, and
+ * a table indexed by the bits of the linear float to encode the 
+ * result, with AVX2 and FMA when the CPU has them. Everything else is
+ * left to LCMS, as are transforms made with cmsFLAGS_NOOPTIMIZE.
+ *
+ * The tables are computed from the pipeline's own curves, so the 
+ * results are within a fraction of a code value of LCMS's float 
+ * transforms; see elles-fast-transform-bench.c, which checks that.
+ *
+ * The plugin needs LCMS 2.8 or later. Register it for every transform
+ * with cmsPlugin (elle_fast_transform_plugin ()), or for one context
+ * with cmsCreateContext or cmsPluginTHR.
+ *
+ * */
+
+#ifndef ELLES_FAST_TRANSFORM_H
+#define ELLES_FAST_TRANSFORM_H
+
+#include <lcms2.h>
+#include "elles-linear.h"
+
+/* The plugin */
+void* elle_fast_transform_plugin (void);
+
+/* TRUE if the plugin does transform */
+cmsBool elle_is_fast_transform (cmsHTRANSFORM transform);
+
+/* Use no better kernels than level in the transforms made from now 
+ * on; the default is the best the CPU has. Meant for benchmarks. */
+void elle_fast_transform_limit (elle_simd_level level);
+
+#endif
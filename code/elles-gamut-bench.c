@@ -0,0 +1,321 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+/* Checks and times the in-gamut tests of elles-gamut.c.
+ *
+ * For every "-g10" RGB profile in the profiles folder, makes a 
+ * synthetic image of linear RGB from 0.0 to 1.0, and finds which of its
+ * pixels are in the gamut of a destination profile three ways:
+ *
+ * - "lcms": transform the image to the destination with cmsDoTransform
+ *   (TYPE_RGB_FLT, unbounded) and check each pixel is in 0.0 to 1.0,
+ *   which is the reference
+ * - "rgb": elle_gamut_check_rgb, with each of the kernels the CPU can
+ *   run; its answer must be the reference's, except for pixels within 
+ *   BOUNDARY_SLACK of the destination's cube, where rounding decides
+ * - "lab": elle_gamut_check_lab on the image's D50 Lab values (from 
+ *   LCMS, not timed), against the destination's segment-maxima table; 
+ *   this is approximate, so the bench reports the share of the pixels 
+ *   outside that it finds, and fails only if it puts a pixel outside 
+ *   by more than MAX_LAB_EXCESS of chroma when it's inside
+ *
+ * The speeds are the fastest of the repeats, in millions of pixels a 
+ * second; the program exits with 1 if a check fails.
+ *
+ * Sample command line to compile this code:
+ *
+ * gcc -g -O2 -Wall -o elles-gamut-bench.exe elles-gamut-bench.c elles-gamut.c elles-linear.c elles-bench-util.c -llcms2 -lm
+ *
+ * Command line options:
+ * -d dir   profiles folder (default: ../profiles/)
+ * -t name  destination profile in that folder 
+ *          (default: sRGB-elle-V4-g10.icc)
+ * -s text  only sources whose name contains text, e.g. "-V4-"
+ * -n N     pixels in the synthetic image (default: 4194304)
+ * -r N     check the image N times and keep the fastest (default: 3)
+ *
+ * */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <lcms2.h>
+#include "elles-linear.h"
+#include "elles-gamut.h"
+#include "elles-bench-util.h"
+#include "elles-gamut-bench.h"
+
+#define BOUNDARY_SLACK  1e-5
+#define MAX_LAB_EXCESS  0.5
+
+int main (int argc, char *argv[])
+{
+char *directory = "../profiles/";
+char *destination_name = "sRGB-elle-V4-g10.icc";
+char *source_filter = NULL;
+size_t pixels = 4194304, i;
+int repeats = 3, failures = 0, sources = 0, opt;
+cmsHPROFILE destination, lab_profile;
+elle_gamut destination_gamut;
+cmsFloat32Number *image, *converted, *lab, *distance;
+cmsUInt8Number *expected, *in_gamut;
+DIR *folder;
+struct dirent *entry;
+
+while ((opt = getopt(argc, argv, "d:t:s:n:r:")) != -1)
+  {
+  if (opt == 'd') directory = optarg;
+  else if (opt == 't') destination_name = optarg;
+  else if (opt == 's') source_filter = optarg;
+  else if (opt == 'n') pixels = (size_t) atol(optarg);
+  else if (opt == 'r') repeats = atoi(optarg);
+  else
+    {
+    fprintf(stderr, "usage: %s [-d folder] [-t destination] [-s filter] "
+                    "[-n pixels] [-r repeats]\n", argv[0]);
+    return 1;
+    }
+  }
+if (pixels < 1) pixels = 1;
+if (pixels > 0xFFFFFFFFu) pixels = 0xFFFFFFFFu;   /* cmsDoTransform's limit */
+if (repeats < 1) repeats = 1;
+
+destination = elle_open_profile (NULL, directory, destination_name);
+if (destination == NULL) return 1;
+if (!elle_gamut_from_profile (destination, &destination_gamut))
+  {
+  fprintf(stderr, "%s isn't an RGB matrix-shaper profile\n", destination_name);
+  return 1;
+  }
+lab_profile = cmsCreateLab4Profile (NULL);
+folder = opendir (directory);
+if (folder == NULL)
+  {
+  fprintf(stderr, "couldn't read the folder %s\n", directory);
+  return 1;
+  }
+
+image = (cmsFloat32Number*) malloc (3 * pixels * sizeof(cmsFloat32Number));
+converted = (cmsFloat32Number*) malloc (3 * pixels * sizeof(cmsFloat32Number));
+lab = (cmsFloat32Number*) malloc (3 * pixels * sizeof(cmsFloat32Number));
+distance = (cmsFloat32Number*) malloc (pixels * sizeof(cmsFloat32Number));
+expected = (cmsUInt8Number*) malloc (pixels);
+in_gamut = (cmsUInt8Number*) malloc (pixels);
+if (image == NULL || converted == NULL || lab == NULL || distance == NULL || 
+    expected == NULL || in_gamut == NULL) return 1;
+/* Interleaved values from 0.0 to 1.0, i.e. the whole source gamut */
+elle_fill_image (image, pixels, 0.0, 1.0);
+
+printf("into %s, %lu pixels, best kernels: %s\n", destination_name, 
+       (unsigned long) pixels, elle_simd_name (elle_simd_best ()));
+printf("%-36s %-12s %10s %12s %8s %s\n", "source", "check", "outside", "Mpixels/s", 
+       "speedup", "agreement");
+
+while ((entry = readdir (folder)) != NULL)
+  {
+  const char *name = entry->d_name;
+  size_t length = strlen(name), outside = 0, found = 0, wrong = 0;
+  double lcms_rate, rate, excess = 0.0;
+  cmsHPROFILE source;
+  cmsHTRANSFORM transform, to_lab;
+  elle_gamut source_gamut;
+  elle_gamut_pair pair;
+  int level;
+
+  if (length < 8 || strcmp(name + length - 8, "-g10.icc") != 0) continue;
+  if (strcmp(name, destination_name) == 0) continue;
+  if (source_filter != NULL && strstr(name, source_filter) == NULL) continue;
+  source = elle_open_profile (NULL, directory, name);
+  if (source == NULL) 
+    {
+    failures++;
+    continue;
+    }
+  if (!elle_gamut_from_profile (source, &source_gamut))
+    {
+    printf("%-36s not an RGB matrix-shaper profile\n", name);
+    cmsCloseProfile (source);
+    continue;
+    }
+  transform = cmsCreateTransform (source, TYPE_RGB_FLT, destination, TYPE_RGB_FLT, 
+                                  INTENT_RELATIVE_COLORIMETRIC, 0);
+  to_lab = cmsCreateTransform (source, TYPE_RGB_FLT, lab_profile, TYPE_Lab_FLT, 
+                               INTENT_RELATIVE_COLORIMETRIC, 0);
+  if (transform == NULL || to_lab == NULL)
+    {
+    printf("%-36s couldn't make the LCMS transforms\n", name);
+    if (transform != NULL) cmsDeleteTransform (transform);
+    if (to_lab != NULL) cmsDeleteTransform (to_lab);
+    cmsCloseProfile (source);
+    failures++;
+    continue;
+    }
+  sources++;
+
+  /* The reference */
+  lcms_rate = measure_transform_and_check (transform, image, converted, expected, 
+                                           pixels, repeats);
+  for ( i = 0; i < pixels; i++ ) outside += !expected[i];
+  printf("%-36s %-12s %10lu %12.1f %8s\n", name, "lcms", (unsigned long) outside, 
+         lcms_rate * 1e-6, "1.00x");
+
+  elle_gamut_pair_init (&source_gamut, &destination_gamut, &pair);
+  for ( level = ELLE_SIMD_SCALAR; level <= (int) elle_simd_best (); level++ )
+    {
+    size_t disagreements = 0, checked_outside = 0;
+    char label[32];
+    if (level == ELLE_SIMD_SSE2) continue;    /* no SSE2 kernels */
+    pair.transform.level = (elle_simd_level) level;
+    rate = measure_rgb_check (&pair, image, distance, in_gamut, pixels, repeats);
+    for ( i = 0; i < pixels; i++ )
+      {
+      const cmsFloat32Number *c = converted + 3 * i;
+      double lowest = fmin (c[0], fmin (c[1], c[2])), highest = fmax (c[0], fmax (c[1], c[2]));
+      double reference = fmax (-lowest, highest - 1.0);
+      checked_outside += !in_gamut[i];
+      if (in_gamut[i] != expected[i] && fabs (reference) > BOUNDARY_SLACK) disagreements++;
+      }
+    snprintf(label, sizeof(label), "rgb %s", elle_simd_name ((elle_simd_level) level));
+    printf("%-36s %-12s %10lu %12.1f %7.2fx %lu wrong%s\n", name, label, 
+           (unsigned long) checked_outside, rate * 1e-6, rate / lcms_rate, 
+           (unsigned long) disagreements, disagreements ? "  FAILED" : "");
+    if (disagreements) failures++;
+    }
+
+  cmsDoTransform (to_lab, image, lab, (cmsUInt32Number) pixels);
+  rate = measure_lab_check (&destination_gamut, lab, distance, in_gamut, pixels, repeats);
+  for ( i = 0; i < pixels; i++ )
+    {
+    if (!in_gamut[i] && !expected[i]) found++;
+    if (!in_gamut[i] && expected[i])
+      {
+      wrong++;
+      if (distance[i] > excess) excess = distance[i];
+      }
+    }
+  printf("%-36s %-12s %10lu %12.1f %7.2fx %.1f%% found, %lu inside (%.3f)%s\n", name, 
+         "lab", (unsigned long) (found + wrong), rate * 1e-6, rate / lcms_rate, 
+         outside > 0 ? 100.0 * found / outside : 100.0, (unsigned long) wrong, excess, 
+         excess > MAX_LAB_EXCESS ? "  FAILED" : "");
+  if (excess > MAX_LAB_EXCESS) failures++;
+
+  cmsDeleteTransform (transform);
+  cmsDeleteTransform (to_lab);
+  cmsCloseProfile (source);
+  }
+closedir (folder);
+
+printf("%d sources checked, %d failures\n", sources, failures);
+free (image);
+free (converted);
+free (lab);
+free (distance);
+free (expected);
+free (in_gamut);
+cmsCloseProfile (lab_profile);
+cmsCloseProfile (destination);
+return failures == 0 ? 0 : 1;
+}
+
+
+/* Transform image into converted, and set in_gamut to whether each 
+ * pixel is in 0.0 to 1.0 there. Returns pixels per second. */
+static double measure_transform_and_check (cmsHTRANSFORM          transform,
+                                           const cmsFloat32Number *image,
+                                           cmsFloat32Number       *converted,
+                                           cmsUInt8Number         *in_gamut,
+                                           size_t                 pixels,
+                                           int                    repeats
+                                           )
+{
+double seconds, best = 0.0;
+struct timespec start;
+size_t i;
+int r;
+
+for ( r = 0; r < repeats; r++ )
+  {
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  cmsDoTransform (transform, image, converted, (cmsUInt32Number) pixels);
+  for ( i = 0; i < pixels; i++ )
+    {
+    const cmsFloat32Number *c = converted + 3 * i;
+    in_gamut[i] = c[0] >= 0.0f && c[0] <= 1.0f && c[1] >= 0.0f && c[1] <= 1.0f &&
+                  c[2] >= 0.0f && c[2] <= 1.0f;
+    }
+  seconds = elle_elapsed_seconds (start);
+  if (r == 0 || seconds < best) best = seconds;
+  }
+return best > 0.0 ? pixels / best : 0.0;
+}
+
+
+static double measure_rgb_check (const elle_gamut_pair  *pair,
+                                 const cmsFloat32Number *image,
+                                 cmsFloat32Number       *distance,
+                                 cmsUInt8Number         *in_gamut,
+                                 size_t                 pixels,
+                                 int                    repeats
+                                 )
+{
+double seconds, best = 0.0;
+struct timespec start;
+int r;
+
+for ( r = 0; r < repeats; r++ )
+  {
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  elle_gamut_check_rgb (pair, image, pixels, 0.0f, distance, in_gamut);
+  seconds = elle_elapsed_seconds (start);
+  if (r == 0 || seconds < best) best = seconds;
+  }
+return best > 0.0 ? pixels / best : 0.0;
+}
+
+
+static double measure_lab_check (const elle_gamut       *gamut,
+                                 const cmsFloat32Number *lab,
+                                 cmsFloat32Number       *distance,
+                                 cmsUInt8Number         *in_gamut,
+                                 size_t                 pixels,
+                                 int                    repeats
+                                 )
+{
+double seconds, best = 0.0;
+struct timespec start;
+int r;
+
+for ( r = 0; r < repeats; r++ )
+  {
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  elle_gamut_check_lab (gamut, lab, pixels, 0.0f, distance, in_gamut);
+  seconds = elle_elapsed_seconds (start);
+  if (r == 0 || seconds < best) best = seconds;
+  }
+return best > 0.0 ? pixels / best : 0.0;
+}
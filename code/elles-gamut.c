@@ -0,0 +1,447 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <lcms2.h>
+#include "elles-linear.h"
+#include "elles-gamut.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ELLE_X86 1
+#include <immintrin.h>
+#endif
+
+/* Points sampled along each edge of each face of the RGB cube, for the
+ * segment-maxima table: 6 x 129 x 129 points, spaced evenly in the 
+ * cube root of linear RGB, which is about evenly in L*, so the dark
+ * segments get as many as the light ones */
+#define FACE_SAMPLES  129
+
+/* Each sample also counts in the segments within this much lightness
+ * (in L*) and hue (in degrees) of it, which is about the spacing of 
+ * the samples, so a segment's maximum isn't missed by falling between
+ * two of them */
+#define LIGHTNESS_MARGIN  1.0f
+#define HUE_MARGIN        1.5f
+
+#define TWO_PI        6.283185307179586f
+#define HUE_SCALE     ((cmsFloat32Number) ELLE_GAMUT_HUE_SEGMENTS / TWO_PI)
+#define LIGHTNESS_SCALE  ((cmsFloat32Number) ELLE_GAMUT_LIGHTNESS_SEGMENTS / 100.0f)
+
+/* atan(t) for t from 0 to 1, to within 1e-5 radians */
+#define ATAN_C1   0.99997726f
+#define ATAN_C3  -0.33262347f
+#define ATAN_C5   0.19354346f
+#define ATAN_C7  -0.11643287f
+#define ATAN_C9   0.05265332f
+#define ATAN_C11 -0.01172120f
+
+static cmsFloat32Number clamp_segment (cmsFloat32Number value, int last);
+
+static cmsFloat32Number hue_of (cmsFloat32Number a, cmsFloat32Number b);
+
+static int segment_of (cmsFloat32Number L, cmsFloat32Number a, cmsFloat32Number b);
+
+static void record_sample (elle_gamut       *gamut,
+                           cmsFloat32Number L, 
+                           cmsFloat32Number a, 
+                           cmsFloat32Number b
+                           );
+
+static size_t check_rgb_scalar (const cmsFloat64Number *m, const cmsFloat32Number *rgb,
+                                size_t first, size_t pixels, cmsFloat32Number tolerance,
+                                cmsFloat32Number *distance, cmsUInt8Number *in_gamut);
+
+static size_t check_lab_scalar (const elle_gamut *gamut, const cmsFloat32Number *lab,
+                                size_t first, size_t count, cmsFloat32Number tolerance,
+                                cmsFloat32Number *distance, cmsUInt8Number *in_gamut);
+
+#ifdef ELLE_X86
+static size_t check_rgb_avx2 (const elle_gamut_pair *pair, const cmsFloat32Number *rgb,
+                              size_t pixels, cmsFloat32Number tolerance,
+                              cmsFloat32Number *distance, cmsUInt8Number *in_gamut);
+
+static size_t check_lab_avx2 (const elle_gamut *gamut, const cmsFloat32Number *lab,
+                              size_t count, cmsFloat32Number tolerance,
+                              cmsFloat32Number *distance, cmsUInt8Number *in_gamut);
+#endif
+
+
+cmsBool elle_gamut_init (const cmsFloat64Number rgb_to_xyz[9], elle_gamut *gamut)
+{
+cmsFloat64Number spacing[FACE_SAMPLES];
+int face, u, v;
+
+memset (gamut, 0, sizeof(elle_gamut));
+memcpy (gamut->rgb_to_xyz, rgb_to_xyz, sizeof(gamut->rgb_to_xyz));
+if (!elle_invert_matrix (gamut->rgb_to_xyz, gamut->xyz_to_rgb)) return FALSE;
+
+/* The largest chroma of a segment is on the surface of the gamut, 
+ * which is the image of the surface of the cube */
+for ( u = 0; u < FACE_SAMPLES; u++ )
+  {
+  cmsFloat64Number step = (cmsFloat64Number) u / (FACE_SAMPLES - 1);
+  spacing[u] = step * step * step;
+  }
+for ( face = 0; face < 6; face++ )
+  for ( u = 0; u < FACE_SAMPLES; u++ )
+    for ( v = 0; v < FACE_SAMPLES; v++ )
+      {
+      const cmsFloat64Number *m = gamut->rgb_to_xyz;
+      cmsFloat64Number rgb[3];
+      cmsCIEXYZ XYZ;
+      cmsCIELab Lab;
+      rgb[face / 2] = face % 2;
+      rgb[(face / 2 + 1) % 3] = spacing[u];
+      rgb[(face / 2 + 2) % 3] = spacing[v];
+      XYZ.X = m[0] * rgb[0] + m[1] * rgb[1] + m[2] * rgb[2];
+      XYZ.Y = m[3] * rgb[0] + m[4] * rgb[1] + m[5] * rgb[2];
+      XYZ.Z = m[6] * rgb[0] + m[7] * rgb[1] + m[8] * rgb[2];
+      cmsXYZ2Lab (NULL, &Lab, &XYZ);
+      record_sample (gamut, (cmsFloat32Number) Lab.L, (cmsFloat32Number) Lab.a, 
+                     (cmsFloat32Number) Lab.b);
+      }
+return TRUE;
+}
+
+
+cmsBool elle_gamut_from_profile (cmsHPROFILE profile, elle_gamut *gamut)
+{
+cmsTagSignature tags[3] = { cmsSigRedColorantTag, cmsSigGreenColorantTag, cmsSigBlueColorantTag };
+cmsFloat64Number matrix[9];
+int c;
+
+if (cmsGetColorSpace (profile) != cmsSigRgbData || !cmsIsMatrixShaper (profile)) 
+  return FALSE;
+for ( c = 0; c < 3; c++ )
+  {
+  cmsCIEXYZ *colorant = (cmsCIEXYZ*) cmsReadTag (profile, tags[c]);
+  if (colorant == NULL) return FALSE;
+  matrix[c] = colorant->X;
+  matrix[3 + c] = colorant->Y;
+  matrix[6 + c] = colorant->Z;
+  }
+return elle_gamut_init (matrix, gamut);
+}
+
+
+void elle_gamut_pair_init (const elle_gamut *source,
+                           const elle_gamut *destination,
+                           elle_gamut_pair  *pair
+                           )
+{
+int row, column;
+
+/* As elle_linear_transform_init, i.e. as LCMS joins the matrices */
+memset (pair, 0, sizeof(elle_gamut_pair));
+for ( row = 0; row < 3; row++ )
+  for ( column = 0; column < 3; column++ )
+    {
+    pair->transform.matrix[3 * row + column] = 
+      destination->xyz_to_rgb[3 * row] * source->rgb_to_xyz[column] +
+      destination->xyz_to_rgb[3 * row + 1] * source->rgb_to_xyz[3 + column] +
+      destination->xyz_to_rgb[3 * row + 2] * source->rgb_to_xyz[6 + column];
+    pair->transform.float_matrix[3 * row + column] = 
+      (cmsFloat32Number) pair->transform.matrix[3 * row + column];
+    }
+pair->transform.level = elle_simd_best ();
+}
+
+
+size_t elle_gamut_check_rgb (const elle_gamut_pair  *pair,
+                             const cmsFloat32Number *rgb,
+                             size_t                 pixels,
+                             cmsFloat32Number       tolerance,
+                             cmsFloat32Number       *distance,
+                             cmsUInt8Number         *in_gamut
+                             )
+{
+#ifdef ELLE_X86
+if (pair->transform.level == ELLE_SIMD_AVX2)
+  return check_rgb_avx2 (pair, rgb, pixels, tolerance, distance, in_gamut);
+#endif
+return check_rgb_scalar (pair->transform.matrix, rgb, 0, pixels, tolerance, distance, 
+                         in_gamut);
+}
+
+
+size_t elle_gamut_check_lab (const elle_gamut       *gamut,
+                             const cmsFloat32Number *lab,
+                             size_t                 count,
+                             cmsFloat32Number       tolerance,
+                             cmsFloat32Number       *distance,
+                             cmsUInt8Number         *in_gamut
+                             )
+{
+#ifdef ELLE_X86
+if (elle_simd_best () == ELLE_SIMD_AVX2)
+  return check_lab_avx2 (gamut, lab, count, tolerance, distance, in_gamut);
+#endif
+return check_lab_scalar (gamut, lab, 0, count, tolerance, distance, in_gamut);
+}
+
+
+/* value in 0 to last, as the AVX2 kernel clamps it: a NaN gives last,
+ * as _mm256_min_ps does */
+static cmsFloat32Number clamp_segment (cmsFloat32Number value, int last)
+{
+value = value < (cmsFloat32Number) last ? value : (cmsFloat32Number) last;
+return value > 0.0f ? value : 0.0f;
+}
+
+
+/* The hue angle of (a, b), from 0 to 2 pi, with the same polynomial as
+ * the AVX2 kernel, so both put a colour in the same segment (but for 
+ * FMA rounding); neutral colours are at hue 0 */
+static cmsFloat32Number hue_of (cmsFloat32Number a, cmsFloat32Number b)
+{
+cmsFloat32Number x = fabsf (a), y = fabsf (b);
+cmsFloat32Number larger = x > y ? x : y, smaller = x > y ? y : x;
+cmsFloat32Number t = larger > 0.0f ? smaller / larger : 0.0f, s = t * t, hue;
+
+hue = t * (ATAN_C1 + s * (ATAN_C3 + s * (ATAN_C5 + s * (ATAN_C7 + s * (ATAN_C9 + s * ATAN_C11)))));
+if (y > x) hue = 0.25f * TWO_PI - hue;
+if (a < 0.0f) hue = 0.5f * TWO_PI - hue;
+if (b < 0.0f) hue = TWO_PI - hue;
+return hue;
+}
+
+
+/* The index of (L, a, b) in max_chroma, flattened. Lightness outside 
+ * 0 to 100 is in the first or last segment. */
+static int segment_of (cmsFloat32Number L, cmsFloat32Number a, cmsFloat32Number b)
+{
+/* Clamped before the conversion to int, so NaNs and huge values stay 
+ * in the table */
+int lightness_segment = (int) clamp_segment (L * LIGHTNESS_SCALE, 
+                                             ELLE_GAMUT_LIGHTNESS_SEGMENTS - 1);
+int hue_segment = (int) clamp_segment (hue_of (a, b) * HUE_SCALE, ELLE_GAMUT_HUE_SEGMENTS - 1);
+return lightness_segment * ELLE_GAMUT_HUE_SEGMENTS + hue_segment;
+}
+
+
+/* Raise the maxima of the segments within the margins of a sample */
+static void record_sample (elle_gamut       *gamut,
+                           cmsFloat32Number L, 
+                           cmsFloat32Number a, 
+                           cmsFloat32Number b
+                           )
+{
+cmsFloat32Number chroma = sqrtf (a * a + b * b), hue = hue_of (a, b) * HUE_SCALE;
+cmsFloat32Number hue_margin = HUE_MARGIN * ELLE_GAMUT_HUE_SEGMENTS / 360.0f;
+int first_lightness = (int) clamp_segment ((L - LIGHTNESS_MARGIN) * LIGHTNESS_SCALE, 
+                                           ELLE_GAMUT_LIGHTNESS_SEGMENTS - 1);
+int last_lightness = (int) clamp_segment ((L + LIGHTNESS_MARGIN) * LIGHTNESS_SCALE, 
+                                          ELLE_GAMUT_LIGHTNESS_SEGMENTS - 1);
+int first_hue = (int) floorf (hue - hue_margin), last_hue = (int) floorf (hue + hue_margin);
+int l, h;
+
+for ( l = first_lightness; l <= last_lightness; l++ )
+  for ( h = first_hue; h <= last_hue; h++ )
+    {
+    /* the hues wrap around */
+    cmsFloat32Number *maximum = &gamut->max_chroma[l][(h + ELLE_GAMUT_HUE_SEGMENTS) % 
+                                                      ELLE_GAMUT_HUE_SEGMENTS];
+    if (chroma > *maximum) *maximum = chroma;
+    }
+}
+
+
+/* ***************************** KERNELS ***************************** */
+
+/* The scalar RGB kernel adds up in double, as LCMS's matrix stages do */
+static size_t check_rgb_scalar (const cmsFloat64Number *m, const cmsFloat32Number *rgb,
+                                size_t first, size_t pixels, cmsFloat32Number tolerance,
+                                cmsFloat32Number *distance, cmsUInt8Number *in_gamut)
+{
+size_t i, outside = 0;
+for ( i = first; i < pixels; i++ )
+  {
+  cmsFloat64Number r = rgb[3 * i], g = rgb[3 * i + 1], b = rgb[3 * i + 2];
+  cmsFloat32Number x = (cmsFloat32Number) (m[0] * r + m[1] * g + m[2] * b);
+  cmsFloat32Number y = (cmsFloat32Number) (m[3] * r + m[4] * g + m[5] * b);
+  cmsFloat32Number z = (cmsFloat32Number) (m[6] * r + m[7] * g + m[8] * b);
+  cmsFloat32Number lowest = fminf (x, fminf (y, z)), highest = fmaxf (x, fmaxf (y, z));
+  cmsFloat32Number d = fmaxf (-lowest, highest - 1.0f);
+  int inside = d <= tolerance;
+  if (distance != NULL) distance[i] = d;
+  if (in_gamut != NULL) in_gamut[i] = (cmsUInt8Number) inside;
+  outside += !inside;
+  }
+return outside;
+}
+
+
+static size_t check_lab_scalar (const elle_gamut *gamut, const cmsFloat32Number *lab,
+                                size_t first, size_t count, cmsFloat32Number tolerance,
+                                cmsFloat32Number *distance, cmsUInt8Number *in_gamut)
+{
+const cmsFloat32Number *table = &gamut->max_chroma[0][0];
+size_t i, outside = 0;
+for ( i = first; i < count; i++ )
+  {
+  cmsFloat32Number L = lab[3 * i], a = lab[3 * i + 1], b = lab[3 * i + 2];
+  cmsFloat32Number d = sqrtf (a * a + b * b) - table[segment_of (L, a, b)];
+  int inside = d <= tolerance;
+  if (distance != NULL) distance[i] = d;
+  if (in_gamut != NULL) in_gamut[i] = (cmsUInt8Number) inside;
+  outside += !inside;
+  }
+return outside;
+}
+
+
+#ifdef ELLE_X86
+
+/* Eight colours at a time, loaded and split into channels as in 
+ * elles-linear.c: a = c0 c1 c2 c0' of pixels 0 and 1, and so on, with
+ * pixels 0-3 in the low halves and 4-7 in the high ones, so the 
+ * channel registers hold the pixels in order. The rest are finished 
+ * with the scalar kernels. */
+
+__attribute__((target("avx2,fma")))
+static inline __m256 load_halves (const cmsFloat32Number *low, const cmsFloat32Number *high)
+{
+return _mm256_insertf128_ps (_mm256_castps128_ps256 (_mm_loadu_ps (low)), 
+                             _mm_loadu_ps (high), 1);
+}
+
+
+__attribute__((target("avx2,fma")))
+static inline void split_channels (const cmsFloat32Number *input, 
+                                   __m256 *first, __m256 *second, __m256 *third)
+{
+__m256 a = load_halves (input, input + 12);
+__m256 b = load_halves (input + 4, input + 16);
+__m256 c = load_halves (input + 8, input + 20);
+__m256 t0 = _mm256_shuffle_ps (a, b, _MM_SHUFFLE(1, 0, 2, 1));
+__m256 t1 = _mm256_shuffle_ps (b, c, _MM_SHUFFLE(2, 1, 3, 2));
+*first = _mm256_shuffle_ps (a, t1, _MM_SHUFFLE(2, 0, 3, 0));
+*second = _mm256_shuffle_ps (t0, t1, _MM_SHUFFLE(3, 1, 2, 0));
+*third = _mm256_shuffle_ps (t0, c, _MM_SHUFFLE(3, 0, 3, 1));
+}
+
+
+/* Store the distances and in-gamut flags of eight colours; returns how
+ * many are outside */
+__attribute__((target("avx2,fma")))
+static inline size_t store_results (__m256 d, __m256 tolerance, size_t i,
+                                    cmsFloat32Number *distance, cmsUInt8Number *in_gamut)
+{
+int inside = _mm256_movemask_ps (_mm256_cmp_ps (d, tolerance, _CMP_LE_OQ)), k;
+if (distance != NULL) _mm256_storeu_ps (distance + i, d);
+if (in_gamut != NULL)
+  for ( k = 0; k < 8; k++ ) in_gamut[i + k] = (cmsUInt8Number) ((inside >> k) & 1);
+return (size_t) (8 - __builtin_popcount (inside));
+}
+
+
+__attribute__((target("avx2,fma")))
+static size_t check_rgb_avx2 (const elle_gamut_pair *pair, const cmsFloat32Number *rgb,
+                              size_t pixels, cmsFloat32Number tolerance,
+                              cmsFloat32Number *distance, cmsUInt8Number *in_gamut)
+{
+const cmsFloat32Number *m = pair->transform.float_matrix;
+__m256 m0 = _mm256_set1_ps (m[0]), m1 = _mm256_set1_ps (m[1]), m2 = _mm256_set1_ps (m[2]);
+__m256 m3 = _mm256_set1_ps (m[3]), m4 = _mm256_set1_ps (m[4]), m5 = _mm256_set1_ps (m[5]);
+__m256 m6 = _mm256_set1_ps (m[6]), m7 = _mm256_set1_ps (m[7]), m8 = _mm256_set1_ps (m[8]);
+__m256 one = _mm256_set1_ps (1.0f), zero = _mm256_setzero_ps ();
+__m256 limit = _mm256_set1_ps (tolerance);
+size_t i, outside = 0;
+
+for ( i = 0; i + 8 <= pixels; i += 8 )
+  {
+  __m256 r, g, b, x, y, z, lowest, highest;
+  split_channels (rgb + 3 * i, &r, &g, &b);
+  x = _mm256_fmadd_ps (m2, b, _mm256_fmadd_ps (m1, g, _mm256_mul_ps (m0, r)));
+  y = _mm256_fmadd_ps (m5, b, _mm256_fmadd_ps (m4, g, _mm256_mul_ps (m3, r)));
+  z = _mm256_fmadd_ps (m8, b, _mm256_fmadd_ps (m7, g, _mm256_mul_ps (m6, r)));
+  lowest = _mm256_min_ps (x, _mm256_min_ps (y, z));
+  highest = _mm256_max_ps (x, _mm256_max_ps (y, z));
+  outside += store_results (_mm256_max_ps (_mm256_sub_ps (zero, lowest), 
+                                           _mm256_sub_ps (highest, one)), 
+                            limit, i, distance, in_gamut);
+  }
+return outside + check_rgb_scalar (pair->transform.matrix, rgb, i, pixels, tolerance, 
+                                   distance, in_gamut);
+}
+
+
+__attribute__((target("avx2,fma")))
+static size_t check_lab_avx2 (const elle_gamut *gamut, const cmsFloat32Number *lab,
+                              size_t count, cmsFloat32Number tolerance,
+                              cmsFloat32Number *distance, cmsUInt8Number *in_gamut)
+{
+const cmsFloat32Number *table = &gamut->max_chroma[0][0];
+__m256 sign = _mm256_set1_ps (-0.0f), zero = _mm256_setzero_ps ();
+__m256 quarter = _mm256_set1_ps (0.25f * TWO_PI), half = _mm256_set1_ps (0.5f * TWO_PI);
+__m256 full = _mm256_set1_ps (TWO_PI);
+__m256 hue_scale = _mm256_set1_ps (HUE_SCALE);
+__m256 lightness_scale = _mm256_set1_ps (LIGHTNESS_SCALE);
+__m256 last_hue = _mm256_set1_ps (ELLE_GAMUT_HUE_SEGMENTS - 1);
+__m256 last_lightness = _mm256_set1_ps (ELLE_GAMUT_LIGHTNESS_SEGMENTS - 1);
+__m256i hue_segments = _mm256_set1_epi32 (ELLE_GAMUT_HUE_SEGMENTS);
+__m256 limit = _mm256_set1_ps (tolerance);
+size_t i, outside = 0;
+
+for ( i = 0; i + 8 <= count; i += 8 )
+  {
+  __m256 L, a, b, x, y, larger, smaller, t, s, hue, chroma;
+  __m256i lightness_segment, hue_segment, index;
+  split_channels (lab + 3 * i, &L, &a, &b);
+  chroma = _mm256_sqrt_ps (_mm256_fmadd_ps (a, a, _mm256_mul_ps (b, b)));
+
+  /* The hue as hue_of finds it */
+  x = _mm256_andnot_ps (sign, a);
+  y = _mm256_andnot_ps (sign, b);
+  larger = _mm256_max_ps (x, y);
+  smaller = _mm256_min_ps (x, y);
+  t = _mm256_and_ps (_mm256_div_ps (smaller, larger), 
+                     _mm256_cmp_ps (larger, zero, _CMP_GT_OQ));
+  s = _mm256_mul_ps (t, t);
+  hue = _mm256_fmadd_ps (s, _mm256_set1_ps (ATAN_C11), _mm256_set1_ps (ATAN_C9));
+  hue = _mm256_fmadd_ps (s, hue, _mm256_set1_ps (ATAN_C7));
+  hue = _mm256_fmadd_ps (s, hue, _mm256_set1_ps (ATAN_C5));
+  hue = _mm256_fmadd_ps (s, hue, _mm256_set1_ps (ATAN_C3));
+  hue = _mm256_fmadd_ps (s, hue, _mm256_set1_ps (ATAN_C1));
+  hue = _mm256_mul_ps (t, hue);
+  hue = _mm256_blendv_ps (hue, _mm256_sub_ps (quarter, hue), _mm256_cmp_ps (y, x, _CMP_GT_OQ));
+  hue = _mm256_blendv_ps (hue, _mm256_sub_ps (half, hue), _mm256_cmp_ps (a, zero, _CMP_LT_OQ));
+  hue = _mm256_blendv_ps (hue, _mm256_sub_ps (full, hue), _mm256_cmp_ps (b, zero, _CMP_LT_OQ));
+
+  hue_segment = _mm256_cvttps_epi32 (_mm256_max_ps (_mm256_min_ps (_mm256_mul_ps (hue, hue_scale), 
+                                                                   last_hue), zero));
+  lightness_segment = _mm256_cvttps_epi32 (_mm256_max_ps (_mm256_min_ps (_mm256_mul_ps (L, lightness_scale),
+                                                                         last_lightness), zero));
+  index = _mm256_add_epi32 (_mm256_mullo_epi32 (lightness_segment, hue_segments), hue_segment);
+  outside += store_results (_mm256_sub_ps (chroma, _mm256_i32gather_ps (table, index, 4)), 
+                            limit, i, distance, in_gamut);
+  }
+return outside + check_lab_scalar (gamut, lab, i, count, tolerance, distance, in_gamut);
+}
+
+#endif
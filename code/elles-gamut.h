@@ -0,0 +1,120 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+/* Gamut-boundary descriptors for the RGB colorspaces, and batch 
+ * in-gamut tests.
+ *
+ * An elle_gamut is made from a colorspace's colorants (linear RGB to 
+ * D50 XYZ, as its profiles store them) and holds two descriptions of 
+ * the gamut:
+ *
+ * - the matrices to and from D50 XYZ, which bound the gamut exactly:
+ *   a colour is inside a matrix-shaper RGB colorspace when its linear
+ *   RGB there is in the unit cube. elle_gamut_pair_init joins two 
+ *   gamuts' matrices into the one LCMS would use for a relative 
+ *   colorimetric transform, and elle_gamut_check_rgb tests linear 
+ *   source RGB against the destination's cube with it, which is the 
+ *   same answer as transforming and checking, without the transform.
+ * - a segment-maxima table in D50 Lab: the largest chroma of the gamut
+ *   in each of ELLE_GAMUT_LIGHTNESS_SEGMENTS lightness segments by 
+ *   ELLE_GAMUT_HUE_SEGMENTS hue segments, found by sampling the 
+ *   surface of the RGB cube (each sample also counts in the segments 
+ *   just next to it, so none is missed between samples). 
+ *   elle_gamut_check_lab uses it for colours that don't come from an 
+ *   RGB colorspace. Since it holds each segment's largest chroma, a 
+ *   colour with more chroma is outside the gamut, but one with less may
+ *   still be outside it, by up to the difference in chroma across its
+ *   segment.
+ *
+ * Encoded RGB (the non-linear TRCs) can be made linear first with 
+ * elle_fast_curve_to_linear (elles-fast-curve.h).
+ *
+ * Both checks run eight colours at a time with AVX2 and FMA when the
+ * CPU has them, and in plain C otherwise; they can disagree only for 
+ * colours within float rounding of the boundary. elles-gamut-bench.c 
+ * checks them against LCMS transforms.
+ *
+ * */
+
+#ifndef ELLES_GAMUT_H
+#define ELLES_GAMUT_H
+
+#include <stddef.h>
+#include <lcms2.h>
+#include "elles-linear.h"
+
+#define ELLE_GAMUT_LIGHTNESS_SEGMENTS  20    /* L* 0 to 100, 5 apart */
+#define ELLE_GAMUT_HUE_SEGMENTS        36    /* 10 degrees each, from a* = 0 */
+
+typedef struct {
+  const char *      name;            /* the colorspace, or NULL */
+  cmsFloat64Number  rgb_to_xyz[9];   /* row-major; the columns are the colorants */
+  cmsFloat64Number  xyz_to_rgb[9];
+  cmsFloat32Number  max_chroma[ELLE_GAMUT_LIGHTNESS_SEGMENTS][ELLE_GAMUT_HUE_SEGMENTS];
+} elle_gamut;
+
+typedef struct {
+  elle_linear_transform  transform;  /* linear source RGB to linear destination RGB */
+} elle_gamut_pair;
+
+/* Make the descriptor of the colorspace with these colorants (linear 
+ * RGB to D50 XYZ, row-major). FALSE if the matrix can't be inverted. */
+cmsBool elle_gamut_init (const cmsFloat64Number rgb_to_xyz[9], elle_gamut *gamut);
+
+/* The same, from the colorant tags of an RGB matrix-shaper profile */
+cmsBool elle_gamut_from_profile (cmsHPROFILE profile, elle_gamut *gamut);
+
+/* For testing colours of source against destination */
+void elle_gamut_pair_init (const elle_gamut *source,
+                           const elle_gamut *destination,
+                           elle_gamut_pair  *pair
+                           );
+
+/* Linear source RGB, interleaved. For each pixel, distance[i] is how
+ * far outside the destination's RGB cube it is, in linear destination
+ * RGB: the largest of -R, -G, -B, R - 1, G - 1 and B - 1, so it's 
+ * negative inside, and minus the distance to the nearest face. 
+ * in_gamut[i] is 1 if distance[i] <= tolerance, else 0. Either output
+ * may be NULL. Returns the number of pixels outside. */
+size_t elle_gamut_check_rgb (const elle_gamut_pair  *pair,
+                             const cmsFloat32Number *rgb,
+                             size_t                 pixels,
+                             cmsFloat32Number       tolerance,
+                             cmsFloat32Number       *distance,
+                             cmsUInt8Number         *in_gamut
+                             );
+
+/* D50 Lab, interleaved. For each colour, distance[i] is its chroma less
+ * the gamut's largest chroma in its segment; in_gamut[i] is 1 if 
+ * distance[i] <= tolerance, else 0. Either output may be NULL. Returns
+ * the number of colours outside. */
+size_t elle_gamut_check_lab (const elle_gamut       *gamut,
+                             const cmsFloat32Number *lab,
+                             size_t                 count,
+                             cmsFloat32Number       tolerance,
+                             cmsFloat32Number       *distance,
+                             cmsUInt8Number         *in_gamut
+                             );
+
+#endif
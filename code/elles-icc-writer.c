@@ -0,0 +1,433 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <lcms2.h>
+#include "elles-icc-writer.h"
+
+/* The profile is encoded twice: once with no buffer, only to count 
+ * the bytes, and then into a zeroed buffer of that size, so padding 
+ * and reserved fields are never written explicitly. */
+typedef struct {
+  cmsUInt8Number *   data;      /* NULL: only count */
+  cmsUInt32Number    used;
+} icc_writer;
+
+typedef struct {
+  cmsUInt32Number    state[4];
+  cmsUInt64Number    length;    /* bytes so far */
+  cmsUInt8Number     block[64];
+} md5_context;
+
+#define ICC_HEADER_SIZE    128
+#define ICC_ALIGN(n)       (((n) + 3) & ~(cmsUInt32Number) 3)
+
+static void encode_profile (icc_writer *w, const elle_V2_rgb_contents *contents);
+static void put_tag_entry (icc_writer *w, int index, cmsUInt32Number signature, 
+                           cmsUInt32Number offset, cmsUInt32Number size);
+static cmsUInt32Number put_text_tag (icc_writer *w, const char *text);
+static cmsUInt32Number put_description_tag (icc_writer *w, const char *text);
+static cmsUInt32Number put_XYZ_tag (icc_writer *w, const cmsCIEXYZ *xyz);
+static cmsUInt32Number put_curve_tag (icc_writer *w, const elle_V2_rgb_contents *contents);
+static void put_bytes (icc_writer *w, const void *bytes, cmsUInt32Number count);
+static void put_zeros (icc_writer *w, cmsUInt32Number count);
+static void put_uint32 (icc_writer *w, cmsUInt32Number value);
+static void put_uint16 (icc_writer *w, cmsUInt16Number value);
+static void put_s15Fixed16 (icc_writer *w, double value);
+static void md5_begin (md5_context *md5);
+static void md5_add (md5_context *md5, const cmsUInt8Number *data, size_t size);
+static void md5_end (md5_context *md5, cmsUInt8Number digest[16]);
+static void md5_block (cmsUInt32Number state[4], const cmsUInt8Number block[64]);
+
+
+cmsBool elle_write_V2_rgb_profile (const elle_V2_rgb_contents *contents,
+                                   cmsUInt8Number             **data,
+                                   cmsUInt32Number            *size
+                                   )
+{
+icc_writer w = { NULL, 0 };
+
+encode_profile (&w, contents);
+*size = w.used;
+*data = (cmsUInt8Number*) calloc (1, w.used);
+if (*data == NULL) return FALSE;
+
+w.data = *data;
+w.used = 0;
+encode_profile (&w, contents);
+
+if (contents->profile_id)
+  elle_icc_profile_id (*data, *size, *data + 84);
+return TRUE;
+}
+
+
+void elle_icc_profile_id (const cmsUInt8Number *data, 
+                          cmsUInt32Number      size,
+                          cmsUInt8Number       id[16]
+                          )
+{
+cmsUInt8Number header[ICC_HEADER_SIZE];
+md5_context md5;
+
+/* The flags, the rendering intent and the ID itself count as zeros */
+memcpy (header, data, ICC_HEADER_SIZE);
+memset (header + 44, 0, 4);
+memset (header + 64, 0, 4);
+memset (header + 84, 0, 16);
+
+md5_begin (&md5);
+md5_add (&md5, header, ICC_HEADER_SIZE);
+md5_add (&md5, data + ICC_HEADER_SIZE, size - ICC_HEADER_SIZE);
+md5_end (&md5, id);
+}
+
+
+static void encode_profile (icc_writer *w, const elle_V2_rgb_contents *contents)
+{
+static const cmsUInt32Number colorant_signatures[3] = {
+  cmsSigRedColorantTag, cmsSigGreenColorantTag, cmsSigBlueColorantTag };
+static const cmsUInt32Number trc_signatures[3] = {
+  cmsSigRedTRCTag, cmsSigGreenTRCTag, cmsSigBlueTRCTag };
+int tag_count = contents->manufacturer != NULL ? 11 : 10;
+int tag = 0, i;
+cmsUInt32Number offset, size, total_size_at;
+
+/* The header. The size is filled in at the end. */
+total_size_at = w->used;
+put_uint32 (w, 0);
+put_uint32 (w, 0x6C636D73);                     /* 'lcms' */
+put_uint32 (w, 0x02200000);                     /* version 2.2 */
+put_uint32 (w, cmsSigDisplayClass);
+put_uint32 (w, cmsSigRgbData);
+put_uint32 (w, cmsSigXYZData);
+put_uint16 (w, (cmsUInt16Number) (contents->created.tm_year + 1900));
+put_uint16 (w, (cmsUInt16Number) (contents->created.tm_mon + 1));
+put_uint16 (w, (cmsUInt16Number) contents->created.tm_mday);
+put_uint16 (w, (cmsUInt16Number) contents->created.tm_hour);
+put_uint16 (w, (cmsUInt16Number) contents->created.tm_min);
+put_uint16 (w, (cmsUInt16Number) contents->created.tm_sec);
+put_uint32 (w, cmsMagicNumber);
+put_uint32 (w, 0x2A6E6978);                     /* '*nix' */
+put_zeros (w, 4 + 4 + 4 + 8 + 4);               /* flags, maker, model, attributes, intent */
+put_s15Fixed16 (w, cmsD50X);
+put_s15Fixed16 (w, cmsD50Y);
+put_s15Fixed16 (w, cmsD50Z);
+put_uint32 (w, 0x6C636D73);                     /* creator 'lcms' */
+put_zeros (w, 16 + 28);                         /* profile ID, reserved */
+
+/* The tag table, filled in as the tags are written */
+put_uint32 (w, (cmsUInt32Number) tag_count);
+put_zeros (w, 12 * tag_count);
+
+/* The tags, in the templates' order. Each starts on a 4-byte boundary;
+ * the sizes in the table don't include the padding. */
+put_zeros (w, ICC_ALIGN(w->used) - w->used);
+offset = w->used;
+size = put_text_tag (w, contents->copyright);
+put_tag_entry (w, tag++, cmsSigCopyrightTag, offset, size);
+
+put_zeros (w, ICC_ALIGN(w->used) - w->used);
+offset = w->used;
+size = put_XYZ_tag (w, &contents->media_whitepoint);
+put_tag_entry (w, tag++, cmsSigMediaWhitePointTag, offset, size);
+
+put_zeros (w, ICC_ALIGN(w->used) - w->used);
+offset = w->used;
+size = put_XYZ_tag (w, &contents->media_blackpoint);
+put_tag_entry (w, tag++, cmsSigMediaBlackPointTag, offset, size);
+
+for ( i = 0; i < 3; i++ )
+  {
+  put_zeros (w, ICC_ALIGN(w->used) - w->used);
+  offset = w->used;
+  size = put_XYZ_tag (w, &contents->colorants[i]);
+  put_tag_entry (w, tag++, colorant_signatures[i], offset, size);
+  }
+
+/* A shared TRC is written once, and the three entries point at it */
+for ( i = 0; i < 3; i++ )
+  {
+  if (i == 0 || !contents->shared_trc)
+    {
+    put_zeros (w, ICC_ALIGN(w->used) - w->used);
+    offset = w->used;
+    size = put_curve_tag (w, contents);
+    }
+  put_tag_entry (w, tag++, trc_signatures[i], offset, size);
+  }
+
+if (contents->manufacturer != NULL)
+  {
+  put_zeros (w, ICC_ALIGN(w->used) - w->used);
+  offset = w->used;
+  size = put_description_tag (w, contents->manufacturer);
+  put_tag_entry (w, tag++, cmsSigDeviceMfgDescTag, offset, size);
+  }
+
+put_zeros (w, ICC_ALIGN(w->used) - w->used);
+offset = w->used;
+size = put_description_tag (w, contents->description);
+put_tag_entry (w, tag++, cmsSigProfileDescriptionTag, offset, size);
+
+/* The profile size, without padding after the last tag */
+if (w->data != NULL)
+  {
+  cmsUInt32Number used = w->used;
+  w->used = total_size_at;
+  put_uint32 (w, used);
+  w->used = used;
+  }
+}
+
+
+static void put_tag_entry (icc_writer *w, int index, cmsUInt32Number signature, 
+                           cmsUInt32Number offset, cmsUInt32Number size)
+{
+cmsUInt32Number used = w->used;
+
+w->used = ICC_HEADER_SIZE + 4 + 12 * index;
+put_uint32 (w, signature);
+put_uint32 (w, offset);
+put_uint32 (w, size);
+w->used = used;
+}
+
+
+/* A 'text' tag. LCMS 2.7 and 2.8 write the text with two terminating
+ * zeros; so does this, so the profiles keep their old bytes. */
+static cmsUInt32Number put_text_tag (icc_writer *w, const char *text)
+{
+cmsUInt32Number start = w->used;
+cmsUInt32Number length = (cmsUInt32Number) strlen(text);
+
+put_uint32 (w, cmsSigTextType);
+put_zeros (w, 4);
+put_bytes (w, text, length);
+put_zeros (w, 2);
+return w->used - start;
+}
+
+
+/* A V2 'desc' tag: the ASCII text, the same text as UTF-16, and an
+ * empty ScriptCode part. As LCMS 2.7 and 2.8 do, the ASCII count is 
+ * the text with two zeros rounded up to a multiple of 4, and the 
+ * Unicode count is one more than that, which makes the tag size a 
+ * multiple of 4 too. */
+static cmsUInt32Number put_description_tag (icc_writer *w, const char *text)
+{
+cmsUInt32Number start = w->used;
+cmsUInt32Number length = (cmsUInt32Number) strlen(text);
+cmsUInt32Number count = ICC_ALIGN(length + 2);
+cmsUInt32Number i;
+
+put_uint32 (w, cmsSigTextDescriptionType);
+put_zeros (w, 4);
+put_uint32 (w, count);
+put_bytes (w, text, length);
+put_zeros (w, count - length);
+
+put_uint32 (w, 0);                              /* Unicode language code */
+put_uint32 (w, count + 1);
+for ( i = 0; i < length; i++ )
+  put_uint16 (w, (cmsUInt8Number) text[i]);
+put_zeros (w, 2 * (count + 1 - length));
+
+put_uint16 (w, 0);                              /* ScriptCode code */
+put_zeros (w, 1 + 67);                          /* ScriptCode count, text */
+return w->used - start;
+}
+
+
+static cmsUInt32Number put_XYZ_tag (icc_writer *w, const cmsCIEXYZ *xyz)
+{
+put_uint32 (w, cmsSigXYZType);
+put_zeros (w, 4);
+put_s15Fixed16 (w, xyz->X);
+put_s15Fixed16 (w, xyz->Y);
+put_s15Fixed16 (w, xyz->Z);
+return 20;
+}
+
+
+/* A 'curv' tag: one u8Fixed8 gamma, or a table. LCMS makes the 
+ * u8Fixed8 from the s15Fixed16 by dropping the low byte. */
+static cmsUInt32Number put_curve_tag (icc_writer *w, const elle_V2_rgb_contents *contents)
+{
+cmsUInt32Number start = w->used;
+cmsUInt32Number i;
+
+put_uint32 (w, cmsSigCurveType);
+put_zeros (w, 4);
+if (contents->gamma > 0)
+  {
+  put_uint32 (w, 1);
+  cmsInt32Number fixed = (cmsInt32Number) floor (contents->gamma * 65536.0 + 0.5);
+  put_uint16 (w, (cmsUInt16Number) ((fixed >> 8) & 0xFFFF));
+  }
+else
+  {
+  put_uint32 (w, contents->table_entries);
+  for ( i = 0; i < contents->table_entries; i++ )
+    put_uint16 (w, contents->table[i]);
+  }
+return w->used - start;
+}
+
+
+static void put_bytes (icc_writer *w, const void *bytes, cmsUInt32Number count)
+{
+if (w->data != NULL) memcpy (w->data + w->used, bytes, count);
+w->used += count;
+}
+
+
+/* The buffer starts out zeroed */
+static void put_zeros (icc_writer *w, cmsUInt32Number count)
+{
+w->used += count;
+}
+
+
+/* Big-endian, as everything in an ICC profile */
+static void put_uint32 (icc_writer *w, cmsUInt32Number value)
+{
+cmsUInt8Number bytes[4];
+bytes[0] = (cmsUInt8Number) (value >> 24);
+bytes[1] = (cmsUInt8Number) (value >> 16);
+bytes[2] = (cmsUInt8Number) (value >> 8);
+bytes[3] = (cmsUInt8Number) value;
+put_bytes (w, bytes, 4);
+}
+
+
+static void put_uint16 (icc_writer *w, cmsUInt16Number value)
+{
+cmsUInt8Number bytes[2];
+bytes[0] = (cmsUInt8Number) (value >> 8);
+bytes[1] = (cmsUInt8Number) value;
+put_bytes (w, bytes, 2);
+}
+
+
+/* Rounded the way LCMS rounds */
+static void put_s15Fixed16 (icc_writer *w, double value)
+{
+put_uint32 (w, (cmsUInt32Number) (cmsInt32Number) floor (value * 65536.0 + 0.5));
+}
+
+
+/* MD5 (RFC 1321) */
+static void md5_begin (md5_context *md5)
+{
+md5->state[0] = 0x67452301;
+md5->state[1] = 0xEFCDAB89;
+md5->state[2] = 0x98BADCFE;
+md5->state[3] = 0x10325476;
+md5->length = 0;
+}
+
+
+static void md5_add (md5_context *md5, const cmsUInt8Number *data, size_t size)
+{
+size_t filled = (size_t) (md5->length & 63);
+
+md5->length += size;
+if (filled > 0)
+  {
+  size_t take = 64 - filled < size ? 64 - filled : size;
+  memcpy (md5->block + filled, data, take);
+  data += take;
+  size -= take;
+  if (filled + take < 64) return;
+  md5_block (md5->state, md5->block);
+  }
+for ( ; size >= 64; data += 64, size -= 64 )
+  md5_block (md5->state, data);
+memcpy (md5->block, data, size);
+}
+
+
+static void md5_end (md5_context *md5, cmsUInt8Number digest[16])
+{
+cmsUInt8Number padding[72];
+cmsUInt64Number bits = md5->length * 8;
+size_t filled = (size_t) (md5->length & 63);
+size_t pad = filled < 56 ? 56 - filled : 120 - filled;
+int i;
+
+memset (padding, 0, sizeof(padding));
+padding[0] = 0x80;
+for ( i = 0; i < 8; i++ )
+  padding[pad + i] = (cmsUInt8Number) (bits >> (8 * i));
+md5_add (md5, padding, pad + 8);
+
+for ( i = 0; i < 16; i++ )
+  digest[i] = (cmsUInt8Number) (md5->state[i / 4] >> (8 * (i % 4)));
+}
+
+
+static void md5_block (cmsUInt32Number state[4], const cmsUInt8Number block[64])
+{
+static const cmsUInt32Number sines[64] = {
+  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+  0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+  0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+  0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+  0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+  0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391 };
+static const int shifts[16] = { 7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21 };
+cmsUInt32Number words[16], a = state[0], b = state[1], c = state[2], d = state[3];
+int i;
+
+for ( i = 0; i < 16; i++ )
+  words[i] = (cmsUInt32Number) block[4 * i] | (cmsUInt32Number) block[4 * i + 1] << 8 |
+             (cmsUInt32Number) block[4 * i + 2] << 16 | (cmsUInt32Number) block[4 * i + 3] << 24;
+
+for ( i = 0; i < 64; i++ )
+  {
+  cmsUInt32Number f, t;
+  int g;
+  if (i < 16)      { f = (b & c) | (~b & d);  g = i; }
+  else if (i < 32) { f = (d & b) | (~d & c);  g = (5 * i + 1) & 15; }
+  else if (i < 48) { f = b ^ c ^ d;           g = (3 * i + 5) & 15; }
+  else             { f = c ^ (b | ~d);        g = (7 * i) & 15; }
+  t = a + f + sines[i] + words[g];
+  a = d;
+  d = c;
+  c = b;
+  b = b + (t << shifts[(i / 16) * 4 + i % 4] | t >> (32 - shifts[(i / 16) * 4 + i % 4]));
+  }
+
+state[0] += a;
+state[1] += b;
+state[2] += c;
+state[3] += d;
+}
@@ -0,0 +1,74 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+/* Writing the true V2 RGB profiles byte by byte.
+ *
+ * The V2 RGB profiles used to be made by filling in template profiles
+ * read from disk (sampleV2*.icm), whose creation dates had to be
+ * updated with iccToXml and iccFromXml. Here the whole profile is
+ * encoded directly: the header, with the current date, the '*nix' 
+ * platform and the D50 PCS illuminant, the tag table, and the 'text',
+ * 'desc', 'XYZ ' and 'curv' tags, laid out exactly as LCMS 2.7 and 2.8
+ * lay them out when saving a profile made from the templates.
+ *
+ * */
+
+#ifndef ELLES_ICC_WRITER_H
+#define ELLES_ICC_WRITER_H
+
+#include <time.h>
+#include <lcms2.h>
+
+/* What goes into a V2 RGB profile. The strings aren't owned. */
+typedef struct {
+  const char *            copyright;        /* cprt */
+  const char *            manufacturer;     /* dmnd; NULL leaves the tag out */
+  const char *            description;      /* desc */
+  cmsCIEXYZ               media_whitepoint;
+  cmsCIEXYZ               media_blackpoint;
+  cmsCIEXYZ               colorants[3];     /* red, green, blue, D50 adapted */
+  cmsFloat64Number        gamma;            /* > 0: the TRC is this pure gamma */
+  const cmsUInt16Number * table;            /* otherwise the TRC as a table */
+  cmsUInt32Number         table_entries;
+  cmsBool                 shared_trc;       /* one 'curv' tag for all three TRCs */
+  cmsBool                 profile_id;       /* fill in the MD5 profile ID */
+  struct tm               created;          /* UTC */
+} elle_V2_rgb_contents;
+
+/* Encode the profile into *data, allocated with malloc. Returns FALSE
+ * if the memory can't be had. */
+cmsBool elle_write_V2_rgb_profile (const elle_V2_rgb_contents *contents,
+                                   cmsUInt8Number             **data,
+                                   cmsUInt32Number            *size
+                                   );
+
+/* The MD5 profile ID of the serialized profile, computed as the ICC 
+ * specs say: over the whole profile with the header's profile flags,
+ * rendering intent and profile ID fields taken as zeros. */
+void elle_icc_profile_id (const cmsUInt8Number *data, 
+                          cmsUInt32Number      size,
+                          cmsUInt8Number       id[16]
+                          );
+
+#endif
@@ -0,0 +1,316 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+
+/* Checks and times the linear float conversions of elles-linear.c.
+ *
+ * For every "-g10" RGB profile in the profiles folder, converts an
+ * unbounded synthetic float image (values from -0.25 to 1.75) to a 
+ * linear destination profile, with cmsDoTransform and with each of the
+ * elles-linear.c kernels the CPU can run (scalar, SSE2, AVX2), both 
+ * interleaved (RGB RGB ...) and planar (RRR... GGG... BBB...).
+ *
+ * Every kernel's output is compared with cmsDoTransform's. The error
+ * is printed in float epsilons, relative to the larger of 1.0 and the
+ * value; more than MAX_EPSILONS is a failure, and the program then 
+ * exits with 1. The speeds are the fastest of the repeats.
+ *
+ * Sample command line to compile this code:
+ *
+ * gcc -g -O2 -Wall -o elles-linear-bench.exe elles-linear-bench.c elles-linear.c elles-bench-util.c -llcms2 -lm
+ *
+ * Command line options:
+ * -d dir   profiles folder (default: ../profiles/)
+ * -t name  destination profile in that folder 
+ *          (default: sRGB-elle-V4-g10.icc)
+ * -s text  only sources whose name contains text, e.g. "-V4-"
+ * -n N     pixels in the synthetic image (default: 4194304)
+ * -r N     convert the image N times and keep the fastest (default: 3)
+ *
+ * */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <float.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <lcms2.h>
+#include "elles-linear.h"
+#include "elles-bench-util.h"
+#include "elles-linear-bench.h"
+
+#define MAX_EPSILONS 8.0
+
+int main (int argc, char *argv[])
+{
+char *directory = "../profiles/";
+char *destination_name = "sRGB-elle-V4-g10.icc";
+char *source_filter = NULL;
+size_t pixels = 4194304, i;
+int repeats = 3, failures = 0, sources = 0, opt;
+cmsHPROFILE destination;
+cmsFloat32Number *image, *expected, *output;
+DIR *folder;
+struct dirent *entry;
+
+while ((opt = getopt(argc, argv, "d:t:s:n:r:")) != -1)
+  {
+  if (opt == 'd') directory = optarg;
+  else if (opt == 't') destination_name = optarg;
+  else if (opt == 's') source_filter = optarg;
+  else if (opt == 'n') pixels = (size_t) atol(optarg);
+  else if (opt == 'r') repeats = atoi(optarg);
+  else
+    {
+    fprintf(stderr, "usage: %s [-d folder] [-t destination] [-s filter] "
+                    "[-n pixels] [-r repeats]\n", argv[0]);
+    return 1;
+    }
+  }
+if (pixels < 1) pixels = 1;
+if (pixels > 0xFFFFFFFFu) pixels = 0xFFFFFFFFu;   /* cmsDoTransform's limit */
+if (repeats < 1) repeats = 1;
+
+destination = elle_open_profile (NULL, directory, destination_name);
+if (destination == NULL) return 1;
+folder = opendir (directory);
+if (folder == NULL)
+  {
+  fprintf(stderr, "couldn't read the folder %s\n", directory);
+  return 1;
+  }
+
+/* The same unbounded image for every conversion */
+image = (cmsFloat32Number*) malloc (3 * pixels * sizeof(cmsFloat32Number));
+expected = (cmsFloat32Number*) malloc (3 * pixels * sizeof(cmsFloat32Number));
+output = (cmsFloat32Number*) malloc (3 * pixels * sizeof(cmsFloat32Number));
+if (image == NULL || expected == NULL || output == NULL) return 1;
+/* Values from -0.25 to 1.75, so the conversions are checked outside
+ * 0.0 to 1.0 too */
+elle_fill_image (image, pixels, -0.25, 1.75);
+
+printf("to %s, %lu pixels, best kernels: %s\n", destination_name, 
+       (unsigned long) pixels, elle_simd_name (elle_simd_best ()));
+printf("%-36s %-11s %-7s %10s %12s %8s\n", "source", "layout", "kernels", 
+       "error (eps)", "Mpixels/s", "speedup");
+
+while ((entry = readdir (folder)) != NULL)
+  {
+  const char *name = entry->d_name;
+  size_t length = strlen(name);
+  cmsHPROFILE source;
+  elle_linear_transform transform;
+  int planar;
+
+  if (length < 8 || strcmp(name + length - 8, "-g10.icc") != 0) continue;
+  if (strcmp(name, destination_name) == 0) continue;
+  if (source_filter != NULL && strstr(name, source_filter) == NULL) continue;
+  source = elle_open_profile (NULL, directory, name);
+  if (source == NULL) 
+    {
+    failures++;
+    continue;
+    }
+  if (!elle_linear_transform_init (source, destination, INTENT_RELATIVE_COLORIMETRIC, 
+                                   &transform))
+    {
+    printf("%-36s not a linear matrix-shaper pair\n", name);
+    cmsCloseProfile (source);
+    continue;
+    }
+  sources++;
+
+  for ( planar = 0; planar < 2; planar++ )
+    {
+    const char *layout = planar ? "planar" : "interleaved";
+    double lcms_rate = measure_lcms (source, destination, planar, image, expected, 
+                                     pixels, repeats);
+    int level;
+
+    if (lcms_rate <= 0.0)
+      {
+      printf("%-36s %-11s couldn't make the LCMS transform\n", name, layout);
+      failures++;
+      continue;
+      }
+    printf("%-36s %-11s %-7s %10s %12.1f %8s\n", name, layout, "lcms", "", 
+           lcms_rate * 1e-6, "1.00x");
+
+    for ( level = ELLE_SIMD_SCALAR; level <= (int) elle_simd_best (); level++ )
+      {
+      double rate, error = 0.0;
+      transform.level = (elle_simd_level) level;
+      rate = measure_kernel (&transform, planar, image, output, pixels, repeats);
+      for ( i = 0; i < 3 * pixels; i++ )
+        {
+        double difference = fabs ((double) output[i] - expected[i]) / 
+                            (FLT_EPSILON * fmax (1.0, fabs (expected[i])));
+        if (difference > error) error = difference;
+        }
+      printf("%-36s %-11s %-7s %10.2f %12.1f %7.2fx%s\n", name, layout, 
+             elle_simd_name ((elle_simd_level) level), error, rate * 1e-6, 
+             rate / lcms_rate, error > MAX_EPSILONS ? "  FAILED" : "");
+      if (error > MAX_EPSILONS) failures++;
+      }
+    }
+  cmsCloseProfile (source);
+  }
+closedir (folder);
+
+printf("%d sources checked, %d failures\n", sources, failures);
+free (image);
+free (expected);
+free (output);
+cmsCloseProfile (destination);
+return failures == 0 ? 0 : 1;
+}
+
+
+/* Convert image with cmsDoTransform into expected, always interleaved
+ * so it can be compared with any kernel; the planar transform is timed
+ * on a planar copy. Returns pixels per second, or 0 on failure. */
+static double measure_lcms (cmsHPROFILE            source,
+                            cmsHPROFILE            destination,
+                            int                    planar,
+                            const cmsFloat32Number *image,
+                            cmsFloat32Number       *expected,
+                            size_t                 pixels,
+                            int                    repeats
+                            )
+{
+cmsUInt32Number format = planar ? (TYPE_RGB_FLT | PLANAR_SH(1)) : TYPE_RGB_FLT;
+cmsFloat32Number *input = (cmsFloat32Number*) image, *output = expected;
+cmsHTRANSFORM transform = cmsCreateTransform (source, format, destination, format, 
+                                              INTENT_RELATIVE_COLORIMETRIC, 0);
+double seconds, best = 0.0;
+struct timespec start;
+size_t i;
+int r;
+
+if (transform == NULL) return 0.0;
+if (planar)
+  {
+  input = (cmsFloat32Number*) malloc (3 * pixels * sizeof(cmsFloat32Number));
+  output = (cmsFloat32Number*) malloc (3 * pixels * sizeof(cmsFloat32Number));
+  if (input == NULL || output == NULL) exit (1);
+  to_planar (image, input, pixels);
+  }
+
+for ( r = 0; r < repeats; r++ )
+  {
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  cmsDoTransform (transform, input, output, (cmsUInt32Number) pixels);
+  seconds = elle_elapsed_seconds (start);
+  if (r == 0 || seconds < best) best = seconds;
+  }
+cmsDeleteTransform (transform);
+
+if (planar)
+  {
+  /* back to interleaved, to compare */
+  for ( i = 0; i < pixels; i++ )
+    {
+    expected[3 * i] = output[i];
+    expected[3 * i + 1] = output[pixels + i];
+    expected[3 * i + 2] = output[2 * pixels + i];
+    }
+  free (input);
+  free (output);
+  }
+return best > 0.0 ? pixels / best : 0.0;
+}
+
+
+/* Convert image with the kernels of transform into output, which is
+ * left interleaved for the comparison. Returns pixels per second. */
+static double measure_kernel (const elle_linear_transform *transform,
+                              int                         planar,
+                              const cmsFloat32Number      *image,
+                              cmsFloat32Number            *output,
+                              size_t                      pixels,
+                              int                         repeats
+                              )
+{
+cmsFloat32Number *input_planes = NULL, *output_planes = NULL;
+double seconds, best = 0.0;
+struct timespec start;
+size_t i;
+int r;
+
+if (planar)
+  {
+  input_planes = (cmsFloat32Number*) malloc (3 * pixels * sizeof(cmsFloat32Number));
+  output_planes = (cmsFloat32Number*) malloc (3 * pixels * sizeof(cmsFloat32Number));
+  if (input_planes == NULL || output_planes == NULL) exit (1);
+  to_planar (image, input_planes, pixels);
+  }
+
+for ( r = 0; r < repeats; r++ )
+  {
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  if (planar)
+    {
+    const cmsFloat32Number *in[3];
+    cmsFloat32Number *out[3];
+    in[0] = input_planes;
+    in[1] = input_planes + pixels;
+    in[2] = input_planes + 2 * pixels;
+    out[0] = output_planes;
+    out[1] = output_planes + pixels;
+    out[2] = output_planes + 2 * pixels;
+    elle_linear_planar (transform, in, out, pixels);
+    }
+  else elle_linear_interleaved (transform, image, output, pixels);
+  seconds = elle_elapsed_seconds (start);
+  if (r == 0 || seconds < best) best = seconds;
+  }
+
+if (planar)
+  {
+  for ( i = 0; i < pixels; i++ )
+    {
+    output[3 * i] = output_planes[i];
+    output[3 * i + 1] = output_planes[pixels + i];
+    output[3 * i + 2] = output_planes[2 * pixels + i];
+    }
+  free (input_planes);
+  free (output_planes);
+  }
+return best > 0.0 ? pixels / best : 0.0;
+}
+
+
+static void to_planar (const cmsFloat32Number *image, cmsFloat32Number *planes, size_t pixels)
+{
+size_t i;
+for ( i = 0; i < pixels; i++ )
+  {
+  planes[i] = image[3 * i];
+  planes[pixels + i] = image[3 * i + 1];
+  planes[2 * pixels + i] = image[3 * i + 2];
+  }
+}
@@ -0,0 +1,43 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+
+static double measure_lcms (cmsHPROFILE            source,
+                            cmsHPROFILE            destination,
+                            int                    planar,
+                            const cmsFloat32Number *image,
+                            cmsFloat32Number       *expected,
+                            size_t                 pixels,
+                            int                    repeats
+                            );
+
+static double measure_kernel (const elle_linear_transform *transform,
+                              int                         planar,
+                              const cmsFloat32Number      *image,
+                              cmsFloat32Number            *output,
+                              size_t                      pixels,
+                              int                         repeats
+                              );
+
+static void to_planar (const cmsFloat32Number *image, cmsFloat32Number *planes, size_t pixels);
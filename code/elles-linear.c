@@ -0,0 +1,391 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <lcms2.h>
+#include "elles-linear.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ELLE_X86 1
+#include <immintrin.h>
+#endif
+
+static cmsBool read_linear_colorants (cmsHPROFILE profile, cmsFloat64Number matrix[9]);
+
+static void interleaved_scalar (const cmsFloat64Number *m, const cmsFloat32Number *input,
+                                cmsFloat32Number *output, size_t pixels);
+
+static void planar_scalar (const cmsFloat64Number *m, const cmsFloat32Number *const input[3],
+                           cmsFloat32Number *const output[3], size_t first, size_t pixels);
+
+#ifdef ELLE_X86
+static void interleaved_sse2 (const elle_linear_transform *transform,
+                              const cmsFloat32Number *input,
+                              cmsFloat32Number *output, size_t pixels);
+
+static void planar_sse2 (const elle_linear_transform *transform,
+                         const cmsFloat32Number *const input[3],
+                         cmsFloat32Number *const output[3], size_t pixels);
+
+static void interleaved_avx2 (const elle_linear_transform *transform,
+                              const cmsFloat32Number *input,
+                              cmsFloat32Number *output, size_t pixels);
+
+static void planar_avx2 (const elle_linear_transform *transform,
+                         const cmsFloat32Number *const input[3],
+                         cmsFloat32Number *const output[3], size_t pixels);
+#endif
+
+
+cmsBool elle_linear_transform_init (cmsHPROFILE            source,
+                                    cmsHPROFILE            destination,
+                                    cmsUInt32Number        intent,
+                                    elle_linear_transform  *transform
+                                    )
+{
+cmsFloat64Number source_matrix[9], destination_matrix[9], inverse[9];
+int row, column;
+
+memset (transform, 0, sizeof(elle_linear_transform));
+if (intent == INTENT_ABSOLUTE_COLORIMETRIC) return FALSE;
+if (!read_linear_colorants (source, source_matrix) ||
+    !read_linear_colorants (destination, destination_matrix) ||
+    !elle_invert_matrix (destination_matrix, inverse)) return FALSE;
+
+/* As LCMS joins the two matrices of the pipeline, in double */
+for ( row = 0; row < 3; row++ )
+  for ( column = 0; column < 3; column++ )
+    {
+    transform->matrix[3 * row + column] = 
+      inverse[3 * row] * source_matrix[column] +
+      inverse[3 * row + 1] * source_matrix[3 + column] +
+      inverse[3 * row + 2] * source_matrix[6 + column];
+    transform->float_matrix[3 * row + column] = 
+      (cmsFloat32Number) transform->matrix[3 * row + column];
+    }
+transform->level = elle_simd_best ();
+return TRUE;
+}
+
+
+elle_simd_level elle_simd_best (void)
+{
+#ifdef ELLE_X86
+__builtin_cpu_init ();
+if (__builtin_cpu_supports ("avx2") && __builtin_cpu_supports ("fma")) return ELLE_SIMD_AVX2;
+if (__builtin_cpu_supports ("sse2")) return ELLE_SIMD_SSE2;
+#endif
+return ELLE_SIMD_SCALAR;
+}
+
+
+const char* elle_simd_name (elle_simd_level level)
+{
+if (level == ELLE_SIMD_AVX2) return "avx2";
+if (level == ELLE_SIMD_SSE2) return "sse2";
+return "scalar";
+}
+
+
+void elle_linear_interleaved (const elle_linear_transform *transform,
+                              const cmsFloat32Number      *input,
+                              cmsFloat32Number            *output,
+                              size_t                      pixels
+                              )
+{
+#ifdef ELLE_X86
+if (transform->level == ELLE_SIMD_AVX2)
+  {
+  interleaved_avx2 (transform, input, output, pixels);
+  return;
+  }
+if (transform->level == ELLE_SIMD_SSE2)
+  {
+  interleaved_sse2 (transform, input, output, pixels);
+  return;
+  }
+#endif
+interleaved_scalar (transform->matrix, input, output, pixels);
+}
+
+
+void elle_linear_planar (const elle_linear_transform *transform,
+                         const cmsFloat32Number      *const input[3],
+                         cmsFloat32Number            *const output[3],
+                         size_t                      pixels
+                         )
+{
+#ifdef ELLE_X86
+if (transform->level == ELLE_SIMD_AVX2)
+  {
+  planar_avx2 (transform, input, output, pixels);
+  return;
+  }
+if (transform->level == ELLE_SIMD_SSE2)
+  {
+  planar_sse2 (transform, input, output, pixels);
+  return;
+  }
+#endif
+planar_scalar (transform->matrix, input, output, 0, pixels);
+}
+
+
+/* The columns of matrix are the colorants; FALSE unless profile is an
+ * RGB matrix-shaper whose three TRCs are the identity, including 
+ * outside 0.0 to 1.0 */
+static cmsBool read_linear_colorants (cmsHPROFILE profile, cmsFloat64Number matrix[9])
+{
+cmsTagSignature colorant_tags[3] = { cmsSigRedColorantTag, cmsSigGreenColorantTag, 
+                                     cmsSigBlueColorantTag };
+cmsTagSignature trc_tags[3] = { cmsSigRedTRCTag, cmsSigGreenTRCTag, cmsSigBlueTRCTag };
+cmsFloat32Number probes[5] = { -0.5f, 0.001f, 0.18f, 1.0f, 4.0f };
+int c, p;
+
+if (cmsGetColorSpace (profile) != cmsSigRgbData || !cmsIsMatrixShaper (profile)) 
+  return FALSE;
+for ( c = 0; c < 3; c++ )
+  {
+  cmsCIEXYZ *colorant = (cmsCIEXYZ*) cmsReadTag (profile, colorant_tags[c]);
+  cmsToneCurve *trc = (cmsToneCurve*) cmsReadTag (profile, trc_tags[c]);
+  if (colorant == NULL || trc == NULL) return FALSE;
+  for ( p = 0; p < 5; p++ )
+    if (fabsf (cmsEvalToneCurveFloat (trc, probes[p]) - probes[p]) > 1e-6f * fabsf (probes[p]))
+      return FALSE;
+  matrix[c] = colorant->X;
+  matrix[3 + c] = colorant->Y;
+  matrix[6 + c] = colorant->Z;
+  }
+return TRUE;
+}
+
+
+cmsBool elle_invert_matrix (const cmsFloat64Number matrix[9], cmsFloat64Number inverse[9])
+{
+cmsFloat64Number determinant = 
+  matrix[0] * (matrix[4] * matrix[8] - matrix[5] * matrix[7]) -
+  matrix[1] * (matrix[3] * matrix[8] - matrix[5] * matrix[6]) +
+  matrix[2] * (matrix[3] * matrix[7] - matrix[4] * matrix[6]);
+
+if (fabs (determinant) < 1e-12) return FALSE;
+inverse[0] = (matrix[4] * matrix[8] - matrix[5] * matrix[7]) / determinant;
+inverse[1] = (matrix[2] * matrix[7] - matrix[1] * matrix[8]) / determinant;
+inverse[2] = (matrix[1] * matrix[5] - matrix[2] * matrix[4]) / determinant;
+inverse[3] = (matrix[5] * matrix[6] - matrix[3] * matrix[8]) / determinant;
+inverse[4] = (matrix[0] * matrix[8] - matrix[2] * matrix[6]) / determinant;
+inverse[5] = (matrix[2] * matrix[3] - matrix[0] * matrix[5]) / determinant;
+inverse[6] = (matrix[3] * matrix[7] - matrix[4] * matrix[6]) / determinant;
+inverse[7] = (matrix[1] * matrix[6] - matrix[0] * matrix[7]) / determinant;
+inverse[8] = (matrix[0] * matrix[4] - matrix[1] * matrix[3]) / determinant;
+return TRUE;
+}
+
+
+/* ***************************** KERNELS ***************************** */
+
+/* The scalar kernels add up in double, as LCMS's matrix stages do, so
+ * they give LCMS's results to the last bit or so. */
+static void interleaved_scalar (const cmsFloat64Number *m, const cmsFloat32Number *input,
+                                cmsFloat32Number *output, size_t pixels)
+{
+size_t i;
+for ( i = 0; i < pixels; i++, input += 3, output += 3 )
+  {
+  cmsFloat64Number r = input[0], g = input[1], b = input[2];
+  output[0] = (cmsFloat32Number) (m[0] * r + m[1] * g + m[2] * b);
+  output[1] = (cmsFloat32Number) (m[3] * r + m[4] * g + m[5] * b);
+  output[2] = (cmsFloat32Number) (m[6] * r + m[7] * g + m[8] * b);
+  }
+}
+
+
+static void planar_scalar (const cmsFloat64Number *m, const cmsFloat32Number *const input[3],
+                           cmsFloat32Number *const output[3], size_t first, size_t pixels)
+{
+size_t i;
+for ( i = first; i < pixels; i++ )
+  {
+  cmsFloat64Number r = input[0][i], g = input[1][i], b = input[2][i];
+  output[0][i] = (cmsFloat32Number) (m[0] * r + m[1] * g + m[2] * b);
+  output[1][i] = (cmsFloat32Number) (m[3] * r + m[4] * g + m[5] * b);
+  output[2][i] = (cmsFloat32Number) (m[6] * r + m[7] * g + m[8] * b);
+  }
+}
+
+
+#ifdef ELLE_X86
+
+/* The SIMD kernels work on four (SSE2) or eight (AVX2) pixels at a
+ * time, and finish the rest with the scalar kernels. Interleaved 
+ * pixels are loaded as three registers, a = r0 g0 b0 r1, b = g1 b1 r2
+ * g2, c = b2 r3 g3 b3, and shuffled into R, G and B; AVX2 does the 
+ * same in each 128-bit half, with pixels 0-3 in the low halves and
+ * 4-7 in the high ones. */
+
+__attribute__((target("sse2")))
+static void interleaved_sse2 (const elle_linear_transform *transform,
+                              const cmsFloat32Number *input,
+                              cmsFloat32Number *output, size_t pixels)
+{
+const cmsFloat32Number *m = transform->float_matrix;
+__m128 m0 = _mm_set1_ps (m[0]), m1 = _mm_set1_ps (m[1]), m2 = _mm_set1_ps (m[2]);
+__m128 m3 = _mm_set1_ps (m[3]), m4 = _mm_set1_ps (m[4]), m5 = _mm_set1_ps (m[5]);
+__m128 m6 = _mm_set1_ps (m[6]), m7 = _mm_set1_ps (m[7]), m8 = _mm_set1_ps (m[8]);
+size_t i;
+
+for ( i = 0; i + 4 <= pixels; i += 4, input += 12, output += 12 )
+  {
+  __m128 a = _mm_loadu_ps (input), b = _mm_loadu_ps (input + 4), c = _mm_loadu_ps (input + 8);
+  __m128 t0 = _mm_shuffle_ps (a, b, _MM_SHUFFLE(1, 0, 2, 1));    /* g0 b0 g1 b1 */
+  __m128 t1 = _mm_shuffle_ps (b, c, _MM_SHUFFLE(2, 1, 3, 2));    /* r2 g2 r3 g3 */
+  __m128 r = _mm_shuffle_ps (a, t1, _MM_SHUFFLE(2, 0, 3, 0));
+  __m128 g = _mm_shuffle_ps (t0, t1, _MM_SHUFFLE(3, 1, 2, 0));
+  __m128 bl = _mm_shuffle_ps (t0, c, _MM_SHUFFLE(3, 0, 3, 1));
+  __m128 x = _mm_add_ps (_mm_add_ps (_mm_mul_ps (m0, r), _mm_mul_ps (m1, g)), _mm_mul_ps (m2, bl));
+  __m128 y = _mm_add_ps (_mm_add_ps (_mm_mul_ps (m3, r), _mm_mul_ps (m4, g)), _mm_mul_ps (m5, bl));
+  __m128 z = _mm_add_ps (_mm_add_ps (_mm_mul_ps (m6, r), _mm_mul_ps (m7, g)), _mm_mul_ps (m8, bl));
+  /* and back: x0 y0 z0 x1, y1 z1 x2 y2, z2 x3 y3 z3 */
+  __m128 u = _mm_shuffle_ps (x, y, _MM_SHUFFLE(2, 0, 2, 0));     /* x0 x2 y0 y2 */
+  __m128 v = _mm_shuffle_ps (x, y, _MM_SHUFFLE(3, 1, 3, 1));     /* x1 x3 y1 y3 */
+  __m128 p = _mm_shuffle_ps (z, v, _MM_SHUFFLE(0, 0, 0, 0));     /* z0 z0 x1 x1 */
+  __m128 q = _mm_shuffle_ps (v, z, _MM_SHUFFLE(1, 1, 2, 2));     /* y1 y1 z1 z1 */
+  __m128 w = _mm_shuffle_ps (u, u, _MM_SHUFFLE(3, 3, 1, 1));     /* x2 x2 y2 y2 */
+  __m128 s = _mm_shuffle_ps (z, v, _MM_SHUFFLE(1, 1, 2, 2));     /* z2 z2 x3 x3 */
+  __m128 t = _mm_shuffle_ps (v, z, _MM_SHUFFLE(3, 3, 3, 3));     /* y3 y3 z3 z3 */
+  _mm_storeu_ps (output, _mm_shuffle_ps (u, p, _MM_SHUFFLE(2, 0, 2, 0)));
+  _mm_storeu_ps (output + 4, _mm_shuffle_ps (q, w, _MM_SHUFFLE(2, 0, 2, 0)));
+  _mm_storeu_ps (output + 8, _mm_shuffle_ps (s, t, _MM_SHUFFLE(2, 0, 2, 0)));
+  }
+interleaved_scalar (transform->matrix, input, output, pixels - i);
+}
+
+
+__attribute__((target("sse2")))
+static void planar_sse2 (const elle_linear_transform *transform,
+                         const cmsFloat32Number *const input[3],
+                         cmsFloat32Number *const output[3], size_t pixels)
+{
+const cmsFloat32Number *m = transform->float_matrix;
+__m128 m0 = _mm_set1_ps (m[0]), m1 = _mm_set1_ps (m[1]), m2 = _mm_set1_ps (m[2]);
+__m128 m3 = _mm_set1_ps (m[3]), m4 = _mm_set1_ps (m[4]), m5 = _mm_set1_ps (m[5]);
+__m128 m6 = _mm_set1_ps (m[6]), m7 = _mm_set1_ps (m[7]), m8 = _mm_set1_ps (m[8]);
+size_t i;
+
+for ( i = 0; i + 4 <= pixels; i += 4 )
+  {
+  __m128 r = _mm_loadu_ps (input[0] + i), g = _mm_loadu_ps (input[1] + i);
+  __m128 b = _mm_loadu_ps (input[2] + i);
+  _mm_storeu_ps (output[0] + i, _mm_add_ps (_mm_add_ps (_mm_mul_ps (m0, r), _mm_mul_ps (m1, g)), 
+                                            _mm_mul_ps (m2, b)));
+  _mm_storeu_ps (output[1] + i, _mm_add_ps (_mm_add_ps (_mm_mul_ps (m3, r), _mm_mul_ps (m4, g)), 
+                                            _mm_mul_ps (m5, b)));
+  _mm_storeu_ps (output[2] + i, _mm_add_ps (_mm_add_ps (_mm_mul_ps (m6, r), _mm_mul_ps (m7, g)), 
+                                            _mm_mul_ps (m8, b)));
+  }
+planar_scalar (transform->matrix, input, output, i, pixels);
+}
+
+
+__attribute__((target("avx2,fma")))
+static inline __m256 load_halves (const cmsFloat32Number *low, const cmsFloat32Number *high)
+{
+return _mm256_insertf128_ps (_mm256_castps128_ps256 (_mm_loadu_ps (low)), 
+                             _mm_loadu_ps (high), 1);
+}
+
+
+__attribute__((target("avx2,fma")))
+static inline void store_halves (cmsFloat32Number *low, cmsFloat32Number *high, __m256 value)
+{
+_mm_storeu_ps (low, _mm256_castps256_ps128 (value));
+_mm_storeu_ps (high, _mm256_extractf128_ps (value, 1));
+}
+
+
+__attribute__((target("avx2,fma")))
+static void interleaved_avx2 (const elle_linear_transform *transform,
+                              const cmsFloat32Number *input,
+                              cmsFloat32Number *output, size_t pixels)
+{
+const cmsFloat32Number *m = transform->float_matrix;
+__m256 m0 = _mm256_set1_ps (m[0]), m1 = _mm256_set1_ps (m[1]), m2 = _mm256_set1_ps (m[2]);
+__m256 m3 = _mm256_set1_ps (m[3]), m4 = _mm256_set1_ps (m[4]), m5 = _mm256_set1_ps (m[5]);
+__m256 m6 = _mm256_set1_ps (m[6]), m7 = _mm256_set1_ps (m[7]), m8 = _mm256_set1_ps (m[8]);
+size_t i;
+
+for ( i = 0; i + 8 <= pixels; i += 8, input += 24, output += 24 )
+  {
+  __m256 a = load_halves (input, input + 12);
+  __m256 b = load_halves (input + 4, input + 16);
+  __m256 c = load_halves (input + 8, input + 20);
+  __m256 t0 = _mm256_shuffle_ps (a, b, _MM_SHUFFLE(1, 0, 2, 1));
+  __m256 t1 = _mm256_shuffle_ps (b, c, _MM_SHUFFLE(2, 1, 3, 2));
+  __m256 r = _mm256_shuffle_ps (a, t1, _MM_SHUFFLE(2, 0, 3, 0));
+  __m256 g = _mm256_shuffle_ps (t0, t1, _MM_SHUFFLE(3, 1, 2, 0));
+  __m256 bl = _mm256_shuffle_ps (t0, c, _MM_SHUFFLE(3, 0, 3, 1));
+  __m256 x = _mm256_fmadd_ps (m2, bl, _mm256_fmadd_ps (m1, g, _mm256_mul_ps (m0, r)));
+  __m256 y = _mm256_fmadd_ps (m5, bl, _mm256_fmadd_ps (m4, g, _mm256_mul_ps (m3, r)));
+  __m256 z = _mm256_fmadd_ps (m8, bl, _mm256_fmadd_ps (m7, g, _mm256_mul_ps (m6, r)));
+  __m256 u = _mm256_shuffle_ps (x, y, _MM_SHUFFLE(2, 0, 2, 0));
+  __m256 v = _mm256_shuffle_ps (x, y, _MM_SHUFFLE(3, 1, 3, 1));
+  __m256 p = _mm256_shuffle_ps (z, v, _MM_SHUFFLE(0, 0, 0, 0));
+  __m256 q = _mm256_shuffle_ps (v, z, _MM_SHUFFLE(1, 1, 2, 2));
+  __m256 w = _mm256_shuffle_ps (u, u, _MM_SHUFFLE(3, 3, 1, 1));
+  __m256 s = _mm256_shuffle_ps (z, v, _MM_SHUFFLE(1, 1, 2, 2));
+  __m256 t = _mm256_shuffle_ps (v, z, _MM_SHUFFLE(3, 3, 3, 3));
+  store_halves (output, output + 12, _mm256_shuffle_ps (u, p, _MM_SHUFFLE(2, 0, 2, 0)));
+  store_halves (output + 4, output + 16, _mm256_shuffle_ps (q, w, _MM_SHUFFLE(2, 0, 2, 0)));
+  store_halves (output + 8, output + 20, _mm256_shuffle_ps (s, t, _MM_SHUFFLE(2, 0, 2, 0)));
+  }
+interleaved_sse2 (transform, input, output, pixels - i);
+}
+
+
+__attribute__((target("avx2,fma")))
+static void planar_avx2 (const elle_linear_transform *transform,
+                         const cmsFloat32Number *const input[3],
+                         cmsFloat32Number *const output[3], size_t pixels)
+{
+const cmsFloat32Number *m = transform->float_matrix;
+__m256 m0 = _mm256_set1_ps (m[0]), m1 = _mm256_set1_ps (m[1]), m2 = _mm256_set1_ps (m[2]);
+__m256 m3 = _mm256_set1_ps (m[3]), m4 = _mm256_set1_ps (m[4]), m5 = _mm256_set1_ps (m[5]);
+__m256 m6 = _mm256_set1_ps (m[6]), m7 = _mm256_set1_ps (m[7]), m8 = _mm256_set1_ps (m[8]);
+size_t i;
+
+for ( i = 0; i + 8 <= pixels; i += 8 )
+  {
+  __m256 r = _mm256_loadu_ps (input[0] + i), g = _mm256_loadu_ps (input[1] + i);
+  __m256 b = _mm256_loadu_ps (input[2] + i);
+  _mm256_storeu_ps (output[0] + i, _mm256_fmadd_ps (m2, b, _mm256_fmadd_ps (m1, g, _mm256_mul_ps (m0, r))));
+  _mm256_storeu_ps (output[1] + i, _mm256_fmadd_ps (m5, b, _mm256_fmadd_ps (m4, g, _mm256_mul_ps (m3, r))));
+  _mm256_storeu_ps (output[2] + i, _mm256_fmadd_ps (m8, b, _mm256_fmadd_ps (m7, g, _mm256_mul_ps (m6, r))));
+  }
+planar_scalar (transform->matrix, input, output, i, pixels);
+}
+
+#endif
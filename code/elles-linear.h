@@ -0,0 +1,92 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+
+/* Fast float conversion between linear RGB profiles.
+ *
+ * Between two matrix-shaper RGB profiles whose TRCs are all linear 
+ * (the "-g10" profiles), a relative colorimetric transform is just one
+ * 3x3 matrix, the inverse of the destination colorants times the 
+ * source colorants. elle_linear_transform_init recognizes such a pair
+ * and computes the matrix the way LCMS does; the conversion functions
+ * then apply it to float pixels, unbounded like LCMS's float 
+ * transforms, with AVX2 and FMA, with SSE2, or with plain C, whichever
+ * the CPU has.
+ *
+ * The results match cmsDoTransform with TYPE_RGB_FLT to within a few 
+ * float epsilons; see elles-linear-bench.c, which checks that.
+ *
+ * */
+
+#ifndef ELLES_LINEAR_H
+#define ELLES_LINEAR_H
+
+#include <stddef.h>
+#include <lcms2.h>
+
+typedef enum {
+  ELLE_SIMD_SCALAR,
+  ELLE_SIMD_SSE2,
+  ELLE_SIMD_AVX2        /* AVX2 and FMA */
+} elle_simd_level;
+
+typedef struct {
+  cmsFloat64Number matrix[9];         /* row-major: out[i] = sum of matrix[3i + j] * in[j] */
+  cmsFloat32Number float_matrix[9];   /* the same, for the SIMD kernels */
+  elle_simd_level  level;             /* the kernels used, set to the best by init */
+} elle_linear_transform;
+
+/* Set up transform from source to destination. Returns FALSE unless 
+ * both are RGB matrix-shaper profiles with linear TRCs, and intent is
+ * one for which LCMS uses the plain matrix (any but absolute). */
+cmsBool elle_linear_transform_init (cmsHPROFILE            source,
+                                    cmsHPROFILE            destination,
+                                    cmsUInt32Number        intent,
+                                    elle_linear_transform  *transform
+                                    );
+
+/* The best kernels this CPU can run */
+elle_simd_level elle_simd_best (void);
+
+/* "scalar", "sse2", "avx2" */
+const char* elle_simd_name (elle_simd_level level);
+
+/* inverse of the row-major 3x3 matrix; FALSE if it is singular */
+cmsBool elle_invert_matrix (const cmsFloat64Number matrix[9], cmsFloat64Number inverse[9]);
+
+/* RGB RGB RGB ... float pixels; output may be input */
+void elle_linear_interleaved (const elle_linear_transform *transform,
+                              const cmsFloat32Number      *input,
+                              cmsFloat32Number            *output,
+                              size_t                      pixels
+                              );
+
+/* Separate R, G and B planes; the output planes may be the input ones */
+void elle_linear_planar (const elle_linear_transform *transform,
+                         const cmsFloat32Number      *const input[3],
+                         cmsFloat32Number            *const output[3],
+                         size_t                      pixels
+                         );
+
+#endif
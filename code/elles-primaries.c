@@ -0,0 +1,481 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <lcms2.h>
+#include "elles-linear.h"
+#include "elles-primaries.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ELLE_X86 1
+#include <immintrin.h>
+#endif
+
+/* The search: each column of the colorant matrix (one primary) is 
+ * moved by -RADIUS to RADIUS steps of 1/65536 in each of X, Y and Z,
+ * which is CANDIDATES choices per column. The first two columns are
+ * searched; the third is whatever makes the rows add up, so it moves 
+ * by up to REACH steps (2 * RADIUS, plus the up to 2 steps the rounded
+ * rows are off by), and its errors are kept in a cube of that size 
+ * holding HUGE_VAL where it would move by more than RADIUS. */
+#define RADIUS       ELLE_PREQUANTIZE_RADIUS
+#define SIDE         (2 * RADIUS + 1)
+#define CANDIDATES   (SIDE * SIDE * SIDE)
+#define PADDED       ((CANDIDATES + 3) & ~3)     /* for four at a time */
+#define REACH        (2 * RADIUS + 2)
+#define CUBE_SIDE    (2 * REACH + 1)
+#define CUBE_SIZE    (CUBE_SIDE * CUBE_SIDE * CUBE_SIDE)
+#define CUBE_CENTER  (REACH * (CUBE_SIDE * CUBE_SIDE + CUBE_SIDE + 1))
+
+typedef struct {
+  cmsFloat64Number  first[PADDED];      /* squared xy error of each first column */
+  cmsFloat64Number  second[PADDED];     /* and second column; HUGE_VAL as padding */
+  cmsFloat64Number  last[CUBE_SIZE];    /* and third column, by its cube index */
+  int               offset[PADDED];     /* a candidate's steps as a cube index offset */
+} prequantize_search;
+
+/* LCMS's Bradford cone matrix (cmswtpnt.c) */
+static const cmsFloat64Number bradford[9] = {
+   0.8951,  0.2664, -0.1614,
+  -0.7502,  1.7135,  0.0367,
+   0.0389, -0.0685,  1.0296 };
+
+static const cmsFloat64Number d50[3] = { cmsD50X, cmsD50Y, cmsD50Z };
+
+static void multiply_matrices (const cmsFloat64Number first[9], 
+                               const cmsFloat64Number second[9], 
+                               cmsFloat64Number       product[9]
+                               );
+
+static cmsBool adaptation_to_d50 (const cmsCIExyY *white, cmsFloat64Number adaptation[9]);
+
+static cmsBool rgb_to_d50 (const cmsCIExyY       *whitepoint,
+                           const cmsCIExyYTRIPLE *primaries,
+                           cmsFloat64Number      colorants[9]
+                           );
+
+static cmsBool reader_matrix (const cmsCIExyY *whitepoint, cmsFloat64Number reader[9]);
+
+static cmsInt32Number to_s15Fixed16 (cmsFloat64Number value);
+
+static cmsFloat64Number read_back_error (const cmsFloat64Number reader[9],
+                                         const cmsInt32Number   colorant[3],
+                                         const cmsCIExyY        *published
+                                         );
+
+static int candidate_index (const int steps[3]);
+
+static int best_second_scalar (const prequantize_search *search, int base, 
+                               cmsFloat64Number limit, cmsFloat64Number *least);
+
+#ifdef ELLE_X86
+static int best_second_avx2 (const prequantize_search *search, int base, 
+                             cmsFloat64Number limit, cmsFloat64Number *least);
+#endif
+
+
+cmsBool elle_check_primaries (const cmsCIExyY       *whitepoint,
+                              const cmsCIExyYTRIPLE *primaries,
+                              const cmsCIExyYTRIPLE *published,
+                              elle_colorant_check   *check
+                              )
+{
+const cmsCIExyY *target[3] = { &published->Red, &published->Green, &published->Blue };
+cmsFloat64Number colorants[9], reader[9];
+int row, column;
+
+if (!rgb_to_d50 (whitepoint, primaries, colorants) ||
+    !reader_matrix (whitepoint, reader))
+  return FALSE;
+
+for ( row = 0; row < 3; row++ )
+  {
+  check->row_error[row] = -to_s15Fixed16 (d50[row]);
+  for ( column = 0; column < 3; column++ )
+    {
+    check->colorants[3 * row + column] = to_s15Fixed16 (colorants[3 * row + column]);
+    check->row_error[row] += check->colorants[3 * row + column];
+    }
+  }
+
+check->xy_error = 0.0;
+for ( column = 0; column < 3; column++ )
+  {
+  cmsInt32Number colorant[3];
+  cmsFloat64Number X, Y, Z, sum, x_error, y_error;
+  for ( row = 0; row < 3; row++ ) colorant[row] = check->colorants[3 * row + column];
+  X = (reader[0] * colorant[0] + reader[1] * colorant[1] + reader[2] * colorant[2]) / 65536.0;
+  Y = (reader[3] * colorant[0] + reader[4] * colorant[1] + reader[5] * colorant[2]) / 65536.0;
+  Z = (reader[6] * colorant[0] + reader[7] * colorant[1] + reader[8] * colorant[2]) / 65536.0;
+  sum = X + Y + Z;
+  if (fabs (sum) < 1e-12) return FALSE;
+  x_error = fabs (X / sum - target[column]->x);
+  y_error = fabs (Y / sum - target[column]->y);
+  if (x_error > check->xy_error) check->xy_error = x_error;
+  if (y_error > check->xy_error) check->xy_error = y_error;
+  }
+return TRUE;
+}
+
+
+cmsBool elle_prequantize_primaries (const cmsCIExyY       *whitepoint,
+                                    const cmsCIExyYTRIPLE *published,
+                                    cmsCIExyYTRIPLE       *prequantized,
+                                    elle_prequantize_stats *stats
+                                    )
+{
+const cmsCIExyY *target[3] = { &published->Red, &published->Green, &published->Blue };
+cmsCIExyY *result[3] = { &prequantized->Red, &prequantized->Green, &prequantized->Blue };
+cmsCIExyY white = *whitepoint;
+cmsFloat64Number reader[9], adaptation[9], from_d50[9];
+cmsFloat64Number best = HUGE_VAL, least;
+cmsInt32Number stored[9];
+int shift[3], steps[3], best_first = -1, best_second = -1, searched = 0;
+int first, second, row, column, i;
+elle_colorant_check before, after;
+prequantize_search *search;
+struct timespec start, end;
+cmsBool avx2 = FALSE;
+
+clock_gettime (CLOCK_MONOTONIC, &start);
+if (!elle_check_primaries (whitepoint, published, published, &before)) return FALSE;
+if (!reader_matrix (whitepoint, reader)) return FALSE;
+
+/* What the rounded rows are short of the white by, which the third 
+ * column makes up for, less what the other two already do */
+for ( row = 0; row < 3; row++ )
+  {
+  shift[row] = -before.row_error[row];
+  if (abs (shift[row]) > REACH - 2 * RADIUS) return FALSE;
+  }
+
+search = (prequantize_search*) malloc (sizeof(prequantize_search));
+if (search == NULL) return FALSE;
+for ( i = 0; i < CUBE_SIZE; i++ ) search->last[i] = HUGE_VAL;
+for ( i = 0; i < PADDED; i++ )
+  {
+  search->first[i] = search->second[i] = HUGE_VAL;
+  search->offset[i] = 0;
+  }
+
+for ( steps[0] = -RADIUS; steps[0] <= RADIUS; steps[0]++ )
+  for ( steps[1] = -RADIUS; steps[1] <= RADIUS; steps[1]++ )
+    for ( steps[2] = -RADIUS; steps[2] <= RADIUS; steps[2]++ )
+      {
+      int candidate = candidate_index (steps);
+      int offset = (steps[0] * CUBE_SIDE + steps[1]) * CUBE_SIDE + steps[2];
+      cmsInt32Number colorant[3];
+      search->offset[candidate] = offset;
+      for ( column = 0; column < 3; column++ )
+        {
+        cmsFloat64Number error;
+        for ( row = 0; row < 3; row++ ) 
+          colorant[row] = before.colorants[3 * row + column] + steps[row];
+        error = read_back_error (reader, colorant, target[column]);
+        if (column == 0) search->first[candidate] = error;
+        else if (column == 1) search->second[candidate] = error;
+        else search->last[CUBE_CENTER + offset] = error;
+        }
+      }
+
+#ifdef ELLE_X86
+avx2 = elle_simd_best () == ELLE_SIMD_AVX2;
+#endif
+
+/* For each first column, the best second column, with the third 
+ * at cube index base - offset[second] */
+for ( first = 0; first < CANDIDATES; first++ )
+  {
+  int base = CUBE_CENTER + (shift[0] * CUBE_SIDE + shift[1]) * CUBE_SIDE + shift[2] 
+             - search->offset[first];
+  if (search->first[first] >= best) continue;
+  searched++;
+#ifdef ELLE_X86
+  if (avx2)
+    second = best_second_avx2 (search, base, best - search->first[first], &least);
+  else
+#endif
+    second = best_second_scalar (search, base, best - search->first[first], &least);
+  if (second >= 0)
+    {
+    best = search->first[first] + least;
+    best_first = first;
+    best_second = second;
+    }
+  }
+
+if (best_first < 0)
+  {
+  free (search);
+  return FALSE;
+  }
+
+/* The chosen matrix, in steps of 1/65536 */
+for ( row = 2; row >= 0; row-- )
+  {
+  int first_step = best_first % SIDE - RADIUS, second_step = best_second % SIDE - RADIUS;
+  best_first /= SIDE;
+  best_second /= SIDE;
+  stored[3 * row] = before.colorants[3 * row] + first_step;
+  stored[3 * row + 1] = before.colorants[3 * row + 1] + second_step;
+  stored[3 * row + 2] = before.colorants[3 * row + 2] + shift[row] - first_step - second_step;
+  }
+free (search);
+
+/* Back to primaries. The colorants must add up to D50 exactly, so the
+ * difference from the s15Fixed16 white (under half a step) is shared 
+ * out over the row, which leaves each colorant at least a third of a
+ * step from where it would round differently. */
+white.Y = 1.0;
+if (!adaptation_to_d50 (&white, adaptation) || !elle_invert_matrix (adaptation, from_d50))
+  return FALSE;
+for ( column = 0; column < 3; column++ )
+  {
+  cmsFloat64Number colorant[3], XYZ[3], sum;
+  for ( row = 0; row < 3; row++ )
+    colorant[row] = (stored[3 * row + column] + 
+                     (d50[row] * 65536.0 - to_s15Fixed16 (d50[row])) / 3.0) / 65536.0;
+  for ( row = 0; row < 3; row++ )
+    XYZ[row] = from_d50[3 * row] * colorant[0] + from_d50[3 * row + 1] * colorant[1] + 
+               from_d50[3 * row + 2] * colorant[2];
+  sum = XYZ[0] + XYZ[1] + XYZ[2];
+  if (fabs (sum) < 1e-12) return FALSE;
+  result[column]->x = XYZ[0] / sum;
+  result[column]->y = XYZ[1] / sum;
+  result[column]->Y = 1.0;
+  }
+
+/* Which LCMS must turn back into the same colorants */
+if (!elle_check_primaries (whitepoint, prequantized, published, &after) ||
+    memcmp (after.colorants, stored, sizeof(stored)) != 0)
+  return FALSE;
+
+if (stats != NULL)
+  {
+  clock_gettime (CLOCK_MONOTONIC, &end);
+  stats->before = before;
+  stats->after = after;
+  stats->candidates = searched * CANDIDATES;
+  stats->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+  }
+return TRUE;
+}
+
+
+static void multiply_matrices (const cmsFloat64Number first[9], 
+                               const cmsFloat64Number second[9], 
+                               cmsFloat64Number       product[9]
+                               )
+{
+int row, column;
+for ( row = 0; row < 3; row++ )
+  for ( column = 0; column < 3; column++ )
+    product[3 * row + column] = first[3 * row] * second[column] + 
+                                first[3 * row + 1] * second[3 + column] + 
+                                first[3 * row + 2] * second[6 + column];
+}
+
+
+/* Bradford from white to D50, as _cmsAdaptationMatrix makes it */
+static cmsBool adaptation_to_d50 (const cmsCIExyY *white, cmsFloat64Number adaptation[9])
+{
+cmsFloat64Number XYZ[3], cone_white[3], cone_d50[3], inverse[9], scaled[9];
+int row, column;
+
+if (fabs (white->y) < 1e-12) return FALSE;
+XYZ[0] = white->x / white->y * white->Y;
+XYZ[1] = white->Y;
+XYZ[2] = (1.0 - white->x - white->y) / white->y * white->Y;
+for ( row = 0; row < 3; row++ )
+  {
+  cone_white[row] = bradford[3 * row] * XYZ[0] + bradford[3 * row + 1] * XYZ[1] + 
+                    bradford[3 * row + 2] * XYZ[2];
+  cone_d50[row] = bradford[3 * row] * d50[0] + bradford[3 * row + 1] * d50[1] + 
+                  bradford[3 * row + 2] * d50[2];
+  if (fabs (cone_white[row]) < 1e-4) return FALSE;
+  }
+if (!elle_invert_matrix (bradford, inverse)) return FALSE;
+for ( row = 0; row < 3; row++ )
+  for ( column = 0; column < 3; column++ )
+    scaled[3 * row + column] = cone_d50[row] / cone_white[row] * bradford[3 * row + column];
+multiply_matrices (inverse, scaled, adaptation);
+return TRUE;
+}
+
+
+/* Linear RGB to D50 XYZ, as _cmsBuildRGB2XYZtransferMatrix makes it 
+ * for cmsCreateRGBProfile: to XYZ with the white at Y = 1, then 
+ * adapted to D50 */
+static cmsBool rgb_to_d50 (const cmsCIExyY       *whitepoint,
+                           const cmsCIExyYTRIPLE *primaries,
+                           cmsFloat64Number      colorants[9]
+                           )
+{
+const cmsCIExyY *primary[3] = { &primaries->Red, &primaries->Green, &primaries->Blue };
+cmsFloat64Number chromaticities[9], inverse[9], to_XYZ[9], adaptation[9];
+cmsFloat64Number white[3], scale[3];
+cmsCIExyY max_white = *whitepoint;
+int row, column;
+
+for ( column = 0; column < 3; column++ )
+  {
+  chromaticities[column] = primary[column]->x;
+  chromaticities[3 + column] = primary[column]->y;
+  chromaticities[6 + column] = 1.0 - primary[column]->x - primary[column]->y;
+  }
+if (!elle_invert_matrix (chromaticities, inverse) || fabs (whitepoint->y) < 1e-12) 
+  return FALSE;
+
+white[0] = whitepoint->x / whitepoint->y;
+white[1] = 1.0;
+white[2] = (1.0 - whitepoint->x - whitepoint->y) / whitepoint->y;
+for ( row = 0; row < 3; row++ )
+  scale[row] = inverse[3 * row] * white[0] + inverse[3 * row + 1] * white[1] + 
+               inverse[3 * row + 2] * white[2];
+for ( row = 0; row < 3; row++ )
+  for ( column = 0; column < 3; column++ )
+    to_XYZ[3 * row + column] = scale[column] * chromaticities[3 * row + column];
+
+max_white.Y = 1.0;
+if (!adaptation_to_d50 (&max_white, adaptation)) return FALSE;
+multiply_matrices (adaptation, to_XYZ, colorants);
+return TRUE;
+}
+
+
+/* D50 back to the white, as a program reading the profile does it:
+ * with the inverse of the s15Fixed16 chromatic adaptation tag */
+static cmsBool reader_matrix (const cmsCIExyY *whitepoint, cmsFloat64Number reader[9])
+{
+cmsFloat64Number adaptation[9];
+int i;
+
+if (!adaptation_to_d50 (whitepoint, adaptation)) return FALSE;
+for ( i = 0; i < 9; i++ ) adaptation[i] = to_s15Fixed16 (adaptation[i]) / 65536.0;
+return elle_invert_matrix (adaptation, reader);
+}
+
+
+/* _cmsDoubleTo15Fixed16 */
+static cmsInt32Number to_s15Fixed16 (cmsFloat64Number value)
+{
+return (cmsInt32Number) floor (value * 65536.0 + 0.5);
+}
+
+
+/* Squared xy distance of a stored colorant, read back, from published */
+static cmsFloat64Number read_back_error (const cmsFloat64Number reader[9],
+                                         const cmsInt32Number   colorant[3],
+                                         const cmsCIExyY        *published
+                                         )
+{
+cmsFloat64Number X = reader[0] * colorant[0] + reader[1] * colorant[1] + reader[2] * colorant[2];
+cmsFloat64Number Y = reader[3] * colorant[0] + reader[4] * colorant[1] + reader[5] * colorant[2];
+cmsFloat64Number Z = reader[6] * colorant[0] + reader[7] * colorant[1] + reader[8] * colorant[2];
+cmsFloat64Number sum = X + Y + Z, x_error, y_error;
+
+if (fabs (sum) < 1e-12 * 65536.0) return HUGE_VAL;
+x_error = X / sum - published->x;
+y_error = Y / sum - published->y;
+return x_error * x_error + y_error * y_error;
+}
+
+
+static int candidate_index (const int steps[3])
+{
+return ((steps[0] + RADIUS) * SIDE + steps[1] + RADIUS) * SIDE + steps[2] + RADIUS;
+}
+
+
+/* The second column with the least second + third error below limit,
+ * the first such if several tie; -1 if none is below it */
+static int best_second_scalar (const prequantize_search *search, int base, 
+                               cmsFloat64Number limit, cmsFloat64Number *least)
+{
+int second, found = -1;
+
+for ( second = 0; second < CANDIDATES; second++ )
+  {
+  cmsFloat64Number error = search->second[second] + 
+                           search->last[base - search->offset[second]];
+  if (error < limit)
+    {
+    limit = error;
+    found = second;
+    }
+  }
+*least = limit;
+return found;
+}
+
+
+#ifdef ELLE_X86
+
+/* The same, four second columns at a time, with the third columns' 
+ * errors gathered from the cube. Each lane keeps its first least 
+ * error, so the lanes together find the same column as the loop. */
+__attribute__((target("avx2,fma")))
+static int best_second_avx2 (const prequantize_search *search, int base, 
+                             cmsFloat64Number limit, cmsFloat64Number *least)
+{
+__m256d lane_least = _mm256_set1_pd (limit);
+__m256d lane_found = _mm256_set1_pd (-1.0);
+__m256d index = _mm256_setr_pd (0.0, 1.0, 2.0, 3.0);
+const __m256d four = _mm256_set1_pd (4.0);
+const __m128i bases = _mm_set1_epi32 (base);
+cmsFloat64Number errors[4], found_at[4];
+int second, lane, found = -1;
+
+for ( second = 0; second < PADDED; second += 4 )
+  {
+  __m128i at = _mm_sub_epi32 (bases, _mm_loadu_si128 ((const __m128i*) (search->offset + second)));
+  __m256d error = _mm256_add_pd (_mm256_loadu_pd (search->second + second),
+                                 _mm256_i32gather_pd (search->last, at, 8));
+  __m256d less = _mm256_cmp_pd (error, lane_least, _CMP_LT_OQ);
+  lane_least = _mm256_blendv_pd (lane_least, error, less);
+  lane_found = _mm256_blendv_pd (lane_found, index, less);
+  index = _mm256_add_pd (index, four);
+  }
+
+_mm256_storeu_pd (errors, lane_least);
+_mm256_storeu_pd (found_at, lane_found);
+for ( lane = 0; lane < 4; lane++ )
+  {
+  int at = (int) found_at[lane];
+  if (at < 0) continue;
+  if (errors[lane] < limit || (errors[lane] == limit && at < found))
+    {
+    limit = errors[lane];
+    found = at;
+    }
+  }
+*least = limit;
+return found;
+}
+
+#endif
@@ -0,0 +1,92 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+/* Prequantizing RGB primaries, so that the colorants of the profiles
+ * made from them add up to the profile white.
+ *
+ * cmsCreateRGBProfile works out the colorant tags from the primaries 
+ * and the white point (adapted to D50 with Bradford) and stores each 
+ * of the nine numbers as s15Fixed16, rounded to 1/65536. Rounded on 
+ * its own, each row of the colorant matrix (the X, Y or Z of red, 
+ * green and blue) can end up 1/65536 away from the same row of the D50
+ * white, so that R = G = B isn't exactly neutral. The built-in 
+ * colorspaces therefore give "prequantized" primaries, a little off 
+ * the published ones, chosen so that every row adds up exactly.
+ *
+ * elle_prequantize_primaries finds such primaries for any colorspace.
+ * It searches the colorant matrices within ELLE_PREQUANTIZE_RADIUS 
+ * steps of 1/65536 of each rounded colorant whose rows add up exactly
+ * to the D50 white, and keeps the one whose primaries, read back 
+ * through the chromatic adaptation tag as a program reading the 
+ * profile would, are nearest the published ones (the least summed 
+ * squared xy distance). It then works back from that matrix to the 
+ * xy primaries that make it, each colorant placed well inside its 
+ * 1/65536 step, so LCMS's own rounding gives the same matrix.
+ *
+ * The search takes a fraction of a millisecond, with AVX2 when the 
+ * CPU has it, so it can be done as each colorspace is read (see the 
+ * "prequantize" key of the make-elles-profiles spec files).
+ *
+ * */
+
+#ifndef ELLES_PRIMARIES_H
+#define ELLES_PRIMARIES_H
+
+#include <lcms2.h>
+
+#define ELLE_PREQUANTIZE_RADIUS  3   /* steps of 1/65536 either way */
+
+/* How the profiles made from a set of primaries turn out */
+typedef struct {
+  cmsInt32Number    colorants[9];    /* s15Fixed16 as stored: rows X, Y, Z; columns R, G, B */
+  cmsInt32Number    row_error[3];    /* each row's sum less the s15Fixed16 D50 white */
+  cmsFloat64Number  xy_error;        /* largest x or y distance of a primary read back */
+} elle_colorant_check;
+
+typedef struct {
+  elle_colorant_check  before;       /* the published primaries */
+  elle_colorant_check  after;        /* the prequantized ones */
+  int                  candidates;   /* colorant matrices searched */
+  cmsFloat64Number     seconds;
+} elle_prequantize_stats;
+
+/* The colorants cmsCreateRGBProfile would store for primaries and 
+ * whitepoint, and how far the primaries read back from them are from 
+ * published. FALSE if the primaries or the white point are degenerate. */
+cmsBool elle_check_primaries (const cmsCIExyY       *whitepoint,
+                              const cmsCIExyYTRIPLE *primaries,
+                              const cmsCIExyYTRIPLE *published,
+                              elle_colorant_check   *check
+                              );
+
+/* Prequantized primaries for the published ones; stats may be NULL. 
+ * FALSE if they're degenerate, or if no colorant matrix close enough 
+ * adds up to the white. */
+cmsBool elle_prequantize_primaries (const cmsCIExyY       *whitepoint,
+                                    const cmsCIExyYTRIPLE *published,
+                                    cmsCIExyYTRIPLE       *prequantized,
+                                    elle_prequantize_stats *stats
+                                    );
+
+#endif
@@ -0,0 +1,616 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+
+/* A long-running server that makes RGB profiles on demand.
+ *
+ * Clients connect to a Unix domain socket and send one request per
+ * line. A profile request gives the profile version, the TRC (as
+ * in the profile file names), the white point and primaries as xy,
+ * and the media white point as XYZ:
+ *
+ *   PROFILE V4 -srgbtrc 0.3127 0.3290 0.64 0.33 0.30 0.60 0.15 0.06 0.95045471 1.0 1.08905029
+ *
+ * and the server answers "OK <size>\n" followed by the size bytes of
+ * the ICC profile, or "ERR <message>\n". "STATS" answers the same way
+ * with the cache counters as text, and "QUIT" closes the connection.
+ *
+ * Profiles are made with elle_make_profile, exactly as the generator
+ * makes them, and named "Custom-elle-V4-srgbtrc.icc" and so on. The
+ * serialized profiles are kept in an LRU cache keyed by (primaries,
+ * white point, media white point, TRC, version), so a repeated request
+ * only costs a hash lookup and a copy.
+ *
+ * Sample command line to compile this code:
+ *
+ * gcc -g -O2 -Wall -o elles-profile-server.exe elles-profile-server.c elles-profiles.c elles-icc-writer.c elles-trc.c elles-arena.c elles-trace.c elles-bench-util.c -llcms2 -lpthread -lm
+ *
+ * Command line options:
+ * -s path  socket to listen on (default: /tmp/elles-profile-server.sock)
+ * -c N     keep at most N profiles in the cache (default: 1024)
+ * -w N     serve at most N connections at once, on N worker threads 
+ *          (default: 16)
+ * -i N     close a connection that takes more than N seconds to send a
+ *          whole request line, or to take a reply (default: 30)
+ *
+ * The main thread only accepts connections, and hands them to the 
+ * workers through a queue of CONNECTION_QUEUE_SIZE. Each worker has 
+ * one arena for all its connections, and serves one connection at a
+ * time, until the client closes it or sends QUIT. When every worker is
+ * busy and the queue is full, the main thread stops accepting, and 
+ * further clients wait in the listen backlog, so no number of clients
+ * can make the server start more threads or arenas. A worker is never
+ * held longer than the idle timeout by a client that sends nothing, 
+ * sends a line a byte at a time, or stops reading its replies.
+ *
+ * */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <lcms2.h>
+#include "elles-profiles.h"
+#include "elles-arena.h"
+#include "elles-bench-util.h"
+#include "elles-profile-server.h"
+
+#define REQUEST_LINE_SIZE 1024
+
+int main (int argc, char *argv[])
+{
+char *socket_path = "/tmp/elles-profile-server.sock";
+int capacity = 1024, workers = 16, idle_seconds = 30, started = 0, i;
+int opt;
+
+while ((opt = getopt(argc, argv, "s:c:w:i:")) != -1)
+  {
+  if (opt == 's') socket_path = optarg;
+  else if (opt == 'c') capacity = atoi(optarg);
+  else if (opt == 'w') workers = atoi(optarg);
+  else if (opt == 'i') idle_seconds = atoi(optarg);
+  else
+    {
+    fprintf(stderr, "usage: %s [-s socket] [-c capacity] [-w workers] [-i idle seconds]\n", argv[0]);
+    return 1;
+    }
+  }
+if (capacity < 1) capacity = 1;
+if (workers < 1) workers = 1;
+if (idle_seconds < 1) idle_seconds = 1;
+
+/* Everything shared by the requests is set up once */
+if (!elle_init_trc_registry ()) return 1;
+
+profile_cache cache;
+memset (&cache, 0, sizeof(cache));
+cache.capacity = capacity;
+cache.bucket_count = 2 * capacity + 1;
+cache.buckets = (cache_entry**) calloc (cache.bucket_count, sizeof(cache_entry*));
+if (cache.buckets == NULL) return 1;
+pthread_mutex_init (&cache.lock, NULL);
+
+connection_queue queue;
+memset (&queue, 0, sizeof(queue));
+queue.cache = &cache;
+queue.idle_seconds = idle_seconds;
+pthread_mutex_init (&queue.lock, NULL);
+pthread_cond_init (&queue.added, NULL);
+pthread_cond_init (&queue.taken, NULL);
+
+/* A client going away mid-reply shouldn't take the server with it */
+signal (SIGPIPE, SIG_IGN);
+
+struct sockaddr_un address;
+memset (&address, 0, sizeof(address));
+address.sun_family = AF_UNIX;
+if (strlen(socket_path) >= sizeof(address.sun_path))
+  {
+  fprintf(stderr, "socket path %s is too long\n", socket_path);
+  return 1;
+  }
+strcpy(address.sun_path, socket_path);
+
+int listener = socket (AF_UNIX, SOCK_STREAM, 0);
+if (listener < 0) { perror ("socket"); return 1; }
+unlink (socket_path);
+if (bind (listener, (struct sockaddr*) &address, sizeof(address)) < 0 ||
+    listen (listener, CONNECTION_QUEUE_SIZE) < 0)
+  {
+  perror (socket_path);
+  return 1;
+  }
+
+pthread_t *threads = (pthread_t*) malloc (workers * sizeof(pthread_t));
+if (threads == NULL) return 1;
+for ( i = 0; i < workers; i++ )
+  if (pthread_create (&threads[started], NULL, connection_worker, &queue) == 0)
+    started++;
+if (started == 0)
+  {
+  fprintf(stderr, "couldn't start any worker threads\n");
+  return 1;
+  }
+printf("listening on %s, caching up to %d profiles, %d workers\n", 
+       socket_path, capacity, started);
+fflush (stdout);
+
+for (;;)
+  {
+  int fd;
+
+  /* Accept only when there's room to queue the connection */
+  pthread_mutex_lock (&queue.lock);
+  while (queue.count == CONNECTION_QUEUE_SIZE)
+    pthread_cond_wait (&queue.taken, &queue.lock);
+  pthread_mutex_unlock (&queue.lock);
+
+  fd = accept (listener, NULL, NULL);
+  if (fd < 0)
+    {
+    if (errno == EINTR) continue;
+    perror ("accept");
+    break;
+    }
+
+  /* A client that stops reading its replies can't hold a worker either */
+  struct timeval send_timeout = { idle_seconds, 0 };
+  setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+
+  pthread_mutex_lock (&queue.lock);
+  queue.fds[(queue.first + queue.count) % CONNECTION_QUEUE_SIZE] = fd;
+  queue.count++;
+  pthread_cond_signal (&queue.added);
+  pthread_mutex_unlock (&queue.lock);
+  }
+
+close (listener);
+unlink (socket_path);
+return 1;
+}
+
+
+/* A worker: one arena, and one connection at a time from the queue */
+static void *connection_worker (void *arg)
+{
+connection_queue *queue = (connection_queue*) arg;
+elle_arena *arena = elle_arena_create ();
+
+for (;;)
+  {
+  int fd;
+  pthread_mutex_lock (&queue->lock);
+  while (queue->count == 0)
+    pthread_cond_wait (&queue->added, &queue->lock);
+  fd = queue->fds[queue->first];
+  queue->first = (queue->first + 1) % CONNECTION_QUEUE_SIZE;
+  queue->count--;
+  pthread_cond_signal (&queue->taken);
+  pthread_mutex_unlock (&queue->lock);
+
+  /* Try again for each connection if the arena couldn't be made */
+  if (arena == NULL) arena = elle_arena_create ();
+  if (arena == NULL) send_error (fd, "out of memory");
+  else serve_connection (arena, queue->cache, queue->idle_seconds, fd);
+  close (fd);
+  }
+return NULL;
+}
+
+
+static void serve_connection (elle_arena    *arena,
+                              profile_cache *cache,
+                              int           idle_seconds,
+                              int           fd
+                              )
+{
+char line[REQUEST_LINE_SIZE], pending[REQUEST_LINE_SIZE];
+size_t pending_length = 0;
+int status;
+
+while ((status = read_request_line (fd, line, sizeof(line), pending,
+                                    &pending_length, idle_seconds)) != 0)
+  {
+  struct timespec start;
+  profile_key key;
+  elle_profile_buffer buffer;
+  char *error;
+
+  if (status < 0)
+    {
+    send_error (fd, status == -2 ? "idle timeout" : "request line too long");
+    break;
+    }
+  clock_gettime (CLOCK_MONOTONIC, &start);
+
+  if (strcmp(line, "QUIT") == 0) break;
+  if (strcmp(line, "STATS") == 0)
+    {
+    char *text = cache_stats_text (cache);
+    if (text == NULL) { send_error (fd, "out of memory"); continue; }
+    send_reply (fd, text, strlen(text));
+    free (text);
+    continue;
+    }
+
+  if (!parse_profile_request (line, &key, &error))
+    {
+    pthread_mutex_lock (&cache->lock);
+    cache->errors++;
+    pthread_mutex_unlock (&cache->lock);
+    send_error (fd, error);
+    continue;
+    }
+
+  if (cache_lookup (cache, &key, &buffer))
+    {
+    send_reply (fd, buffer.data, buffer.size);
+    elle_free_profile_buffer (&buffer);
+    cache_count (cache, 1, elle_elapsed_seconds (start));
+    }
+  else if (make_requested_profile (arena, &key, &buffer))
+    {
+    send_reply (fd, buffer.data, buffer.size);
+    cache_insert (cache, &key, &buffer);
+    cache_count (cache, 0, elle_elapsed_seconds (start));
+    }
+  else
+    {
+    pthread_mutex_lock (&cache->lock);
+    cache->errors++;
+    pthread_mutex_unlock (&cache->lock);
+    send_error (fd, "couldn't make the profile");
+    }
+  }
+}
+
+
+/* Returns 1 with the next line (without its newline) in line, 0 at the
+ * end of the connection, -1 if the line doesn't fit, -2 if the whole 
+ * line hasn't come within idle_seconds. Bytes read past the newline 
+ * are kept in pending for the next call. */
+static int read_request_line (int fd, char *line, size_t size,
+                              char *pending, size_t *pending_length,
+                              int idle_seconds
+                              )
+{
+struct timespec start;
+clock_gettime (CLOCK_MONOTONIC, &start);
+for (;;)
+  {
+  struct pollfd readable = { fd, POLLIN, 0 };
+  int remaining, ready;
+
+  char *newline = memchr (pending, '\n', *pending_length);
+  if (newline != NULL)
+    {
+    size_t length = newline - pending;
+    memcpy (line, pending, length);
+    line[length] = '\0';
+    if (length > 0 && line[length - 1] == '\r') line[length - 1] = '\0';
+    *pending_length -= length + 1;
+    memmove (pending, newline + 1, *pending_length);
+    return 1;
+    }
+  if (*pending_length == size) return -1;
+
+  /* The deadline is for the whole line, so trickling bytes don't reset it */
+  remaining = (int) ((idle_seconds - elle_elapsed_seconds (start)) * 1000.0);
+  if (remaining <= 0) return -2;
+  ready = poll (&readable, 1, remaining);
+  if (ready < 0 && errno == EINTR) continue;
+  if (ready < 0) return 0;
+  if (ready == 0) return -2;
+
+  ssize_t n = read (fd, pending + *pending_length, size - *pending_length);
+  if (n < 0 && errno == EINTR) continue;
+  if (n <= 0) return 0;
+  *pending_length += n;
+  }
+}
+
+
+static cmsBool parse_profile_request (char *line, profile_key *key,
+                                      char **error
+                                      )
+{
+char version[8], suffix[32];
+double wx, wy, rx, ry, gx, gy, bx, by, mwX, mwY, mwZ;
+int consumed = 0;
+
+if (sscanf(line, "PROFILE %7s %31s %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %n",
+           version, suffix, &wx, &wy, &rx, &ry, &gx, &gy, &bx, &by,
+           &mwX, &mwY, &mwZ, &consumed) != 13 || line[consumed] != '\0')
+  {
+  *error = "expected PROFILE <V2|V4> <trc> <wx> <wy> <rx> <ry> <gx> <gy> <bx> <by> <mwX> <mwY> <mwZ>";
+  return FALSE;
+  }
+
+memset (key, 0, sizeof(profile_key));
+if (strcmp(version, "V4") == 0) key->version = 4;
+else if (strcmp(version, "V2") == 0) key->version = 2;
+else
+  {
+  *error = "the profile version must be V2 or V4";
+  return FALSE;
+  }
+if (!elle_trc_from_suffix (suffix, &key->trc))
+  {
+  *error = "unknown TRC; use -g10, -g18, -g22, -srgbtrc, -labl or -rec709";
+  return FALSE;
+  }
+
+/* The y values are divided by when going from xyY to XYZ */
+if (!isfinite(wx + wy + rx + ry + gx + gy + bx + by + mwX + mwY + mwZ) ||
+    wy <= 0.0 || ry == 0.0 || gy == 0.0 || by == 0.0)
+  {
+  *error = "the chromaticities aren't usable";
+  return FALSE;
+  }
+
+key->whitepoint.x = wx;  key->whitepoint.y = wy;  key->whitepoint.Y = 1.0;
+key->primaries.Red.x = rx;   key->primaries.Red.y = ry;   key->primaries.Red.Y = 1.0;
+key->primaries.Green.x = gx; key->primaries.Green.y = gy; key->primaries.Green.Y = 1.0;
+key->primaries.Blue.x = bx;  key->primaries.Blue.y = by;  key->primaries.Blue.Y = 1.0;
+key->media_whitepoint.X = mwX;
+key->media_whitepoint.Y = mwY;
+key->media_whitepoint.Z = mwZ;
+return TRUE;
+}
+
+
+static cmsBool make_requested_profile (elle_arena          *arena,
+                                       const profile_key   *key,
+                                       elle_profile_buffer *buffer
+                                       )
+{
+elle_profile_spec spec;
+cmsBool made = FALSE;
+
+memset (&spec, 0, sizeof(spec));
+spec.kind = ELLE_PROFILE_RGB;
+spec.profile_version = key->version == 2 ? "-V2" : "-V4";
+spec.trc = key->trc;
+spec.basename = "Custom";
+spec.id = "-elle";
+spec.extension = ".icc";
+spec.manufacturer = "Custom chromaticities, made by elles-profile-server";
+spec.whitepoint = key->whitepoint;
+spec.primaries = key->primaries;
+spec.media_whitepoint = key->media_whitepoint;
+
+cmsContext ContextID = elle_arena_begin (arena);
+if (ContextID != NULL)
+  {
+  cmsMLU *copyright = cmsMLUalloc(ContextID, 1);
+  cmsMLUsetASCII(copyright, "en", "US", ELLE_COPYRIGHT_TEXT);
+  made = elle_make_profile (ContextID, &spec, copyright, buffer);
+  cmsMLUfree(copyright);
+  }
+elle_arena_end (arena, ContextID, NULL);
+return made;
+}
+
+
+/* FNV-1a over the key bytes */
+static unsigned long hash_key (const profile_key *key)
+{
+const unsigned char *bytes = (const unsigned char*) key;
+unsigned long hash = 2166136261UL;
+size_t i;
+
+for ( i = 0; i < sizeof(profile_key); i++ )
+  {
+  hash ^= bytes[i];
+  hash *= 16777619UL;
+  }
+return hash;
+}
+
+
+/* On a hit, copies the profile bytes into copy (which the caller
+ * frees) and makes the entry the most recently used. */
+static cmsBool cache_lookup (profile_cache       *cache,
+                             const profile_key   *key,
+                             elle_profile_buffer *copy
+                             )
+{
+cache_entry *entry;
+cmsBool found = FALSE;
+
+pthread_mutex_lock (&cache->lock);
+entry = cache->buckets[hash_key (key) % cache->bucket_count];
+while (entry != NULL && memcmp (&entry->key, key, sizeof(profile_key)) != 0)
+  entry = entry->next_in_bucket;
+
+if (entry != NULL)
+  {
+  copy->data = (cmsUInt8Number*) malloc (entry->buffer.size);
+  if (copy->data != NULL)
+    {
+    memcpy (copy->data, entry->buffer.data, entry->buffer.size);
+    copy->size = entry->buffer.size;
+    found = TRUE;
+
+    /* Move to the front of the LRU list */
+    if (cache->newest != entry)
+      {
+      entry->newer->older = entry->older;
+      if (entry->older) entry->older->newer = entry->newer;
+      else cache->oldest = entry->newer;
+      entry->newer = NULL;
+      entry->older = cache->newest;
+      cache->newest->newer = entry;
+      cache->newest = entry;
+      }
+    }
+  }
+pthread_mutex_unlock (&cache->lock);
+return found;
+}
+
+
+/* Takes over buffer. If another connection cached the same profile
+ * while this one was making it, the new copy is dropped. */
+static void cache_insert (profile_cache       *cache,
+                          const profile_key   *key,
+                          elle_profile_buffer *buffer
+                          )
+{
+unsigned long bucket = hash_key (key) % cache->bucket_count;
+cache_entry *entry;
+
+pthread_mutex_lock (&cache->lock);
+for ( entry = cache->buckets[bucket]; entry != NULL; entry = entry->next_in_bucket )
+  if (memcmp (&entry->key, key, sizeof(profile_key)) == 0) break;
+if (entry != NULL || (entry = (cache_entry*) malloc (sizeof(cache_entry))) == NULL)
+  {
+  pthread_mutex_unlock (&cache->lock);
+  elle_free_profile_buffer (buffer);
+  return;
+  }
+
+while (cache->count >= cache->capacity)
+  {
+  cache_entry *oldest = cache->oldest;
+  unlink_entry (cache, oldest);
+  cache->bytes -= oldest->buffer.size;
+  elle_free_profile_buffer (&oldest->buffer);
+  free (oldest);
+  cache->evictions++;
+  }
+
+entry->key = *key;
+entry->buffer = *buffer;
+entry->next_in_bucket = cache->buckets[bucket];
+cache->buckets[bucket] = entry;
+entry->newer = NULL;
+entry->older = cache->newest;
+if (cache->newest) cache->newest->newer = entry;
+else cache->oldest = entry;
+cache->newest = entry;
+cache->count++;
+cache->bytes += buffer->size;
+pthread_mutex_unlock (&cache->lock);
+}
+
+
+/* Remove an entry from its bucket and from the LRU list.
+ * Called with the cache lock held. */
+static void unlink_entry (profile_cache *cache, cache_entry *entry)
+{
+cache_entry **link = &cache->buckets[hash_key (&entry->key) % cache->bucket_count];
+while (*link != entry) link = &(*link)->next_in_bucket;
+*link = entry->next_in_bucket;
+
+if (entry->newer) entry->newer->older = entry->older;
+else cache->newest = entry->older;
+if (entry->older) entry->older->newer = entry->newer;
+else cache->oldest = entry->newer;
+cache->count--;
+}
+
+
+static void cache_count (profile_cache *cache, int hit, double seconds)
+{
+pthread_mutex_lock (&cache->lock);
+if (hit)
+  {
+  cache->hits++;
+  cache->hit_seconds += seconds;
+  if (seconds > cache->max_hit_seconds) cache->max_hit_seconds = seconds;
+  }
+else
+  {
+  cache->misses++;
+  cache->miss_seconds += seconds;
+  if (seconds > cache->max_miss_seconds) cache->max_miss_seconds = seconds;
+  }
+pthread_mutex_unlock (&cache->lock);
+}
+
+
+static char* cache_stats_text (profile_cache *cache)
+{
+char *text = (char*) malloc (1024);
+if (text == NULL) return NULL;
+
+pthread_mutex_lock (&cache->lock);
+snprintf(text, 1024,
+         "profiles %d of %d, %zu bytes\n"
+         "hits %lu, mean %.1f us, max %.1f us\n"
+         "misses %lu, mean %.1f us, max %.1f us\n"
+         "evictions %lu\n"
+         "errors %lu\n",
+         cache->count, cache->capacity, cache->bytes,
+         cache->hits,
+         cache->hits ? 1e6 * cache->hit_seconds / cache->hits : 0.0,
+         1e6 * cache->max_hit_seconds,
+         cache->misses,
+         cache->misses ? 1e6 * cache->miss_seconds / cache->misses : 0.0,
+         1e6 * cache->max_miss_seconds,
+         cache->evictions, cache->errors);
+pthread_mutex_unlock (&cache->lock);
+return text;
+}
+
+
+static cmsBool write_all (int fd, const void *data, size_t size)
+{
+const char *bytes = (const char*) data;
+while (size > 0)
+  {
+  ssize_t n = write (fd, bytes, size);
+  if (n < 0 && errno == EINTR) continue;
+  if (n <= 0) return FALSE;
+  bytes += n;
+  size -= n;
+  }
+return TRUE;
+}
+
+
+static cmsBool send_reply (int fd, const void *data, size_t size)
+{
+char header[32];
+snprintf(header, sizeof(header), "OK %zu\n", size);
+return write_all (fd, header, strlen(header)) && write_all (fd, data, size);
+}
+
+
+static void send_error (int fd, const char *message)
+{
+write_all (fd, "ERR ", 4);
+write_all (fd, message, strlen(message));
+write_all (fd, "\n", 1);
+}
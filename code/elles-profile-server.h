@@ -0,0 +1,122 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+
+/* What identifies a cached profile. Built with memset first, so the
+ * padding is zero and the key can be hashed and compared as bytes. */
+typedef struct {
+  cmsCIExyYTRIPLE  primaries;
+  cmsCIExyY        whitepoint;
+  cmsCIEXYZ        media_whitepoint;
+  elle_trc         trc;
+  int              version;        /* 2 or 4 */
+} profile_key;
+
+typedef struct cache_entry {
+  profile_key          key;
+  elle_profile_buffer  buffer;
+  struct cache_entry * newer;       /* LRU list, most recently used first */
+  struct cache_entry * older;
+  struct cache_entry * next_in_bucket;
+} cache_entry;
+
+typedef struct {
+  cache_entry **   buckets;
+  int              bucket_count;
+  int              count;
+  int              capacity;        /* most profiles kept */
+  cache_entry *    newest;
+  cache_entry *    oldest;
+  size_t           bytes;
+  /* counters */
+  unsigned long    hits;
+  unsigned long    misses;
+  unsigned long    evictions;
+  unsigned long    errors;
+  double           hit_seconds;     /* summed latency of hits */
+  double           miss_seconds;    /* summed latency of misses */
+  double           max_hit_seconds;
+  double           max_miss_seconds;
+  pthread_mutex_t  lock;
+} profile_cache;
+
+#define CONNECTION_QUEUE_SIZE 64    /* also the listen backlog */
+
+/* Accepted connections waiting for a worker: a ring of fds */
+typedef struct {
+  int              fds[CONNECTION_QUEUE_SIZE];
+  int              first;
+  int              count;
+  profile_cache *  cache;
+  int              idle_seconds;    /* -i: per request line, and per reply */
+  pthread_mutex_t  lock;
+  pthread_cond_t   added;           /* a connection was queued */
+  pthread_cond_t   taken;           /* a worker took one */
+} connection_queue;
+
+static void *connection_worker (void *arg);
+
+static void serve_connection (elle_arena    *arena,
+                              profile_cache *cache,
+                              int           idle_seconds,
+                              int           fd
+                              );
+
+static int read_request_line (int fd, char *line, size_t size,
+                              char *pending, size_t *pending_length,
+                              int idle_seconds
+                              );
+
+static cmsBool parse_profile_request (char *line, profile_key *key,
+                                      char **error
+                                      );
+
+static cmsBool make_requested_profile (elle_arena          *arena,
+                                       const profile_key   *key,
+                                       elle_profile_buffer *buffer
+                                       );
+
+static cmsBool cache_lookup (profile_cache       *cache,
+                             const profile_key   *key,
+                             elle_profile_buffer *copy
+                             );
+
+static void cache_insert (profile_cache       *cache,
+                          const profile_key   *key,
+                          elle_profile_buffer *buffer
+                          );
+
+static void cache_count (profile_cache *cache, int hit, double seconds);
+
+static char* cache_stats_text (profile_cache *cache);
+
+static unsigned long hash_key (const profile_key *key);
+
+static void unlink_entry (profile_cache *cache, cache_entry *entry);
+
+static cmsBool write_all (int fd, const void *data, size_t size);
+
+static cmsBool send_reply (int fd, const void *data, size_t size);
+
+static void send_error (int fd, const char *message);
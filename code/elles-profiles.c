@@ -0,0 +1,694 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+
+/* About the ICC profile header "Platform" tag:
+ *
+ * When creating a profile, LCMS checks to see if the platform is
+ * Windows ('MSFT'). If your platform isn't Windows, LCMS defaults
+ * to using the Apple ('APPL') platform tag for the profile header.
+ *
+ * There is an unofficial Platform
+ * cmsPlatformSignature cmsSigUnices 0x2A6E6978 '*nix'. There is,
+ * however, no LCMS2 API for changing the platform when making a profile.
+ *
+ * So on my own computer, to replace 'APPL' with '*nix' in the header,
+ * I modified the LCMS source file 'cmsio0.c' and recompiled LCMS:
+ * #ifdef CMS_IS_WINDOWS_
+ * Header.platform= (cmsPlatformSignature) _cmsAdjustEndianess32(cmsSigMicrosoft);
+ * #else
+ * Header.platform= (cmsPlatformSignature) _cmsAdjustEndianess32(cmsSigUnices);
+ * #endif
+ *
+ * The RGB V2 profiles don't go through LCMS's profile writer (see
+ * elles-icc-writer.c), and always get '*nix'.
+ *
+ * */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <lcms2.h>
+#include "elles-profiles.h"
+#include "elles-icc-writer.h"
+#include "elles-trace.h"
+
+/* About the true V2 profiles:
+ * 
+ * The RGB V2 profiles used to be made by filling in "template" V2 
+ * profiles read from disk. They are now encoded directly, by 
+ * elles-icc-writer.c, with the same tags in the same order as the 
+ * templates had. The sRGB, L* and Rec709 TRCs are, as in the 
+ * templates, 4096-entry tables unless spec->V2_trc_entries or 
+ * spec->compact asks for another size.
+ * 
+ * */
+#define V2_DEFAULT_TRC_ENTRIES 4096
+
+static cmsBool make_V2_profile (cmsHPROFILE              V4_profile,
+                                const elle_profile_spec  *spec,
+                                cmsMLU                   *copyright,
+                                elle_profile_buffer      *buffer
+                                );
+
+static char* make_profile_name (char* basename,
+                                char* id,
+                                char* profile_version,
+                                elle_trc trc,
+                                char* extension
+                                );
+
+static cmsHPROFILE make_V4_profile (cmsContext               ContextID,
+                                    const elle_profile_spec  *spec,
+                                    cmsMLU                   *copyright
+                                    );
+
+static cmsHPROFILE make_LAB_XYZ_profile (cmsContext               ContextID,
+                                         const elle_profile_spec  *spec,
+                                         cmsMLU                   *copyright
+                                         );
+
+static cmsHPROFILE make_gray_profile (cmsContext               ContextID,
+                                      const elle_profile_spec  *spec,
+                                      cmsMLU                   *copyright
+                                      );
+
+static cmsBool save_profile_to_buffer (cmsHPROFILE          profile,
+                                       elle_profile_buffer  *buffer
+                                       );
+
+static cmsBool check_profile_id (const elle_profile_buffer *buffer);
+
+static cmsUInt32Number V2_table_entries (const elle_profile_spec *spec);
+
+static cmsUInt64Number hash_bytes (cmsUInt64Number hash, 
+                                   const void      *data, 
+                                   size_t          size
+                                   );
+
+static cmsUInt64Number hash_string (cmsUInt64Number hash, const char *text);
+
+
+cmsBool elle_make_profile (cmsContext               ContextID,
+                           const elle_profile_spec  *spec,
+                           cmsMLU                   *copyright,
+                           elle_profile_buffer      *buffer
+                           )
+{
+cmsHPROFILE profile = NULL;
+cmsMLU *compact_copyright = NULL;
+elle_trace_scope scope;
+cmsBool ok, V2_made = FALSE;
+
+buffer->data = NULL;
+buffer->size = 0;
+
+if (spec->compact)
+  {
+  compact_copyright = cmsMLUalloc(ContextID, 1);
+  if (compact_copyright == NULL) return FALSE;
+  cmsMLUsetASCII(compact_copyright, "en", "US", ELLE_COMPACT_COPYRIGHT_TEXT);
+  copyright = compact_copyright;
+  }
+
+if (spec->kind == ELLE_PROFILE_RGB)
+  {
+  /* The V2 profile takes its colorants and TRCs from the V4 profile */
+  cmsHPROFILE V4_profile = make_V4_profile (ContextID, spec, copyright);
+  if (V4_profile == NULL)
+    {
+    if (compact_copyright != NULL) cmsMLUfree(compact_copyright);
+    return FALSE;
+    }
+  if (strcmp(spec->profile_version, "-V2") == 0)
+    {
+    V2_made = make_V2_profile (V4_profile, spec, copyright, buffer);
+    cmsCloseProfile (V4_profile);
+    if (compact_copyright != NULL) cmsMLUfree(compact_copyright);
+    if (!V2_made) return FALSE;
+    }
+  else profile = V4_profile;
+  }
+else if (spec->kind == ELLE_PROFILE_GRAY)
+  profile = make_gray_profile (ContextID, spec, copyright);
+else
+  profile = make_LAB_XYZ_profile (ContextID, spec, copyright);
+
+/* The V2 RGB profiles are already serialized, with their ID */
+ok = TRUE;
+if (!V2_made)
+  {
+  if (compact_copyright != NULL) cmsMLUfree(compact_copyright);
+  if (profile == NULL) return FALSE;
+
+  /* The ID is computed last, over the finished profile */
+  if (cmsGetProfileVersion (profile) >= 4.0 || spec->V2_profile_id)
+    {
+    elle_trace_enter (&scope, ELLE_STAGE_PROFILE_ID);
+    ok = cmsMD5computeID (profile);
+    elle_trace_leave (&scope, 0);
+    }
+  if (ok)
+    {
+    elle_trace_enter (&scope, ELLE_STAGE_SERIALIZE);
+    ok = save_profile_to_buffer (profile, buffer);
+    elle_trace_leave (&scope, buffer->size);
+    }
+  cmsCloseProfile (profile);
+  }
+
+if (!ok) return FALSE;
+
+elle_trace_enter (&scope, ELLE_STAGE_PROFILE_ID);
+ok = check_profile_id (buffer);
+elle_trace_leave (&scope, 0);
+if (!ok)
+  {
+  char *name = elle_profile_name (spec);
+  fprintf(stderr, "%s: the saved profile ID doesn't match its bytes\n", name);
+  free (name);
+  elle_free_profile_buffer (buffer);
+  }
+return ok;
+}
+
+
+void elle_free_profile_buffer (elle_profile_buffer *buffer)
+{
+free (buffer->data);
+buffer->data = NULL;
+buffer->size = 0;
+}
+
+
+char* elle_profile_name (const elle_profile_spec *spec)
+{
+return make_profile_name (spec->basename, spec->id, spec->profile_version,
+                          spec->trc, spec->extension);
+}
+
+
+cmsBool elle_write_profile_file (const char                *directory,
+                                 const elle_profile_spec   *spec,
+                                 const elle_profile_buffer *buffer
+                                 )
+{
+char *name = elle_profile_name (spec);
+cmsBool ok = elle_write_named_file (directory, name, buffer);
+
+free (name);
+return ok;
+}
+
+
+cmsBool elle_write_named_file (const char                *directory,
+                               const char                *name,
+                               const elle_profile_buffer *buffer
+                               )
+{
+char *filename = (char*) malloc (strlen(directory) + strlen(name) + 1);
+elle_trace_scope scope;
+cmsBool ok = FALSE;
+FILE *file;
+
+strcpy(filename, directory);
+strcat(filename, name);
+
+elle_trace_enter (&scope, ELLE_STAGE_FILE_WRITE);
+file = fopen (filename, "wb");
+if (file != NULL)
+  {
+  ok = fwrite (buffer->data, 1, buffer->size, file) == buffer->size;
+  if (fclose (file) != 0) ok = FALSE;
+  }
+elle_trace_leave (&scope, ok ? buffer->size : 0);
+if (!ok) fprintf(stderr, "couldn't write %s\n", filename);
+
+free (filename);
+return ok;
+}
+
+
+cmsBool elle_read_profile_file (const char          *directory,
+                                const char          *name,
+                                elle_profile_buffer *buffer
+                                )
+{
+char *filename = (char*) malloc (strlen(directory) + strlen(name) + 1);
+cmsBool ok = FALSE;
+FILE *file;
+long size;
+
+buffer->data = NULL;
+buffer->size = 0;
+strcpy(filename, directory);
+strcat(filename, name);
+
+file = fopen (filename, "rb");
+if (file != NULL)
+  {
+  fseek (file, 0, SEEK_END);
+  size = ftell (file);
+  fseek (file, 0, SEEK_SET);
+  if (size > 0) buffer->data = (cmsUInt8Number*) malloc (size);
+  if (buffer->data != NULL && fread (buffer->data, 1, size, file) == (size_t) size)
+    {
+    buffer->size = (cmsUInt32Number) size;
+    ok = TRUE;
+    }
+  else elle_free_profile_buffer (buffer);
+  fclose (file);
+  }
+if (!ok) fprintf(stderr, "couldn't read %s\n", filename);
+free (filename);
+return ok;
+}
+
+
+cmsBool elle_make_device_link (cmsContext                ContextID,
+                               const elle_profile_buffer *source,
+                               const elle_profile_buffer *destination,
+                               cmsUInt32Number           intent,
+                               const char                *description_text,
+                               cmsMLU                    *copyright,
+                               elle_profile_buffer       *link
+                               )
+{
+cmsHPROFILE source_profile, destination_profile, link_profile = NULL;
+cmsHTRANSFORM transform = NULL;
+cmsBool ok = FALSE;
+
+link->data = NULL;
+link->size = 0;
+
+source_profile = cmsOpenProfileFromMemTHR (ContextID, source->data, source->size);
+destination_profile = cmsOpenProfileFromMemTHR (ContextID, destination->data, 
+                                                destination->size);
+if (source_profile != NULL && destination_profile != NULL)
+  transform = cmsCreateTransformTHR (ContextID, 
+                 source_profile, 
+                 cmsFormatterForColorspaceOfProfile (source_profile, 4, TRUE),
+                 destination_profile,
+                 cmsFormatterForColorspaceOfProfile (destination_profile, 4, TRUE),
+                 intent, 0);
+/* The transform keeps its own copy of the pipeline */
+if (source_profile != NULL) cmsCloseProfile (source_profile);
+if (destination_profile != NULL) cmsCloseProfile (destination_profile);
+if (transform == NULL) return FALSE;
+
+link_profile = cmsTransform2DeviceLink (transform, 4.3, 0);
+cmsDeleteTransform (transform);
+if (link_profile == NULL) return FALSE;
+
+cmsMLU *description = cmsMLUalloc(ContextID, 1);
+cmsMLUsetASCII(description, "en", "US", description_text);
+cmsWriteTag(link_profile, cmsSigProfileDescriptionTag, description);
+cmsMLUfree(description);
+cmsWriteTag(link_profile, cmsSigCopyrightTag, copyright);
+
+if (cmsMD5computeID (link_profile))
+  ok = save_profile_to_buffer (link_profile, link);
+cmsCloseProfile (link_profile);
+return ok;
+}
+
+
+cmsUInt64Number elle_profile_inputs_hash (const elle_profile_spec *spec,
+                                          const char              *copyright_text
+                                          )
+{
+cmsUInt64Number hash = 14695981039346656037ULL;
+const elle_trc_definition *definition = elle_trc_definition_of (spec->trc);
+cmsInt32Number code_version = ELLE_PROFILE_CODE_VERSION;
+cmsInt32Number kind = (cmsInt32Number) spec->kind;
+
+hash = hash_bytes (hash, &code_version, sizeof(code_version));
+hash = hash_bytes (hash, &kind, sizeof(kind));
+hash = hash_string (hash, spec->profile_version);
+hash = hash_string (hash, spec->basename);
+hash = hash_string (hash, spec->id);
+hash = hash_string (hash, spec->extension);
+hash = hash_string (hash, spec->manufacturer);
+hash = hash_string (hash, copyright_text);
+hash = hash_bytes (hash, &spec->whitepoint, sizeof(spec->whitepoint));
+hash = hash_bytes (hash, &spec->primaries, sizeof(spec->primaries));
+hash = hash_bytes (hash, &spec->media_whitepoint, sizeof(spec->media_whitepoint));
+hash = hash_bytes (hash, &spec->media_blackpoint, sizeof(spec->media_blackpoint));
+hash = hash_bytes (hash, &spec->V2_profile_id, sizeof(spec->V2_profile_id));
+hash = hash_bytes (hash, &spec->V2_trc_entries, sizeof(spec->V2_trc_entries));
+hash = hash_bytes (hash, &spec->compact, sizeof(spec->compact));
+
+if (definition != NULL)
+  {
+  hash = hash_bytes (hash, &definition->type, sizeof(definition->type));
+  hash = hash_bytes (hash, definition->parameters, sizeof(definition->parameters));
+  }
+return hash;
+}
+
+
+/* 64-bit FNV-1a */
+static cmsUInt64Number hash_bytes (cmsUInt64Number hash, 
+                                   const void      *data, 
+                                   size_t          size
+                                   )
+{
+const cmsUInt8Number *bytes = (const cmsUInt8Number*) data;
+size_t i;
+
+for ( i = 0; i < size; i++ )
+  {
+  hash ^= bytes[i];
+  hash *= 1099511628211ULL;
+  }
+return hash;
+}
+
+
+/* Strings are hashed with their terminating '\0', so that "ab" + "c" 
+ * and "a" + "bc" hash differently */
+static cmsUInt64Number hash_string (cmsUInt64Number hash, const char *text)
+{
+if (text == NULL) text = "";
+return hash_bytes (hash, text, strlen(text) + 1);
+}
+
+
+static cmsBool save_profile_to_buffer (cmsHPROFILE          profile,
+                                       elle_profile_buffer  *buffer
+                                       )
+{
+cmsUInt32Number size = 0;
+
+/* The first call only computes the size */
+if (!cmsSaveProfileToMem (profile, NULL, &size) || size == 0) return FALSE;
+buffer->data = (cmsUInt8Number*) malloc (size);
+if (buffer->data == NULL) return FALSE;
+if (!cmsSaveProfileToMem (profile, buffer->data, &size))
+  {
+  elle_free_profile_buffer (buffer);
+  return FALSE;
+  }
+buffer->size = size;
+return TRUE;
+}
+
+
+/* The size of the computed V2 TRC tables; 0 keeps the template's */
+static cmsUInt32Number V2_table_entries (const elle_profile_spec *spec)
+{
+if (spec->V2_trc_entries > 0) return spec->V2_trc_entries;
+return spec->compact ? ELLE_COMPACT_V2_TRC_ENTRIES : 0;
+}
+
+
+/* Recompute the MD5 profile ID from the saved bytes. A profile 
+ * without an ID (all zeros) has nothing to check. */
+static cmsBool check_profile_id (const elle_profile_buffer *buffer)
+{
+cmsUInt8Number recomputed_id[16], zero_id[16];
+
+memset (zero_id, 0, sizeof(zero_id));
+if (buffer->size < 128) return FALSE;
+if (memcmp (buffer->data + 84, zero_id, sizeof(zero_id)) == 0) return TRUE;
+
+elle_icc_profile_id (buffer->data, buffer->size, recomputed_id);
+return memcmp (buffer->data + 84, recomputed_id, sizeof(recomputed_id)) == 0;
+}
+
+
+static cmsHPROFILE make_gray_profile (cmsContext               ContextID,
+                                      const elle_profile_spec  *spec,
+                                      cmsMLU                   *copyright
+                                      )
+{
+const cmsToneCurve *grayTRC;
+cmsCIExyY whitepoint = spec->whitepoint;
+cmsCIEXYZ media_whitepoint = spec->media_whitepoint;
+cmsCIEXYZ media_blackpoint = spec->media_blackpoint;
+elle_trace_scope scope, tags_scope;
+elle_trace_enter (&scope, ELLE_STAGE_TONE_CURVE);
+grayTRC = elle_trc_curve (spec->trc);
+elle_trace_leave (&scope, 0);
+if (grayTRC == NULL) return NULL;
+
+/* Make V4 gray profile */
+elle_trace_enter (&scope, ELLE_STAGE_CREATE_PROFILE);
+cmsHPROFILE profile = cmsCreateGrayProfileTHR (ContextID, &whitepoint, grayTRC );
+elle_trace_leave (&scope, 0);
+if (profile == NULL) return NULL;
+elle_trace_enter (&tags_scope, ELLE_STAGE_WRITE_TAGS);
+cmsWriteTag(profile, cmsSigCopyrightTag, copyright);
+cmsWriteTag (profile, cmsSigMediaWhitePointTag, &media_whitepoint);
+
+char *description_text = make_profile_name (spec->basename, spec->id, "-V4",
+                                            spec->trc, spec->extension);
+cmsMLU *description;
+description = cmsMLUalloc(ContextID, 1);
+cmsMLUsetASCII(description, "en", "US", description_text);
+cmsWriteTag(profile, cmsSigProfileDescriptionTag, description);
+cmsMLUfree(description);
+free (description_text);
+
+/* Make V2 gray profile from the V4 gray profile.
+ * The V2 gray profiles have always kept the V4 description. */
+if (strcmp(spec->profile_version, "-V2") == 0)
+  {
+  cmsSetProfileVersion (profile, 2.2);
+  cmsWriteTag (profile, cmsSigMediaBlackPointTag, &media_blackpoint);
+  if (V2_table_entries (spec) > 0 && elle_trc_definition_of (spec->trc)->type != 1)
+    {
+    const cmsToneCurve *table;
+    elle_trace_enter (&scope, ELLE_STAGE_TONE_CURVE);
+    table = elle_trc_sampled_curve (spec->trc, V2_table_entries (spec));
+    elle_trace_leave (&scope, 0);
+    if (table == NULL)
+      {
+      elle_trace_leave (&tags_scope, 0);
+      cmsCloseProfile (profile);
+      return NULL;
+      }
+    cmsWriteTag (profile, cmsSigGrayTRCTag, table);
+    }
+  }
+
+elle_trace_leave (&tags_scope, 0);
+return profile;
+}
+
+
+static cmsHPROFILE make_V4_profile (cmsContext               ContextID,
+                                    const elle_profile_spec  *spec,
+                                    cmsMLU                   *copyright
+                                    )
+{
+cmsToneCurve *curve[3], *tonecurve;
+elle_trace_scope scope;
+/* The shared curve is only read; LCMS copies it into the TRC tags */
+elle_trace_enter (&scope, ELLE_STAGE_TONE_CURVE);
+tonecurve = (cmsToneCurve*) elle_trc_curve (spec->trc);
+elle_trace_leave (&scope, 0);
+if (tonecurve == NULL) return NULL;
+/* Given the same curve three times, cmsCreateRGBProfileTHR links the 
+ * green and blue TRC tags to the red one, so every V4 profile stores 
+ * the curve once */
+curve[0] = curve[1] = curve[2] = tonecurve;
+
+/* Make V4 profile */
+elle_trace_enter (&scope, ELLE_STAGE_CREATE_PROFILE);
+cmsHPROFILE V4_profile = cmsCreateRGBProfileTHR (ContextID, &spec->whitepoint,
+                                                 &spec->primaries, curve);
+elle_trace_leave (&scope, 0);
+if (V4_profile == NULL) return NULL;
+
+elle_trace_enter (&scope, ELLE_STAGE_WRITE_TAGS);
+cmsWriteTag(V4_profile, cmsSigCopyrightTag, copyright);
+
+/* The colorants already give the primaries */
+if (spec->compact) cmsWriteTag (V4_profile, cmsSigChromaticityTag, NULL);
+
+cmsMLU *MfgDesc;
+MfgDesc   = cmsMLUalloc(ContextID, 1);
+cmsMLUsetASCII(MfgDesc, "en", "US", spec->manufacturer);
+if (!spec->compact) cmsWriteTag(V4_profile, cmsSigDeviceMfgDescTag, MfgDesc);
+
+/* The caller saves the V4 profile, or uses it to make the V2 profile */
+char* profile_version="-V4";
+char *description_text = make_profile_name (spec->basename, spec->id,
+                                            profile_version, spec->trc,
+                                            spec->extension);
+cmsMLU *description;
+description = cmsMLUalloc(ContextID, 1);
+cmsMLUsetASCII(description, "en", "US", description_text);
+cmsWriteTag(V4_profile, cmsSigProfileDescriptionTag, description);
+free (description_text);
+cmsMLUfree(description);
+cmsMLUfree(MfgDesc);
+elle_trace_leave (&scope, 0);
+return V4_profile;
+}
+
+
+static cmsBool make_V2_profile (cmsHPROFILE              V4_profile,
+                                const elle_profile_spec  *spec,
+                                cmsMLU                   *copyright,
+                                elle_profile_buffer      *buffer
+                                )
+{
+static const cmsTagSignature colorant_tags[3] = {
+  cmsSigRedColorantTag, cmsSigGreenColorantTag, cmsSigBlueColorantTag };
+const elle_trc_definition *definition = elle_trc_definition_of (spec->trc);
+elle_V2_rgb_contents contents;
+elle_trace_scope scope;
+char *copyright_text, *description_text;
+cmsUInt32Number length;
+time_t now;
+cmsBool ok;
+int i;
+
+if (definition == NULL) return FALSE;
+memset (&contents, 0, sizeof(contents));
+contents.media_whitepoint = spec->media_whitepoint;
+contents.media_blackpoint = spec->media_blackpoint;
+contents.profile_id = spec->V2_profile_id;
+now = time (NULL);
+gmtime_r (&now, &contents.created);
+
+/* Get the colorants from the V4 profile */
+for ( i = 0; i < 3; i++ )
+  {
+  cmsCIEXYZ *colorant = (cmsCIEXYZ*) cmsReadTag (V4_profile, colorant_tags[i]);
+  if (colorant == NULL) return FALSE;
+  contents.colorants[i] = *colorant;
+  }
+
+/* The gamma TRCs are stored as gammas. The other TRCs are sampled 
+ * into tables of spec->V2_trc_entries values, or, if that's 0, into 
+ * the 4096-entry tables the templates had. Either way the table is 
+ * stored once for all three channels, as the templates stored it. */
+elle_trace_enter (&scope, ELLE_STAGE_TONE_CURVE);
+if (definition->type == 1)
+  contents.gamma = definition->parameters[0];
+else
+  {
+  cmsUInt32Number entries = V2_table_entries (spec);
+  const cmsToneCurve *table = 
+    elle_trc_sampled_curve (spec->trc, entries > 0 ? entries : V2_DEFAULT_TRC_ENTRIES);
+  if (table != NULL)
+    {
+    contents.table = cmsGetToneCurveEstimatedTable (table);
+    contents.table_entries = cmsGetToneCurveEstimatedTableEntries (table);
+    contents.shared_trc = TRUE;
+    }
+  }
+elle_trace_leave (&scope, 0);
+if (definition->type != 1 && contents.table == NULL) return FALSE;
+if (spec->compact) contents.shared_trc = TRUE;
+
+/* Set copyright, manufacturer, and description */
+length = cmsMLUgetASCII (copyright, "en", "US", NULL, 0);
+copyright_text = (char*) calloc (1, length + 1);
+if (copyright_text == NULL)
+  {
+  return FALSE;
+  }
+cmsMLUgetASCII (copyright, "en", "US", copyright_text, length + 1);
+description_text = make_profile_name (spec->basename, spec->id, "-V2", spec->trc,
+                                      spec->extension);
+contents.copyright = copyright_text;
+contents.manufacturer = spec->compact ? NULL : spec->manufacturer;
+contents.description = description_text;
+
+elle_trace_enter (&scope, ELLE_STAGE_V2_ENCODE);
+ok = elle_write_V2_rgb_profile (&contents, &buffer->data, &buffer->size);
+elle_trace_leave (&scope, ok ? buffer->size : 0);
+if (!ok) elle_free_profile_buffer (buffer);
+
+free (description_text);
+free (copyright_text);
+return ok;
+}
+
+
+static char* make_profile_name (char* basename,
+                                char* id,
+                                char* profile_version,
+                                elle_trc trc_id,
+                                char* extension
+                                )
+{
+char* name="";
+const char* trc = elle_trc_suffix (trc_id);
+int i = 0;
+
+if ( strcmp(basename, "-sRGB")==0 && strcmp(trc, "-rec709")==0 ) basename="Rec709";
+
+i =
+		strlen(basename) +
+		strlen(id) +
+		strlen(profile_version) +
+		strlen(trc) +
+		strlen(extension);
+name = (char*) malloc (i + 1);
+
+
+strcpy(name, basename);
+strcat(name, id);
+strcat(name, profile_version);
+strcat(name, trc);
+strcat(name, extension);
+
+return name;
+}
+
+
+static cmsHPROFILE make_LAB_XYZ_profile (cmsContext               ContextID,
+                                         const elle_profile_spec  *spec,
+                                         cmsMLU                   *copyright
+                                         )
+{
+/* Based on transicc output, the V4 profiles
+ * can be used in unbounded mode, but the V2 versions cannot. */
+cmsHPROFILE profile;
+elle_trace_scope scope;
+
+elle_trace_enter (&scope, ELLE_STAGE_CREATE_PROFILE);
+if (spec->kind == ELLE_PROFILE_XYZ)
+  profile = cmsCreateXYZProfileTHR(ContextID);
+else if (strcmp(spec->profile_version, "-V2") == 0)
+  profile  = cmsCreateLab2ProfileTHR(ContextID, &spec->whitepoint);
+else
+  profile  = cmsCreateLab4ProfileTHR(ContextID, &spec->whitepoint);
+elle_trace_leave (&scope, 0);
+if (profile == NULL) return NULL;
+
+elle_trace_enter (&scope, ELLE_STAGE_WRITE_TAGS);
+cmsWriteTag(profile, cmsSigCopyrightTag, copyright);
+elle_trace_leave (&scope, 0);
+/* These profiles have always kept the LCMS built-in descriptions,
+ * e.g. "Lab identity built-in" */
+return profile;
+}
@@ -0,0 +1,159 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+
+/* The profile-making code as a library.
+ *
+ * elle_make_profile makes one profile in memory and returns the
+ * serialized ICC bytes, so the profile can be embedded or opened with
+ * cmsOpenProfileFromMem without ever touching the disk. Writing the
+ * bytes to a file is left to a sink such as elle_write_profile_file.
+ *
+ * All LCMS objects are made in the ContextID passed in, so several
+ * threads can make profiles at once, each with its own context.
+ *
+ * */
+
+#ifndef ELLES_PROFILES_H
+#define ELLES_PROFILES_H
+
+#include <lcms2.h>
+#include "elles-trc.h"
+
+/* The copyright text written into every profile */
+#define ELLE_COPYRIGHT_TEXT "Copyright 2016, Elle Stone (http://ninedegreesbelow.com/), CC-BY-SA 3.0 Unported (https://creativecommons.org/licenses/by-sa/3.0/legalcode)."
+
+/* Compact profiles, for embedding, have this copyright text instead,
+ * no manufacturer text, and V2 TRC tables of this many entries unless 
+ * spec->V2_trc_entries says otherwise */
+#define ELLE_COMPACT_COPYRIGHT_TEXT "Copyright 2016 Elle Stone, CC-BY-SA 3.0"
+#define ELLE_COMPACT_V2_TRC_ENTRIES 1024
+
+typedef enum {
+  ELLE_PROFILE_RGB,     /* matrix-shaper RGB, from whitepoint and primaries */
+  ELLE_PROFILE_GRAY,    /* gray, from whitepoint */
+  ELLE_PROFILE_LAB,     /* LCMS built-in Lab identity, V2 or V4 */
+  ELLE_PROFILE_XYZ      /* LCMS built-in XYZ identity, always V4 */
+} elle_profile_kind;
+
+/* Everything needed to make one profile. The strings aren't owned.
+ * The profile name (and description) is
+ * basename + id + profile_version + elle_trc_suffix(trc) + extension,
+ * for example "sRGB" "-elle" "-V4" "-srgbtrc" ".icc". */
+typedef struct {
+  elle_profile_kind kind;
+  char *           profile_version;   /* "-V4" or "-V2" */
+  elle_trc         trc;               /* ELLE_TRC_NONE for Lab, XYZ */
+  char *           basename;
+  char *           id;
+  char *           extension;
+  char *           manufacturer;      /* RGB only */
+  cmsCIExyY        whitepoint;
+  cmsCIExyYTRIPLE  primaries;         /* RGB only */
+  cmsCIEXYZ        media_whitepoint;
+  cmsCIEXYZ        media_blackpoint;
+  cmsBool          V2_profile_id;     /* give V2 profiles an MD5 profile ID too */
+  cmsUInt32Number  V2_trc_entries;    /* V2 sRGB, L* and Rec709 TRC table size;
+                                         0: 4096 entries */
+  cmsBool          compact;           /* smallest valid profile, for embedding */
+} elle_profile_spec;
+
+/* Serialized profile bytes, allocated with malloc */
+typedef struct {
+  cmsUInt8Number * data;
+  cmsUInt32Number  size;
+} elle_profile_buffer;
+
+/* Make the profile described by spec and serialize it into buffer.
+ * Returns FALSE, with buffer emptied, if the profile couldn't be made.
+ *
+ * Every V4 profile gets the MD5 profile ID in its header (and the V2
+ * profiles too, if spec->V2_profile_id is set; the V2 specs only 
+ * reserve those header bytes as zero). The ID is checked against a 
+ * recomputation from the saved bytes, and a mismatch is an error.
+ *
+ * If spec->compact is set, the copyright passed in is replaced by the
+ * short ELLE_COMPACT_COPYRIGHT_TEXT, the optional manufacturer and 
+ * chromaticity tags are left out, and V2 profiles get shorter TRC 
+ * tables, shared by the three TRC tags. (V4 profiles always store the
+ * curve once: LCMS links the green and blue TRC tags to the red one.) */
+cmsBool elle_make_profile (cmsContext               ContextID,
+                           const elle_profile_spec  *spec,
+                           cmsMLU                   *copyright,
+                           elle_profile_buffer      *buffer
+                           );
+
+void elle_free_profile_buffer (elle_profile_buffer *buffer);
+
+/* The profile name for spec, e.g. "sRGB-elle-V4-srgbtrc.icc".
+ * The caller frees the returned string. */
+char* elle_profile_name (const elle_profile_spec *spec);
+
+/* File sink: write buffer to directory + elle_profile_name(spec).
+ * directory must end with a '/', e.g. "../profiles/". */
+cmsBool elle_write_profile_file (const char                *directory,
+                                 const elle_profile_spec   *spec,
+                                 const elle_profile_buffer *buffer
+                                 );
+
+/* The same, for a file named by the caller, e.g. a device link */
+cmsBool elle_write_named_file (const char                *directory,
+                               const char                *name,
+                               const elle_profile_buffer *buffer
+                               );
+
+/* Bump this when a change to the profile-making code changes the 
+ * profiles it makes, so profiles made by the old code are rebuilt */
+#define ELLE_PROFILE_CODE_VERSION 5
+
+/* A hash of everything the profile for spec is made from: the spec,
+ * the TRC parameters, the copyright text and the code version. 
+ * Profiles with the same hash have the same content, apart from the 
+ * creation date. */
+cmsUInt64Number elle_profile_inputs_hash (const elle_profile_spec *spec,
+                                          const char              *copyright_text
+                                          );
+
+/* Read directory + name (name as given, e.g. "sRGB-elle-V4-srgbtrc.icc")
+ * into buffer. Returns FALSE, with a message, if it can't be read. */
+cmsBool elle_read_profile_file (const char          *directory,
+                                const char          *name,
+                                elle_profile_buffer *buffer
+                                );
+
+/* Make a V4 device link from source to destination (serialized 
+ * profiles) with the given rendering intent. The transform is built 
+ * for float pixels, so LCMS only joins the matrices and curves and 
+ * never resamples the conversion into a CLUT; the link holds the same
+ * math as the two profiles. description_text names the link. */
+cmsBool elle_make_device_link (cmsContext                ContextID,
+                               const elle_profile_buffer *source,
+                               const elle_profile_buffer *destination,
+                               cmsUInt32Number           intent,
+                               const char                *description_text,
+                               cmsMLU                    *copyright,
+                               elle_profile_buffer       *link
+                               );
+
+#endif
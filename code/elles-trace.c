@@ -0,0 +1,339 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <lcms2.h>
+#include "elles-trace.h"
+
+/* The job being recorded on this thread, and the innermost stage */
+static __thread elle_trace_job * current_job = NULL;
+static __thread int              current_stage = -1;
+static __thread int              thread_number = -1;
+static int                       threads_numbered = 0;
+
+static const char *stage_names[ELLE_STAGE_COUNT] = {
+  "tone_curve", "create_profile", "write_tags", "V2_encode", "profile_id",
+  "serialize", "file_write"
+};
+
+static cmsUInt64Number now_nanoseconds (void);
+static void add_counters (elle_stage_counters *sum, const elle_stage_counters *counters);
+static void write_stages (FILE *out, const elle_stage_counters *stages);
+static void write_json_string (FILE *out, const char *text);
+
+
+const char* elle_stage_name (elle_stage stage)
+{
+return stage < ELLE_STAGE_COUNT ? stage_names[stage] : "unknown";
+}
+
+
+void elle_trace_begin (elle_trace_job *job, cmsBool record_events)
+{
+memset (job->stages, 0, sizeof(job->stages));
+job->allocated_bytes = 0;
+job->nanoseconds = 0;
+job->event_count = 0;
+job->record_events = record_events;
+job->thread = elle_trace_thread ();
+job->start = now_nanoseconds ();
+current_job = job;
+current_stage = -1;
+}
+
+
+void elle_trace_end (void)
+{
+if (current_job == NULL) return;
+current_job->nanoseconds = now_nanoseconds () - current_job->start;
+current_job = NULL;
+current_stage = -1;
+}
+
+
+void elle_trace_free (elle_trace_job *job)
+{
+free (job->events);
+job->events = NULL;
+job->event_count = 0;
+job->events_allocated = 0;
+}
+
+
+void elle_trace_enter (elle_trace_scope *scope, elle_stage stage)
+{
+scope->active = current_job != NULL;
+if (!scope->active) return;
+scope->stage = stage;
+scope->outer_stage = current_stage;
+current_stage = (int) stage;
+scope->start = now_nanoseconds ();
+}
+
+
+void elle_trace_leave (elle_trace_scope *scope, cmsUInt64Number written_bytes)
+{
+elle_trace_job *job = current_job;
+elle_stage_counters *counters;
+cmsUInt64Number nanoseconds;
+
+if (!scope->active || job == NULL) return;
+nanoseconds = now_nanoseconds () - scope->start;
+counters = &job->stages[scope->stage];
+counters->calls++;
+counters->nanoseconds += nanoseconds;
+counters->written_bytes += written_bytes;
+current_stage = scope->outer_stage;
+
+if (job->record_events)
+  {
+  elle_trace_event *event;
+  if (job->event_count == job->events_allocated)
+    {
+    int allocated = job->events_allocated ? 2 * job->events_allocated : 16;
+    elle_trace_event *events = (elle_trace_event*) realloc (job->events, 
+                                                 allocated * sizeof(elle_trace_event));
+    /* Without the memory, the job just has no more events */
+    if (events == NULL)
+      {
+      job->record_events = FALSE;
+      return;
+      }
+    job->events = events;
+    job->events_allocated = allocated;
+    }
+  event = &job->events[job->event_count++];
+  event->stage = scope->stage;
+  event->thread = job->thread;
+  event->start = scope->start;
+  event->nanoseconds = nanoseconds;
+  }
+}
+
+
+void elle_trace_allocation (size_t bytes)
+{
+elle_trace_job *job = current_job;
+if (job == NULL) return;
+job->allocated_bytes += bytes;
+if (current_stage >= 0) job->stages[current_stage].allocated_bytes += bytes;
+}
+
+
+int elle_trace_thread (void)
+{
+if (thread_number < 0) thread_number = __sync_fetch_and_add (&threads_numbered, 1);
+return thread_number;
+}
+
+
+cmsBool elle_trace_write_summary (FILE                        *out,
+                                  const elle_trace_job *const *jobs,
+                                  int                         count
+                                  )
+{
+elle_stage_counters totals[ELLE_STAGE_COUNT];
+elle_stage_counters (*group_stages)[ELLE_STAGE_COUNT];
+const char **groups;
+int *group_jobs;
+cmsUInt64Number *group_nanoseconds, total_nanoseconds = 0, total_allocated = 0;
+int group_count = 0, built = 0, i, g, s;
+
+groups = (const char**) calloc (count + 1, sizeof(char*));
+group_jobs = (int*) calloc (count + 1, sizeof(int));
+group_nanoseconds = (cmsUInt64Number*) calloc (count + 1, sizeof(cmsUInt64Number));
+group_stages = calloc (count + 1, sizeof(*group_stages));
+if (groups == NULL || group_jobs == NULL || group_nanoseconds == NULL || group_stages == NULL)
+  {
+  free (groups);
+  free (group_jobs);
+  free (group_nanoseconds);
+  free (group_stages);
+  return FALSE;
+  }
+
+/* Sum by stage, and by group in the order the groups first appear */
+memset (totals, 0, sizeof(totals));
+for ( i = 0; i < count; i++ )
+  {
+  const elle_trace_job *job = jobs[i];
+  const char *group = job->group != NULL ? job->group : "";
+  if (job->start == 0) continue;
+  built++;
+  for ( g = 0; g < group_count; g++ ) 
+    if (strcmp(groups[g], group) == 0) break;
+  if (g == group_count) groups[group_count++] = group;
+  group_jobs[g]++;
+  group_nanoseconds[g] += job->nanoseconds;
+  total_nanoseconds += job->nanoseconds;
+  total_allocated += job->allocated_bytes;
+  for ( s = 0; s < ELLE_STAGE_COUNT; s++ )
+    {
+    add_counters (&totals[s], &job->stages[s]);
+    add_counters (&group_stages[g][s], &job->stages[s]);
+    }
+  }
+
+fprintf(out, "{\n  \"jobs_recorded\": %d,\n  \"jobs_not_recorded\": %d,\n", 
+        built, count - built);
+fprintf(out, "  \"totals\": { \"job_ns\": %llu, \"allocated_bytes\": %llu,\n"
+             "    \"stages\": ", (unsigned long long) total_nanoseconds, 
+        (unsigned long long) total_allocated);
+write_stages (out, totals);
+fprintf(out, " },\n  \"groups\": [\n");
+for ( g = 0; g < group_count; g++ )
+  {
+  fprintf(out, "    { \"name\": ");
+  write_json_string (out, groups[g]);
+  fprintf(out, ", \"jobs\": %d, \"job_ns\": %llu,\n      \"stages\": ", group_jobs[g], 
+          (unsigned long long) group_nanoseconds[g]);
+  write_stages (out, group_stages[g]);
+  fprintf(out, " }%s\n", g + 1 < group_count ? "," : "");
+  }
+fprintf(out, "  ],\n  \"jobs\": [\n");
+for ( i = 0, g = 0; i < count; i++ )
+  {
+  const elle_trace_job *job = jobs[i];
+  if (job->start == 0) continue;
+  fprintf(out, "    { \"name\": ");
+  write_json_string (out, job->name != NULL ? job->name : "");
+  fprintf(out, ", \"group\": ");
+  write_json_string (out, job->group != NULL ? job->group : "");
+  fprintf(out, ", \"thread\": %d, \"job_ns\": %llu, \"allocated_bytes\": %llu,\n"
+               "      \"stages\": ", job->thread, (unsigned long long) job->nanoseconds,
+          (unsigned long long) job->allocated_bytes);
+  write_stages (out, job->stages);
+  fprintf(out, " }%s\n", ++g < built ? "," : "");
+  }
+fprintf(out, "  ]\n}\n");
+
+free (groups);
+free (group_jobs);
+free (group_nanoseconds);
+free (group_stages);
+return !ferror (out);
+}
+
+
+/* Complete ("X") events, one per job and one per scope, with the 
+ * times in microseconds from the first job's start */
+cmsBool elle_trace_write_chrome_trace (FILE                        *out,
+                                       const elle_trace_job *const *jobs,
+                                       int                         count
+                                       )
+{
+cmsUInt64Number origin = 0;
+int threads = 0, first, i, e;
+
+for ( i = 0; i < count; i++ )
+  {
+  if (jobs[i]->start == 0) continue;
+  if (origin == 0 || jobs[i]->start < origin) origin = jobs[i]->start;
+  if (jobs[i]->thread + 1 > threads) threads = jobs[i]->thread + 1;
+  }
+
+fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+for ( i = 0; i < threads; i++ )
+  fprintf(out, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+               "\"args\": {\"name\": \"worker %d\"}}", i ? ",\n" : "", i, i);
+first = threads == 0;
+for ( i = 0; i < count; i++ )
+  {
+  const elle_trace_job *job = jobs[i];
+  if (job->start == 0) continue;
+  fprintf(out, "%s{\"name\": ", first ? "" : ",\n");
+  first = 0;
+  write_json_string (out, job->name != NULL ? job->name : "job");
+  fprintf(out, ", \"cat\": \"job\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, "
+               "\"ts\": %.3f, \"dur\": %.3f, \"args\": {\"group\": ", job->thread, 
+          (job->start - origin) * 1e-3, job->nanoseconds * 1e-3);
+  write_json_string (out, job->group != NULL ? job->group : "");
+  fprintf(out, ", \"allocated_bytes\": %llu}}", (unsigned long long) job->allocated_bytes);
+  for ( e = 0; e < job->event_count; e++ )
+    {
+    const elle_trace_event *event = &job->events[e];
+    fprintf(out, ",\n{\"name\": \"%s\", \"cat\": \"stage\", \"ph\": \"X\", \"pid\": 1, "
+                 "\"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}", elle_stage_name (event->stage), 
+            event->thread, (event->start - origin) * 1e-3, event->nanoseconds * 1e-3);
+    }
+  }
+fprintf(out, "\n]}\n");
+return !ferror (out);
+}
+
+
+static cmsUInt64Number now_nanoseconds (void)
+{
+struct timespec now;
+clock_gettime (CLOCK_MONOTONIC, &now);
+return (cmsUInt64Number) now.tv_sec * 1000000000u + (cmsUInt64Number) now.tv_nsec;
+}
+
+
+static void add_counters (elle_stage_counters *sum, const elle_stage_counters *counters)
+{
+sum->calls += counters->calls;
+sum->nanoseconds += counters->nanoseconds;
+sum->allocated_bytes += counters->allocated_bytes;
+sum->written_bytes += counters->written_bytes;
+}
+
+
+/* { "tone_curve": { "calls": ..., ... }, ... }, leaving out the stages
+ * never entered */
+static void write_stages (FILE *out, const elle_stage_counters *stages)
+{
+int s, written = 0;
+
+fputs ("{", out);
+for ( s = 0; s < ELLE_STAGE_COUNT; s++ )
+  {
+  if (stages[s].calls == 0) continue;
+  fprintf(out, "%s\n        \"%s\": { \"calls\": %llu, \"ns\": %llu, "
+               "\"allocated_bytes\": %llu, \"written_bytes\": %llu }", 
+          written++ ? "," : "", stage_names[s], (unsigned long long) stages[s].calls, 
+          (unsigned long long) stages[s].nanoseconds, 
+          (unsigned long long) stages[s].allocated_bytes, 
+          (unsigned long long) stages[s].written_bytes);
+  }
+fputs (written ? " }" : "}", out);
+}
+
+
+static void write_json_string (FILE *out, const char *text)
+{
+const unsigned char *c;
+
+fputc ('"', out);
+for ( c = (const unsigned char*) text; *c; c++ )
+  {
+  if (*c == '"' || *c == '\\') fprintf(out, "\\%c", *c);
+  else if (*c < 0x20) fprintf(out, "\\u%04x", *c);
+  else fputc (*c, out);
+  }
+fputc ('"', out);
+}
@@ -0,0 +1,142 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+/* Per-stage timing and allocation counters for profile making.
+ *
+ * A job's counters are kept in an elle_trace_job, which the thread 
+ * running the job makes current with elle_trace_begin. The code being
+ * measured marks each stage with a scope:
+ *
+ *   elle_trace_scope scope;
+ *   elle_trace_enter (&scope, ELLE_STAGE_CREATE_PROFILE);
+ *   ... 
+ *   elle_trace_leave (&scope, bytes_written);
+ *
+ * which adds one call, the time taken, the bytes the arena allocated
+ * in the meantime (see elles-arena.c) and the bytes written to the 
+ * current job's counters for that stage, and, if the job records 
+ * events, one event for a Chrome trace. A scope inside another counts
+ * its time in both, and its allocations only in the inner one.
+ *
+ * Nothing is recorded on a thread without a current job, so the 
+ * instrumentation is switched on at run time by calling elle_trace_begin,
+ * and costs one thread-local load per scope when it's off.
+ *
+ * elle_trace_write_summary and elle_trace_write_chrome_trace write the
+ * counters of a set of jobs as JSON: totals by stage, by group (the
+ * colorspace) and by job, or the events in the Trace Event Format that
+ * chrome://tracing and Perfetto read.
+ *
+ * */
+
+#ifndef ELLES_TRACE_H
+#define ELLES_TRACE_H
+
+#include <stdio.h>
+#include <lcms2.h>
+
+typedef enum {
+  ELLE_STAGE_TONE_CURVE,      /* getting or sampling the TRC */
+  ELLE_STAGE_CREATE_PROFILE,  /* cmsCreateRGBProfile and the like */
+  ELLE_STAGE_WRITE_TAGS,      /* cmsWriteTag and its MLUs */
+  ELLE_STAGE_V2_ENCODE,       /* writing a V2 RGB profile (elles-icc-writer.c) */
+  ELLE_STAGE_PROFILE_ID,      /* computing and checking the MD5 profile ID */
+  ELLE_STAGE_SERIALIZE,       /* cmsSaveProfileToMem */
+  ELLE_STAGE_FILE_WRITE,      /* writing the profile file */
+  ELLE_STAGE_COUNT
+} elle_stage;
+
+typedef struct {
+  cmsUInt64Number  calls;
+  cmsUInt64Number  nanoseconds;
+  cmsUInt64Number  allocated_bytes;
+  cmsUInt64Number  written_bytes;
+} elle_stage_counters;
+
+typedef struct {
+  elle_stage       stage;
+  int              thread;           /* elle_trace_thread of the recording thread */
+  cmsUInt64Number  start;            /* nanoseconds, CLOCK_MONOTONIC */
+  cmsUInt64Number  nanoseconds;
+} elle_trace_event;
+
+typedef struct {
+  const char *         name;         /* e.g. the profile name; not owned */
+  const char *         group;        /* e.g. the colorspace; not owned */
+  int                  thread;
+  cmsUInt64Number      start;        /* of the whole job */
+  cmsUInt64Number      nanoseconds;
+  cmsUInt64Number      allocated_bytes;   /* including outside any scope */
+  elle_stage_counters  stages[ELLE_STAGE_COUNT];
+  /* only if events were asked for */
+  cmsBool              record_events;
+  elle_trace_event *   events;
+  int                  event_count;
+  int                  events_allocated;
+} elle_trace_job;
+
+typedef struct {
+  elle_stage       stage;
+  cmsUInt64Number  start;
+  int              outer_stage;      /* the enclosing scope's, or -1 */
+  cmsBool          active;           /* FALSE if there was no current job */
+} elle_trace_scope;
+
+/* "tone_curve", "create_profile", ... */
+const char* elle_stage_name (elle_stage stage);
+
+/* Make job current on this thread, with its counters cleared (its 
+ * name and group are kept). record_events also keeps one event per
+ * scope, for elle_trace_write_chrome_trace. */
+void elle_trace_begin (elle_trace_job *job, cmsBool record_events);
+
+/* Finish the current job of this thread, and make none current */
+void elle_trace_end (void);
+
+/* Free the job's events */
+void elle_trace_free (elle_trace_job *job);
+
+void elle_trace_enter (elle_trace_scope *scope, elle_stage stage);
+
+void elle_trace_leave (elle_trace_scope *scope, cmsUInt64Number written_bytes);
+
+/* Count bytes allocated for the current job; called by the arena */
+void elle_trace_allocation (size_t bytes);
+
+/* A small number for the calling thread, 0 for the first to ask */
+int elle_trace_thread (void);
+
+/* The jobs may include ones never begun (e.g. skipped); they're 
+ * counted as skipped. Returns FALSE if writing failed. */
+cmsBool elle_trace_write_summary (FILE                        *out,
+                                  const elle_trace_job *const *jobs,
+                                  int                         count
+                                  );
+
+cmsBool elle_trace_write_chrome_trace (FILE                        *out,
+                                       const elle_trace_job *const *jobs,
+                                       int                         count
+                                       );
+
+#endif
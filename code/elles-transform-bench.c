@@ -0,0 +1,431 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+
+/* Transform throughput benchmark over the generated profiles.
+ *
+ * Reads every .icc profile in the profiles folder, then, for every
+ * RGB "-elle-V4-" profile, transforms a large synthetic image to a 
+ * destination profile with cmsDoTransform, in 8-bit, 16-bit and float.
+ * The V2 profile with the same colorspace and TRC is measured the same
+ * way, so the V4 parametric curves and the V2 sampled curves (e.g. the
+ * 4096-entry table in sRGB-elle-V2-srgbtrc.icc) can be compared side 
+ * by side. Making each transform is timed too, since that's where 
+ * LCMS optimizes the curves.
+ *
+ * The results are printed, and can be written as CSV and JSON to pick
+ * the fastest profile for a workflow or to compare against an earlier
+ * run.
+ *
+ * Sample command line to compile this code:
+ *
+ * gcc -g -O2 -Wall -o elles-transform-bench.exe elles-transform-bench.c elles-bench-util.c -llcms2
+ *
+ * Command line options:
+ * -d dir   profiles folder (default: ../profiles/)
+ * -t name  destination profile in that folder 
+ *          (default: sRGB-elle-V4-srgbtrc.icc)
+ * -s text  only sources whose name contains text, e.g. "-srgbtrc"
+ * -n N     pixels in the synthetic image (default: 4194304)
+ * -r N     transform the image N times and keep the fastest (default: 3)
+ * -c file  write the results as CSV
+ * -J file  write the results as JSON
+ *
+ * */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <lcms2.h>
+#include "elles-bench-util.h"
+#include "elles-transform-bench.h"
+
+#define FORMAT_COUNT 3
+
+int main (int argc, char *argv[])
+{
+char *directory = "../profiles/";
+char *destination_name = "sRGB-elle-V4-srgbtrc.icc";
+char *source_filter = NULL;
+char *csv_file = NULL, *json_file = NULL;
+size_t pixels = 4194304;
+int repeats = 3;
+int opt, i, f, count, result_count = 0;
+loaded_profile *profiles = NULL, *destination;
+bench_result *results;
+void *output;
+cmsBool ok = TRUE;
+
+pixel_format formats[FORMAT_COUNT] = {
+  { "8-bit",  TYPE_RGB_8,   3 * sizeof(cmsUInt8Number),   NULL },
+  { "16-bit", TYPE_RGB_16,  3 * sizeof(cmsUInt16Number),  NULL },
+  { "float",  TYPE_RGB_FLT, 3 * sizeof(cmsFloat32Number), NULL }
+};
+
+while ((opt = getopt(argc, argv, "d:t:s:n:r:c:J:")) != -1)
+  {
+  if (opt == 'd') directory = optarg;
+  else if (opt == 't') destination_name = optarg;
+  else if (opt == 's') source_filter = optarg;
+  else if (opt == 'n') pixels = (size_t) atol(optarg);
+  else if (opt == 'r') repeats = atoi(optarg);
+  else if (opt == 'c') csv_file = optarg;
+  else if (opt == 'J') json_file = optarg;
+  else
+    {
+    fprintf(stderr, "usage: %s [-d folder] [-t destination] [-s filter] "
+                    "[-n pixels] [-r repeats] [-c csv] [-J json]\n", argv[0]);
+    return 1;
+    }
+  }
+if (pixels < 1) pixels = 1;
+if (pixels > 0xFFFFFFFFu) pixels = 0xFFFFFFFFu;   /* cmsDoTransform's limit */
+if (repeats < 1) repeats = 1;
+
+/* Every profile is read, so a profile LCMS can't open shows up here */
+count = load_profiles (directory, &profiles);
+if (count < 0) return 1;
+destination = find_profile (profiles, count, destination_name);
+if (destination == NULL)
+  {
+  fprintf(stderr, "no destination profile %s in %s\n", destination_name, directory);
+  return 1;
+  }
+
+/* The same synthetic images are used for every transform */
+for ( f = 0; f < FORMAT_COUNT; f++ ) 
+  {
+  formats[f].pixels = malloc (pixels * formats[f].bytes_per_pixel);
+  if (formats[f].pixels == NULL) return 1;
+  fill_image (&formats[f], pixels);
+  }
+output = malloc (pixels * formats[FORMAT_COUNT - 1].bytes_per_pixel);
+results = (bench_result*) calloc ((size_t) count * FORMAT_COUNT, sizeof(bench_result));
+if (output == NULL || results == NULL) return 1;
+
+for ( i = 0; i < count; i++ )
+  {
+  char *name = profiles[i].name;
+  char *V4_tag = strstr(name, "-elle-V4-");
+  loaded_profile *V2 = NULL;
+
+  if (V4_tag == NULL) continue;
+  if (cmsGetColorSpace (profiles[i].profile) != cmsSigRgbData) continue;
+  if (source_filter != NULL && strstr(name, source_filter) == NULL) continue;
+
+  /* The V2 counterpart has the same name with V2 for V4 */
+  char *V2_name = strdup (name);
+  V2_name[V4_tag - name + 7] = '2';
+  V2 = find_profile (profiles, count, V2_name);
+  free (V2_name);
+
+  for ( f = 0; f < FORMAT_COUNT; f++ )
+    {
+    bench_result *result = &results[result_count++];
+    result->V4_name = name;
+    result->V2_name = V2 ? V2->name : NULL;
+    result->format = f;
+    result->V4 = measure_transform (profiles[i].profile, destination->profile, 
+                                    &formats[f], output, pixels, repeats);
+    if (V2 != NULL)
+      result->V2 = measure_transform (V2->profile, destination->profile, 
+                                      &formats[f], output, pixels, repeats);
+    }
+  }
+
+print_results (results, result_count, formats, destination_name);
+if (csv_file && !write_csv (csv_file, results, result_count, formats, 
+                            destination_name))
+  ok = FALSE;
+if (json_file && !write_json (json_file, results, result_count, formats, 
+                              destination_name, pixels, repeats))
+  ok = FALSE;
+
+free (results);
+free (output);
+for ( f = 0; f < FORMAT_COUNT; f++ ) free (formats[f].pixels);
+for ( i = 0; i < count; i++ ) 
+  {
+  cmsCloseProfile (profiles[i].profile);
+  free (profiles[i].name);
+  }
+free (profiles);
+return ok ? 0 : 1;
+}
+
+
+/* Read every .icc file in directory, sorted by name. Returns how many
+ * were read, or -1 if the folder can't be read. */
+static int load_profiles (const char      *directory, 
+                          loaded_profile  **profiles
+                          )
+{
+DIR *folder = opendir (directory);
+struct dirent *entry;
+struct timespec start;
+int count = 0, allocated = 0, failed = 0;
+double seconds;
+
+if (folder == NULL)
+  {
+  fprintf(stderr, "couldn't read the folder %s\n", directory);
+  return -1;
+  }
+
+clock_gettime (CLOCK_MONOTONIC, &start);
+*profiles = NULL;
+while ((entry = readdir (folder)) != NULL)
+  {
+  size_t length = strlen(entry->d_name);
+  char *filename;
+  cmsHPROFILE profile;
+
+  if (length < 4 || strcmp(entry->d_name + length - 4, ".icc") != 0) continue;
+  filename = (char*) malloc (strlen(directory) + length + 2);
+  strcpy(filename, directory);
+  if (filename[0] != '\0' && filename[strlen(filename) - 1] != '/') 
+    strcat(filename, "/");
+  strcat(filename, entry->d_name);
+  profile = cmsOpenProfileFromFile (filename, "r");
+  free (filename);
+  if (profile == NULL)
+    {
+    fprintf(stderr, "couldn't open %s\n", entry->d_name);
+    failed++;
+    continue;
+    }
+
+  if (count == allocated)
+    {
+    allocated = allocated ? 2 * allocated : 128;
+    *profiles = realloc (*profiles, allocated * sizeof(loaded_profile));
+    if (*profiles == NULL) 
+      {
+      fprintf(stderr, "out of memory reading the profiles\n");
+      exit (1);
+      }
+    }
+  (*profiles)[count].name = strdup (entry->d_name);
+  (*profiles)[count].profile = profile;
+  count++;
+  }
+closedir (folder);
+seconds = elle_elapsed_seconds (start);
+
+qsort (*profiles, count, sizeof(loaded_profile), compare_profile_names);
+printf("read %d profiles from %s in %.1f ms", count, directory, seconds * 1e3);
+if (failed) printf(", %d couldn't be opened", failed);
+printf("\n");
+return count;
+}
+
+
+static int compare_profile_names (const void *a, const void *b)
+{
+return strcmp (((const loaded_profile*) a)->name, 
+               ((const loaded_profile*) b)->name);
+}
+
+
+static loaded_profile* find_profile (loaded_profile *profiles, 
+                                     int            count, 
+                                     const char     *name
+                                     )
+{
+loaded_profile key;
+key.name = (char*) name;
+if (count == 0) return NULL;
+return bsearch (&key, profiles, count, sizeof(loaded_profile), 
+                compare_profile_names);
+}
+
+
+/* Pseudo-random pixels, the same on every run, covering the whole 
+ * range of each format (0..1 for float) */
+static void fill_image (pixel_format *format, size_t pixels)
+{
+cmsUInt32Number state = 12345;
+size_t i, values = 3 * pixels;
+
+for ( i = 0; i < values; i++ )
+  {
+  state = state * 1664525u + 1013904223u;
+  if (format->format == TYPE_RGB_8)
+    ((cmsUInt8Number*) format->pixels)[i] = (cmsUInt8Number) (state >> 24);
+  else if (format->format == TYPE_RGB_16)
+    ((cmsUInt16Number*) format->pixels)[i] = (cmsUInt16Number) (state >> 16);
+  else
+    ((cmsFloat32Number*) format->pixels)[i] = (cmsFloat32Number) ((state >> 8) / 16777215.0);
+  }
+}
+
+
+static measurement measure_transform (cmsHPROFILE   source,
+                                      cmsHPROFILE   destination,
+                                      pixel_format  *format,
+                                      void          *output,
+                                      size_t        pixels,
+                                      int           repeats
+                                      )
+{
+measurement result = { 0, 0.0, 0.0 };
+struct timespec start;
+cmsHTRANSFORM transform;
+double seconds, best = 0.0;
+int i;
+
+clock_gettime (CLOCK_MONOTONIC, &start);
+transform = cmsCreateTransform (source, format->format, destination, 
+                                format->format, INTENT_RELATIVE_COLORIMETRIC, 0);
+result.create_ms = elle_elapsed_seconds (start) * 1e3;
+if (transform == NULL) return result;
+
+for ( i = 0; i < repeats; i++ )
+  {
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  cmsDoTransform (transform, format->pixels, output, (cmsUInt32Number) pixels);
+  seconds = elle_elapsed_seconds (start);
+  if (i == 0 || seconds < best) best = seconds;
+  }
+cmsDeleteTransform (transform);
+
+result.measured = 1;
+result.pixels_per_second = best > 0.0 ? pixels / best : 0.0;
+return result;
+}
+
+
+static void print_results (bench_result *results, int count, 
+                           pixel_format *formats, const char *destination
+                           )
+{
+int i;
+
+printf("to %s, millions of pixels per second (transform creation in ms):\n", 
+       destination);
+printf("%-32s %-7s %18s %18s %7s\n", "source", "format", "V4", "V2", "V2/V4");
+for ( i = 0; i < count; i++ )
+  {
+  bench_result *result = &results[i];
+  printf("%-32s %-7s", result->V4_name, formats[result->format].name);
+  if (result->V4.measured)
+    printf(" %9.1f (%6.2f)", result->V4.pixels_per_second * 1e-6, result->V4.create_ms);
+  else printf(" %18s", "failed");
+  if (result->V2.measured)
+    printf(" %9.1f (%6.2f)", result->V2.pixels_per_second * 1e-6, result->V2.create_ms);
+  else printf(" %18s", result->V2_name ? "failed" : "-");
+  if (result->V4.measured && result->V2.measured)
+    printf(" %7.2f", result->V2.pixels_per_second / result->V4.pixels_per_second);
+  printf("\n");
+  }
+}
+
+
+static cmsBool write_csv (const char *filename, bench_result *results, 
+                          int count, pixel_format *formats, 
+                          const char *destination
+                          )
+{
+FILE *file = fopen (filename, "w");
+int i;
+
+if (file == NULL)
+  {
+  fprintf(stderr, "couldn't write %s\n", filename);
+  return FALSE;
+  }
+fprintf(file, "source_V4,source_V2,destination,format,"
+              "V4_create_ms,V4_pixels_per_second,V2_create_ms,V2_pixels_per_second\n");
+for ( i = 0; i < count; i++ )
+  {
+  bench_result *result = &results[i];
+  fprintf(file, "%s,%s,%s,%s,", result->V4_name, 
+          result->V2_name ? result->V2_name : "", destination, 
+          formats[result->format].name);
+  if (result->V4.measured) 
+    fprintf(file, "%.4f,%.0f,", result->V4.create_ms, result->V4.pixels_per_second);
+  else fprintf(file, ",,");
+  if (result->V2.measured) 
+    fprintf(file, "%.4f,%.0f\n", result->V2.create_ms, result->V2.pixels_per_second);
+  else fprintf(file, ",\n");
+  }
+if (fclose (file) != 0)
+  {
+  fprintf(stderr, "couldn't write %s\n", filename);
+  return FALSE;
+  }
+return TRUE;
+}
+
+
+/* The profile names are the generator's file names, which have no
+ * quotes or backslashes, so they are written without escaping */
+static cmsBool write_json (const char *filename, bench_result *results, 
+                           int count, pixel_format *formats, 
+                           const char *destination, size_t pixels, 
+                           int repeats
+                           )
+{
+FILE *file = fopen (filename, "w");
+int i;
+
+if (file == NULL)
+  {
+  fprintf(stderr, "couldn't write %s\n", filename);
+  return FALSE;
+  }
+fprintf(file, "{\n  \"destination\": \"%s\",\n  \"pixels\": %zu,\n"
+              "  \"repeats\": %d,\n  \"results\": [\n", 
+        destination, pixels, repeats);
+for ( i = 0; i < count; i++ )
+  {
+  bench_result *result = &results[i];
+  fprintf(file, "    { \"format\": \"%s\", \"V4\": { \"profile\": \"%s\"", 
+          formats[result->format].name, result->V4_name);
+  if (result->V4.measured)
+    fprintf(file, ", \"create_ms\": %.4f, \"pixels_per_second\": %.0f", 
+            result->V4.create_ms, result->V4.pixels_per_second);
+  fprintf(file, " }, \"V2\": ");
+  if (result->V2_name == NULL) fprintf(file, "null");
+  else
+    {
+    fprintf(file, "{ \"profile\": \"%s\"", result->V2_name);
+    if (result->V2.measured)
+      fprintf(file, ", \"create_ms\": %.4f, \"pixels_per_second\": %.0f", 
+              result->V2.create_ms, result->V2.pixels_per_second);
+    fprintf(file, " }");
+    }
+  fprintf(file, " }%s\n", i + 1 < count ? "," : "");
+  }
+fprintf(file, "  ]\n}\n");
+if (fclose (file) != 0)
+  {
+  fprintf(stderr, "couldn't write %s\n", filename);
+  return FALSE;
+  }
+return TRUE;
+}
@@ -0,0 +1,91 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+
+/* A profile read from the profiles folder */
+typedef struct {
+  char *           name;            /* file name, e.g. "sRGB-elle-V4-srgbtrc.icc" */
+  cmsHPROFILE      profile;
+} loaded_profile;
+
+/* One of the pixel formats transformed */
+typedef struct {
+  const char *     name;
+  cmsUInt32Number  format;          /* TYPE_RGB_8, TYPE_RGB_16, TYPE_RGB_FLT */
+  size_t           bytes_per_pixel;
+  void *           pixels;          /* the synthetic source image */
+} pixel_format;
+
+/* One transform: how long it took to make, and how fast it ran */
+typedef struct {
+  int              measured;
+  double           create_ms;
+  double           pixels_per_second;
+} measurement;
+
+/* A source colorspace and TRC in one pixel format, with the V4 profile
+ * and its V2 counterpart side by side */
+typedef struct {
+  char *           V4_name;
+  char *           V2_name;         /* NULL if there is no V2 profile */
+  int              format;          /* index into the pixel formats */
+  measurement      V4;
+  measurement      V2;
+} bench_result;
+
+static int load_profiles (const char      *directory, 
+                          loaded_profile  **profiles
+                          );
+
+static int compare_profile_names (const void *a, const void *b);
+
+static loaded_profile* find_profile (loaded_profile *profiles, 
+                                     int            count, 
+                                     const char     *name
+                                     );
+
+static void fill_image (pixel_format *format, size_t pixels);
+
+static measurement measure_transform (cmsHPROFILE   source,
+                                      cmsHPROFILE   destination,
+                                      pixel_format  *format,
+                                      void          *output,
+                                      size_t        pixels,
+                                      int           repeats
+                                      );
+
+static void print_results (bench_result *results, int count, 
+                           pixel_format *formats, const char *destination
+                           );
+
+static cmsBool write_csv (const char *filename, bench_result *results, 
+                          int count, pixel_format *formats, 
+                          const char *destination
+                          );
+
+static cmsBool write_json (const char *filename, bench_result *results, 
+                           int count, pixel_format *formats, 
+                           const char *destination, size_t pixels, 
+                           int repeats
+                           );
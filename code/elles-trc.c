@@ -0,0 +1,360 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <lcms2.h>
+#include <lcms2_plugin.h>
+#include "elles-trc.h"
+
+/* The TRC parameters, in the order of elle_trc. The gamma values
+ * 1.80078125 and 2.19921875 are exactly representable as u8Fixed8,
+ * the encoding used for gamma values in V2 'curv' tags. */
+static const elle_trc_definition trc_definitions[ELLE_TRC_COUNT] = {
+  { "-g10",     1, { 1.00 } },
+  { "-g18",     1, { 1.80078125 } },
+  { "-g22",     1, { 2.19921875 } },
+  { "-srgbtrc", 4, { 2.4, 1.0 / 1.055,  0.055 / 1.055, 1.0 / 12.92, 0.04045 } },
+  { "-labl",    4, { 3.0, 1.0 / 1.16,  0.16 / 1.16, 2700.0 / 24389.0, 0.08000 } },
+  { "-rec709",  4, { 1.0 / 0.45, 1.0 / 1.099,  0.099 / 1.099,  1.0 / 4.5, 0.081 } }
+};
+
+/* The registry's LCMS context counts the allocations made in it,
+ * through a memory plugin, so the cost of each curve can be reported. */
+typedef struct {
+  cmsUInt32Number   allocations;
+  cmsUInt32Number   bytes;
+} allocation_counter;
+
+typedef struct {
+  cmsToneCurve *    curve;
+  cmsToneCurve *    reverse_curve;
+  elle_trc_stats    stats;
+} trc_entry;
+
+/* The sampled tables made so far, newest first */
+typedef struct sampled_entry {
+  elle_trc                trc;
+  cmsUInt32Number         entries;
+  cmsToneCurve *          curve;
+  struct sampled_entry *  next;
+} sampled_entry;
+
+static trc_entry trc_registry[ELLE_TRC_COUNT];
+static sampled_entry *sampled_curves = NULL;
+static allocation_counter trc_counter;
+static cmsContext trc_context = NULL;
+static int trc_registry_ready = 0;
+static pthread_mutex_t trc_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void* counting_malloc (cmsContext ContextID, cmsUInt32Number size);
+static void counting_free (cmsContext ContextID, void *Ptr);
+static void* counting_realloc (cmsContext ContextID, void* Ptr, cmsUInt32Number NewSize);
+static cmsBool build_trc_registry (void);
+static cmsToneCurve* make_tonecurve (cmsContext ContextID, elle_trc trc);
+static cmsToneCurve* make_sampled_curve (elle_trc trc, cmsUInt32Number entries);
+
+static cmsPluginMemHandler counting_memory_plugin = {
+  { cmsPluginMagicNumber, 2060, cmsPluginMemHandlerSig, NULL },
+  counting_malloc, counting_free, counting_realloc,
+  NULL, NULL, NULL
+};
+
+
+const elle_trc_definition* elle_trc_definition_of (elle_trc trc)
+{
+if (trc < 0 || trc >= ELLE_TRC_COUNT) return NULL;
+return &trc_definitions[trc];
+}
+
+
+const char* elle_trc_suffix (elle_trc trc)
+{
+if (trc < 0 || trc >= ELLE_TRC_COUNT) return "";
+return trc_definitions[trc].suffix;
+}
+
+
+cmsBool elle_trc_from_suffix (const char *suffix, elle_trc *trc)
+{
+int i;
+for ( i = 0; i < ELLE_TRC_COUNT; i++ )
+  if (strcmp(suffix, trc_definitions[i].suffix) == 0)
+    {
+    *trc = (elle_trc) i;
+    return TRUE;
+    }
+return FALSE;
+}
+
+
+const cmsToneCurve* elle_trc_curve (elle_trc trc)
+{
+if (trc < 0 || trc >= ELLE_TRC_COUNT) return NULL;
+if (!elle_init_trc_registry ()) return NULL;
+return trc_registry[trc].curve;
+}
+
+
+const cmsToneCurve* elle_trc_reverse_curve (elle_trc trc)
+{
+if (trc < 0 || trc >= ELLE_TRC_COUNT) return NULL;
+if (!elle_init_trc_registry ()) return NULL;
+return trc_registry[trc].reverse_curve;
+}
+
+
+const cmsToneCurve* elle_trc_sampled_curve (elle_trc trc, cmsUInt32Number entries)
+{
+sampled_entry *entry;
+cmsToneCurve *curve = NULL;
+
+if (trc < 0 || trc >= ELLE_TRC_COUNT) return NULL;
+if (entries < 2 || entries > 65535) return NULL;
+if (!elle_init_trc_registry ()) return NULL;
+
+pthread_mutex_lock (&trc_registry_lock);
+for ( entry = sampled_curves; entry != NULL; entry = entry->next )
+  if (entry->trc == trc && entry->entries == entries) break;
+if (entry != NULL) curve = entry->curve;
+else 
+  {
+  curve = make_sampled_curve (trc, entries);
+  entry = (sampled_entry*) malloc (sizeof(sampled_entry));
+  if (curve != NULL && entry != NULL)
+    {
+    entry->trc = trc;
+    entry->entries = entries;
+    entry->curve = curve;
+    entry->next = sampled_curves;
+    sampled_curves = entry;
+    }
+  else
+    {
+    if (curve != NULL) cmsFreeToneCurve (curve);
+    free (entry);
+    curve = NULL;
+    }
+  }
+pthread_mutex_unlock (&trc_registry_lock);
+return curve;
+}
+
+
+cmsBool elle_trc_sampling_error (elle_trc          trc, 
+                                 cmsUInt32Number   entries,
+                                 double            *forward,
+                                 double            *round_trip
+                                 )
+{
+const cmsToneCurve *table = elle_trc_sampled_curve (trc, entries);
+const cmsToneCurve *curve = elle_trc_curve (trc);
+const cmsToneCurve *reverse = elle_trc_reverse_curve (trc);
+int i;
+
+*forward = *round_trip = 0.0;
+if (table == NULL || curve == NULL || reverse == NULL) return FALSE;
+
+for ( i = 0; i <= 65535; i++ )
+  {
+  cmsFloat32Number x = (cmsFloat32Number) (i / 65535.0);
+  double error;
+
+  error = fabs (cmsEvalToneCurveFloat (table, x) - cmsEvalToneCurveFloat (curve, x));
+  if (error > *forward) *forward = error;
+
+  error = fabs (cmsEvalToneCurveFloat (table, cmsEvalToneCurveFloat (reverse, x)) - x);
+  if (error > *round_trip) *round_trip = error;
+  }
+return TRUE;
+}
+
+
+cmsBool elle_init_trc_registry (void)
+{
+cmsBool ok = TRUE;
+
+if (__atomic_load_n (&trc_registry_ready, __ATOMIC_ACQUIRE)) return TRUE;
+
+pthread_mutex_lock (&trc_registry_lock);
+if (!trc_registry_ready)
+  {
+  ok = build_trc_registry ();
+  if (ok) __atomic_store_n (&trc_registry_ready, 1, __ATOMIC_RELEASE);
+  }
+pthread_mutex_unlock (&trc_registry_lock);
+return ok;
+}
+
+
+void elle_trc_registry_stats (elle_trc trc, elle_trc_stats *stats)
+{
+memset (stats, 0, sizeof(elle_trc_stats));
+if (trc < 0 || trc >= ELLE_TRC_COUNT) return;
+if (!elle_init_trc_registry ()) return;
+*stats = trc_registry[trc].stats;
+}
+
+
+void elle_free_trc_registry (void)
+{
+int i;
+
+pthread_mutex_lock (&trc_registry_lock);
+for ( i = 0; i < ELLE_TRC_COUNT; i++ )
+  {
+  if (trc_registry[i].curve) cmsFreeToneCurve (trc_registry[i].curve);
+  if (trc_registry[i].reverse_curve) cmsFreeToneCurve (trc_registry[i].reverse_curve);
+  memset (&trc_registry[i], 0, sizeof(trc_entry));
+  }
+while (sampled_curves != NULL)
+  {
+  sampled_entry *next = sampled_curves->next;
+  cmsFreeToneCurve (sampled_curves->curve);
+  free (sampled_curves);
+  sampled_curves = next;
+  }
+if (trc_context) cmsDeleteContext (trc_context);
+trc_context = NULL;
+__atomic_store_n (&trc_registry_ready, 0, __ATOMIC_RELEASE);
+pthread_mutex_unlock (&trc_registry_lock);
+}
+
+
+/* Called with trc_registry_lock held */
+static cmsBool build_trc_registry (void)
+{
+struct timespec start, end;
+cmsUInt32Number allocations, bytes;
+int i;
+
+memset (&trc_counter, 0, sizeof(trc_counter));
+if (trc_context == NULL)
+  trc_context = cmsCreateContext (&counting_memory_plugin, &trc_counter);
+if (trc_context == NULL)
+  {
+  fprintf(stderr, "couldn't create the TRC registry context\n");
+  return FALSE;
+  }
+
+for ( i = 0; i < ELLE_TRC_COUNT; i++ )
+  {
+  trc_entry *entry = &trc_registry[i];
+  if (entry->curve != NULL) continue;
+
+  allocations = __atomic_load_n (&trc_counter.allocations, __ATOMIC_RELAXED);
+  bytes = __atomic_load_n (&trc_counter.bytes, __ATOMIC_RELAXED);
+  clock_gettime (CLOCK_MONOTONIC, &start);
+
+  entry->curve = make_tonecurve (trc_context, (elle_trc) i);
+  if (entry->curve != NULL)
+    entry->reverse_curve = cmsReverseToneCurve (entry->curve);
+
+  clock_gettime (CLOCK_MONOTONIC, &end);
+  entry->stats.seconds = (end.tv_sec - start.tv_sec) +
+                         (end.tv_nsec - start.tv_nsec) * 1e-9;
+  entry->stats.allocations =
+    __atomic_load_n (&trc_counter.allocations, __ATOMIC_RELAXED) - allocations;
+  entry->stats.bytes =
+    __atomic_load_n (&trc_counter.bytes, __ATOMIC_RELAXED) - bytes;
+
+  if (entry->curve == NULL || entry->reverse_curve == NULL)
+    {
+    fprintf(stderr, "couldn't build the %s curve\n", trc_definitions[i].suffix);
+    return FALSE;
+    }
+  }
+return TRUE;
+}
+
+
+static cmsToneCurve* make_tonecurve (cmsContext ContextID, elle_trc trc)
+{
+const elle_trc_definition *definition = &trc_definitions[trc];
+
+if (definition->type == 1)
+  return cmsBuildGamma (ContextID, definition->parameters[0]);
+return cmsBuildParametricToneCurve (ContextID, definition->type,
+                                    definition->parameters);
+}
+
+
+/* Evaluate the TRC's parameters in double precision at entries evenly
+ * spaced inputs, as the V2 templates' 4096-entry tables were made, so 
+ * every table size comes from the same arithmetic. Called with 
+ * trc_registry_lock held, after the registry is built. */
+static cmsToneCurve* make_sampled_curve (elle_trc trc, cmsUInt32Number entries)
+{
+const cmsFloat64Number *p = trc_definitions[trc].parameters;
+cmsUInt16Number *values = (cmsUInt16Number*) malloc (entries * sizeof(cmsUInt16Number));
+cmsToneCurve *curve;
+cmsUInt32Number i;
+
+if (values == NULL) return NULL;
+for ( i = 0; i < entries; i++ )
+  {
+  double x = (double) i / (entries - 1), value;
+  if (trc_definitions[trc].type == 1) value = pow (x, p[0]);
+  else value = x >= p[4] ? pow (p[1] * x + p[2], p[0]) : p[3] * x;
+  value = floor (value * 65535.0 + 0.5);
+  if (value < 0.0) value = 0.0;
+  if (value > 65535.0) value = 65535.0;
+  values[i] = (cmsUInt16Number) value;
+  }
+curve = cmsBuildTabulatedToneCurve16 (trc_context, entries, values);
+free (values);
+return curve;
+}
+
+
+/* Curves are copied into profile tags from any thread, so the
+ * counters are updated atomically. */
+static void* counting_malloc (cmsContext ContextID, cmsUInt32Number size)
+{
+allocation_counter *counter = (allocation_counter*) cmsGetContextUserData (ContextID);
+__atomic_add_fetch (&counter->allocations, 1, __ATOMIC_RELAXED);
+__atomic_add_fetch (&counter->bytes, size, __ATOMIC_RELAXED);
+return malloc (size);
+}
+
+
+static void counting_free (cmsContext ContextID, void *Ptr)
+{
+(void) ContextID;
+free (Ptr);
+}
+
+
+static void* counting_realloc (cmsContext ContextID, void* Ptr, cmsUInt32Number NewSize)
+{
+allocation_counter *counter = (allocation_counter*) cmsGetContextUserData (ContextID);
+__atomic_add_fetch (&counter->allocations, 1, __ATOMIC_RELAXED);
+__atomic_add_fetch (&counter->bytes, NewSize, __ATOMIC_RELAXED);
+return realloc (Ptr, NewSize);
+}
@@ -0,0 +1,108 @@
+/* License:
+ *
+ * Code for making well-behaved ICC profiles
+ * Copyright © 2013, 2014, 2015, 2016 Elle Stone
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * Contact information:
+ * ellestone@ninedegreesbelow.com
+ * http://ninedegreesbelow.com
+ *
+ * */
+
+/* The TRC registry.
+ *
+ * The six tone response curves used by the profiles are built once,
+ * together with their reverse curves, and shared by every profile.
+ * Curves are looked up by elle_trc, not by their file name suffix.
+ *
+ * The curves belong to the registry's own LCMS context, and must not
+ * be freed or changed by the caller. LCMS copies a curve when it's
+ * written to a profile tag, so sharing them between threads is safe.
+ *
+ * */
+
+#ifndef ELLES_TRC_H
+#define ELLES_TRC_H
+
+#include <lcms2.h>
+
+typedef enum {
+  ELLE_TRC_G10,         /* "-g10", gamma 1.00 */
+  ELLE_TRC_G18,         /* "-g18", gamma 1.80078125 */
+  ELLE_TRC_G22,         /* "-g22", gamma 2.19921875 */
+  ELLE_TRC_SRGB,        /* "-srgbtrc", sRGB TRC */
+  ELLE_TRC_LABL,        /* "-labl", L* TRC */
+  ELLE_TRC_REC709,      /* "-rec709", Rec.709 TRC */
+  ELLE_TRC_COUNT,
+  ELLE_TRC_NONE = ELLE_TRC_COUNT  /* Lab and XYZ profiles have no TRC */
+} elle_trc;
+
+/* The LCMS parametric curve that defines a TRC. Type 1 is a pure
+ * gamma, type 4 is the IEC 61966-2.1 style curve; see the LCMS
+ * docs for cmsBuildParametricToneCurve. */
+typedef struct {
+  char *            suffix;
+  cmsInt32Number    type;
+  cmsFloat64Number  parameters[5];
+} elle_trc_definition;
+
+/* What building one curve and its reverse cost */
+typedef struct {
+  double            seconds;
+  cmsUInt32Number   allocations;
+  cmsUInt32Number   bytes;
+} elle_trc_stats;
+
+const elle_trc_definition* elle_trc_definition_of (elle_trc trc);
+
+/* "-g10", "-srgbtrc", ...; "" for ELLE_TRC_NONE */
+const char* elle_trc_suffix (elle_trc trc);
+
+/* Returns FALSE if suffix doesn't name a TRC */
+cmsBool elle_trc_from_suffix (const char *suffix, elle_trc *trc);
+
+/* The shared curves. The registry is built on first use. */
+const cmsToneCurve* elle_trc_curve (elle_trc trc);
+const cmsToneCurve* elle_trc_reverse_curve (elle_trc trc);
+
+/* The TRC sampled into a table of entries 16-bit values (2 to 65535),
+ * for V2 'curv' tags. The tables are computed in double precision from
+ * the same parameters as the parametric curves, built on first use for each (trc, entries)
+ * and then shared like the other curves. NULL if entries is out of 
+ * range or the table couldn't be built. */
+const cmsToneCurve* elle_trc_sampled_curve (elle_trc trc, cmsUInt32Number entries);
+
+/* How far the sampled table for (trc, entries) is from the parametric
+ * curve, over every 16-bit input value, in units of 1.0 = full scale:
+ * forward is the largest difference between the two curves; round_trip
+ * the largest error when a linear value is encoded with the exact 
+ * reverse curve and decoded again with the table, as a CMM would. */
+cmsBool elle_trc_sampling_error (elle_trc          trc, 
+                                 cmsUInt32Number   entries,
+                                 double            *forward,
+                                 double            *round_trip
+                                 );
+
+/* Build the registry now. Returns FALSE if a curve couldn't be built. */
+cmsBool elle_init_trc_registry (void);
+
+void elle_trc_registry_stats (elle_trc trc, elle_trc_stats *stats);
+
+/* Free the curves. No curve may be in use. */
+void elle_free_trc_registry (void);
+
+#endif
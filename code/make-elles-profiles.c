@@ -23,56 +23,312 @@
  * 
  * */
 
-/* About the ICC profile header "Platform" tag:
- * 
- * When creating a profile, LCMS checks to see if the platform is 
- * Windows ('MSFT'). If your platform isn't Windows, LCMS defaults 
- * to using the Apple ('APPL') platform tag for the profile header.
+/* Sample command line to compile this code:
  * 
- * There is an unofficial Platform 
- * cmsPlatformSignature cmsSigUnices 0x2A6E6978 '*nix'. There is, 
- * however, no LCMS2 API for changing the platform when making a profile.
+ * gcc -g -O0 -Wall -o make-elles-profiles.exe make-elles-profiles.c elles-profiles.c elles-icc-writer.c elles-trc.c elles-arena.c elles-cube.c elles-bundle.c elles-gamut.c elles-linear.c elles-trace.c elles-primaries.c elles-bench-util.c -llcms2 -lpthread -lm
  * 
- * So on my own computer, to replace 'APPL' with '*nix' in the header, 
- * I modified the LCMS source file 'cmsio0.c' and recompiled LCMS:
- * #ifdef CMS_IS_WINDOWS_
- * Header.platform= (cmsPlatformSignature) _cmsAdjustEndianess32(cmsSigMicrosoft);
- * #else
- * Header.platform= (cmsPlatformSignature) _cmsAdjustEndianess32(cmsSigUnices);
- * #endif
  * 
  * */
 
-/* Sample command line to compile this code:
+/* About the profile-making jobs:
+ * 
+ * main() doesn't make the profiles directly. Each colorspace is a
+ * record (see builtin_colorspaces, or a spec file given with -f), and
+ * each record adds one job per (TRC, profile version) to a queue. 
+ * The queue is run on a pool of worker threads, which start on the
+ * first jobs while the rest of the records are still being read. Each
+ * worker has its own LCMS context, so the jobs share no LCMS state. 
  * 
- * gcc -g -O0 -Wall -o make-elles-profiles.exe make-elles-profiles.c -llcms2
+ * The V2 profile for a colorspace and TRC is made from a V4 profile 
+ * that its job builds in memory, so the V2 jobs don't have to wait 
+ * on the V4 jobs. The output files don't depend on the number of 
+ * threads or on the order in which the jobs finish.
  * 
+ * Command line options:
+ * -j N   run the jobs on N worker threads (default: number of CPUs)
+ * -b     first run all the jobs with -j1, and report the measured speedup
+ * -o dir write the profiles to dir (default: ../profiles/)
+ * -m     report the memory each profile took: peak bytes in use, and 
+ *        bytes LCMS still held when the job ended (should be 0); the
+ *        TRC tags' copies of the shared curves aren't included (see 
+ *        elles-arena.h)
+ * -f file make the colorspaces in file instead of the built-in ones 
+ *        (the format is described above read_colorspace_file)
+ * -p     print the colorspaces (built-in, or from -f) in the spec file
+ *        format, and make no profiles
+ * -a     make every profile, even the ones the manifest in the output
+ *        directory shows are up to date (see load_manifest)
+ * -i     give the V2 profiles an MD5 profile ID as well (the V4 profiles
+ *        always have one)
+ * -t N   compute the V2 sRGB, L* and Rec709 TRCs as tables of N entries,
+ *        instead of the usual 4096-entry tables, 
+ *        and report the error of the tables at 256, 1024, 4096 and N
+ * -c     make compact profiles for embedding, named "-elle-compact-" 
+ *        (see elle_make_profile)
+ * -z     with -c, also make each full profile in memory, and report 
+ *        each compact profile's size next to the size of the full one
+ * -L file after making the profiles, make the device links listed in 
+ *        file (see make_device_links), and report how much faster a 
+ *        transform is made from each link than from its two profiles
+ *        (the file format is described above read_pairs_file)
+ * -C file after making the profiles, bake the pairs listed in file into
+ *        .cube 3D LUTs, sampled on the worker threads, and report each
+ *        LUT's Delta E 2000 against the exact transform (see make_cube_luts)
+ * -g N   the 3D LUT grid size (default 33; 17 and 65 are also usual)
+ * -e prefix write every profile into prefix.h and prefix.c as byte 
+ *        arrays, with a lookup by (colorspace, TRC, version), for linking
+ *        into programs (see write_embedded_profiles)
+ * -B file write every profile into one indexed bundle file, for 
+ *        programs to map and look profiles up in (see write_profile_bundle)
+ * -x prefix write the TRC parameters and the RGB to RGB matrices for 
+ *        every pair of RGB colorspaces into prefix.h and prefix.json
+ *        (see write_matrix_export)
+ * -G prefix write a gamut-boundary descriptor of every RGB colorspace
+ *        into prefix.h and prefix.c, for the in-gamut checks of 
+ *        elles-gamut.c (see write_gamut_descriptors)
+ * -T file write the time, arena allocations and bytes written of each 
+ *        stage of making each profile (tone curve, profile creation, tag
+ *        writing, V2 encoding, profile ID, serialization, file writing) 
+ *        into file as JSON, totalled by stage, by colorspace and by job
+ *        (see elles-trace.h)
+ * -E file write one event per stage of each job into file, in the Trace 
+ *        Event Format that chrome://tracing and Perfetto read
+ * -Q     check the prequantized primaries of the built-in colorspaces
+ *        against the ones elle_prequantize_primaries finds from the 
+ *        published primaries (see check_prequantized), and make no profiles
+ * 
+ * The profiles themselves are made in memory by elle_make_profile 
+ * (elles-profiles.c); writing them to files is just one way to use them.
  * 
  * */
  
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <glob.h>
 #include <lcms2.h>
+#include "elles-profiles.h"
+#include "elles-arena.h"
+#include "elles-cube.h"
+#include "elles-bundle.h"
+#include "elles-gamut.h"
+#include "elles-linear.h"
+#include "elles-trace.h"
+#include "elles-primaries.h"
+#include "elles-bench-util.h"
 #include "make-elles-profiles.h"
 
-int main ()
+int main (int argc, char *argv[])
 {
+int i; /* for looping through the finished jobs */
+
+/* ******************** Read the command line options **************** */
+int threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+int compare = 0, memory_report = 0, print_only = 0, rebuild_all = 0, check_only = 0;
+int V2_profile_id = 0, V2_trc_entries = 0, compact = 0, size_report = 0;
+char *directory = "../profiles/";
+char *spec_file = NULL, *pairs_file = NULL, *cube_pairs_file = NULL;
+char *embed_prefix = NULL, *bundle_file = NULL, *matrix_prefix = NULL;
+char *gamut_prefix = NULL, *trace_file = NULL, *events_file = NULL;
+int grid_size = 33;
+int opt;
+while ((opt = getopt(argc, argv, "j:bo:mf:pait:czL:C:g:e:B:x:G:T:E:Q")) != -1)
+  {
+  if (opt == 'j') threads = atoi(optarg);
+  else if (opt == 'b') compare = 1;
+  else if (opt == 'o') directory = make_directory_name (optarg);
+  else if (opt == 'm') memory_report = 1;
+  else if (opt == 'f') spec_file = optarg;
+  else if (opt == 'p') print_only = 1;
+  else if (opt == 'a') rebuild_all = 1;
+  else if (opt == 'i') V2_profile_id = 1;
+  else if (opt == 't') V2_trc_entries = atoi(optarg);
+  else if (opt == 'c') compact = 1;
+  else if (opt == 'z') size_report = 1;
+  else if (opt == 'L') pairs_file = optarg;
+  else if (opt == 'C') cube_pairs_file = optarg;
+  else if (opt == 'g') grid_size = atoi(optarg);
+  else if (opt == 'e') embed_prefix = optarg;
+  else if (opt == 'B') bundle_file = optarg;
+  else if (opt == 'x') matrix_prefix = optarg;
+  else if (opt == 'G') gamut_prefix = optarg;
+  else if (opt == 'T') trace_file = optarg;
+  else if (opt == 'E') events_file = optarg;
+  else if (opt == 'Q') check_only = 1;
+  else 
+    {
+    fprintf(stderr, "usage: %s [-j threads] [-b] [-o directory] [-m] "
+                    "[-f colorspace file] [-p] [-a] [-i] [-t entries] [-c] [-z] "
+                    "[-L link pairs file] [-C LUT pairs file] [-g grid size] "
+                    "[-e embedded source prefix] [-B bundle file] "
+                    "[-x matrix export prefix] [-G gamut descriptor prefix] "
+                    "[-T stage timings file] [-E trace events file] [-Q]\n", argv[0]);
+    return 1;
+    }
+  }
+if (threads < 1) threads = 1;
+if (V2_trc_entries != 0 && (V2_trc_entries < 2 || V2_trc_entries > 65535))
+  {
+  fprintf(stderr, "the V2 TRC tables need 2 to 65535 entries\n");
+  return 1;
+  }
+if (grid_size < 2 || grid_size > 256)
+  {
+  fprintf(stderr, "a 3D LUT needs 2 to 256 grid points (17, 33 and 65 are usual)\n");
+  return 1;
+  }
+
+colorspace_table table = { NULL, 0, 0, NULL, FALSE, 0 };
+profile_queue queue;
+profile_pool pool;
+profile_manifest manifest = { NULL, 0, 0 };
+int built = 0, skipped = 0, failed = 0;
+/* Each worker makes its own copyright MLU from this text */
+char *copyright_text = ELLE_COPYRIGHT_TEXT;
+
+/* -p: print the colorspaces in the spec file format, make nothing */
+if (print_only)
+  {
+  cmsBool read_ok = TRUE;
+  if (spec_file) read_ok = read_colorspace_file (&table, spec_file);
+  else builtin_colorspaces (&table);
+  print_colorspaces (&table, stdout);
+  free_colorspaces (&table);
+  return read_ok ? 0 : 1;
+  }
+
+/* -Q: check the built-in prequantized primaries, make nothing */
+if (check_only)
+  {
+  table.check_prequantized = TRUE;
+  builtin_colorspaces (&table);
+  printf("%d of the built-in prequantized primaries don't add up to the white\n", 
+         table.prequantized_failures);
+  free_colorspaces (&table);
+  return table.prequantized_failures == 0 ? 0 : 1;
+  }
+
 printf("D50X, D50Y, D50Z = %1.8f %1.8f %1.8f\n", cmsD50X, cmsD50Y, cmsD50Z);
-int i; /* for looping through the various TRCs */
 
-/* *****************Set up V2_profile variables and values *************** */
-cmsHPROFILE V4_profile;
+/* ****************** RUN THE PROFILE-MAKING JOBS ******************* */
+double serial_seconds = 0.0, wall_seconds, job_seconds = 0.0;
+cmsBool read_ok = TRUE;
+
+/* Build the shared TRCs once, for all the jobs */
+if (!elle_init_trc_registry ()) return 1;
+for ( i = 0; i < ELLE_TRC_COUNT; i++ )
+  {
+  elle_trc_stats stats;
+  elle_trc_registry_stats ((elle_trc) i, &stats);
+  printf("TRC %-9s built in %8.1f us, %3u allocations, %6u bytes\n", 
+         elle_trc_suffix ((elle_trc) i), stats.seconds * 1e6, 
+         stats.allocations, stats.bytes);
+  }
+if (V2_trc_entries > 0) report_trc_tables ((cmsUInt32Number) V2_trc_entries);
+
+init_profile_queue (&queue);
+queue.V2_profile_id = V2_profile_id;
+queue.V2_trc_entries = (cmsUInt32Number) V2_trc_entries;
+queue.compact = compact;
+queue.compare_sizes = compact && size_report;
+queue.trace = trace_file != NULL || events_file != NULL;
+queue.trace_events = events_file != NULL;
+table.queue = &queue;
+load_manifest (&manifest, directory);
+
+if (compare && threads > 1)
+  {
+  /* Both runs need the whole queue, so read it all first. Both 
+   * rebuild every profile, or the second run would skip them all. */
+  if (spec_file) read_ok = read_colorspace_file (&table, spec_file);
+  else builtin_colorspaces (&table);
+  close_profile_queue (&queue);
+  serial_seconds = run_profile_jobs (&queue, 1, copyright_text, directory);
+  printf("-j1: %d jobs in %.3f s\n", queue.count, serial_seconds);
+  wall_seconds = run_profile_jobs (&queue, threads, copyright_text, directory);
+  }
+else
+  {
+  /* The workers start on the first jobs while the rest are still 
+   * being read, so a long spec file never has to be read up front. */
+  start_profile_pool (&pool, &queue, threads, copyright_text, directory,
+                      rebuild_all ? NULL : &manifest);
+  if (spec_file) read_ok = read_colorspace_file (&table, spec_file);
+  else builtin_colorspaces (&table);
+  close_profile_queue (&queue);
+  wall_seconds = finish_profile_pool (&pool);
+  }
+
+for ( i = 0; i < queue.count; i++ ) job_seconds += QUEUE_JOB(&queue, i)->seconds;
+printf("-j%d: %d colorspaces, %d jobs in %.3f s\n", threads, table.count, 
+       queue.count, wall_seconds);
+
+if (serial_seconds > 0.0)
+  printf("speedup against -j1: %.2fx\n", serial_seconds / wall_seconds);
+else if (threads > 1)
+  printf("speedup against -j1 (estimated from summed job times): %.2fx\n", 
+         job_seconds / wall_seconds);
+
+report_memory (&queue, memory_report);
+if (queue.compare_sizes) report_sizes (&queue);
+if (queue.trace && !write_trace_files (&queue, trace_file, events_file))
+  read_ok = FALSE;
+
+for ( i = 0; i < queue.count; i++ ) 
+  {
+  job_status status = QUEUE_JOB(&queue, i)->status;
+  if (status == JOB_BUILT) built++;
+  else if (status == JOB_SKIPPED) skipped++;
+  else failed++;
+  }
+printf("%d profiles rebuilt, %d skipped as unchanged, %d failed\n", 
+       built, skipped, failed);
+if (failed > 0) read_ok = FALSE;
+if (!write_manifest (&manifest, &queue, directory)) read_ok = FALSE;
+/* elle_make_profile puts the short copyright in compact profiles */
+if (embed_prefix && 
+    !write_embedded_profiles (&queue, directory, embed_prefix, 
+                              compact ? ELLE_COMPACT_COPYRIGHT_TEXT : copyright_text))
+  read_ok = FALSE;
+if (bundle_file && !write_profile_bundle (&queue, directory, bundle_file))
+  read_ok = FALSE;
+if (matrix_prefix && !write_matrix_export (&queue, directory, matrix_prefix))
+  read_ok = FALSE;
+if (gamut_prefix && !write_gamut_descriptors (&queue, directory, gamut_prefix))
+  read_ok = FALSE;
+
+/* The links are made from the profiles just written */
+if (pairs_file && !make_device_links (pairs_file, directory, copyright_text)) 
+  read_ok = FALSE;
+if (cube_pairs_file && !make_cube_luts (cube_pairs_file, directory, grid_size, threads))
+  read_ok = FALSE;
+
+free_manifest (&manifest);
+free_profile_queue (&queue);
+free_colorspaces (&table);
+elle_free_trc_registry ();
+
+/* make gcc happy by returning an integer from main() */
+return read_ok ? 0 : 1;
+}
+
+/* The built-in colorspaces. Each colorspace is one record; the
+ * profiles are made from the records, so a colorspace can just as 
+ * well come from a spec file (see read_colorspace_file). */
+static void builtin_colorspaces (colorspace_table *table)
+{
 cmsCIEXYZ media_whitepoint;
-cmsCIEXYZ media_blackpoint = {0.0, 0.0, 0.0};
 cmsCIExyY whitepoint;
 cmsCIExyYTRIPLE primaries;
-//cmsMLU *MfgDesc = cmsMLUalloc(NULL, 1);
-cmsMLU *copyright = cmsMLUalloc(NULL, 1);
-cmsMLUsetASCII(copyright, "en", "US", "Copyright 2016, Elle Stone (http://ninedegreesbelow.com/), CC-BY-SA 3.0 Unported (https://creativecommons.org/licenses/by-sa/3.0/legalcode).");
-char *basename="", *trc="";
+cmsCIExyYTRIPLE no_primaries = { {0.0, 0.0, 0.0}, {0.0, 0.0, 0.0}, {0.0, 0.0, 0.0} };
+char *basename="";
 char *manufacturer="";
-char *id="-elle", *extension=".icc";
 
 
 /* ************************** WHITE POINTS ************************** */
@@ -129,7 +385,7 @@ cmsCIExyY d60_aces= {0.32168, 0.33767, 1.0};
 cmsCIEXYZ d60_aces_media_whitepoint = {0.952646075, 1.0, 1.008825184};
 
 
-/* ********************** MAKE THE PROFILES ************************* */
+/* ************************** COLORSPACES *************************** */
 
 /* ACES PROFILES */
 
@@ -152,18 +408,8 @@ media_whitepoint = d60_aces_media_whitepoint;
 basename = "ACEScg";
 manufacturer = "ACEScg chromaticities from S-2014-004 v1.0.1, http://www.oscars.org/science-technology/aces/aces-documentation";
 //ModelDesc = "http://www.oscars.org/science-technology/aces/aces-documentation";
-for ( i = 0; i < 6; i++ ) {
-    if (i==0) trc="-g10";
-    else if (i==1) trc="-g18";
-    else if (i==2) trc="-g22";
-    else if (i==3) trc="-srgbtrc";
-    else if (i==4) trc="-labl";
-    else if (i==5) trc="-rec709";
-    V4_profile = make_V4_profile (whitepoint, primaries, trc, basename, id, 
-                              extension, copyright, manufacturer);
-    make_V2_profile (V4_profile, media_whitepoint, media_blackpoint, 
-                 trc, basename, id, extension, copyright, manufacturer);
-    }
+add_colorspace (table, ELLE_PROFILE_RGB, basename, manufacturer, whitepoint, 
+                primaries, media_whitepoint, ALL_TRCS, ALL_VERSIONS);
 
 /* ***** Make profile: ACES, D60, gamma=1.00 */
 /* ACES chromaticities taken from
@@ -171,13 +417,13 @@ for ( i = 0; i < 6; i++ ) {
  * Informative Notes on SMPTE ST 2065-1 – Academy
  * Color Encoding Specification (ACES)
  * http://www.oscars.org/science-technology/aces/aces-documentation
- * 
+ * */
 cmsCIExyYTRIPLE aces_primaries = 
 {
 {0.73470,  0.26530,  1.0},
 {0.00000,  1.00000,  1.0},
 {0.00010, -0.07700,  1.0}
-}; */
+};
 cmsCIExyYTRIPLE aces_primaries_prequantized = 
 {
 {0.734704192222, 0.265298276252,  1.0},
@@ -188,29 +434,14 @@ whitepoint = d60_aces;
 primaries = aces_primaries_prequantized;
 media_whitepoint = d60_aces_media_whitepoint;
 basename = "ACES";
+check_prequantized (table, basename, whitepoint, aces_primaries, primaries);
 manufacturer = "ACES chromaticities from TB-2014-004, http://www.oscars.org/science-technology/aces/aces-documentation";
 //ModelDesc = "http://www.oscars.org/science-technology/aces/aces-documentation";
-for ( i = 0; i < 6; i++ ) {
-    if (i==0) trc="-g10";
-    else if (i==1) trc="-g18";
-    else if (i==3) trc="-g22";
-    else if (i==4) 
-      {
-        trc="-srgbtrc";
-      }
-    else if (i==5) 
-      {
-        trc="-labl";
-        }
-    else if (i==6) 
-      {
-        trc="-rec709";
-      }
-    V4_profile = make_V4_profile (whitepoint, primaries, trc, basename, id, 
-                              extension, copyright, manufacturer);
-    make_V2_profile (V4_profile, media_whitepoint, media_blackpoint, 
-                 trc, basename, id, extension, copyright, manufacturer);
-    }
+/* The old hand-written ACES loop skipped i==2 and never reached i==6,
+ * so ACES profiles with the rec709 TRC weren't made until the
+ * colorspaces became records. */
+add_colorspace (table, ELLE_PROFILE_RGB, basename, manufacturer, whitepoint, 
+                primaries, media_whitepoint, ALL_TRCS, ALL_VERSIONS);
 
 
 /* ***** Make profile: AllColorsRGB, D50, gamma=1.00 */
@@ -248,18 +479,8 @@ media_whitepoint = d50_illuminant_specs_media_whitepoint;
 basename = "AllColorsRGB";
 manufacturer = "AllColorsRGB chromaticities from http://ninedegreesbelow.com/photography/lcms-make-icc-profiles.html#AllColorsRGB";
 //ModelDesc = "http://ninedegreesbelow.com/photography/lcms-make-icc-profiles.html#AllColorsRGB";
-for ( i = 0; i < 6; i++ ) {
-    if (i==0) trc="-g10";
-    else if (i==1) trc="-g18";
-    else if (i==2) trc="-g22";
-    else if (i==3) trc="-srgbtrc";
-    else if (i==4) trc="-labl";
-    else if (i==5) trc="-rec709";
-    V4_profile = make_V4_profile (whitepoint, primaries, trc, basename, id, 
-                              extension, copyright, manufacturer);
-    make_V2_profile (V4_profile, media_whitepoint, media_blackpoint, 
-                 trc, basename, id, extension, copyright, manufacturer);
-    }
+add_colorspace (table, ELLE_PROFILE_RGB, basename, manufacturer, whitepoint, 
+                primaries, media_whitepoint, ALL_TRCS, ALL_VERSIONS);
 
 
 /* ***** Make profile: Identity, D50, gamma=1.00. */
@@ -276,18 +497,8 @@ media_whitepoint = d50_illuminant_specs_media_whitepoint;
 basename = "IdentityRGB";
 manufacturer = "A discussion of the Identity profile primaries can be found here: http://ninedegreesbelow.com/photography/xyz-rgb.html#ICC";
 //ModelDesc = "";
-for ( i = 0; i < 6; i++ ) {
-    if (i==0) trc="-g10";
-    else if (i==1) trc="-g18";
-    else if (i==2) trc="-g22";
-    else if (i==3) trc="-srgbtrc";
-    else if (i==4) trc="-labl";
-    else if (i==5) trc="-rec709";
-    V4_profile = make_V4_profile (whitepoint, primaries, trc, basename, id, 
-                              extension, copyright, manufacturer);
-    make_V2_profile (V4_profile, media_whitepoint, media_blackpoint, 
-                 trc, basename, id, extension, copyright, manufacturer);
-    }
+add_colorspace (table, ELLE_PROFILE_RGB, basename, manufacturer, whitepoint, 
+                primaries, media_whitepoint, ALL_TRCS, ALL_VERSIONS);
 
 
 /* ***** Make profile: Romm/Prophoto, D50, gamma=1.80 */
@@ -316,18 +527,8 @@ media_whitepoint = d50_romm_spec_media_whitepoint;
 basename = "LargeRGB";
 manufacturer = "LargeRGB chromaticities from Reference Input/Output Medium Metric RGB Color Encodings (RIMM/ROMM RGB), http://photo-lovers.org/pdf/color/romm.pdf";
 //ModelDesc = "";
-for ( i = 0; i < 6; i++ ) {
-    if (i==0) trc="-g10";
-    else if (i==1) trc="-g18";
-    else if (i==2) trc="-g22";
-    else if (i==3) trc="-srgbtrc";
-    else if (i==4) trc="-labl";
-    else if (i==5) trc="-rec709";
-    V4_profile = make_V4_profile (whitepoint, primaries, trc, basename, id, 
-                              extension, copyright, manufacturer);
-    make_V2_profile (V4_profile, media_whitepoint, media_blackpoint, 
-                 trc, basename, id, extension, copyright, manufacturer);
-    }
+add_colorspace (table, ELLE_PROFILE_RGB, basename, manufacturer, whitepoint, 
+                primaries, media_whitepoint, ALL_TRCS, ALL_VERSIONS);
 
 
 /* ***** Make profile: WidegamutRGB, D50, gamma=2.19921875 */
@@ -348,6 +549,9 @@ media_whitepoint = d50_romm_spec_media_whitepoint;
 basename = "WideRGB";
 manufacturer = "WideRGB chromaticities from Danny Pascale: A review of RGB color spaces, http://www.babelcolor.com/download/A%20review%20of%20RGB%20color%20spaces.pdf";
 //ModelDesc = "";
+/* WideRGB was defined here for a long time without ever being made */
+add_colorspace (table, ELLE_PROFILE_RGB, basename, manufacturer, whitepoint, 
+                primaries, media_whitepoint, ALL_TRCS, ALL_VERSIONS);
 
 
 /* ***** Make profile: ClayRGB (AdobeRGB), D65, gamma=2.19921875 */
@@ -359,12 +563,12 @@ manufacturer = "WideRGB chromaticities from Danny Pascale: A review of RGB color
  * if used with appropriate caution to avoid posterization. 
  * When made with the gamma=2.19921875 tone response curve
  * this profile can be applied to DCF R98 camera-generated jpegs.
- *
+ * */
 cmsCIExyYTRIPLE adobe_primaries = {
 {0.6400, 0.3300, 1.0},
 {0.2100, 0.7100, 1.0},
 {0.1500, 0.0600, 1.0}
-}; */
+};
 cmsCIExyYTRIPLE adobe_primaries_prequantized = {
 {0.639996511, 0.329996864, 1.0},
 {0.210005295, 0.710004866, 1.0},
@@ -374,20 +578,11 @@ primaries = adobe_primaries_prequantized;
 whitepoint = d65_srgb_adobe_specs;
 media_whitepoint = d65_media_whitepoint;
 basename = "ClayRGB";
+check_prequantized (table, basename, whitepoint, adobe_primaries, primaries);
 manufacturer = "ClayRGB chromaticities as given in Adobe RGB (1998) Color Image Encoding, Version 2005-05, https://www.adobe.com/digitalimag/pdfs/AdobeRGB1998.pdf";
 //ModelDesc = "";
-for ( i = 0; i < 6; i++ ) {
-    if (i==0) trc="-g10";
-    else if (i==1) trc="-g18";
-    else if (i==2) trc="-g22";
-    else if (i==3) trc="-srgbtrc";
-    else if (i==4) trc="-labl";
-    else if (i==5) trc="-rec709";
-    V4_profile = make_V4_profile (whitepoint, primaries, trc, basename, id, 
-                              extension, copyright, manufacturer);
-    make_V2_profile (V4_profile, media_whitepoint, media_blackpoint, 
-                 trc, basename, id, extension, copyright, manufacturer);
-    }
+add_colorspace (table, ELLE_PROFILE_RGB, basename, manufacturer, whitepoint, 
+                primaries, media_whitepoint, ALL_TRCS, ALL_VERSIONS);
 
 
 /* ***** Make profile: Rec.2020, D65, Rec709 TRC */
@@ -399,15 +594,17 @@ cmsCIExyYTRIPLE rec2020_primaries = {
 {0.1314, 0.0459, 1.0}
 };
 https://www.itu.int/dms_pubrec/itu-r/rec/bt/R-REC-BT.2020-2-201510-I!!PDF-E.pdf
+I used the first set of primaries given above, but after 
+hexadecimal quantization the two sets of primaries 
+seem to produce the same profile colorants.
+The prequantized primaries are checked (-Q) against the second set,
+from the BT.2020-2 link, which follows.
+*/
 cmsCIExyYTRIPLE rec2020_primaries = {
 {0.708, 0.292, 1.0},
 {0.170, 0.797, 1.0},
 {0.131, 0.046, 1.0}
 };
-I used the first set of primaries given above, but after 
-hexadecimal quantization the two sets of primaries 
-seem to produce the same profile colorants.
-*/
 cmsCIExyYTRIPLE rec2020_primaries_prequantized = {
 {0.708012540607, 0.291993664388, 1.0},
 {0.169991652439, 0.797007778423, 1.0},
@@ -417,20 +614,11 @@ primaries = rec2020_primaries_prequantized;
 whitepoint = d65_srgb_adobe_specs;
 media_whitepoint = d65_media_whitepoint;
 basename = "Rec2020";
+check_prequantized (table, basename, whitepoint, rec2020_primaries, primaries);
 manufacturer = "Rec2020 chromaticities from https://www.itu.int/dms_pub/itu-r/opb/rep/R-REP-BT.2246-2-2012-PDF-E.pdf; https://www.itu.int/dms_pubrec/itu-r/rec/bt/R-REC-BT.2020-2-201510-I!!PDF-E.pdf";
 //ModelDesc = "";
-for ( i = 0; i < 6; i++ ) {
-    if (i==0) trc="-g10";
-    else if (i==1) trc="-g18";
-    else if (i==2) trc="-g22";
-    else if (i==3) trc="-srgbtrc";
-    else if (i==4) trc="-labl";
-    else if (i==5) trc="-rec709";
-    V4_profile = make_V4_profile (whitepoint, primaries, trc, basename, id, 
-                              extension, copyright, manufacturer);
-    make_V2_profile (V4_profile, media_whitepoint, media_blackpoint, 
-                 trc, basename, id, extension, copyright, manufacturer);
-    }
+add_colorspace (table, ELLE_PROFILE_RGB, basename, manufacturer, whitepoint, 
+                primaries, media_whitepoint, ALL_TRCS, ALL_VERSIONS);
 
 
 /* ***** Make profile: sRGB, D65, sRGB TRC */
@@ -443,12 +631,12 @@ for ( i = 0; i < 6; i++ ) {
  * is an excellent color space for editing 8-bit images.
  * When made using the linear gamma TRC, the resulting profile
  * should only be used for high bit depth image editing.
- *
+ * */
 cmsCIExyYTRIPLE srgb_primaries = {
 {0.6400, 0.3300, 1.0},
 {0.3000, 0.6000, 1.0},
 {0.1500, 0.0600, 1.0}
-}; */
+};
 cmsCIExyYTRIPLE srgb_primaries_pre_quantized = {
 {0.639998686, 0.330010138, 1.0},
 {0.300003784, 0.600003357, 1.0},
@@ -458,24 +646,18 @@ primaries = srgb_primaries_pre_quantized;
 whitepoint = d65_srgb_adobe_specs;
 media_whitepoint = d65_media_whitepoint;
 basename = "sRGB";
+check_prequantized (table, basename, whitepoint, srgb_primaries, primaries);
 manufacturer = "sRGB chromaticities from A Standard Default Color Space for the Internet - sRGB, http://www.w3.org/Graphics/Color/sRGB; also see http://www.color.org/specification/ICC1v43_2010-12.pdf";
 //ModelDesc = "";
-for ( i = 0; i < 6; i++ ) {
-    if (i==0) trc="-g10";
-    else if (i==1) trc="-g18";
-    else if (i==2) trc="-g22";
-    else if (i==3) trc="-srgbtrc";
-    else if (i==4) trc="-labl"; 
-    else if (i==5) {
-      trc="-rec709"; 
-      basename="Rec709";
-      manufacturer="Rec709 chromaticities from Recommendation ITU-R BT.709-6 (06/2015), http://www.itu.int/dms_pubrec/itu-r/rec/bt/R-REC-BT.709-6-201506-I!!PDF-E.pdf";
-      }
-    V4_profile = make_V4_profile (whitepoint, primaries, trc, basename, id, 
-                              extension, copyright, manufacturer);
-    make_V2_profile (V4_profile, media_whitepoint, media_blackpoint, 
-                 trc, basename, id, extension, copyright, manufacturer);
-    }
+add_colorspace (table, ELLE_PROFILE_RGB, basename, manufacturer, whitepoint, 
+                primaries, media_whitepoint, ALL_TRCS & ~TRC_BIT(ELLE_TRC_REC709), 
+                ALL_VERSIONS);
+/* sRGB primaries with the Rec709 TRC are made as "Rec709" */
+basename="Rec709";
+manufacturer="Rec709 chromaticities from Recommendation ITU-R BT.709-6 (06/2015), http://www.itu.int/dms_pubrec/itu-r/rec/bt/R-REC-BT.709-6-201506-I!!PDF-E.pdf";
+add_colorspace (table, ELLE_PROFILE_RGB, basename, manufacturer, whitepoint, 
+                primaries, media_whitepoint, TRC_BIT(ELLE_TRC_REC709), 
+                ALL_VERSIONS);
 
 
 /* ***** Make profile: CIE-RGB profile, E white point*/
@@ -501,12 +683,12 @@ for ( i = 0; i < 6; i++ ) {
 700.0 nm has Spectral Locus coordinates: x:0.734690023  y:0.265309977
 546.1 nm has Spectral Locus coordinates: x:0.2736747378 y:0.7174284409
 435.8 nm has Spectral Locus coordinates: x:0.1665361196 y:0.0088826412
-*
+*/
 cmsCIExyYTRIPLE cie_primaries_ledtuning = {
 {0.7346900230, 0.2653099770, 1.0},
 {0.2736747378, 0.7174284409, 1.0},
 {0.1665361196, 0.0088826412, 1.0}
-}; */
+};
 /* Assuming you want to use the ASTM values for the E white point, 
  * here are the prequantized ledtuning primaries */
 cmsCIExyYTRIPLE cie_primaries_ledtuning_prequantized = {
@@ -518,317 +700,2291 @@ primaries = cie_primaries_ledtuning_prequantized;
 whitepoint = e_astm;
 media_whitepoint = e_astm_media_whitepoint;
 basename = "CIERGB";
+check_prequantized (table, basename, whitepoint, cie_primaries_ledtuning, primaries);
 manufacturer = "A discussion of the CIERGB chromaticities can be found at http://ninedegreesbelow.com/photography/lcms-make-icc-profiles.html#CIERGB";
 //ModelDesc = "";
-for ( i = 0; i < 6; i++ ) {
-    if (i==0) trc="-g10";
-    else if (i==1) trc="-g18";
-    else if (i==2) trc="-g22";
-    else if (i==3) trc="-srgbtrc";
-    else if (i==4) trc="-labl";
-    else if (i==5) trc="-rec709";
-    V4_profile = make_V4_profile (whitepoint, primaries, trc, basename, id, 
-                              extension, copyright, manufacturer);
-    make_V2_profile (V4_profile, media_whitepoint, media_blackpoint, 
-                 trc, basename, id, extension, copyright, manufacturer);
-    }
+add_colorspace (table, ELLE_PROFILE_RGB, basename, manufacturer, whitepoint, 
+                primaries, media_whitepoint, ALL_TRCS, ALL_VERSIONS);
 
 
-/* **************************** Make Gray ICC profiles ************** */
+/* **************************** Gray ICC profiles ******************* */
 whitepoint = d50_illuminant_specs;
 media_whitepoint = d50_illuminant_specs_media_whitepoint;
 basename = "Gray";
-for ( i = 0; i < 6; i++ ) 
-    {
-    if (i==0) trc="-g10";
-    else if (i==1) trc="-g18";
-    else if (i==2) trc="-g22";
-    else if (i==3) trc="-srgbtrc";
-    else if (i==4) trc="-labl";
-    else if (i==5) trc="-rec709";
-    make_gray_profile (whitepoint, trc, basename, id, extension, 
-                       copyright, media_whitepoint, media_blackpoint
-                       );
-    } 
+add_colorspace (table, ELLE_PROFILE_GRAY, basename, "", whitepoint, 
+                no_primaries, media_whitepoint, ALL_TRCS, ALL_VERSIONS);
 
 
-/* *********** Make LCMS built-in LAB and XYZ profiles ************** */
+/* *************** LCMS built-in LAB and XYZ profiles ***************** */
 whitepoint = d50_illuminant_specs;
-make_LAB_XYZ_profiles (whitepoint, copyright);
+add_colorspace (table, ELLE_PROFILE_LAB, "Lab-D50-Identity", "", whitepoint, 
+                no_primaries, media_whitepoint, 0, ALL_VERSIONS);
+add_colorspace (table, ELLE_PROFILE_XYZ, "XYZ-D50-Identity", "", whitepoint, 
+                no_primaries, media_whitepoint, 0, VERSION_V4);
+}
 
+/* -Q: the built-in prequantized primaries, next to the published ones
+ * as cmsCreateRGBProfile would round them and to what 
+ * elle_prequantize_primaries finds. The built-in ones were tuned by 
+ * hand; they fail the check if their colorant rows don't add up to the
+ * D50 white. The solver's can be a little nearer the published 
+ * primaries, but using them would change the profiles. */
+static void check_prequantized (colorspace_table *table,
+                                const char       *basename,
+                                cmsCIExyY        whitepoint,
+                                cmsCIExyYTRIPLE  published,
+                                cmsCIExyYTRIPLE  prequantized
+                                )
+{
+elle_colorant_check builtin;
+elle_prequantize_stats stats;
+cmsCIExyYTRIPLE solved;
+
+if (!table->check_prequantized) return;
+if (!elle_check_primaries (&whitepoint, &prequantized, &published, &builtin) ||
+    !elle_prequantize_primaries (&whitepoint, &published, &solved, &stats))
+  {
+  fprintf(stderr, "%s: couldn't check the prequantized primaries\n", basename);
+  table->prequantized_failures++;
+  return;
+  }
 
-/* make gcc happy by returning an integer from main() */
-return 0;
+printf("%s\n  published: ", basename);
+print_rows (&stats.before);
+printf("  built-in:  ");
+print_rows (&builtin);
+printf("  solved:    ");
+print_rows (&stats.after);
+printf("  solved in %.0f us (%d colorant matrices), %s colorants as built-in:\n", 
+       stats.seconds * 1e6, stats.candidates, 
+       memcmp (builtin.colorants, stats.after.colorants, sizeof(builtin.colorants)) == 0 ? 
+       "the same" : "different");
+printf("    red = %.12f %.12f\n    green = %.12f %.12f\n    blue = %.12f %.12f\n",
+       solved.Red.x, solved.Red.y, solved.Green.x, solved.Green.y, 
+       solved.Blue.x, solved.Blue.y);
+if (builtin.row_error[0] != 0 || builtin.row_error[1] != 0 || builtin.row_error[2] != 0)
+  table->prequantized_failures++;
 }
 
-static void make_gray_profile (cmsCIExyY       whitepoint,
-                               char *          trc,
-                               char *          basename,
-                               char *          id,
-                               char *          extension,
-                               cmsMLU          *copyright,
-                               cmsCIEXYZ       media_whitepoint,
-                               cmsCIEXYZ       media_blackpoint
-                               )
+
+static void print_rows (const elle_colorant_check *check)
 {
-cmsToneCurve *grayTRC, *tonecurve;
-tonecurve = make_tonecurve (trc);
-grayTRC= tonecurve;
-
-/* Make V4 gray profile */
-cmsHPROFILE profile = cmsCreateGrayProfile ( &whitepoint, grayTRC );
-cmsWriteTag(profile, cmsSigCopyrightTag, copyright);
-cmsWriteTag (profile, cmsSigMediaWhitePointTag, &media_whitepoint);
-char* profile_version="-V4";
-char *filename = make_file_name (basename, id, profile_version, trc, extension);
-
-char *description_text = filename + 12;
-cmsMLU *description;
-description = cmsMLUalloc(NULL, 1);
-cmsMLUsetASCII(description, "en", "US", description_text);
-cmsWriteTag(profile, cmsSigProfileDescriptionTag, description);
-
-cmsSaveProfileToFile(profile, filename);
-cmsMLUfree(description);
-
-/* Make V2 gray profile */
-profile_version="-V2";
-filename = make_file_name (basename, id, profile_version, trc, extension);
-cmsSetProfileVersion (profile, 2.2);
-cmsWriteTag (profile, cmsSigMediaBlackPointTag, &media_blackpoint);
-
-description_text = filename + 12;
-description = cmsMLUalloc(NULL, 1);
-cmsMLUsetASCII(description, "en", "US", description_text);
-
-cmsSaveProfileToFile(profile, filename);
-cmsMLUfree(description);
-}
-
-
-static cmsHPROFILE make_V4_profile (cmsCIExyY       whitepoint,
-                                    cmsCIExyYTRIPLE primaries,
-                                    char *          trc,
-                                    char *          basename,
-                                    char *          id,
-                                    char *          extension,
-                                    cmsMLU          *copyright,
-                                    char *          manufacturer
-                                    )
+printf("colorant rows off the white by %+d %+d %+d/65536, "
+       "primaries read back off by up to %.2e\n", 
+       check->row_error[0], check->row_error[1], check->row_error[2], 
+       check->xy_error);
+}
+
+
+/* ******************** COLORSPACE SPEC FILES *********************** */
+
+/* A spec file has one INI-style section per colorspace:
+ * 
+ * [Rec2020]
+ * kind = rgb                       (rgb, gray, lab or xyz; default rgb)
+ * manufacturer = Rec2020 chromaticities from ...
+ * whitepoint = 0.3127 0.3290       (x y, with an optional Y)
+ * media_whitepoint = 0.95045471 1.0 1.08905029
+ * red = 0.708012540607 0.291993664388 1.0
+ * green = 0.169991652439 0.797007778423 1.0
+ * blue = 0.130997824007 0.045996550894 1.0
+ * trcs = -g10 -g22 -srgbtrc       (default: all of them)
+ * versions = V4 V2                 (default: both)
+ * prequantize = yes                (default: no)
+ * 
+ * With "prequantize = yes", red, green and blue are the published 
+ * primaries, and the profiles are made from the prequantized ones that
+ * elle_prequantize_primaries finds for them (see elles-primaries.h), 
+ * so that their colorants add up to the white. -p prints the 
+ * prequantized primaries.
+ * 
+ * The section name is the profile basename. Lines starting with # or ;
+ * are comments. A colorspace with an error is reported and skipped,
+ * and the rest of the file is still read. "-" reads standard input.
+ * -p prints the built-in colorspaces in this format. */
+
+#define SPEC_LINE_LENGTH 4096
+
+static char* trim (char *text)
+{
+char *end;
+while (*text == ' ' || *text == '\t') text++;
+end = text + strlen(text);
+while (end > text && (end[-1] == ' ' || end[-1] == '\t' || 
+                      end[-1] == '\n' || end[-1] == '\r'))
+  end--;
+*end = '\0';
+return text;
+}
+
+
+/* Read between min and max numbers; returns how many, or -1 */
+static int parse_numbers (const char *text, double *values, int min, int max)
 {
-cmsToneCurve *curve[3], *tonecurve;
-tonecurve = make_tonecurve (trc);
-curve[0] = curve[1] = curve[2] = tonecurve;
+char *end;
+int count = 0;
+
+for (;;)
+  {
+  while (*text == ' ' || *text == '\t') text++;
+  if (*text == '\0') break;
+  if (count == max) return -1;
+  values[count] = strtod (text, &end);
+  if (end == text) return -1;
+  count++;
+  text = end;
+  }
+return count >= min ? count : -1;
+}
+
+
+static cmsBool parse_xyY (const char *text, cmsCIExyY *xyY)
+{
+double values[3] = { 0.0, 0.0, 1.0 };
+if (parse_numbers (text, values, 2, 3) < 0) return FALSE;
+xyY->x = values[0];
+xyY->y = values[1];
+xyY->Y = values[2];
+return TRUE;
+}
 
-/* Make V4 profile */
-cmsHPROFILE V4_profile = cmsCreateRGBProfile ( &whitepoint, &primaries, curve);
 
-cmsWriteTag(V4_profile, cmsSigCopyrightTag, copyright);
+/* The keys seen in the current section */
+#define SEEN_WHITEPOINT        1
+#define SEEN_MEDIA_WHITEPOINT  2
+#define SEEN_RED               4
+#define SEEN_GREEN             8
+#define SEEN_BLUE              16
+#define SEEN_TRCS              32
+#define PREQUANTIZE            64      /* not a key: prequantize = yes */
+
+/* Check a finished section and add it to the table */
+static cmsBool finish_colorspace (colorspace_table  *table,
+                                  colorspace_record *record,
+                                  int               seen,
+                                  const char        *filename,
+                                  int               line_number
+                                  )
+{
+const char *missing = NULL;
+
+if (!(seen & SEEN_TRCS))
+  record->trcs = (record->kind == ELLE_PROFILE_RGB || 
+                  record->kind == ELLE_PROFILE_GRAY) ? ALL_TRCS : 0;
 
-cmsMLU *MfgDesc;
-MfgDesc   = cmsMLUalloc(NULL, 1);
-cmsMLUsetASCII(MfgDesc, "en", "US", manufacturer);
-cmsWriteTag(V4_profile, cmsSigDeviceMfgDescTag, MfgDesc);
+if (record->kind == ELLE_PROFILE_RGB || record->kind == ELLE_PROFILE_GRAY)
+  {
+  if (!(seen & SEEN_WHITEPOINT)) missing = "whitepoint";
+  else if (!(seen & SEEN_MEDIA_WHITEPOINT)) missing = "media_whitepoint";
+  else if (record->trcs == 0) missing = "trcs";
+  }
+if (record->kind == ELLE_PROFILE_RGB && missing == NULL)
+  {
+  if (!(seen & SEEN_RED)) missing = "red";
+  else if (!(seen & SEEN_GREEN)) missing = "green";
+  else if (!(seen & SEEN_BLUE)) missing = "blue";
+  }
+if (missing != NULL)
+  {
+  fprintf(stderr, "%s:%d: [%s] has no %s, skipped\n", filename, line_number, 
+          record->basename, missing);
+  return FALSE;
+  }
+if (record->kind == ELLE_PROFILE_RGB && (seen & PREQUANTIZE))
+  {
+  cmsCIExyYTRIPLE published = record->primaries;
+  if (!elle_prequantize_primaries (&record->whitepoint, &published, 
+                                   &record->primaries, NULL))
+    {
+    fprintf(stderr, "%s:%d: [%s] couldn't prequantize the primaries, skipped\n", 
+            filename, line_number, record->basename);
+    return FALSE;
+    }
+  }
+if ((record->kind == ELLE_PROFILE_LAB || record->kind == ELLE_PROFILE_XYZ) && 
+    record->trcs != 0)
+  {
+  fprintf(stderr, "%s:%d: [%s] LAB and XYZ profiles have no TRCs, skipped\n", 
+          filename, line_number, record->basename);
+  return FALSE;
+  }
 
-char* profile_version="-V4";
-char *filename = make_file_name (basename, id, profile_version, trc, extension);
-char *description_text = filename + 12;
-cmsMLU *description;
-description = cmsMLUalloc(NULL, 1);
-cmsMLUsetASCII(description, "en", "US", description_text);
-cmsWriteTag(V4_profile, cmsSigProfileDescriptionTag, description);
-cmsSaveProfileToFile(V4_profile, filename);
-cmsMLUfree(description);
-cmsMLUfree(MfgDesc);
-cmsBool cmsMD5computeID(cmsHPROFILE hProfile);
-return V4_profile;
+add_colorspace (table, record->kind, record->basename, record->manufacturer, 
+                record->whitepoint, record->primaries, 
+                record->media_whitepoint, record->trcs, record->versions);
+return TRUE;
 }
 
 
-static cmsToneCurve* make_tonecurve (char * trc)
-{ //printf("%s\n", trc);
-  cmsToneCurve *tonecurve;
-  if (strcmp( trc, "-g10") == 0)
-  tonecurve = cmsBuildGamma (NULL, 1.00);
-  
-  else if (strcmp( trc, "-g18") == 0) 
-  tonecurve = cmsBuildGamma (NULL, 1.80078125); 
+static cmsBool read_colorspace_file (colorspace_table *table, 
+                                     const char       *filename
+                                     )
+{
+FILE *in = strcmp(filename, "-") == 0 ? stdin : fopen (filename, "r");
+char line[SPEC_LINE_LENGTH];
+char basename[SPEC_LINE_LENGTH], manufacturer[SPEC_LINE_LENGTH];
+colorspace_record record;
+int line_number = 0, section_line = 0, errors = 0;
+int in_section = 0, section_ok = 0, seen = 0;
+
+if (in == NULL)
+  {
+  fprintf(stderr, "couldn't open %s\n", filename);
+  return FALSE;
+  }
+
+for (;;)
+  {
+  char *text = NULL, *key, *value;
+  int at_end = fgets (line, sizeof(line), in) == NULL;
   
-  else if (strcmp( trc, "-g22") == 0)
-  tonecurve = cmsBuildGamma (NULL, 2.19921875);
+  if (!at_end)
+    {
+    line_number++;
+    if (strchr(line, '\n') == NULL && !feof(in))
+      {
+      int c;
+      fprintf(stderr, "%s:%d: line too long\n", filename, line_number);
+      while ((c = fgetc(in)) != EOF && c != '\n') ;
+      errors++;
+      section_ok = 0;
+      continue;
+      }
+    text = trim (line);
+    if (*text == '\0' || *text == '#' || *text == ';') continue;
+    }
+
+  /* A new section, or the end of the file, finishes the current one */
+  if (at_end || *text == '[')
+    {
+    if (in_section && section_ok && 
+        !finish_colorspace (table, &record, seen, filename, section_line))
+      errors++;
+    if (at_end) break;
+
+    text = trim (text + 1);
+    if (text[0] == '\0' || text[strlen(text) - 1] != ']')
+      {
+      fprintf(stderr, "%s:%d: bad section header\n", filename, line_number);
+      errors++;
+      in_section = section_ok = 0;
+      continue;
+      }
+    text[strlen(text) - 1] = '\0';
+    text = trim (text);
+    in_section = 1;
+    section_ok = 1;
+    section_line = line_number;
+    seen = 0;
+    if (*text == '\0' || strchr(text, '/') != NULL)
+      {
+      fprintf(stderr, "%s:%d: bad colorspace name \"%s\"\n", filename, 
+              line_number, text);
+      errors++;
+      section_ok = 0;
+      }
+    strcpy(basename, text);
+    manufacturer[0] = '\0';
+    memset (&record, 0, sizeof(record));
+    record.kind = ELLE_PROFILE_RGB;
+    record.basename = basename;
+    record.manufacturer = manufacturer;
+    record.versions = ALL_VERSIONS;
+    continue;
+    }
+
+  if (!in_section)
+    {
+    fprintf(stderr, "%s:%d: key outside of a [colorspace] section\n", 
+            filename, line_number);
+    errors++;
+    continue;
+    }
+  value = strchr(text, '=');
+  if (value == NULL)
+    {
+    fprintf(stderr, "%s:%d: expected key = value\n", filename, line_number);
+    errors++;
+    section_ok = 0;
+    continue;
+    }
+  *value = '\0';
+  key = trim (text);
+  value = trim (value + 1);
+
+  if (strcmp(key, "kind") == 0)
+    {
+    if (strcmp(value, "rgb") == 0) record.kind = ELLE_PROFILE_RGB;
+    else if (strcmp(value, "gray") == 0) record.kind = ELLE_PROFILE_GRAY;
+    else if (strcmp(value, "lab") == 0) record.kind = ELLE_PROFILE_LAB;
+    else if (strcmp(value, "xyz") == 0) record.kind = ELLE_PROFILE_XYZ;
+    else key = NULL;
+    }
+  else if (strcmp(key, "manufacturer") == 0)
+    strcpy(manufacturer, value);
+  else if (strcmp(key, "whitepoint") == 0)
+    {
+    if (parse_xyY (value, &record.whitepoint)) seen |= SEEN_WHITEPOINT;
+    else key = NULL;
+    }
+  else if (strcmp(key, "media_whitepoint") == 0)
+    {
+    double XYZ[3];
+    if (parse_numbers (value, XYZ, 3, 3) < 0) key = NULL;
+    else
+      {
+      record.media_whitepoint.X = XYZ[0];
+      record.media_whitepoint.Y = XYZ[1];
+      record.media_whitepoint.Z = XYZ[2];
+      seen |= SEEN_MEDIA_WHITEPOINT;
+      }
+    }
+  else if (strcmp(key, "red") == 0)
+    {
+    if (parse_xyY (value, &record.primaries.Red)) seen |= SEEN_RED;
+    else key = NULL;
+    }
+  else if (strcmp(key, "green") == 0)
+    {
+    if (parse_xyY (value, &record.primaries.Green)) seen |= SEEN_GREEN;
+    else key = NULL;
+    }
+  else if (strcmp(key, "blue") == 0)
+    {
+    if (parse_xyY (value, &record.primaries.Blue)) seen |= SEEN_BLUE;
+    else key = NULL;
+    }
+  else if (strcmp(key, "trcs") == 0)
+    {
+    char *suffix = strtok (value, " \t");
+    record.trcs = 0;
+    for ( ; suffix != NULL; suffix = strtok (NULL, " \t") )
+      {
+      elle_trc trc;
+      if (!elle_trc_from_suffix (suffix, &trc)) break;
+      record.trcs |= TRC_BIT(trc);
+      }
+    if (suffix == NULL) seen |= SEEN_TRCS;
+    else key = NULL;
+    }
+  else if (strcmp(key, "versions") == 0)
+    {
+    char *version = strtok (value, " \t");
+    record.versions = 0;
+    for ( ; version != NULL; version = strtok (NULL, " \t") )
+      {
+      if (strcmp(version, "V4") == 0) record.versions |= VERSION_V4;
+      else if (strcmp(version, "V2") == 0) record.versions |= VERSION_V2;
+      else break;
+      }
+    if (version != NULL || record.versions == 0) key = NULL;
+    }
+  else if (strcmp(key, "prequantize") == 0)
+    {
+    if (strcmp(value, "yes") == 0) seen |= PREQUANTIZE;
+    else if (strcmp(value, "no") == 0) seen &= ~PREQUANTIZE;
+    else key = NULL;
+    }
+  else
+    {
+    fprintf(stderr, "%s:%d: unknown key \"%s\"\n", filename, line_number, key);
+    errors++;
+    section_ok = 0;
+    continue;
+    }
+
+  if (key == NULL)
+    {
+    fprintf(stderr, "%s:%d: bad value \"%s\"\n", filename, line_number, value);
+    errors++;
+    section_ok = 0;
+    }
+  }
+
+if (in != stdin) fclose (in);
+if (errors) fprintf(stderr, "%s: %d errors\n", filename, errors);
+return errors == 0;
+}
+
+
+/* Shortest decimal that reads back as the same double */
+static void print_number (FILE *out, double value)
+{
+char text[32];
+int digits;
+for ( digits = 6; digits < 17; digits++ )
+  {
+  snprintf(text, sizeof(text), "%.*g", digits, value);
+  if (strtod (text, NULL) == value) break;
+  }
+if (digits == 17) snprintf(text, sizeof(text), "%.17g", value);
+fprintf(out, " %s", text);
+}
+
+
+static void print_colorspaces (colorspace_table *table, FILE *out)
+{
+static const char *kinds[] = { "rgb", "gray", "lab", "xyz" };
+int i, t;
+
+for ( i = 0; i < table->count; i++ )
+  {
+  colorspace_record *record = &table->records[i];
+  fprintf(out, "[%s]\nkind = %s\n", record->basename, kinds[record->kind]);
+  if (record->manufacturer[0] != '\0') 
+    fprintf(out, "manufacturer = %s\n", record->manufacturer);
+  fprintf(out, "whitepoint =");
+  print_number (out, record->whitepoint.x);
+  print_number (out, record->whitepoint.y);
+  print_number (out, record->whitepoint.Y);
+  fprintf(out, "\nmedia_whitepoint =");
+  print_number (out, record->media_whitepoint.X);
+  print_number (out, record->media_whitepoint.Y);
+  print_number (out, record->media_whitepoint.Z);
+  fprintf(out, "\n");
+  if (record->kind == ELLE_PROFILE_RGB)
+    {
+    cmsCIExyY *primary[3] = { &record->primaries.Red, 
+                              &record->primaries.Green, 
+                              &record->primaries.Blue };
+    static const char *names[3] = { "red", "green", "blue" };
+    for ( t = 0; t < 3; t++ )
+      {
+      fprintf(out, "%s =", names[t]);
+      print_number (out, primary[t]->x);
+      print_number (out, primary[t]->y);
+      print_number (out, primary[t]->Y);
+      fprintf(out, "\n");
+      }
+    }
+  if (record->trcs != 0)
+    {
+    fprintf(out, "trcs =");
+    for ( t = 0; t < ELLE_TRC_COUNT; t++ )
+      if (record->trcs & TRC_BIT(t)) fprintf(out, " %s", elle_trc_suffix ((elle_trc) t));
+    fprintf(out, "\n");
+    }
+  fprintf(out, "versions =%s%s\n\n", 
+          record->versions & VERSION_V4 ? " V4" : "", 
+          record->versions & VERSION_V2 ? " V2" : "");
+  }
+}
+
+
+/* ************************* COLORSPACES AND JOBS ******************** */
+
+static void add_colorspace (colorspace_table  *table,
+                            elle_profile_kind kind,
+                            char *            basename,
+                            char *            manufacturer,
+                            cmsCIExyY         whitepoint,
+                            cmsCIExyYTRIPLE   primaries,
+                            cmsCIEXYZ         media_whitepoint,
+                            unsigned          trcs,
+                            unsigned          versions
+                            )
+{
+colorspace_record *record;
+
+if (table->count == table->allocated)
+  {
+  table->allocated = table->allocated ? 2 * table->allocated : 32;
+  table->records = realloc (table->records, 
+                            table->allocated * sizeof(colorspace_record));
+  if (table->records == NULL) 
+    {
+    fprintf(stderr, "out of memory adding colorspaces\n");
+    exit (1);
+    }
+  }
+
+/* The jobs point at the names, so they are copied once here and 
+ * don't move when the table grows */
+record = &table->records[table->count++];
+record->kind = kind;
+record->basename = strdup (basename);
+record->manufacturer = strdup (manufacturer);
+record->whitepoint = whitepoint;
+record->primaries = primaries;
+record->media_whitepoint = media_whitepoint;
+record->trcs = trcs;
+record->versions = versions;
+
+if (table->queue != NULL) add_colorspace_jobs (table->queue, record);
+}
+
 
-  else if (strcmp( trc, "-srgbtrc") == 0) {
-  cmsFloat64Number srgb_parameters[5] = 
-  { 2.4, 1.0 / 1.055,  0.055 / 1.055, 1.0 / 12.92, 0.04045 };
-  tonecurve =  
-  cmsBuildParametricToneCurve(NULL, 4, srgb_parameters);
+static void free_colorspaces (colorspace_table *table)
+{
+int i;
+for ( i = 0; i < table->count; i++ )
+  {
+  free (table->records[i].basename);
+  free (table->records[i].manufacturer);
+  }
+free (table->records);
+table->records = NULL;
+table->count = table->allocated = 0;
+}
+
+
+/* One job per TRC and profile version, V4 first, in the order of 
+ * elle_trc; one per version for the LAB and XYZ identity profiles. */
+static void add_colorspace_jobs (profile_queue           *queue,
+                                 const colorspace_record *record
+                                 )
+{
+int t;
+
+if (record->trcs == 0)
+  {
+  if (record->versions & VERSION_V4)
+    add_job (queue, record->kind, "-V4", ELLE_TRC_NONE, record->basename, 
+             record->manufacturer, record->whitepoint, record->primaries, 
+             record->media_whitepoint);
+  if (record->versions & VERSION_V2)
+    add_job (queue, record->kind, "-V2", ELLE_TRC_NONE, record->basename, 
+             record->manufacturer, record->whitepoint, record->primaries, 
+             record->media_whitepoint);
+  return;
   }
 
-  else if (strcmp( trc, "-rec709") == 0) { 
-  cmsFloat64Number rec709_parameters[5] = 
-  { 1.0 / 0.45, 1.0 / 1.099,  0.099 / 1.099,  1.0 / 4.5, 0.081 };  
-  tonecurve = 
-  cmsBuildParametricToneCurve(NULL, 4, rec709_parameters);
+for ( t = 0; t < ELLE_TRC_COUNT; t++ ) 
+  {
+  if (!(record->trcs & TRC_BIT(t))) continue;
+  if (record->versions & VERSION_V4)
+    add_job (queue, record->kind, "-V4", (elle_trc) t, record->basename, 
+             record->manufacturer, record->whitepoint, record->primaries, 
+             record->media_whitepoint);
+  if (record->versions & VERSION_V2)
+    add_job (queue, record->kind, "-V2", (elle_trc) t, record->basename, 
+             record->manufacturer, record->whitepoint, record->primaries, 
+             record->media_whitepoint);
   }
+}
+
 
-  else if (strcmp( trc, "-labl") == 0) {
-  cmsFloat64Number labl_parameters[5] = 
-  { 3.0, 1.0 / 1.16,  0.16 / 1.16, 2700.0 / 24389.0, 0.08000 };
-  tonecurve = 
-  cmsBuildParametricToneCurve(NULL, 4, labl_parameters);
+static void add_job (profile_queue   *queue,
+                     elle_profile_kind kind,
+                     char *          profile_version,
+                     elle_trc        trc,
+                     char *          basename,
+                     char *          manufacturer,
+                     cmsCIExyY       whitepoint,
+                     cmsCIExyYTRIPLE primaries,
+                     cmsCIEXYZ       media_whitepoint
+                     )
+{
+cmsCIEXYZ media_blackpoint = {0.0, 0.0, 0.0};
+profile_job *job;
+
+pthread_mutex_lock (&queue->lock);
+if (queue->count == queue->chunk_count * JOBS_PER_CHUNK)
+  {
+  profile_job **chunks = realloc (queue->chunks, 
+                                  (queue->chunk_count + 1) * sizeof(profile_job*));
+  if (chunks != NULL) 
+    {
+    queue->chunks = chunks;
+    chunks[queue->chunk_count] = malloc (JOBS_PER_CHUNK * sizeof(profile_job));
+    }
+  if (chunks == NULL || chunks[queue->chunk_count] == NULL)
+    {
+    fprintf(stderr, "out of memory adding profile jobs\n");
+    exit (1);
+    }
+  queue->chunk_count++;
   }
 
-  return tonecurve;
+job = QUEUE_JOB(queue, queue->count);
+memset (job, 0, sizeof(profile_job));
+job->spec.kind = kind;
+job->spec.profile_version = profile_version;
+job->spec.trc = trc;
+job->spec.basename = basename;
+/* Compact profiles are named apart, so they never replace full ones */
+job->spec.id = queue->compact ? "-elle-compact" : "-elle";
+job->spec.extension = ".icc";
+job->spec.manufacturer = manufacturer;
+job->spec.whitepoint = whitepoint;
+job->spec.primaries = primaries;
+job->spec.media_whitepoint = media_whitepoint;
+job->spec.media_blackpoint = media_blackpoint;
+job->spec.V2_profile_id = queue->V2_profile_id;
+job->spec.V2_trc_entries = queue->V2_trc_entries;
+job->spec.compact = queue->compact;
+queue->count++;
+pthread_cond_signal (&queue->added);
+pthread_mutex_unlock (&queue->lock);
 }
 
 
-static cmsHPROFILE make_V2_profile (cmsHPROFILE  V4_profile,
-                                    cmsCIEXYZ    media_whitepoint,
-                                    cmsCIEXYZ    media_blackpoint,
-                                    char *          trc,
-                                    char *          basename,
-                                    char *          id,
-                                    char *          extension,
-                                    cmsMLU          *copyright,
-                                    char *          manufacturer
-                                    )
+static void init_profile_queue (profile_queue *queue)
+{
+queue->chunks = NULL;
+queue->chunk_count = 0;
+queue->count = 0;
+queue->closed = 0;
+queue->V2_profile_id = FALSE;
+queue->V2_trc_entries = 0;
+queue->compact = FALSE;
+queue->compare_sizes = FALSE;
+queue->trace = FALSE;
+queue->trace_events = FALSE;
+pthread_mutex_init (&queue->lock, NULL);
+pthread_cond_init (&queue->added, NULL);
+}
+
+
+/* No more jobs: wake every waiting worker so it can finish */
+static void close_profile_queue (profile_queue *queue)
 {
-/* Open sample V2 profile */
-char *sample_profile_filename;
-sample_profile_filename = "sampleV2.icm";
+pthread_mutex_lock (&queue->lock);
+queue->closed = 1;
+pthread_cond_broadcast (&queue->added);
+pthread_mutex_unlock (&queue->lock);
+}
 
-if (strcmp(trc, "-srgbtrc") == 0 ) sample_profile_filename = "sampleV2srgb.icm";
-if (strcmp(trc, "-labl") == 0 )    sample_profile_filename = "sampleV2labl.icm";
-if (strcmp(trc, "-rec709") == 0 )  sample_profile_filename = "sampleV2rec709.icm";
 
-cmsHPROFILE sampleV2 = cmsOpenProfileFromFile(sample_profile_filename, "r");
+static void free_profile_queue (profile_queue *queue)
+{
+int i;
+for ( i = 0; i < queue->count; i++ ) elle_trace_free (&QUEUE_JOB(queue, i)->trace);
+for ( i = 0; i < queue->chunk_count; i++ ) free (queue->chunks[i]);
+free (queue->chunks);
+pthread_cond_destroy (&queue->added);
+pthread_mutex_destroy (&queue->lock);
+}
 
-char *profile_version="-V2";
-char *filename;
-cmsHPROFILE V2_profile = sampleV2;
-cmsSetProfileVersion (V2_profile, 2.2);
-cmsSetDeviceClass (V2_profile, cmsSigDisplayClass);
-cmsSetPCS (V2_profile, cmsSigXYZData);
-cmsWriteTag (V2_profile, cmsSigMediaWhitePointTag, &media_whitepoint);
-cmsWriteTag (V2_profile, cmsSigMediaBlackPointTag, &media_blackpoint);
 
-/* Get and set the colorants */
-cmsCIEXYZ  *red = cmsReadTag(V4_profile, cmsSigRedColorantTag); 
-cmsCIEXYZ red_tag = *red;
-cmsWriteTag (V2_profile, cmsSigRedColorantTag, &red_tag);
+static void run_profile_job (elle_arena      *arena,
+                             profile_pool    *pool,
+                             profile_job     *job
+                             )
+{
+struct timespec start;
+elle_profile_buffer buffer;
+cmsBool made = FALSE;
+char *name, *filename;
+struct stat file_stat;
+clock_gettime (CLOCK_MONOTONIC, &start);
+
+name = elle_profile_name (&job->spec);
+filename = (char*) malloc (strlen(pool->directory) + strlen(name) + 1);
+strcpy(filename, pool->directory);
+strcat(filename, name);
+job->status = JOB_FAILED;
+job->inputs_hash = elle_profile_inputs_hash (&job->spec, pool->copyright_text);
+
+if (job_is_current (pool, job, name, filename))
+  {
+  job->status = JOB_SKIPPED;
+  free (filename);
+  free (name);
+  job->seconds = elle_elapsed_seconds (start);
+  return;
+  }
+
+/* The stage scopes in elles-profiles.c and elles-arena.c record into
+ * the job from here on. A skipped job is never begun. */
+if (pool->queue->trace) elle_trace_begin (&job->trace, pool->queue->trace_events);
+
+/* Everything LCMS allocates for the job comes from the arena, and 
+ * goes back to it in one step when the job ends. Only the finished 
+ * profile bytes are malloc'd outside the arena. */
+cmsContext ContextID = elle_arena_begin (arena);
+if (ContextID != NULL)
+  {
+  cmsMLU *copyright = cmsMLUalloc(ContextID, 1);
+  cmsMLUsetASCII(copyright, "en", "US", pool->copyright_text);
+  made = elle_make_profile (ContextID, &job->spec, copyright, &buffer);
+  cmsMLUfree(copyright);
+  }
+elle_arena_end (arena, ContextID, &job->memory);
 
-cmsCIEXYZ  *green = cmsReadTag(V4_profile, cmsSigGreenColorantTag); 
-cmsCIEXYZ green_tag = *green;
-cmsWriteTag (V2_profile, cmsSigGreenColorantTag, &green_tag);
+if (made)
+  {
+  if (elle_write_profile_file (pool->directory, &job->spec, &buffer) &&
+      stat (filename, &file_stat) == 0)
+    {
+    job->status = JOB_BUILT;
+    job->file_size = (long long) file_stat.st_size;
+    job->file_mtime = (long long) file_stat.st_mtime;
+    }
+  elle_free_profile_buffer (&buffer);
+  }
+else fprintf(stderr, "couldn't make %s\n", name);
 
-cmsCIEXYZ  *blue = cmsReadTag(V4_profile, cmsSigBlueColorantTag); 
-cmsCIEXYZ blue_tag = *blue;
-cmsWriteTag (V2_profile, cmsSigBlueColorantTag, &blue_tag);
+elle_trace_end ();
+if (made && pool->queue->compare_sizes) measure_full_size (arena, pool, job);
+free (filename);
+free (name);
+job->seconds = elle_elapsed_seconds (start);
+}
 
-/* Get and set the TRCs */
 
-if ( (strcmp( trc, "-g10") == 0) || 
-     (strcmp( trc, "-g18") == 0) || 
-     (strcmp( trc, "-g22") == 0) )
+/* -z: make the full profile for a compact job, only to report its size.
+ * It's made after the job has ended, in an arena pass of its own, so 
+ * neither the job's memory stats nor its trace count it. */
+static void measure_full_size (elle_arena *arena, profile_pool *pool, profile_job *job)
 {
-cmsToneCurve  *red_trc = cmsReadTag(V4_profile, cmsSigRedTRCTag);
-cmsWriteTag (V2_profile, cmsSigRedTRCTag, red_trc);
+elle_profile_spec full = job->spec;
+elle_profile_buffer full_buffer;
+elle_arena_stats memory;
+cmsContext ContextID = elle_arena_begin (arena);
+
+full.compact = FALSE;
+full.id = "-elle";
+if (ContextID != NULL)
+  {
+  cmsMLU *copyright = cmsMLUalloc(ContextID, 1);
+  cmsMLUsetASCII(copyright, "en", "US", pool->copyright_text);
+  if (elle_make_profile (ContextID, &full, copyright, &full_buffer))
+    {
+    job->full_size = full_buffer.size;
+    elle_free_profile_buffer (&full_buffer);
+    }
+  cmsMLUfree(copyright);
+  }
+elle_arena_end (arena, ContextID, &memory);
+}
 
-cmsToneCurve  *green_trc = cmsReadTag(V4_profile, cmsSigGreenTRCTag);
-cmsWriteTag (V2_profile, cmsSigGreenTRCTag, green_trc);
 
-cmsToneCurve  *blue_trc = cmsReadTag(V4_profile, cmsSigBlueTRCTag); 
-cmsWriteTag (V2_profile, cmsSigBlueTRCTag, blue_trc);
+/* Skip the job if the manifest has the same inputs hash for the 
+ * profile, and the file is still the one that was written then */
+static cmsBool job_is_current (profile_pool *pool, 
+                               profile_job  *job,
+                               const char   *name,
+                               const char   *filename
+                               )
+{
+manifest_entry *entry;
+struct stat file_stat;
+
+if (pool->manifest == NULL || job->inputs_hash == 0) return FALSE;
+entry = find_manifest_entry (pool->manifest, name);
+if (entry == NULL || entry->hash != job->inputs_hash) return FALSE;
+if (stat (filename, &file_stat) != 0) return FALSE;
+if ((long long) file_stat.st_size != entry->size || 
+    (long long) file_stat.st_mtime != entry->mtime)
+  return FALSE;
+
+job->file_size = entry->size;
+job->file_mtime = entry->mtime;
+return TRUE;
 }
 
-/* Set copyright, manufacturer, and ModelDesc tags */
-cmsWriteTag(V2_profile, cmsSigCopyrightTag, copyright);
 
-cmsMLU *MfgDesc;
-MfgDesc   = cmsMLUalloc(NULL, 1);
-cmsMLUsetASCII(MfgDesc, "en", "US", manufacturer);
-cmsWriteTag(V2_profile, cmsSigDeviceMfgDescTag, MfgDesc);
+static void *profile_worker (void *arg)
+{
+profile_pool *pool = arg;
+profile_queue *queue = pool->queue;
+profile_job *job;
+
+elle_arena *arena = elle_arena_create ();
+if (arena == NULL) 
+  {
+  fprintf(stderr, "couldn't create a memory arena for a worker\n");
+  return NULL;
+  }
+
+for (;;)
+  {
+  pthread_mutex_lock (&queue->lock);
+  while (pool->next_job >= queue->count && !queue->closed)
+    pthread_cond_wait (&queue->added, &queue->lock);
+  job = NULL;
+  if (pool->next_job < queue->count) 
+    {
+    job = QUEUE_JOB(queue, pool->next_job);
+    pool->next_job++;
+    }
+  pthread_mutex_unlock (&queue->lock);
+  if (job == NULL) break;
+  run_profile_job (arena, pool, job);
+  }
+
+elle_arena_destroy (arena);
+return NULL;
+}
+
 
-/* Set filename and description */
-filename = make_file_name (basename, id, profile_version, trc, extension);
-char *description_text = filename + 12;
-cmsMLU *description;
-description = cmsMLUalloc(NULL, 1);
-cmsMLUsetASCII(description, "en", "US", description_text);
-cmsWriteTag(V2_profile, cmsSigProfileDescriptionTag, description);
-cmsSaveProfileToFile(V2_profile, filename);
-cmsMLUfree(description);
-cmsMLUfree(MfgDesc);
-cmsBool cmsMD5computeID(cmsHPROFILE hProfile);
-return 0;
+/* Start the workers. They run the jobs as they are added, until the 
+ * queue is closed and empty. */
+static void start_profile_pool (profile_pool     *pool,
+                                profile_queue    *queue, 
+                                int              threads, 
+                                char *           copyright_text,
+                                char *           directory,
+                                profile_manifest *manifest
+                                )
+{
+int i;
+
+pool->queue = queue;
+pool->next_job = 0;
+pool->copyright_text = copyright_text;
+pool->directory = directory;
+pool->manifest = manifest;
+pool->workers = NULL;
+pool->started = 0;
+
+clock_gettime (CLOCK_MONOTONIC, &pool->start);
+if (threads > 1)
+  {
+  pool->workers = malloc (threads * sizeof(pthread_t));
+  if (pool->workers != NULL)
+    for ( i = 0; i < threads; i++ ) 
+      if (pthread_create (&pool->workers[pool->started], NULL, 
+                          profile_worker, pool) == 0)
+        pool->started++;
+  }
 }
 
 
-static char* make_file_name (char* basename, 
-                            char* id, 
-                            char* profile_version, 
-                            char* trc, 
-                            char* extension
-                            )
+/* Wait for the workers; call after close_profile_queue. Returns the
+ * seconds since the pool was started. */
+static double finish_profile_pool (profile_pool *pool)
 {
-char* filename="";
-char* path="../profiles/";
-int i = 0;
+int i;
 
-if ( strcmp(basename, "-sRGB")==0 && strcmp(trc, "-rec709")==0 ) basename="Rec709";
+/* With -j1, or if no thread could be started, do the work on this one */
+if (pool->started == 0) profile_worker (pool);
+for ( i = 0; i < pool->started; i++ ) pthread_join (pool->workers[i], NULL);
+free (pool->workers);
+return elle_elapsed_seconds (pool->start);
+}
 
-i =
-		strlen(path) +
-		strlen(basename) +
-		strlen(id) +
-		strlen(profile_version) +
-		strlen(trc) +
-		strlen(extension);
-filename = (char*) malloc (i + 1); 
 
+/* Run all the jobs of a closed queue, from the first, rebuilding 
+ * every profile */
+static double run_profile_jobs (profile_queue *queue, 
+                                int           threads, 
+                                char *        copyright_text,
+                                char *        directory
+                                )
+{
+profile_pool pool;
+start_profile_pool (&pool, queue, threads, copyright_text, directory, NULL);
+return finish_profile_pool (&pool);
+}
 
-strcpy(filename, path);
-strcat(filename, basename);
-strcat(filename, id);
-strcat(filename, profile_version);
-strcat(filename, trc);
-strcat(filename, extension);
 
-return filename;
+/* Make sure an output directory name ends with a '/' */
+static char* make_directory_name (char* directory)
+{
+size_t length = strlen(directory);
+char* name;
+
+if (length > 0 && directory[length - 1] == '/') return directory;
+name = (char*) malloc (length + 2);
+strcpy(name, directory);
+strcat(name, "/");
+return name;
 }
 
 
-static void make_LAB_XYZ_profiles (cmsCIExyY whitepoint, 
-                                   cmsMLU *copyright
-                                   )
+/* Peak and retained arena bytes: per profile if asked for, and 
+ * always the largest peak and the total retained. */
+static void report_memory (profile_queue *queue, int per_profile)
 {
-/* Based on transicc output, the V4 profiles 
- * can be used in unbounded mode, but the V2 versions cannot. */
-cmsHPROFILE profile;
-cmsMLU *description;
-char *filename;
-
-profile  = cmsCreateLab2Profile(&whitepoint);
-cmsWriteTag(profile, cmsSigCopyrightTag, copyright);
-description = cmsMLUalloc(NULL, 1);
-cmsMLUsetASCII(description, "en", "US", "Lab-D50-Identity-elle-V2.icc");
-                             filename = "../profiles/Lab-D50-Identity-elle-V2.icc";
-cmsSaveProfileToFile(profile, filename);
-cmsMLUfree(description);
-
-profile  = cmsCreateLab4Profile(&whitepoint);
-cmsWriteTag(profile, cmsSigCopyrightTag, copyright);
-description = cmsMLUalloc(NULL, 1);
-cmsMLUsetASCII(description, "en", "US", "Lab-D50-Identity-elle-V4.icc");
-                             filename = "../profiles/Lab-D50-Identity-elle-V4.icc";
-cmsSaveProfileToFile(profile, filename);
-cmsMLUfree(description);
-
-profile = cmsCreateXYZProfile();
-cmsWriteTag(profile, cmsSigCopyrightTag, copyright);
-description = cmsMLUalloc(NULL, 1);
-cmsMLUsetASCII(description, "en", "US", "XYZ-D50-Identity-elle-V4.icc");
-                             filename = "../profiles/XYZ-D50-Identity-elle-V4.icc";
-cmsSaveProfileToFile(profile, filename);
-cmsMLUfree(description);
+size_t largest_peak = 0, retained = 0;
+int i;
+
+for ( i = 0; i < queue->count; i++ )
+  {
+  elle_arena_stats *memory = &QUEUE_JOB(queue, i)->memory;
+  if (per_profile)
+    {
+    char *name = elle_profile_name (&QUEUE_JOB(queue, i)->spec);
+    printf("%-36s %6zu allocations, peak %8zu bytes, retained %zu bytes\n", 
+           name, memory->allocations, memory->peak_bytes, 
+           memory->retained_bytes);
+    free (name);
+    }
+  if (memory->peak_bytes > largest_peak) largest_peak = memory->peak_bytes;
+  retained += memory->retained_bytes;
+  }
+printf("memory: largest peak %zu bytes per profile, %zu bytes retained in all\n", 
+       largest_peak, retained);
+}
+
+
+/* How close the sampled V2 TRC tables are to the parametric curves,
+ * at the usual sizes and at the size asked for, in 16-bit code values.
+ * Each table adds 2 bytes per entry to the profile, per channel. */
+static void report_trc_tables (cmsUInt32Number entries)
+{
+cmsUInt32Number sizes[4] = { 256, 1024, 4096, entries };
+int size_count = (entries == 256 || entries == 1024 || entries == 4096) ? 3 : 4;
+int i, t;
+
+printf("V2 TRC tables, largest error in 16-bit code values:\n");
+printf("%-9s %7s %9s %11s\n", "TRC", "entries", "forward", "round trip");
+for ( t = 0; t < ELLE_TRC_COUNT; t++ )
+  {
+  /* The gamma TRCs are written as a single gamma value, not a table */
+  if (elle_trc_definition_of ((elle_trc) t)->type == 1) continue;
+  for ( i = 0; i < size_count; i++ )
+    {
+    double forward, round_trip;
+    if (!elle_trc_sampling_error ((elle_trc) t, sizes[i], &forward, &round_trip))
+      {
+      printf("%-9s %7u couldn't be built\n", elle_trc_suffix ((elle_trc) t), sizes[i]);
+      continue;
+      }
+    printf("%-9s %7u %9.2f %11.2f%s\n", elle_trc_suffix ((elle_trc) t), sizes[i], 
+           forward * 65535.0, round_trip * 65535.0, 
+           sizes[i] == entries ? "  <- used" : "");
+    }
+  }
+}
+
+
+/* Compact and full profile sizes, for the profiles made in this run */
+static void report_sizes (profile_queue *queue)
+{
+long long compact_total = 0, full_total = 0;
+int i;
+
+printf("%-44s %8s %8s\n", "compact profile", "bytes", "full");
+for ( i = 0; i < queue->count; i++ )
+  {
+  profile_job *job = QUEUE_JOB(queue, i);
+  char *name;
+  if (job->status != JOB_BUILT || job->full_size == 0) continue;
+  name = elle_profile_name (&job->spec);
+  printf("%-44s %8lld %8u  (%.0f%%)\n", name, job->file_size, job->full_size, 
+         100.0 * job->file_size / job->full_size);
+  free (name);
+  compact_total += job->file_size;
+  full_total += job->full_size;
+  }
+if (full_total > 0)
+  printf("compact profiles: %lld bytes in all, against %lld bytes full (%.0f%%)\n", 
+         compact_total, full_total, 100.0 * compact_total / full_total);
+}
+
+
+/* -T and -E: the stage counters of every job, as a JSON summary and as
+ * Chrome trace events. Either file name may be NULL. */
+static cmsBool write_trace_files (profile_queue *queue, 
+                                  const char    *trace_file,
+                                  const char    *events_file
+                                  )
+{
+const elle_trace_job **jobs;
+char **names;
+cmsBool ok = TRUE;
+int i;
+
+jobs = (const elle_trace_job**) malloc ((queue->count + 1) * sizeof(elle_trace_job*));
+names = (char**) malloc ((queue->count + 1) * sizeof(char*));
+if (jobs == NULL || names == NULL)
+  {
+  free (jobs);
+  free (names);
+  return FALSE;
+  }
+for ( i = 0; i < queue->count; i++ )
+  {
+  profile_job *job = QUEUE_JOB(queue, i);
+  names[i] = elle_profile_name (&job->spec);
+  job->trace.name = names[i];
+  job->trace.group = job->spec.basename;
+  jobs[i] = &job->trace;
+  }
+
+if (trace_file)
+  {
+  FILE *out = fopen (trace_file, "w");
+  if (out == NULL || !elle_trace_write_summary (out, jobs, queue->count)) ok = FALSE;
+  if (out != NULL && fclose (out) != 0) ok = FALSE;
+  if (!ok) fprintf(stderr, "couldn't write %s\n", trace_file);
+  else printf("stage timings written to %s\n", trace_file);
+  }
+if (events_file)
+  {
+  cmsBool written;
+  FILE *out = fopen (events_file, "w");
+  written = out != NULL && elle_trace_write_chrome_trace (out, jobs, queue->count);
+  if (out != NULL && fclose (out) != 0) written = FALSE;
+  if (!written) fprintf(stderr, "couldn't write %s\n", events_file);
+  else printf("trace events written to %s\n", events_file);
+  ok = ok && written;
+  }
+
+for ( i = 0; i < queue->count; i++ ) 
+  {
+  QUEUE_JOB(queue, i)->trace.name = NULL;
+  free (names[i]);
+  }
+free (names);
+free (jobs);
+return ok;
+}
+
+
+/* ************************ EMBEDDED PROFILES ************************ */
+
+/* Every profile of this run that was made (or was already up to date),
+ * read back from its file, sorted by (colorspace, TRC, version); a 
+ * colorspace made twice is kept once. Sets *ok to FALSE if a file 
+ * couldn't be read. */
+static embedded_profile* read_embedded_profiles (profile_queue *queue,
+                                                 const char    *directory,
+                                                 int           *count_out,
+                                                 cmsBool       *ok
+                                                 )
+{
+embedded_profile *profiles = (embedded_profile*) calloc (queue->count + 1, 
+                                                         sizeof(embedded_profile));
+int count = 0, i, kept;
+
+for ( i = 0; i < queue->count; i++ )
+  {
+  profile_job *job = QUEUE_JOB(queue, i);
+  embedded_profile *profile = &profiles[count];
+  if (job->status == JOB_FAILED) continue;
+  profile->name = elle_profile_name (&job->spec);
+  profile->colorspace = job->spec.basename;
+  profile->trc = elle_trc_suffix (job->spec.trc);
+  profile->version = strcmp(job->spec.profile_version, "-V2") == 0 ? 2 : 4;
+  if (!elle_read_profile_file (directory, profile->name, &profile->bytes))
+    {
+    free (profile->name);
+    *ok = FALSE;
+    continue;
+    }
+  count++;
+  }
+
+/* Sorted for the binary searches */
+qsort (profiles, count, sizeof(embedded_profile), compare_embedded_profiles);
+for ( i = 0, kept = 0; i < count; i++ )
+  {
+  if (kept > 0 && compare_embedded_profiles (&profiles[kept - 1], &profiles[i]) == 0)
+    {
+    free (profiles[i].name);
+    elle_free_profile_buffer (&profiles[i].bytes);
+    continue;
+    }
+  profiles[kept++] = profiles[i];
+  }
+count = kept;
+*count_out = count;
+return profiles;
+}
+
+
+static void free_embedded_profiles (embedded_profile *profiles, int count)
+{
+int i;
+
+for ( i = 0; i < count; i++ )
+  {
+  free (profiles[i].name);
+  elle_free_profile_buffer (&profiles[i].bytes);
+  }
+free (profiles);
+}
+
+
+/* -e prefix writes prefix.h and prefix.c, which hold every profile of
+ * this run as a static const byte array, so a program can link the
+ * profiles in and pass them to cmsOpenProfileFromMem without reading
+ * any files. The generated header declares:
+ * 
+ *   elle_embedded_profiles[]         sorted by (colorspace, TRC, version)
+ *   elle_find_embedded_profile ()    binary search on that key
+ *   ELLE_PROFILE_<colorspace>_<TRC>_V<version>
+ *                                    the index of each profile in the
+ *                                    table, for lookups at compile time
+ * 
+ * The bytes are read back from the profile files, so the profiles 
+ * skipped as up to date are embedded too. copyright_text is the text 
+ * the profiles were made with, for the comment at the top of prefix.c. */
+
+static cmsBool write_embedded_profiles (profile_queue *queue,
+                                        const char    *directory,
+                                        const char    *prefix,
+                                        const char    *copyright_text
+                                        )
+{
+embedded_profile *profiles;
+size_t length = strlen(prefix) + 3;
+char *header_file = (char*) malloc (length), *source_file = (char*) malloc (length);
+const char *header_name;
+FILE *header = NULL, *source = NULL;
+int count, i;
+size_t j, total = 0;
+cmsBool ok = TRUE;
+
+profiles = read_embedded_profiles (queue, directory, &count, &ok);
+
+snprintf(header_file, length, "%s.h", prefix);
+snprintf(source_file, length, "%s.c", prefix);
+header_name = strrchr (header_file, '/') ? strrchr (header_file, '/') + 1 : header_file;
+header = fopen (header_file, "w");
+source = fopen (source_file, "w");
+if (header == NULL || source == NULL)
+  {
+  fprintf(stderr, "couldn't write %s and %s\n", header_file, source_file);
+  ok = FALSE;
+  }
+else
+  {
+  fprintf(header, 
+    "/* Generated by make-elles-profiles -e; don't edit. */\n\n"
+    "#ifndef ELLES_EMBEDDED_PROFILES_H\n"
+    "#define ELLES_EMBEDDED_PROFILES_H\n\n"
+    "#ifdef __cplusplus\n"
+    "extern \"C\" {\n"
+    "#endif\n\n"
+    "typedef struct {\n"
+    "  const char *          colorspace;   /* e.g. \"sRGB\" */\n"
+    "  const char *          trc;          /* e.g. \"-srgbtrc\"; \"\" for Lab and XYZ */\n"
+    "  int                   version;      /* 2 or 4 */\n"
+    "  const char *          name;         /* the profile's file name */\n"
+    "  const unsigned char * data;\n"
+    "  unsigned int          size;\n"
+    "} elle_embedded_profile;\n\n"
+    "#define ELLE_EMBEDDED_PROFILE_COUNT %d\n\n"
+    "/* Sorted by colorspace, TRC and version (strcmp order) */\n"
+    "extern const elle_embedded_profile elle_embedded_profiles[ELLE_EMBEDDED_PROFILE_COUNT];\n\n"
+    "/* NULL if there's no such profile */\n"
+    "const elle_embedded_profile* elle_find_embedded_profile (const char *colorspace,\n"
+    "                                                        const char *trc,\n"
+    "                                                        int        version\n"
+    "                                                        );\n\n"
+    "/* The index of each profile in elle_embedded_profiles */\n", count);
+  for ( i = 0; i < count; i++ )
+    {
+    fprintf(header, "#define ");
+    write_identifier (header, "ELLE_PROFILE_", profiles[i].colorspace, profiles[i].trc, 
+                      profiles[i].version);
+    fprintf(header, " %d\n", i);
+    }
+  fprintf(header, "\n#ifdef __cplusplus\n}\n#endif\n\n#endif\n");
+
+  fprintf(source, 
+    "/* Generated by make-elles-profiles -e; don't edit.\n"
+    " * The profiles are\n"
+    " * %s\n"
+    " * See the copyright tag of each. */\n\n"
+    "#include <string.h>\n"
+    "#include \"%s\"\n\n", copyright_text, header_name);
+  for ( i = 0; i < count; i++ )
+    {
+    const elle_profile_buffer *bytes = &profiles[i].bytes;
+    fprintf(source, "/* %s */\n", profiles[i].name);
+    fprintf(source, "static const unsigned char ");
+    write_identifier (source, "profile_", profiles[i].colorspace, profiles[i].trc, 
+                      profiles[i].version);
+    fprintf(source, "[%u] = {", bytes->size);
+    for ( j = 0; j < bytes->size; j++ )
+      fprintf(source, "%s0x%02x%s", j % 16 == 0 ? "\n  " : "", bytes->data[j], 
+              j + 1 < bytes->size ? "," : "");
+    fprintf(source, "\n};\n\n");
+    total += bytes->size;
+    }
+
+  fprintf(source, "const elle_embedded_profile elle_embedded_profiles[ELLE_EMBEDDED_PROFILE_COUNT] = {\n");
+  for ( i = 0; i < count; i++ )
+    {
+    fprintf(source, "  { \"%s\", \"%s\", %d, \"%s\", ", profiles[i].colorspace, 
+            profiles[i].trc, profiles[i].version, profiles[i].name);
+    write_identifier (source, "profile_", profiles[i].colorspace, profiles[i].trc, 
+                      profiles[i].version);
+    fprintf(source, ", %u }%s\n", profiles[i].bytes.size, i + 1 < count ? "," : "");
+    }
+  fprintf(source, "};\n\n");
+
+  fprintf(source, 
+    "const elle_embedded_profile* elle_find_embedded_profile (const char *colorspace,\n"
+    "                                                        const char *trc,\n"
+    "                                                        int        version\n"
+    "                                                        )\n"
+    "{\n"
+    "int low = 0, high = ELLE_EMBEDDED_PROFILE_COUNT - 1;\n"
+    "while (low <= high)\n"
+    "  {\n"
+    "  int middle = (low + high) / 2;\n"
+    "  const elle_embedded_profile *profile = &elle_embedded_profiles[middle];\n"
+    "  int order = strcmp(colorspace, profile->colorspace);\n"
+    "  if (order == 0) order = strcmp(trc, profile->trc);\n"
+    "  if (order == 0) order = version - profile->version;\n"
+    "  if (order == 0) return profile;\n"
+    "  if (order < 0) high = middle - 1;\n"
+    "  else low = middle + 1;\n"
+    "  }\n"
+    "return NULL;\n"
+    "}\n");
+
+  if (ferror (header) || ferror (source)) ok = FALSE;
+  }
+if (header != NULL && fclose (header) != 0) ok = FALSE;
+if (source != NULL && fclose (source) != 0) ok = FALSE;
+if (ok) printf("%d profiles (%lu bytes) embedded in %s and %s\n", count, 
+               (unsigned long) total, header_file, source_file);
+
+free_embedded_profiles (profiles, count);
+free (header_file);
+free (source_file);
+return ok;
+}
+
+
+/* -B file writes every profile of this run into one bundle file (see
+ * elles-bundle.h), which a program maps and looks profiles up in 
+ * without reading or copying anything. Like -e, the bytes are read back
+ * from the profile files. */
+static cmsBool write_profile_bundle (profile_queue *queue,
+                                     const char    *directory,
+                                     const char    *filename
+                                     )
+{
+embedded_profile *profiles;
+elle_bundle_profile *entries;
+unsigned long total = 0;
+int count, i;
+cmsBool ok = TRUE;
+
+profiles = read_embedded_profiles (queue, directory, &count, &ok);
+entries = (elle_bundle_profile*) calloc (count + 1, sizeof(elle_bundle_profile));
+for ( i = 0; i < count; i++ )
+  {
+  entries[i].colorspace = profiles[i].colorspace;
+  entries[i].trc = profiles[i].trc;
+  entries[i].name = profiles[i].name;
+  entries[i].version = profiles[i].version;
+  entries[i].data = profiles[i].bytes.data;
+  entries[i].size = profiles[i].bytes.size;
+  total += profiles[i].bytes.size;
+  }
+if (!elle_bundle_write (filename, entries, count)) ok = FALSE;
+else printf("%d profiles (%lu bytes) bundled in %s\n", count, total, filename);
+
+free (entries);
+free_embedded_profiles (profiles, count);
+return ok;
+}
+
+
+static int compare_embedded_profiles (const void *a, const void *b)
+{
+const embedded_profile *first = (const embedded_profile*) a;
+const embedded_profile *second = (const embedded_profile*) b;
+int order = strcmp(first->colorspace, second->colorspace);
+if (order == 0) order = strcmp(first->trc, second->trc);
+if (order == 0) order = first->version - second->version;
+return order;
+}
+
+
+/* prefix + colorspace + trc + "_V" + version, with every character
+ * that can't be in a C identifier made a '_'; trc may be NULL, and 
+ * version 0, to leave them out */
+static void write_identifier (FILE       *out,
+                              const char *prefix,
+                              const char *colorspace,
+                              const char *trc,
+                              int        version
+                              )
+{
+const char *parts[2];
+int p;
+
+parts[0] = colorspace;
+parts[1] = trc;
+fputs (prefix, out);
+for ( p = 0; p < 2; p++ )
+  {
+  const char *c;
+  if (parts[p] == NULL) continue;
+  for ( c = parts[p]; *c; c++ )
+    fputc (isalnum ((unsigned char) *c) ? *c : '_', out);
+  }
+if (version > 0) fprintf(out, "_V%d", version);
+}
+
+
+/* ************************** MATRIX EXPORT ************************** */
+
+/* -x prefix writes prefix.h and prefix.json with what a shader or a 
+ * hot loop needs to convert between the RGB colorspaces without a CMM:
+ * 
+ * - for each TRC, the parametric curve parameters as the V4 profiles
+ *   store them, i.e. rounded to s15Fixed16Number; the curve is 
+ *   Y = X^g for type 1, and Y = (aX + b)^g for X >= d, else cX, 
+ *   for type 4 ([g, a, b, c, d]; see cmsBuildParametricToneCurve)
+ * - for each colorspace, the matrix from linear RGB to D50 XYZ, which
+ *   is the colorant tags read back from its V4 profile, so it has 
+ *   the Bradford adaptation and the quantization of the profile
+ * - for each (source, destination) pair, inverse(destination) x 
+ *   source, the matrix LCMS makes for a relative colorimetric 
+ *   transform between the two profiles
+ * 
+ * The matrices are row-major: out[i] = sum over j of m[3i + j] * in[j].
+ * The colorants are read from the V4 profiles made (or kept) in this
+ * run, one profile per colorspace, since every TRC has the same ones. */
+
+static cmsBool write_matrix_export (profile_queue *queue,
+                                    const char    *directory,
+                                    const char    *prefix
+                                    )
+{
+exported_colorspace *colorspaces;
+size_t length = strlen(prefix) + 6;
+char *header_file = (char*) malloc (length), *json_file = (char*) malloc (length);
+FILE *header = NULL, *json = NULL;
+int count, pairs = 0, i, j, k, t;
+cmsBool ok = TRUE;
+
+colorspaces = read_rgb_colorspaces (queue, directory, &count, &ok);
+
+snprintf(header_file, length, "%s.h", prefix);
+snprintf(json_file, length, "%s.json", prefix);
+header = fopen (header_file, "w");
+json = fopen (json_file, "w");
+if (header == NULL || json == NULL)
+  {
+  fprintf(stderr, "couldn't write %s and %s\n", header_file, json_file);
+  ok = FALSE;
+  }
+else
+  {
+  fprintf(header, 
+    "/* Generated by make-elles-profiles -x; don't edit.\n"
+    " * Matrices are row-major: out[i] = sum over j of m[3i + j] * in[j].\n"
+    " * elle_rgb_matrices[source][destination] converts linear source RGB\n"
+    " * to linear destination RGB, relative colorimetric. */\n\n"
+    "#ifndef ELLES_RGB_MATRICES_H\n"
+    "#define ELLES_RGB_MATRICES_H\n\n"
+    "/* Y = X^g (type 1), or Y = (aX + b)^g for X >= d, else cX (type 4,\n"
+    " * parameters g, a, b, c, d), rounded as the V4 profiles store them */\n"
+    "typedef struct {\n"
+    "  const char *  suffix;\n"
+    "  int           type;\n"
+    "  double        parameters[5];\n"
+    "} elle_trc_parameters;\n\n"
+    "#define ELLE_TRC_PARAMETER_COUNT %d\n\n"
+    "static const elle_trc_parameters elle_trc_parameter_table[ELLE_TRC_PARAMETER_COUNT] = {\n",
+    ELLE_TRC_COUNT);
+  fprintf(json, "{\n  \"matrix_layout\": \"row-major, out[i] = sum over j of m[3i + j] * in[j]\",\n");
+  fprintf(json, "  \"trcs\": [\n");
+  for ( t = 0; t < ELLE_TRC_COUNT; t++ )
+    {
+    const elle_trc_definition *definition = elle_trc_definition_of ((elle_trc) t);
+    int parameter_count = definition->type == 1 ? 1 : 5;
+    fprintf(header, "  { \"%s\", %d, {", definition->suffix, definition->type);
+    fprintf(json, "    { \"suffix\": \"%s\", \"type\": %d, \"parameters\": [", 
+            definition->suffix, definition->type);
+    for ( k = 0; k < parameter_count; k++ )
+      {
+      double stored = floor (definition->parameters[k] * 65536.0 + 0.5) / 65536.0;
+      fprintf(header, "%s%.17g", k ? ", " : " ", stored);
+      fprintf(json, "%s%.17g", k ? ", " : "", stored);
+      }
+    fprintf(header, " } }%s\n", t + 1 < ELLE_TRC_COUNT ? "," : "");
+    fprintf(json, "] }%s\n", t + 1 < ELLE_TRC_COUNT ? "," : "");
+    }
+  fprintf(header, "};\n\n");
+  fprintf(json, "  ],\n  \"colorspaces\": [\n");
+
+  fprintf(header, "/* The index of each colorspace in the tables below */\n");
+  for ( i = 0; i < count; i++ )
+    {
+    fprintf(header, "#define ");
+    write_identifier (header, "ELLE_COLORSPACE_", colorspaces[i].name, NULL, 0);
+    fprintf(header, " %d\n", i);
+    }
+  fprintf(header, "#define ELLE_COLORSPACE_COUNT %d\n\n", count);
+
+  fprintf(header, "static const char *elle_colorspace_names[ELLE_COLORSPACE_COUNT] = {\n");
+  for ( i = 0; i < count; i++ )
+    fprintf(header, "  \"%s\"%s\n", colorspaces[i].name, i + 1 < count ? "," : "");
+  fprintf(header, "};\n\n");
+
+  fprintf(header, "/* Linear RGB to D50 XYZ, from the colorant tags */\n");
+  fprintf(header, "static const double elle_rgb_to_xyz[ELLE_COLORSPACE_COUNT][9] = {\n");
+  for ( i = 0; i < count; i++ )
+    {
+    fprintf(header, "  ");
+    write_matrix (header, colorspaces[i].rgb_to_xyz, FALSE);
+    fprintf(header, "%s  /* %s */\n", i + 1 < count ? "," : " ", colorspaces[i].name);
+    fprintf(json, "    { \"name\": \"%s\", \"rgb_to_xyz_d50\": ", colorspaces[i].name);
+    write_matrix (json, colorspaces[i].rgb_to_xyz, TRUE);
+    fprintf(json, " }%s\n", i + 1 < count ? "," : "");
+    }
+  fprintf(header, "};\n\n");
+  fprintf(json, "  ],\n  \"pairs\": [\n");
+
+  fprintf(header, "static const double elle_rgb_matrices[ELLE_COLORSPACE_COUNT][ELLE_COLORSPACE_COUNT][9] = {\n");
+  for ( i = 0; i < count; i++ )
+    {
+    fprintf(header, "  { /* from %s */\n", colorspaces[i].name);
+    for ( j = 0; j < count; j++ )
+      {
+      double matrix[9];
+      multiply_matrices (colorspaces[j].xyz_to_rgb, colorspaces[i].rgb_to_xyz, matrix);
+      fprintf(header, "    ");
+      write_matrix (header, matrix, FALSE);
+      fprintf(header, "%s  /* to %s */\n", j + 1 < count ? "," : " ", colorspaces[j].name);
+      if (i == j) continue;
+      fprintf(json, "    { \"source\": \"%s\", \"destination\": \"%s\", \"matrix\": ", 
+              colorspaces[i].name, colorspaces[j].name);
+      write_matrix (json, matrix, TRUE);
+      pairs++;
+      fprintf(json, " }%s\n", pairs < count * (count - 1) ? "," : "");
+      }
+    fprintf(header, "  }%s\n", i + 1 < count ? "," : "");
+    }
+  fprintf(header, "};\n\n#endif\n");
+  fprintf(json, "  ]\n}\n");
+
+  if (ferror (header) || ferror (json)) ok = FALSE;
+  }
+if (header != NULL && fclose (header) != 0) ok = FALSE;
+if (json != NULL && fclose (json) != 0) ok = FALSE;
+if (ok) printf("%d colorspaces, %d conversion matrices written to %s and %s\n", 
+               count, count * (count - 1), header_file, json_file);
+
+free (colorspaces);
+free (header_file);
+free (json_file);
+return ok;
+}
+
+
+/* The RGB colorspaces of this run, once each, in the order of the 
+ * jobs, with their colorants read from their V4 profiles. Sets *ok to
+ * FALSE if a profile couldn't be read. */
+static exported_colorspace* read_rgb_colorspaces (profile_queue *queue,
+                                                  const char    *directory,
+                                                  int           *count_out,
+                                                  cmsBool       *ok
+                                                  )
+{
+exported_colorspace *colorspaces = (exported_colorspace*) calloc (queue->count + 1, 
+                                                                  sizeof(exported_colorspace));
+cmsContext ContextID = cmsCreateContext (NULL, NULL);
+int count = 0, i, j;
+
+for ( i = 0; i < queue->count; i++ )
+  {
+  profile_job *job = QUEUE_JOB(queue, i);
+  exported_colorspace *colorspace = &colorspaces[count];
+  char *name;
+
+  if (job->status == JOB_FAILED || job->spec.kind != ELLE_PROFILE_RGB || 
+      strcmp(job->spec.profile_version, "-V4") != 0) continue;
+  for ( j = 0; j < count; j++ )
+    if (strcmp(colorspaces[j].name, job->spec.basename) == 0) break;
+  if (j < count) continue;
+
+  name = elle_profile_name (&job->spec);
+  colorspace->name = job->spec.basename;
+  if (read_rgb_to_xyz (ContextID, directory, name, colorspace->rgb_to_xyz) &&
+      elle_invert_matrix (colorspace->rgb_to_xyz, colorspace->xyz_to_rgb)) 
+    count++;
+  else
+    {
+    fprintf(stderr, "couldn't read the colorants of %s\n", name);
+    *ok = FALSE;
+    }
+  free (name);
+  }
+cmsDeleteContext (ContextID);
+*count_out = count;
+return colorspaces;
+}
+
+
+/* The columns of the matrix are the red, green and blue colorants */
+static cmsBool read_rgb_to_xyz (cmsContext  ContextID,
+                                const char  *directory,
+                                const char  *name,
+                                double      matrix[9]
+                                )
+{
+cmsTagSignature tags[3] = { cmsSigRedColorantTag, cmsSigGreenColorantTag, cmsSigBlueColorantTag };
+elle_profile_buffer bytes;
+cmsHPROFILE profile;
+cmsBool ok = TRUE;
+int c;
+
+if (!elle_read_profile_file (directory, name, &bytes)) return FALSE;
+profile = cmsOpenProfileFromMemTHR (ContextID, bytes.data, bytes.size);
+if (profile == NULL) ok = FALSE;
+for ( c = 0; ok && c < 3; c++ )
+  {
+  cmsCIEXYZ *colorant = (cmsCIEXYZ*) cmsReadTag (profile, tags[c]);
+  if (colorant == NULL) 
+    {
+    ok = FALSE;
+    break;
+    }
+  matrix[c] = colorant->X;
+  matrix[3 + c] = colorant->Y;
+  matrix[6 + c] = colorant->Z;
+  }
+if (profile != NULL) cmsCloseProfile (profile);
+elle_free_profile_buffer (&bytes);
+return ok;
+}
+
+
+/* product = first x second */
+static void multiply_matrices (const double first[9], 
+                               const double second[9], 
+                               double       product[9]
+                               )
+{
+int row, column;
+for ( row = 0; row < 3; row++ )
+  for ( column = 0; column < 3; column++ )
+    product[3 * row + column] = first[3 * row] * second[column] +
+                                first[3 * row + 1] * second[3 + column] +
+                                first[3 * row + 2] * second[6 + column];
+}
+
+
+/* "{ m0, m1, ... }" for C, "[ m0, m1, ... ]" for JSON */
+static void write_matrix (FILE *out, const double matrix[9], cmsBool json)
+{
+int k;
+fputs (json ? "[ " : "{ ", out);
+for ( k = 0; k < 9; k++ ) fprintf(out, "%.17g%s", matrix[k], k < 8 ? ", " : " ");
+fputs (json ? "]" : "}", out);
+}
+
+
+/* ************************ GAMUT DESCRIPTORS ************************ */
+
+/* -G prefix writes prefix.h and prefix.c with the gamut-boundary 
+ * descriptor of every RGB colorspace of this run (see elles-gamut.h):
+ * 
+ *   elle_gamuts[]        the descriptors, in the order of the -x tables
+ *   ELLE_GAMUT_<colorspace>
+ *                        the index of each colorspace's descriptor
+ * 
+ * Like the -x matrices, the descriptors are made from the colorants 
+ * of the V4 profiles, so they have the profiles' quantization. Link 
+ * the program with elles-gamut.c for the checks. */
+
+static cmsBool write_gamut_descriptors (profile_queue *queue,
+                                        const char    *directory,
+                                        const char    *prefix
+                                        )
+{
+exported_colorspace *colorspaces;
+size_t length = strlen(prefix) + 3;
+char *header_file = (char*) malloc (length), *source_file = (char*) malloc (length);
+const char *header_name;
+FILE *header = NULL, *source = NULL;
+elle_gamut *gamuts = NULL;
+double seconds = 0.0;
+int count, i, l, h;
+cmsBool ok = TRUE;
+
+/* Every descriptor is made before anything is written, so a colorspace
+ * that can't be read or made leaves no half-initialized elle_gamuts */
+colorspaces = read_rgb_colorspaces (queue, directory, &count, &ok);
+if (ok) gamuts = (elle_gamut*) malloc ((count + 1) * sizeof(elle_gamut));
+if (gamuts == NULL) ok = FALSE;
+for ( i = 0; i < count && ok; i++ )
+  {
+  struct timespec start;
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  if (!elle_gamut_init (colorspaces[i].rgb_to_xyz, &gamuts[i]))
+    {
+    fprintf(stderr, "couldn't make the gamut of %s\n", colorspaces[i].name);
+    ok = FALSE;
+    }
+  seconds += elle_elapsed_seconds (start);
+  }
+if (!ok)
+  {
+  fprintf(stderr, "no gamut descriptors written\n");
+  free (gamuts);
+  free (colorspaces);
+  free (header_file);
+  free (source_file);
+  return FALSE;
+  }
+
+snprintf(header_file, length, "%s.h", prefix);
+snprintf(source_file, length, "%s.c", prefix);
+header_name = strrchr (header_file, '/') ? strrchr (header_file, '/') + 1 : header_file;
+header = fopen (header_file, "w");
+source = fopen (source_file, "w");
+if (header == NULL || source == NULL)
+  {
+  fprintf(stderr, "couldn't write %s and %s\n", header_file, source_file);
+  ok = FALSE;
+  }
+else
+  {
+  fprintf(header, 
+    "/* Generated by make-elles-profiles -G; don't edit. */\n\n"
+    "#ifndef ELLES_GAMUTS_H\n"
+    "#define ELLES_GAMUTS_H\n\n"
+    "#include \"elles-gamut.h\"\n\n"
+    "/* The index of each colorspace in elle_gamuts */\n");
+  for ( i = 0; i < count; i++ )
+    {
+    fprintf(header, "#define ");
+    write_identifier (header, "ELLE_GAMUT_", colorspaces[i].name, NULL, 0);
+    fprintf(header, " %d\n", i);
+    }
+  fprintf(header, "#define ELLE_GAMUT_COUNT %d\n\n"
+                  "extern const elle_gamut elle_gamuts[ELLE_GAMUT_COUNT];\n\n"
+                  "#endif\n", count);
+
+  fprintf(source, 
+    "/* Generated by make-elles-profiles -G; don't edit.\n"
+    " * max_chroma is in D50 Lab; rows are lightness segments, columns hue\n"
+    " * segments. */\n\n"
+    "#include <lcms2.h>\n"
+    "#include \"%s\"\n\n"
+    "const elle_gamut elle_gamuts[ELLE_GAMUT_COUNT] = {\n", header_name);
+  for ( i = 0; i < count; i++ )
+    {
+    const elle_gamut *gamut = &gamuts[i];
+    fprintf(source, "  { \"%s\",\n    ", colorspaces[i].name);
+    write_matrix (source, gamut->rgb_to_xyz, FALSE);
+    fprintf(source, ",\n    ");
+    write_matrix (source, gamut->xyz_to_rgb, FALSE);
+    fprintf(source, ",\n    {");
+    for ( l = 0; l < ELLE_GAMUT_LIGHTNESS_SEGMENTS; l++ )
+      {
+      fprintf(source, "\n      {");
+      for ( h = 0; h < ELLE_GAMUT_HUE_SEGMENTS; h++ )
+        fprintf(source, " %.9g%s", gamut->max_chroma[l][h], 
+                h + 1 < ELLE_GAMUT_HUE_SEGMENTS ? "," : " ");
+      fprintf(source, "}%s", l + 1 < ELLE_GAMUT_LIGHTNESS_SEGMENTS ? "," : "");
+      }
+    fprintf(source, "\n    } }%s\n", i + 1 < count ? "," : "");
+    }
+  fprintf(source, "};\n");
+
+  if (ferror (header) || ferror (source)) ok = FALSE;
+  }
+if (header != NULL && fclose (header) != 0) ok = FALSE;
+if (source != NULL && fclose (source) != 0) ok = FALSE;
+if (ok) printf("%d gamut descriptors (%.1f ms each) written to %s and %s\n", count, 
+               count > 0 ? 1e3 * seconds / count : 0.0, header_file, source_file);
+else
+  {
+  /* A partial header or source would only fail later, in the build */
+  remove (header_file);
+  remove (source_file);
+  }
+
+free (gamuts);
+free (colorspaces);
+free (header_file);
+free (source_file);
+return ok;
+}
+
+
+/* ************************* CONVERSION PAIRS ************************ */
+
+/* The pairs files for -L and -C have one conversion per line:
+ * 
+ *   <source profile> <destination profile> [intent]
+ * 
+ * for example "ACEScg-elle-V4-g10 sRGB-elle-V4-srgbtrc relative". The
+ * ".icc" may be left off. The intent is perceptual, relative (the 
+ * default), saturation or absolute. Lines starting with # are comments.
+ * 
+ * A profile name may have the wildcards * ? and [...], matched against
+ * the profiles in the output directory, so that one line can ask for a
+ * whole matrix of pairs: "*-elle-V4-g10 *-elle-V4-srgbtrc" converts 
+ * every linear V4 profile to every V4 profile with the sRGB TRC. A 
+ * profile is never paired with itself, and device links (made by -L,
+ * named "-link.icc") are never matched. */
+
+static const char *intent_names[4] = { "perceptual", "relative", "saturation", "absolute" };
+
+static cmsBool read_pairs_file (pair_list  *list, 
+                                const char *pairs_file,
+                                const char *directory
+                                )
+{
+FILE *file = fopen (pairs_file, "r");
+char line[1024];
+int line_number = 0;
+cmsBool ok = TRUE;
+
+if (file == NULL)
+  {
+  fprintf(stderr, "couldn't open %s\n", pairs_file);
+  return FALSE;
+  }
+
+while (fgets (line, sizeof(line), file) != NULL)
+  {
+  char *source_name, *destination_name, *intent_name;
+  char **sources, **destinations;
+  int source_count, destination_count, s, d;
+  cmsUInt32Number intent = INTENT_RELATIVE_COLORIMETRIC;
+
+  line_number++;
+  source_name = strtok (line, " \t\r\n");
+  if (source_name == NULL || source_name[0] == '#') continue;
+  destination_name = strtok (NULL, " \t\r\n");
+  intent_name = strtok (NULL, " \t\r\n");
+  if (destination_name == NULL || 
+      (intent_name != NULL && !parse_intent (intent_name, &intent)))
+    {
+    fprintf(stderr, "%s:%d: expected <source> <destination> [intent]\n", 
+            pairs_file, line_number);
+    ok = FALSE;
+    continue;
+    }
+
+  sources = expand_profile_names (directory, source_name, &source_count);
+  destinations = expand_profile_names (directory, destination_name, &destination_count);
+  if (source_count == 0 || destination_count == 0)
+    {
+    fprintf(stderr, "%s:%d: no profile matches %s\n", pairs_file, line_number,
+            source_count == 0 ? source_name : destination_name);
+    ok = FALSE;
+    }
+  for ( s = 0; s < source_count; s++ )
+    for ( d = 0; d < destination_count; d++ )
+      {
+      profile_pair *pair;
+      if (strcmp(sources[s], destinations[d]) == 0) continue;
+      if (list->count == list->allocated)
+        {
+        list->allocated = list->allocated ? 2 * list->allocated : 16;
+        list->pairs = realloc (list->pairs, list->allocated * sizeof(profile_pair));
+        }
+      pair = &list->pairs[list->count++];
+      pair->source_file = strdup (sources[s]);
+      pair->destination_file = strdup (destinations[d]);
+      pair->intent = intent;
+      }
+  free_names (sources, source_count);
+  free_names (destinations, destination_count);
+  }
+
+fclose (file);
+return ok;
+}
+
+
+/* The profile file names name stands for: name itself (with ".icc"
+ * added if it isn't there), or the profiles in directory that match it
+ * if it has wildcards. Free the names with free_names. */
+static char** expand_profile_names (const char *directory, 
+                                    const char *name,
+                                    int        *count
+                                    )
+{
+char *file_name = profile_file_name (name);
+char **names;
+char *pattern;
+glob_t matches;
+size_t i, prefix = strlen(directory);
+
+*count = 0;
+if (strpbrk (file_name, "*?[") == NULL)
+  {
+  names = (char**) malloc (sizeof(char*));
+  names[0] = file_name;
+  *count = 1;
+  return names;
+  }
+
+pattern = (char*) malloc (prefix + strlen(file_name) + 1);
+strcpy(pattern, directory);
+strcat(pattern, file_name);
+free (file_name);
+if (glob (pattern, 0, NULL, &matches) != 0)
+  {
+  free (pattern);
+  return NULL;
+  }
+free (pattern);
+
+/* glob sorts the matches, so the pairs come out in a stable order */
+names = (char**) malloc (matches.gl_pathc * sizeof(char*));
+for ( i = 0; i < matches.gl_pathc; i++ )
+  {
+  const char *match = matches.gl_pathv[i] + prefix;
+  size_t length = strlen(match);
+  if (length >= 9 && strcmp(match + length - 9, "-link.icc") == 0) continue;
+  names[(*count)++] = strdup (match);
+  }
+globfree (&matches);
+return names;
+}
+
+
+static void free_names (char **names, int count)
+{
+int i;
+for ( i = 0; i < count; i++ ) free (names[i]);
+free (names);
+}
+
+
+static void free_pairs (pair_list *list)
+{
+int i;
+for ( i = 0; i < list->count; i++ )
+  {
+  free (list->pairs[i].source_file);
+  free (list->pairs[i].destination_file);
+  }
+free (list->pairs);
+list->pairs = NULL;
+list->count = list->allocated = 0;
+}
+
+
+static cmsBool parse_intent (const char *text, cmsUInt32Number *intent)
+{
+cmsUInt32Number i;
+for ( i = 0; i < 4; i++ )
+  if (strcmp(text, intent_names[i]) == 0)
+    {
+    *intent = i;
+    return TRUE;
+    }
+return FALSE;
+}
+
+
+/* name, with ".icc" added if it isn't there; the caller frees it */
+static char* profile_file_name (const char *name)
+{
+size_t length = strlen(name);
+char *file_name = (char*) malloc (length + 5);
+
+strcpy(file_name, name);
+if (length < 4 || strcmp(name + length - 4, ".icc") != 0) 
+  strcat(file_name, ".icc");
+return file_name;
+}
+
+
+/* "<source>-to-<destination>-<intent>" + suffix, from the file names 
+ * without ".icc"; the caller frees it */
+static char* pair_output_name (const profile_pair *pair, const char *suffix)
+{
+size_t length = strlen(pair->source_file) + strlen(pair->destination_file) + 
+                strlen(suffix) + 32;
+char *name = (char*) malloc (length);
+
+snprintf(name, length, "%.*s-to-%.*s-%s%s", 
+         (int) strlen(pair->source_file) - 4, pair->source_file, 
+         (int) strlen(pair->destination_file) - 4, pair->destination_file, 
+         intent_names[pair->intent], suffix);
+return name;
+}
+
+
+/* Read both profiles of pair from directory */
+static cmsBool read_pair_profiles (const char          *directory,
+                                   const profile_pair  *pair,
+                                   elle_profile_buffer *source,
+                                   elle_profile_buffer *destination
+                                   )
+{
+if (!elle_read_profile_file (directory, pair->source_file, source)) return FALSE;
+if (!elle_read_profile_file (directory, pair->destination_file, destination))
+  {
+  elle_free_profile_buffer (source);
+  return FALSE;
+  }
+return TRUE;
+}
+
+
+/* *************************** DEVICE LINKS ************************** */
+
+/* Each pair in the pairs file (see read_pairs_file) is made into a 
+ * device link, written next to the profiles as 
+ * <source>-to-<destination>-<intent>-link.icc. */
+
+#define LINK_BENCHMARK_REPEATS 50
+
+static cmsBool make_device_links (const char *pairs_file, 
+                                  const char *directory,
+                                  const char *copyright_text
+                                  )
+{
+pair_list list = { NULL, 0, 0 };
+int made = 0, errors = 0, i;
+cmsContext ContextID;
+cmsMLU *copyright;
+
+if (!read_pairs_file (&list, pairs_file, directory)) errors++;
+ContextID = cmsCreateContext (NULL, NULL);
+copyright = cmsMLUalloc(ContextID, 1);
+cmsMLUsetASCII(copyright, "en", "US", copyright_text);
+
+for ( i = 0; i < list.count; i++ )
+  {
+  profile_pair *pair = &list.pairs[i];
+  elle_profile_buffer source, destination, link;
+  char *link_name;
+
+  if (!read_pair_profiles (directory, pair, &source, &destination))
+    {
+    errors++;
+    continue;
+    }
+
+  link_name = pair_output_name (pair, "-link.icc");
+  if (elle_make_device_link (ContextID, &source, &destination, pair->intent, 
+                             link_name, copyright, &link))
+    {
+    if (elle_write_named_file (directory, link_name, &link))
+      {
+      made++;
+      benchmark_link (&source, &destination, &link, pair->intent, link_name);
+      }
+    else errors++;
+    elle_free_profile_buffer (&link);
+    }
+  else
+    {
+    fprintf(stderr, "couldn't make %s\n", link_name);
+    errors++;
+    }
+
+  free (link_name);
+  elle_free_profile_buffer (&source);
+  elle_free_profile_buffer (&destination);
+  }
+
+free_pairs (&list);
+cmsMLUfree(copyright);
+cmsDeleteContext (ContextID);
+printf("%d device links made, %d errors\n", made, errors);
+return errors == 0;
+}
+
+
+/* What a process that loads the link saves: compare making a transform
+ * from the two profiles against making one from the link, both from
+ * bytes in memory, as a process starting up would */
+static void benchmark_link (const elle_profile_buffer *source,
+                            const elle_profile_buffer *destination,
+                            const elle_profile_buffer *link,
+                            cmsUInt32Number           intent,
+                            const char                *link_name
+                            )
+{
+int f;
+
+for ( f = 0; f < 2; f++ )
+  {
+  cmsBool is_float = f == 1;
+  double from_profiles = transform_creation_us (source, destination, intent, is_float);
+  double from_link = transform_creation_us (link, NULL, intent, is_float);
+  if (from_profiles < 0.0 || from_link < 0.0)
+    {
+    printf("%s: couldn't make the %s transforms\n", link_name, is_float ? "float" : "8-bit");
+    continue;
+    }
+  printf("%-60s %-5s %9.1f us from profiles, %9.1f us from link (%.1fx)\n", 
+         link_name, is_float ? "float" : "8-bit", from_profiles, from_link, 
+         from_link > 0.0 ? from_profiles / from_link : 0.0);
+  }
+}
+
+
+/* Average microseconds to open the profiles and make a transform; a 
+ * device link is passed as first, with second NULL. -1 on failure. */
+static double transform_creation_us (const elle_profile_buffer *first,
+                                     const elle_profile_buffer *second,
+                                     cmsUInt32Number           intent,
+                                     cmsBool                   is_float
+                                     )
+{
+cmsUInt32Number bytes = is_float ? 4 : 1;
+struct timespec start;
+int i;
+
+clock_gettime (CLOCK_MONOTONIC, &start);
+for ( i = 0; i < LINK_BENCHMARK_REPEATS; i++ )
+  {
+  cmsHPROFILE input = cmsOpenProfileFromMem (first->data, first->size);
+  cmsHPROFILE output = second ? cmsOpenProfileFromMem (second->data, second->size) : NULL;
+  cmsHTRANSFORM transform = NULL;
+  cmsUInt32Number output_format;
+
+  if (input != NULL && (second == NULL || output != NULL))
+    {
+    output_format = second ? cmsFormatterForColorspaceOfProfile (output, bytes, is_float)
+                           : cmsFormatterForPCSOfProfile (input, bytes, is_float);
+    transform = cmsCreateTransform (input, 
+                                    cmsFormatterForColorspaceOfProfile (input, bytes, is_float),
+                                    output, output_format, intent, 0);
+    }
+  if (input != NULL) cmsCloseProfile (input);
+  if (output != NULL) cmsCloseProfile (output);
+  if (transform == NULL) return -1.0;
+  cmsDeleteTransform (transform);
+  }
+return elle_elapsed_seconds (start) * 1e6 / LINK_BENCHMARK_REPEATS;
+}
+
+
+/* ***************************** 3D LUTS ***************************** */
+
+/* Each pair in the pairs file (see read_pairs_file) is baked into a 
+ * grid_size^3 .cube file, written next to the profiles as
+ * <source>-to-<destination>-<intent>-<grid_size>.cube. Linear sources
+ * get an L* shaper (see elles-cube.h). The grids are sampled one after
+ * the other, each on threads threads. */
+
+#define CUBE_ERROR_SAMPLES 65536
+
+static cmsBool make_cube_luts (const char *pairs_file, 
+                               const char *directory,
+                               int        grid_size,
+                               int        threads
+                               )
+{
+pair_list list = { NULL, 0, 0 };
+int made = 0, errors = 0, i;
+double seconds = 0.0, worst = 0.0;
+cmsContext ContextID;
+char suffix[32];
+
+if (!read_pairs_file (&list, pairs_file, directory)) errors++;
+ContextID = cmsCreateContext (NULL, NULL);
+snprintf(suffix, sizeof(suffix), "-%d.cube", grid_size);
+
+for ( i = 0; i < list.count; i++ )
+  {
+  profile_pair *pair = &list.pairs[i];
+  elle_profile_buffer source, destination;
+  elle_cube_lut lut;
+  elle_cube_error error;
+  char *lut_name;
+
+  if (!read_pair_profiles (directory, pair, &source, &destination))
+    {
+    errors++;
+    continue;
+    }
+
+  lut_name = pair_output_name (pair, suffix);
+  if (elle_make_cube_lut (ContextID, &source, &destination, pair->intent, 
+                          (cmsUInt32Number) grid_size, ELLE_CUBE_SHAPER_IF_LINEAR, 
+                          threads, &lut))
+    {
+    if (elle_write_cube_file (directory, lut_name, lut_name, &lut)) made++;
+    else errors++;
+    seconds += lut.seconds;
+    if (elle_cube_lut_error (ContextID, &source, &destination, pair->intent, 
+                             &lut, CUBE_ERROR_SAMPLES, &error))
+      {
+      printf("%-64s %s sampled in %7.3f s, dE2000 mean %.4f max %.4f "
+             "(at %.4f %.4f %.4f)\n", lut_name, lut.shaper_size > 0 ? "shaper," : "       ",
+             lut.seconds, error.mean, error.max, error.worst_input[0], 
+             error.worst_input[1], error.worst_input[2]);
+      if (error.max > worst) worst = error.max;
+      }
+    else printf("%-64s sampled in %7.3f s, error not measured\n", lut_name, lut.seconds);
+    elle_free_cube_lut (&lut);
+    }
+  else
+    {
+    fprintf(stderr, "couldn't make %s\n", lut_name);
+    errors++;
+    }
+
+  free (lut_name);
+  elle_free_profile_buffer (&source);
+  elle_free_profile_buffer (&destination);
+  }
+
+free_pairs (&list);
+cmsDeleteContext (ContextID);
+printf("%d 3D LUTs of %d^3 made in %.3f s of sampling on %d threads, "
+       "largest dE2000 %.4f, %d errors\n", made, grid_size, seconds, threads, 
+       worst, errors);
+return errors == 0;
+}
+
+
+/* ***************************** MANIFEST **************************** */
+
+/* The manifest is a text file, one profile per line:
+ * <inputs hash, hex> <file size> <file mtime> <profile name>
+ * A missing or unreadable manifest just means every profile is made. */
+static void load_manifest (profile_manifest *manifest, const char *directory)
+{
+char *filename = (char*) malloc (strlen(directory) + strlen(MANIFEST_NAME) + 1);
+char line[1024];
+FILE *file;
+
+strcpy(filename, directory);
+strcat(filename, MANIFEST_NAME);
+file = fopen (filename, "r");
+free (filename);
+if (file == NULL) return;
+
+while (fgets (line, sizeof(line), file) != NULL)
+  {
+  unsigned long long hash;
+  long long size, mtime;
+  int name_start = 0;
+  size_t length;
+
+  if (line[0] == '#') continue;
+  if (sscanf (line, "%llx %lld %lld %n", &hash, &size, &mtime, &name_start) < 3 ||
+      name_start == 0)
+    continue;
+  length = strlen(line);
+  while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+    line[--length] = '\0';
+  if (line[name_start] == '\0') continue;
+  add_manifest_entry (manifest, line + name_start, (cmsUInt64Number) hash, 
+                      size, mtime);
+  }
+fclose (file);
+
+qsort (manifest->entries, manifest->count, sizeof(manifest_entry), 
+       compare_manifest_entries);
+}
+
+
+static void add_manifest_entry (profile_manifest *manifest,
+                                const char       *name,
+                                cmsUInt64Number  hash,
+                                long long        size,
+                                long long        mtime
+                                )
+{
+manifest_entry *entry;
+
+if (manifest->count == manifest->allocated)
+  {
+  manifest->allocated = manifest->allocated ? 2 * manifest->allocated : 256;
+  manifest->entries = realloc (manifest->entries, 
+                               manifest->allocated * sizeof(manifest_entry));
+  if (manifest->entries == NULL)
+    {
+    fprintf(stderr, "out of memory reading the manifest\n");
+    exit (1);
+    }
+  }
+entry = &manifest->entries[manifest->count++];
+entry->name = strdup (name);
+entry->hash = hash;
+entry->size = size;
+entry->mtime = mtime;
+entry->superseded = 0;
+}
+
+
+static int compare_manifest_entries (const void *a, const void *b)
+{
+return strcmp (((const manifest_entry*) a)->name, 
+               ((const manifest_entry*) b)->name);
+}
+
+
+/* Read-only, so the workers can all look up at once */
+static manifest_entry* find_manifest_entry (profile_manifest *manifest, 
+                                            const char       *name
+                                            )
+{
+manifest_entry key;
+if (manifest->count == 0) return NULL;
+key.name = (char*) name;
+return bsearch (&key, manifest->entries, manifest->count, 
+                sizeof(manifest_entry), compare_manifest_entries);
+}
+
+
+/* Write the profiles of this run, plus the old entries for profiles 
+ * this run didn't touch (e.g. when -f names only a few colorspaces).
+ * Failed profiles are left out, so they are made again next time. */
+static cmsBool write_manifest (profile_manifest *manifest, 
+                               profile_queue    *queue,
+                               const char       *directory
+                               )
+{
+profile_manifest updated = { NULL, 0, 0 };
+char *filename, *temporary;
+manifest_entry *entry;
+cmsBool ok = FALSE;
+FILE *file;
+int i;
+
+for ( i = 0; i < queue->count; i++ )
+  {
+  profile_job *job = QUEUE_JOB(queue, i);
+  char *name = elle_profile_name (&job->spec);
+  entry = find_manifest_entry (manifest, name);
+  if (entry != NULL) entry->superseded = 1;
+  if (job->status != JOB_FAILED)
+    add_manifest_entry (&updated, name, job->inputs_hash, job->file_size, 
+                        job->file_mtime);
+  free (name);
+  }
+for ( i = 0; i < manifest->count; i++ )
+  {
+  entry = &manifest->entries[i];
+  if (!entry->superseded)
+    add_manifest_entry (&updated, entry->name, entry->hash, entry->size, 
+                        entry->mtime);
+  }
+qsort (updated.entries, updated.count, sizeof(manifest_entry), 
+       compare_manifest_entries);
+
+/* Write a new file and rename it over the old one, so an interrupted 
+ * run never leaves half a manifest */
+filename = (char*) malloc (strlen(directory) + strlen(MANIFEST_NAME) + 1);
+strcpy(filename, directory);
+strcat(filename, MANIFEST_NAME);
+temporary = (char*) malloc (strlen(filename) + 5);
+strcpy(temporary, filename);
+strcat(temporary, ".new");
+
+file = fopen (temporary, "w");
+if (file != NULL)
+  {
+  fprintf(file, "# inputs-hash file-size file-mtime profile\n");
+  for ( i = 0; i < updated.count; i++ )
+    {
+    entry = &updated.entries[i];
+    /* The same profile twice (a colorspace repeated in a spec file) 
+     * is listed once */
+    if (i > 0 && strcmp(entry->name, updated.entries[i - 1].name) == 0) continue;
+    fprintf(file, "%016llx %lld %lld %s\n", (unsigned long long) entry->hash, 
+            entry->size, entry->mtime, entry->name);
+    }
+  ok = fclose (file) == 0;
+  if (ok) ok = rename (temporary, filename) == 0;
+  }
+if (!ok) fprintf(stderr, "couldn't write %s\n", filename);
+
+free (temporary);
+free (filename);
+free_manifest (&updated);
+return ok;
+}
+
+
+static void free_manifest (profile_manifest *manifest)
+{
+int i;
+for ( i = 0; i < manifest->count; i++ ) free (manifest->entries[i].name);
+free (manifest->entries);
+manifest->entries = NULL;
+manifest->count = manifest->allocated = 0;
 }
@@ -23,56 +23,384 @@
  * 
  * */
 
-static cmsHPROFILE make_V2_profile (cmsHPROFILE  V4_profile,
-                                    cmsCIEXYZ    media_whitepoint,
-                                    cmsCIEXYZ    media_blackpoint,
-                                    char *          trc,
-                                    char *          basename,
-                                    char *          id,
-                                    char *          extension,
-                                    cmsMLU          *copyright,
-                                    char *          manufacturer
-                                    );
+/* One colorspace: everything needed to make its profiles except the
+ * TRC and the profile version, plus the TRCs and versions to make.
+ * RGB colorspaces have primaries; gray ones ignore them. The LAB and
+ * XYZ identity profiles have no TRCs (trcs == 0). */
+typedef struct {
+  elle_profile_kind kind;
+  char *           basename;
+  char *           manufacturer;
+  cmsCIExyY        whitepoint;
+  cmsCIExyYTRIPLE  primaries;
+  cmsCIEXYZ        media_whitepoint;
+  unsigned         trcs;       /* TRC_BIT(trc) for each TRC to make */
+  unsigned         versions;   /* VERSION_V4 and/or VERSION_V2 */
+} colorspace_record;
+
+#define TRC_BIT(trc)   (1u << (trc))
+#define ALL_TRCS       ((1u << ELLE_TRC_COUNT) - 1)
+#define VERSION_V4     1u
+#define VERSION_V2     2u
+#define ALL_VERSIONS   (VERSION_V4 | VERSION_V2)
+
+typedef enum {
+  JOB_FAILED,                 /* also: not run yet */
+  JOB_BUILT,
+  JOB_SKIPPED                 /* inputs and output file unchanged */
+} job_status;
+
+/* One profile-making job: a (colorspace, TRC, profile version) triple, 
+ * or one of the LAB and XYZ identity profiles. */
+typedef struct {
+  elle_profile_spec spec;
+  double           seconds;   /* time the job took, filled in when run */
+  elle_arena_stats memory;    /* memory the job took, filled in when run */
+  /* filled in when run, for the manifest */
+  job_status       status;
+  cmsUInt64Number  inputs_hash;
+  long long        file_size;
+  long long        file_mtime;
+  cmsUInt32Number  full_size;  /* -c -z: size of the full profile */
+  elle_trace_job   trace;      /* -T and -E: stage timings, filled in when run */
+} profile_job;
+
+/* The manifest in the output directory records, for each profile, 
+ * the hash of its inputs (elle_profile_inputs_hash) and the size and
+ * modification time of the file written. A job whose hash matches and
+ * whose file hasn't changed since is skipped. */
+#define MANIFEST_NAME "elles-manifest.txt"
+
+typedef struct {
+  char *           name;
+  cmsUInt64Number  hash;
+  long long        size;
+  long long        mtime;
+  int              superseded;  /* replaced by a job of this run */
+} manifest_entry;
+
+typedef struct {
+  manifest_entry * entries;     /* sorted by name */
+  int              count;
+  int              allocated;
+} profile_manifest;
+
+/* The jobs are kept in fixed-size chunks, so a job doesn't move while 
+ * a worker runs it and more jobs are being added. Workers wait on 
+ * "added" until there is a job for them or the queue is closed. */
+#define JOBS_PER_CHUNK 256
+#define QUEUE_JOB(queue, i) \
+  (&(queue)->chunks[(i) / JOBS_PER_CHUNK][(i) % JOBS_PER_CHUNK])
+
+typedef struct {
+  profile_job **   chunks;
+  int              chunk_count;
+  int              count;
+  int              closed;    /* no more jobs will be added */
+  cmsBool          V2_profile_id;  /* set in every job's spec */
+  cmsUInt32Number  V2_trc_entries; /* set in every job's spec */
+  cmsBool          compact;        /* set in every job's spec */
+  cmsBool          compare_sizes;  /* -z: also make each full profile, for its size */
+  cmsBool          trace;          /* count each job's stages (-T, -E) */
+  cmsBool          trace_events;   /* and keep its events too (-E) */
+  pthread_mutex_t  lock;
+  pthread_cond_t   added;
+} profile_queue;
+
+/* The colorspaces read so far. If queue is set, the jobs for each 
+ * colorspace are queued as soon as it's added. */
+typedef struct {
+  colorspace_record * records;
+  int              count;
+  int              allocated;
+  profile_queue *  queue;
+  /* -Q: report on the built-in prequantized primaries as they're added */
+  cmsBool          check_prequantized;
+  int              prequantized_failures;
+} colorspace_table;
+
+/* Shared state of the worker threads running a profile_queue */
+typedef struct {
+  profile_queue *  queue;
+  int              next_job;   /* guarded by queue->lock */
+  char *           copyright_text;
+  char *           directory;
+  profile_manifest * manifest;  /* NULL: rebuild every profile */
+  pthread_t *      workers;
+  int              started;
+  struct timespec  start;
+} profile_pool;
+
+/* A profile written into the -e source or the -B bundle (see 
+ * read_embedded_profiles) */
+typedef struct {
+  char *              name;
+  const char *        colorspace;     /* the job's basename */
+  const char *        trc;            /* elle_trc_suffix, "" for Lab and XYZ */
+  int                 version;        /* 2 or 4 */
+  elle_profile_buffer bytes;
+} embedded_profile;
+
+/* A colorspace written by -x or -G (see read_rgb_colorspaces) */
+typedef struct {
+  const char *        name;           /* the job's basename */
+  double              rgb_to_xyz[9];  /* to D50 XYZ, row-major */
+  double              xyz_to_rgb[9];
+} exported_colorspace;
+
+/* One conversion from a pairs file (see read_pairs_file) */
+typedef struct {
+  char *           source_file;       /* e.g. "ACEScg-elle-V4-g10.icc" */
+  char *           destination_file;
+  cmsUInt32Number  intent;
+} profile_pair;
+
+typedef struct {
+  profile_pair *   pairs;
+  int              count;
+  int              allocated;
+} pair_list;
+
+static void builtin_colorspaces (colorspace_table *table);
+
+static void check_prequantized (colorspace_table *table,
+                                const char       *basename,
+                                cmsCIExyY        whitepoint,
+                                cmsCIExyYTRIPLE  published,
+                                cmsCIExyYTRIPLE  prequantized
+                                );
+
+static void print_rows (const elle_colorant_check *check);
+
+static cmsBool read_colorspace_file (colorspace_table *table, 
+                                     const char       *filename
+                                     );
 
-static char* make_file_name (char* basename,
-                             char* id,
-                             char* profile_version,
-                             char* trc,
-                             char* extension
+static cmsBool finish_colorspace (colorspace_table  *table,
+                                  colorspace_record *record,
+                                  int               seen,
+                                  const char        *filename,
+                                  int               line_number
+                                  );
+
+static char* trim (char *text);
+
+static int parse_numbers (const char *text, double *values, int min, int max);
+
+static cmsBool parse_xyY (const char *text, cmsCIExyY *xyY);
+
+static void print_number (FILE *out, double value);
+
+static void print_colorspaces (colorspace_table *table, FILE *out);
+
+static void add_colorspace (colorspace_table  *table,
+                            elle_profile_kind kind,
+                            char *            basename,
+                            char *            manufacturer,
+                            cmsCIExyY         whitepoint,
+                            cmsCIExyYTRIPLE   primaries,
+                            cmsCIEXYZ         media_whitepoint,
+                            unsigned          trcs,
+                            unsigned          versions
+                            );
+
+static void free_colorspaces (colorspace_table *table);
+
+static void add_colorspace_jobs (profile_queue           *queue,
+                                 const colorspace_record *record
+                                 );
+
+static void add_job (profile_queue   *queue,
+                     elle_profile_kind kind,
+                     char *          profile_version,
+                     elle_trc        trc,
+                     char *          basename,
+                     char *          manufacturer,
+                     cmsCIExyY       whitepoint,
+                     cmsCIExyYTRIPLE primaries,
+                     cmsCIEXYZ       media_whitepoint
+                     );
+
+static void init_profile_queue (profile_queue *queue);
+
+static void close_profile_queue (profile_queue *queue);
+
+static void free_profile_queue (profile_queue *queue);
+
+static void run_profile_job (elle_arena      *arena,
+                             profile_pool    *pool,
+                             profile_job     *job
                              );
 
-static cmsHPROFILE make_V4_profile (cmsCIExyY       whitepoint,
-                                    cmsCIExyYTRIPLE primaries,
-                                    char *          trc,
-                                    char *          basename,
-                                    char *          id,
-                                    char *          extension,
-                                    cmsMLU          *copyright,
-                                    char *          manufacturer
+static void measure_full_size (elle_arena *arena, profile_pool *pool, profile_job *job);
+
+static cmsBool job_is_current (profile_pool *pool, 
+                               profile_job  *job,
+                               const char   *name,
+                               const char   *filename
+                               );
+
+static void *profile_worker (void *arg);
+
+static void start_profile_pool (profile_pool     *pool,
+                                profile_queue    *queue, 
+                                int              threads, 
+                                char *           copyright_text,
+                                char *           directory,
+                                profile_manifest *manifest
+                                );
+
+static double finish_profile_pool (profile_pool *pool);
+
+static double run_profile_jobs (profile_queue *queue, 
+                                int           threads, 
+                                char *        copyright_text,
+                                char *        directory
+                                );
+
+static char* make_directory_name (char* directory);
+
+static void report_memory (profile_queue *queue, int per_profile);
+
+static void report_trc_tables (cmsUInt32Number entries);
+
+static void report_sizes (profile_queue *queue);
+
+static cmsBool write_trace_files (profile_queue *queue, 
+                                  const char    *trace_file,
+                                  const char    *events_file
+                                  );
+
+static cmsBool write_embedded_profiles (profile_queue *queue,
+                                        const char    *directory,
+                                        const char    *prefix,
+                                        const char    *copyright_text
+                                        );
+
+static embedded_profile* read_embedded_profiles (profile_queue *queue,
+                                                 const char    *directory,
+                                                 int           *count_out,
+                                                 cmsBool       *ok
+                                                 );
+
+static void free_embedded_profiles (embedded_profile *profiles, int count);
+
+static cmsBool write_profile_bundle (profile_queue *queue,
+                                     const char    *directory,
+                                     const char    *filename
+                                     );
+
+static int compare_embedded_profiles (const void *a, const void *b);
+
+static void write_identifier (FILE       *out,
+                              const char *prefix,
+                              const char *colorspace,
+                              const char *trc,
+                              int        version
+                              );
+
+static cmsBool write_matrix_export (profile_queue *queue,
+                                    const char    *directory,
+                                    const char    *prefix
                                     );
 
-static void make_LAB_XYZ_profiles (cmsCIExyY whitepoint, 
-                                   cmsMLU *copyright
+static exported_colorspace* read_rgb_colorspaces (profile_queue *queue,
+                                                  const char    *directory,
+                                                  int           *count_out,
+                                                  cmsBool       *ok
+                                                  );
+
+static cmsBool read_rgb_to_xyz (cmsContext  ContextID,
+                                const char  *directory,
+                                const char  *name,
+                                double      matrix[9]
+                                );
+
+static void multiply_matrices (const double first[9], 
+                               const double second[9], 
+                               double       product[9]
+                               );
+
+static void write_matrix (FILE *out, const double matrix[9], cmsBool json);
+
+static cmsBool write_gamut_descriptors (profile_queue *queue,
+                                        const char    *directory,
+                                        const char    *prefix
+                                        );
+
+static cmsBool read_pairs_file (pair_list  *list, 
+                                const char *pairs_file,
+                                const char *directory
+                                );
+
+static char** expand_profile_names (const char *directory, 
+                                    const char *name,
+                                    int        *count
+                                    );
+
+static void free_names (char **names, int count);
+
+static void free_pairs (pair_list *list);
+
+static cmsBool parse_intent (const char *text, cmsUInt32Number *intent);
+
+static char* profile_file_name (const char *name);
+
+static char* pair_output_name (const profile_pair *pair, const char *suffix);
+
+static cmsBool read_pair_profiles (const char          *directory,
+                                   const profile_pair  *pair,
+                                   elle_profile_buffer *source,
+                                   elle_profile_buffer *destination
                                    );
 
-static cmsToneCurve* make_tonecurve (char * trc);
+static cmsBool make_device_links (const char *pairs_file, 
+                                  const char *directory,
+                                  const char *copyright_text
+                                  );
+
+static void benchmark_link (const elle_profile_buffer *source,
+                            const elle_profile_buffer *destination,
+                            const elle_profile_buffer *link,
+                            cmsUInt32Number           intent,
+                            const char                *link_name
+                            );
 
-static void make_gray_profile (cmsCIExyY       whitepoint,
-                               char *          trc,
-                               char *          basename,
-                               char *          id,
-                               char *          extension,
-                               cmsMLU          *copyright,
-                               cmsCIEXYZ       media_whitepoint,
-                               cmsCIEXYZ       media_blackpoint
+static double transform_creation_us (const elle_profile_buffer *first,
+                                     const elle_profile_buffer *second,
+                                     cmsUInt32Number           intent,
+                                     cmsBool                   is_float
+                                     );
+
+static cmsBool make_cube_luts (const char *pairs_file, 
+                               const char *directory,
+                               int        grid_size,
+                               int        threads
                                );
 
-/*
-iccFromXml sampleV2srgb.xml sampleV2srgb.icm
-iccFromXml sampleV2rec709.xml sampleV2rec709.icm
-iccFromXml sampleV2labl.xml sampleV2labl.icm
-iccFromXml sampleV2.xml sampleV2.icm
+static void load_manifest (profile_manifest *manifest, const char *directory);
+
+static void add_manifest_entry (profile_manifest *manifest,
+                                const char       *name,
+                                cmsUInt64Number  hash,
+                                long long        size,
+                                long long        mtime
+                                );
+
+static int compare_manifest_entries (const void *a, const void *b);
+
+static manifest_entry* find_manifest_entry (profile_manifest *manifest, 
+                                            const char       *name
+                                            );
 
+static cmsBool write_manifest (profile_manifest *manifest, 
+                               profile_queue    *queue,
+                               const char       *directory
+                               );
+
+static void free_manifest (profile_manifest *manifest);
+
+/*
 rm r *.icc*
 rm make-elles-profiles
 